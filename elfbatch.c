@@ -0,0 +1,342 @@
+// elfbatch.c
+#include "elfbatch.h"
+#include "elfhash.h"
+
+#include <linux/fs.h>
+#include <pthread.h>
+#include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEADER      -1 // patched itself
+#define SAME_INODE  -2 // another path to the inode of input 'same_as'
+#define UNREADABLE  -3
+
+typedef struct {
+	const char* path;
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	unsigned char build_id[RECIPE_MAX_BUILD_ID];
+	int build_id_size;
+	uint64_t content_hash;
+	int hashed;
+	int leader; // index of the input whose result this one copies, or one of the values above
+	int same_as;
+} BatchInput;
+
+// inputs to run patch_file on, shared by the workers of one phase
+typedef struct {
+	const BatchInput* inputs;
+	const PatchConfig* config;
+	int* jobs;    // input indices
+	int job_count;
+	int* results; // patch_file result, by input index
+	int next;     // next job to take, under 'mutex'
+	pthread_mutex_t mutex;
+} BatchQueue;
+
+static int compare_inputs(const void* a, const void* b) {
+	const BatchInput* x = a;
+	const BatchInput* y = b;
+	if (x->size != y->size) return (x->size > y->size) - (x->size < y->size);
+	if (x->build_id_size != y->build_id_size) return x->build_id_size - y->build_id_size;
+	int id = memcmp(x->build_id, y->build_id, x->build_id_size);
+	if (id != 0) return id;
+	if (x->device != y->device) return (x->device > y->device) - (x->device < y->device);
+	return (x->inode > y->inode) - (x->inode < y->inode);
+}
+
+static int same_key(const BatchInput* x, const BatchInput* y) {
+	return x->size == y->size && x->build_id_size == y->build_id_size
+	    && memcmp(x->build_id, y->build_id, x->build_id_size) == 0;
+}
+
+static int read_input(BatchInput* input) {
+	int fd = open(input->path, O_RDONLY);
+	if (fd < 0) return FALSE;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return FALSE;
+	}
+
+	input->device = st.st_dev;
+	input->inode = st.st_ino;
+	input->size = st.st_size;
+	input->build_id_size = elf_read_build_id(fd, input->build_id, sizeof(input->build_id));
+	close(fd);
+	return TRUE;
+}
+
+static int hash_input(BatchInput* input) {
+	if (input->hashed) return TRUE;
+
+	int fd = open(input->path, O_RDONLY);
+	if (fd < 0) return FALSE;
+
+	ElfHash64 state;
+	elfhash_init(&state, 0);
+	int ok = elfhash_fd(&state, fd, 0, input->size);
+	close(fd);
+
+	input->content_hash = elfhash_final(&state);
+	input->hashed = ok;
+	return ok;
+}
+
+// a matching hash only nominates a duplicate, linking needs the bytes to be equal
+static int same_content(const BatchInput* x, const BatchInput* y) {
+	int a = open(x->path, O_RDONLY);
+	if (a < 0) return FALSE;
+	int b = open(y->path, O_RDONLY);
+	if (b < 0) {
+		close(a);
+		return FALSE;
+	}
+
+	char* buffer = malloc(2 * 65536);
+	int same = buffer != NULL;
+	for (off_t offset = 0; same && offset < x->size;) {
+		size_t size = x->size - offset < 65536 ? x->size - offset : 65536;
+		same = pread(a, buffer, size, offset) == (ssize_t)size
+		    && pread(b, buffer + 65536, size, offset) == (ssize_t)size
+		    && memcmp(buffer, buffer + 65536, size) == 0;
+		offset += size;
+	}
+
+	free(buffer);
+	close(b);
+	close(a);
+	return same;
+}
+
+// mark duplicates inside [first, last) which share size and build-id
+static void dedup_group(BatchInput* inputs, int first, int last) {
+	// sorted by inode, so links to one file are adjacent
+	for (int i = first + 1; i < last; ++i) {
+		if (inputs[i].leader == LEADER && inputs[i].device == inputs[i - 1].device && inputs[i].inode == inputs[i - 1].inode) {
+			inputs[i].leader = SAME_INODE;
+			inputs[i].same_as = inputs[i - 1].leader == SAME_INODE ? inputs[i - 1].same_as : i - 1;
+		}
+	}
+
+	int distinct = 0;
+	for (int i = first; i < last; ++i) distinct += inputs[i].leader == LEADER;
+	if (distinct < 2) return;
+
+	for (int i = first; i < last; ++i) {
+		if (inputs[i].leader != LEADER || !hash_input(&inputs[i])) continue;
+
+		for (int j = first; j < i; ++j) {
+			if (inputs[j].leader == LEADER && inputs[j].hashed && inputs[j].content_hash == inputs[i].content_hash
+			    && same_content(&inputs[j], &inputs[i])) {
+				inputs[i].leader = j;
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * Replace 'target' with a copy of 'source' sharing its storage: a reflink
+ * first, which keeps the files independent, then a hard link.
+ * The new file is renamed over the target so readers never see it partial.
+ */
+static int link_output(const char* source, const char* target, PatchBatchStats* stats) {
+	char temp_path[4096];
+	snprintf(temp_path, sizeof(temp_path), "%s.%i.tmp", target, (int)getpid());
+
+	struct stat st;
+	if (stat(target, &st) < 0) return FALSE;
+
+	int in = open(source, O_RDONLY);
+	if (in < 0) return FALSE;
+
+	int out = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 07777);
+	if (out >= 0) {
+		int cloned = ioctl(out, FICLONE, in) == 0;
+		close(out);
+		if (cloned && rename(temp_path, target) == 0) {
+			close(in);
+			stats->reflinked++;
+			return TRUE;
+		}
+		unlink(temp_path);
+	}
+	close(in);
+
+	if (link(source, temp_path) == 0) {
+		if (rename(temp_path, target) == 0) {
+			stats->hardlinked++;
+			return TRUE;
+		}
+		unlink(temp_path);
+	}
+
+	return FALSE;
+}
+
+static void* batch_worker(void* arg) {
+	BatchQueue* queue = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&queue->mutex);
+		int job = queue->next < queue->job_count ? queue->jobs[queue->next++] : -1;
+		pthread_mutex_unlock(&queue->mutex);
+		if (job < 0) return NULL;
+
+		queue->results[job] = patch_file(queue->inputs[job].path, queue->config);
+	}
+}
+
+/**
+ * Patch the inputs listed in 'jobs' on up to 'threads' threads, the calling
+ * one included. Inputs are distinct files, so they never wait for each other;
+ * the work of one class or ABI is not serialised behind another.
+ */
+static void run_jobs(const BatchInput* inputs, const PatchConfig* config, int* jobs, int job_count, int* results, int threads) {
+	BatchQueue queue;
+	memset(&queue, 0, sizeof(BatchQueue));
+	queue.inputs = inputs;
+	queue.config = config;
+	queue.jobs = jobs;
+	queue.job_count = job_count;
+	queue.results = results;
+	pthread_mutex_init(&queue.mutex, NULL);
+
+	if (threads > job_count) threads = job_count;
+	pthread_t* workers = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+	int started = 0;
+	while (workers && started < threads - 1 && pthread_create(&workers[started], NULL, batch_worker, &queue) == 0) started++;
+
+	batch_worker(&queue);
+	for (int i = 0; i < started; ++i) pthread_join(workers[i], NULL);
+
+	free(workers);
+	pthread_mutex_destroy(&queue.mutex);
+}
+
+static void count_result(PatchBatchStats* stats, int result) {
+	if (result == PATCH_UNCHANGED) stats->unchanged++;
+	else if (result == PATCH_BUSY) stats->busy++;
+	else if (result == PATCH_CONFLICT) stats->conflicts++;
+	else if (result) stats->patched++;
+	else stats->failed++;
+}
+
+int patch_batch(const char* const* paths, int count, const PatchConfig* config, int threads, SysrootIndex* check,
+                PatchBatchStats* stats) {
+	PatchBatchStats local_stats;
+	if (!stats) stats = &local_stats;
+	memset(stats, 0, sizeof(PatchBatchStats));
+	stats->inputs = count;
+
+	BatchInput* inputs = calloc(count ? count : 1, sizeof(BatchInput));
+	if (!inputs) return FALSE;
+
+	for (int i = 0; i < count; ++i) {
+		inputs[i].path = paths[i];
+		inputs[i].leader = read_input(&inputs[i]) ? LEADER : UNREADABLE;
+	}
+
+	qsort(inputs, count, sizeof(BatchInput), compare_inputs);
+
+	for (int first = 0; first < count;) {
+		int last = first + 1;
+		while (last < count && same_key(&inputs[first], &inputs[last])) last++;
+		if (last - first > 1) dedup_group(inputs, first, last);
+		first = last;
+	}
+
+	// patch every distinct input first, copies are made from the results
+	int* patched = calloc(count ? count : 1, sizeof(int));
+	int* jobs = calloc(count ? count : 1, sizeof(int));
+	if (!patched || !jobs) {
+		free(jobs);
+		free(patched);
+		free(inputs);
+		return FALSE;
+	}
+
+	if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	int job_count = 0;
+	for (int i = 0; i < count; ++i) {
+		if (inputs[i].leader == UNREADABLE) {
+			printf("Failed to read %s\n", inputs[i].path);
+			stats->failed++;
+		} else if (inputs[i].leader == LEADER) {
+			jobs[job_count++] = i;
+		}
+	}
+	run_jobs(inputs, config, jobs, job_count, patched, threads);
+	for (int i = 0; i < job_count; ++i) count_result(stats, patched[jobs[i]]);
+
+	// copies that could not be linked to their leader's result are patched on their own
+	job_count = 0;
+	for (int i = 0; i < count; ++i) {
+		int leader = inputs[i].leader;
+
+		// patched through its sibling, unless the sibling's path got replaced
+		if (leader == SAME_INODE) {
+			leader = inputs[inputs[i].same_as].leader;
+			if (leader == LEADER) {
+				stats->shared++;
+				continue;
+			}
+		}
+		if (leader < 0) continue;
+
+		if (!patched[leader]) {
+			// the original failed, its copy would too
+			stats->failed++;
+			continue;
+		}
+
+		// identical content needing no change, leave the copy and its inode alone
+		if (patched[leader] == PATCH_UNCHANGED) {
+			stats->unchanged++;
+			continue;
+		}
+
+		// identical content already patched with other rules, same conflict
+		if (patched[leader] == PATCH_CONFLICT) {
+			stats->conflicts++;
+			continue;
+		}
+
+		// nothing to link from while another writer has the original, try the copy on its own.
+		// A link replaces the copy's inode, which a journal cannot undo, so journaled runs
+		// patch every copy in place.
+		if (patched[leader] != PATCH_BUSY && !config->journal && link_output(inputs[leader].path, inputs[i].path, stats)) continue;
+
+		jobs[job_count++] = i;
+	}
+	run_jobs(inputs, config, jobs, job_count, patched, threads);
+	for (int i = 0; i < job_count; ++i) count_result(stats, patched[jobs[i]]);
+
+	printf("Batch: %i inputs, %i patched, %i unchanged, %i busy, %i conflicts, %i shared, %i reflinked, %i hardlinked, %i failed\n",
+	       stats->inputs, stats->patched, stats->unchanged, stats->busy, stats->conflicts, stats->shared, stats->reflinked,
+	       stats->hardlinked, stats->failed);
+
+	// the index caches headers as it goes, so the check stays on this thread
+	if (check) {
+		for (int i = 0; i < count; ++i) {
+			if (inputs[i].leader == UNREADABLE) continue;
+			int broken = sysroot_check(check, inputs[i].path, NULL);
+			stats->broken += broken < 0 ? 1 : broken;
+		}
+		printf("Checked %i inputs: %i broken references\n", stats->inputs, stats->broken);
+	}
+
+	free(jobs);
+	free(patched);
+	free(inputs);
+	return stats->failed == 0 && stats->conflicts == 0 && stats->broken == 0;
+}
@@ -0,0 +1,50 @@
+// elfbatch.h
+#pragma once
+
+#include "elfcheck.h"
+#include "elfpatcher.h"
+
+typedef struct {
+	int inputs;
+	int patched;     // unique contents actually patched
+	int unchanged;   // paths that already had the wanted names
+	int busy;        // paths skipped because another writer kept them locked
+	int conflicts;   // paths left alone because they were patched with another rule set
+	int shared;      // paths that were already hard links of another input
+	int reflinked;
+	int hardlinked;
+	int failed;
+	int broken;      // DT_NEEDED entries the post-patch check could not resolve
+} PatchBatchStats;
+
+/**
+ * Patch many files in place, doing the work once per distinct content.
+ *   - Inputs are grouped by size and GNU build-id; only groups with more
+ *     than one member are fully hashed, and equal hashes are confirmed by
+ *     comparing the bytes before a copy is linked.
+ *   - Each distinct input is patched, the other copies are replaced by a
+ *     reflink of the result, or a hard link where reflinks are unsupported.
+ *     If neither works the copy is patched on its own, as is every copy
+ *     while config->journal is set: a link replaces the inode and cannot be
+ *     reverted.
+ *   - Files another writer keeps locked are counted as busy, not failed.
+ *   - Files patched earlier with another rule set are left alone and
+ *     counted as conflicts, as are their copies.
+ *   - Distinct files are patched by a pool of threads, so the libraries of
+ *     every ABI in a mixed tree are worked on at once.
+ *   - With a sysroot index every input is checked afterwards with
+ *     sysroot_check, e.g. to validate the search paths of the runpath
+ *     strategy against the device image.
+ *
+ * @param config the prefix of each file is picked from its rules by the ELF
+ *               header, so one pass covers a tree of mixed ABIs; every file
+ *               is patched with patch_file
+ * @param threads how many files are patched at once, 0 picks the CPU count
+ * @param check  optional index of the device sysroot to check the results
+ *               against, or NULL
+ * @param stats  optional counters, may be NULL
+ * @return TRUE if every file was patched without conflicts and, with
+ *         'check', every dependency resolves; FALSE otherwise
+ */
+int patch_batch(const char* const* paths, int count, const PatchConfig* config, int threads, SysrootIndex* check,
+                PatchBatchStats* stats);
@@ -0,0 +1,306 @@
+// elfcheck.c
+#define _GNU_SOURCE // strchrnul
+#include "elfcheck.h"
+#include "elfhash.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_INITIAL_CAPACITY 1024
+#define CHECK_MAX_LINK_HOPS 40
+
+// absolute, without empty, "." and ".." components
+static void normalize(char* out, size_t size, const char* path) {
+	size_t length = 0;
+	out[0] = '\0';
+
+	while (*path) {
+		while (*path == '/') path++;
+		const char* end = strchrnul(path, '/');
+		size_t component = end - path;
+
+		if (component == 0 || (component == 1 && path[0] == '.')) {
+			// nothing
+		} else if (component == 2 && path[0] == '.' && path[1] == '.') {
+			while (length > 0 && out[--length] != '/');
+			out[length] = '\0';
+		} else if (length + component + 2 <= size) {
+			out[length++] = '/';
+			memcpy(&out[length], path, component);
+			length += component;
+			out[length] = '\0';
+		}
+		path = end;
+	}
+
+	if (length == 0 && size > 1) strcpy(out, "/");
+}
+
+static uint64_t hash_path(const char* path) {
+	return elfhash(path, strlen(path), 0);
+}
+
+static SysrootEntry* index_find(SysrootIndex* index, const char* path) {
+	uint64_t hash = hash_path(path);
+	for (size_t i = hash & (index->capacity - 1);; i = (i + 1) & (index->capacity - 1)) {
+		SysrootEntry* entry = &index->entries[i];
+		if (!entry->path) return NULL;
+		if (entry->hash == hash && strcmp(entry->path, path) == 0) return entry;
+	}
+}
+
+static int index_insert(SysrootIndex* index, const char* path, int is_link) {
+	// keep the load under 3/4
+	if ((index->count + 1) * 4 > index->capacity * 3) {
+		size_t capacity = index->capacity * 2;
+		SysrootEntry* entries = calloc(capacity, sizeof(SysrootEntry));
+		if (!entries) return FALSE;
+
+		for (size_t i = 0; i < index->capacity; ++i) {
+			if (!index->entries[i].path) continue;
+			size_t slot = index->entries[i].hash & (capacity - 1);
+			while (entries[slot].path) slot = (slot + 1) & (capacity - 1);
+			entries[slot] = index->entries[i];
+		}
+		free(index->entries);
+		index->entries = entries;
+		index->capacity = capacity;
+	}
+
+	uint64_t hash = hash_path(path);
+	size_t slot = hash & (index->capacity - 1);
+	while (index->entries[slot].path) slot = (slot + 1) & (index->capacity - 1);
+
+	SysrootEntry* entry = &index->entries[slot];
+	entry->path = strdup(path);
+	if (!entry->path) return FALSE;
+	entry->hash = hash;
+	entry->is_link = is_link;
+	index->count++;
+	return TRUE;
+}
+
+// index everything below host_path; the device path is host_path past the root
+static int walk(SysrootIndex* index, char* host_path, size_t length, size_t root_length) {
+	DIR* dir = opendir(host_path);
+	if (!dir) return TRUE; // unreadable subdirectories are just not indexed
+
+	int ok = TRUE;
+	struct dirent* dirent;
+	while (ok && (dirent = readdir(dir))) {
+		const char* name = dirent->d_name;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+		size_t name_length = strlen(name);
+		if (length + name_length + 2 > PATH_MAX) continue;
+		host_path[length] = '/';
+		memcpy(&host_path[length + 1], name, name_length + 1);
+
+		int type = dirent->d_type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+			type = lstat(host_path, &st) < 0 ? DT_UNKNOWN
+			     : S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if (type == DT_DIR) ok = walk(index, host_path, length + 1 + name_length, root_length);
+		else if (type == DT_REG || type == DT_LNK) ok = index_insert(index, &host_path[root_length], type == DT_LNK);
+	}
+
+	host_path[length] = '\0';
+	closedir(dir);
+	return ok;
+}
+
+int sysroot_index_init(SysrootIndex* index, const char* sysroot) {
+	memset(index, 0, sizeof(SysrootIndex));
+
+	char root[PATH_MAX];
+	if (!realpath(sysroot, root)) return FALSE;
+	if (strcmp(root, "/") == 0) root[0] = '\0';
+
+	index->root = strdup(root);
+	index->capacity = CHECK_INITIAL_CAPACITY;
+	index->entries = calloc(index->capacity, sizeof(SysrootEntry));
+	if (!index->root || !index->entries) {
+		sysroot_index_free(index);
+		return FALSE;
+	}
+
+	char host_path[PATH_MAX];
+	strcpy(host_path, root);
+	if (!walk(index, host_path, strlen(root), strlen(root))) {
+		sysroot_index_free(index);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void sysroot_index_free(SysrootIndex* index) {
+	for (size_t i = 0; index->entries && i < index->capacity; ++i) free(index->entries[i].path);
+	free(index->entries);
+	free(index->root);
+	memset(index, 0, sizeof(SysrootIndex));
+}
+
+/**
+ * The entry a device path ends up at, following symlinks of the path and
+ * of any directory on the way, all through the index.
+ *
+ * @return NULL if it does not exist in the sysroot (or loops)
+ */
+static SysrootEntry* resolve(SysrootIndex* index, const char* device_path) {
+	char path[PATH_MAX];
+	normalize(path, sizeof(path), device_path);
+
+	for (int hops = 0; hops < CHECK_MAX_LINK_HOPS; ++hops) {
+		SysrootEntry* entry = index_find(index, path);
+		if (entry && !entry->is_link) return entry;
+
+		// the first component that is a link, the whole path included
+		SysrootEntry* link = NULL;
+		char* rest = path + 1;
+		for (;;) {
+			rest = strchrnul(rest, '/');
+			char saved = *rest;
+			*rest = '\0';
+			link = index_find(index, path);
+			*rest = saved;
+			if ((link && link->is_link) || !saved) break;
+			rest++;
+		}
+		if (!link || !link->is_link) return NULL;
+
+		char host_path[PATH_MAX], target[PATH_MAX], next[PATH_MAX * 2 + 2];
+		snprintf(host_path, sizeof(host_path), "%s%s", index->root, link->path);
+		ssize_t size = readlink(host_path, target, sizeof(target) - 1);
+		if (size < 0) return NULL;
+		target[size] = '\0';
+
+		if (target[0] == '/') {
+			snprintf(next, sizeof(next), "%s%s", target, rest);
+		} else {
+			size_t dir_length = strrchr(link->path, '/') - link->path;
+			snprintf(next, sizeof(next), "%.*s/%s%s", (int)dir_length, link->path, target, rest);
+		}
+		normalize(path, sizeof(path), next);
+	}
+
+	return NULL;
+}
+
+static void read_header(SysrootIndex* index, SysrootEntry* entry) {
+	if (entry->header_read) return;
+	entry->header_read = TRUE;
+
+	char host_path[PATH_MAX];
+	snprintf(host_path, sizeof(host_path), "%s%s", index->root, entry->path);
+
+	// e_ident, e_type and e_machine have the same place in both classes
+	unsigned char header[EI_NIDENT + 4];
+	int fd = open(host_path, O_RDONLY);
+	if (fd < 0) return;
+	ssize_t size = pread(fd, header, sizeof(header), 0);
+	close(fd);
+
+	if (size != sizeof(header) || memcmp(header, ELFMAG, SELFMAG) != 0) return;
+	entry->elf_class = header[EI_CLASS];
+	entry->machine = header[EI_DATA] == ELFDATA2MSB ? header[EI_NIDENT + 2] << 8 | header[EI_NIDENT + 3]
+	                                               : header[EI_NIDENT + 3] << 8 | header[EI_NIDENT + 2];
+}
+
+// a resolved candidate: the matching entry, else the first mismatching one in '*mismatch'
+static SysrootEntry* try_candidate(SysrootIndex* index, const char* device_path, const ElfDeps* deps,
+                                   SysrootEntry** mismatch) {
+	SysrootEntry* entry = resolve(index, device_path);
+	if (!entry) return NULL;
+
+	read_header(index, entry);
+	if (entry->elf_class == deps->elf_class && entry->machine == deps->machine) return entry;
+
+	if (!*mismatch) *mismatch = entry;
+	return NULL;
+}
+
+// search the ':' separated 'dirs' for the bare 'name'
+static SysrootEntry* search(SysrootIndex* index, const char* dirs, const char* name, const char* origin,
+                            const ElfDeps* deps, SysrootEntry** mismatch) {
+	while (dirs && *dirs) {
+		const char* end = strchrnul(dirs, ':');
+		size_t length = end - dirs;
+		char candidate[PATH_MAX * 2];
+
+		// $ORIGIN only stands for something when the file is in the sysroot
+		if (length >= 7 && (strncmp(dirs, "$ORIGIN", 7) == 0 || strncmp(dirs, "${ORIGIN}", 9) == 0)) {
+			size_t skip = dirs[1] == '{' ? 9 : 7;
+			if (origin && length >= skip) {
+				snprintf(candidate, sizeof(candidate), "%s%.*s/%s", origin, (int)(length - skip), dirs + skip, name);
+				SysrootEntry* entry = try_candidate(index, candidate, deps, mismatch);
+				if (entry) return entry;
+			}
+		} else if (length > 0) {
+			snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)length, dirs, name);
+			SysrootEntry* entry = try_candidate(index, candidate, deps, mismatch);
+			if (entry) return entry;
+		}
+
+		dirs = *end ? end + 1 : end;
+	}
+
+	return NULL;
+}
+
+int sysroot_check(SysrootIndex* index, const char* path, const char* default_dirs) {
+	ElfDeps deps;
+	if (!read_deps(path, &deps)) {
+		printf("%s: cannot read the dependencies\n", path);
+		return -1;
+	}
+	if (!default_dirs) default_dirs = deps.elf_class == ELFCLASS64 ? CHECK_DEFAULT_DIRS64 : CHECK_DEFAULT_DIRS;
+
+	// the device directory of the file itself, if it was checked in place
+	char real_path[PATH_MAX], origin[PATH_MAX];
+	const char* origin_dir = NULL;
+	size_t root_length = strlen(index->root);
+	if (realpath(path, real_path) && strncmp(real_path, index->root, root_length) == 0 && real_path[root_length] == '/') {
+		snprintf(origin, sizeof(origin), "%s", &real_path[root_length]);
+		*strrchr(origin, '/') = '\0';
+		origin_dir = origin;
+	}
+
+	int broken = 0;
+	for (int i = 0; i < deps.needed_count; ++i) {
+		const char* name = deps.needed[i];
+		SysrootEntry* mismatch = NULL;
+		SysrootEntry* found;
+
+		if (strchr(name, '/')) {
+			found = try_candidate(index, name, &deps, &mismatch);
+		} else {
+			found = search(index, deps.search_path, name, origin_dir, &deps, &mismatch);
+			if (!found) found = search(index, default_dirs, name, origin_dir, &deps, &mismatch);
+		}
+		if (found) continue;
+
+		broken++;
+		if (!mismatch) {
+			printf("%s: %s is not in %s\n", path, name, index->root[0] ? index->root : "/");
+		} else if (mismatch->elf_class == 0) {
+			printf("%s: %s resolves to %s, which is not an ELF file\n", path, name, mismatch->path);
+		} else {
+			printf("%s: %s resolves to %s, which is ELFCLASS%i e_machine %i instead of ELFCLASS%i e_machine %i\n",
+			       path, name, mismatch->path, mismatch->elf_class == ELFCLASS64 ? 64 : 32, mismatch->machine,
+			       deps.elf_class == ELFCLASS64 ? 64 : 32, deps.machine);
+		}
+	}
+
+	free_deps(&deps);
+	return broken;
+}
@@ -0,0 +1,49 @@
+// elfcheck.h
+#pragma once
+
+#include "elfpatcher.h"
+
+// default search path after DT_RUNPATH, as seen on the device, by ELF class
+#define CHECK_DEFAULT_DIRS   "/system/lib:/vendor/lib"
+#define CHECK_DEFAULT_DIRS64 "/system/lib64:/vendor/lib64"
+
+typedef struct {
+	uint64_t hash;
+	char* path;        // device path, e.g. "/system/lib/libc.so"
+	uint8_t is_link;
+	uint8_t header_read;
+	uint8_t elf_class; // 0 if not an ELF file (or unreadable)
+	uint16_t machine;
+} SysrootEntry;
+
+/**
+ * Every file and symlink below a sysroot, keyed by its device path.
+ * Built with one walk of the tree; lookups after that are hash probes,
+ * and ELF headers are read on first use and cached.
+ */
+typedef struct {
+	char* root;
+	SysrootEntry* entries; // open addressing, 'capacity' is a power of two
+	size_t capacity;
+	size_t count;
+} SysrootIndex;
+
+// walk 'sysroot' (the directory standing for the device's '/'), FALSE if it cannot be read
+int sysroot_index_init(SysrootIndex* index, const char* sysroot);
+void sysroot_index_free(SysrootIndex* index);
+
+/**
+ * Resolve every DT_NEEDED of 'path' the way the loader would on the device.
+ *   - Names containing '/' are taken as device paths.
+ *   - Bare names are searched in DT_RUNPATH (or DT_RPATH), then 'default_dirs'
+ *     (':' separated, NULL for CHECK_DEFAULT_DIRS or CHECK_DEFAULT_DIRS64
+ *     by the class of 'path'). $ORIGIN is only known
+ *     when 'path' itself lies inside the sysroot.
+ *   - Symlinks, also of directories, are followed inside the sysroot.
+ *   - A candidate of another ELF class or e_machine is skipped like the
+ *     loader does; if nothing else matches it is reported as the cause.
+ * Broken references are printed.
+ *
+ * @return how many DT_NEEDED entries do not resolve, -1 if 'path' cannot be read
+ */
+int sysroot_check(SysrootIndex* index, const char* path, const char* default_dirs);
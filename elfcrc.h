@@ -0,0 +1,9 @@
+// elfcrc.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, as in ZIP and gzip), continuing from 'crc' (0 to start).
+// Thread safe: the table is a constant.
+uint32_t elf_crc32(uint32_t crc, const void* data, size_t size);
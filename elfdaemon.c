@@ -0,0 +1,412 @@
+// elfdaemon.c
+#define _GNU_SOURCE
+#include "elfdaemon.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_SIZE 256
+#define POLL_INTERVAL_MS 200
+
+// DaemonResponse.result of a connection turned away: the job never ran
+#define RESULT_QUEUE_FULL -1
+
+// followed by the path, then 'rule_count' DaemonRules each followed by its prefix
+typedef struct {
+	uint32_t type;
+	uint32_t strategy;
+	uint32_t path_size;
+	uint32_t rule_count;
+} DaemonRequest;
+
+typedef struct {
+	int32_t machine;
+	int32_t elf_class;
+	uint32_t prefix_size;
+} DaemonRule;
+
+typedef struct {
+	int32_t result;
+	uint32_t message_size;
+} DaemonResponse;
+
+typedef struct {
+	const PatchDaemonConfig* config;
+	PatchConfig patch; // the configured one, with the daemon's recipe cache
+	RecipeCache cache;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;
+	int queue[QUEUE_SIZE];
+	int head, count;
+	int shutdown;
+} PatchDaemon;
+
+static void hex_build_id(char* out, const unsigned char* build_id, int size) {
+	for (int i = 0; i < size; ++i) sprintf(&out[i * 2], "%02x", build_id[i]);
+	out[size * 2] = '\0';
+}
+
+/**
+ * Run one job, in the daemon or in-process. Patch jobs go through
+ * patch_file with 'config', so the rule table, lock wait, journal, recipe
+ * caches and marker apply exactly as for a local run.
+ * Writes a one-line summary to 'reply'.
+ */
+static int run_job(const PatchConfig* config, int type, const char* path, char* reply, size_t reply_size) {
+	if (type == DAEMON_JOB_QUERY) {
+		int fd = open(path, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			if (fd >= 0) close(fd);
+			snprintf(reply, reply_size, "cannot open %s", path);
+			return FALSE;
+		}
+
+		unsigned char build_id[RECIPE_MAX_BUILD_ID];
+		int build_id_size = elf_read_build_id(fd, build_id, sizeof(build_id));
+		const PatchRule* rule = patch_rule_read(&config->rules, fd);
+		close(fd);
+
+		// keyed like patch_fd_edits keys them
+		int cached = FALSE;
+		if (rule && build_id_size > 0) {
+			uint64_t rules_hash = recipe_rules_hash(rule->prefix, config->strategy);
+			cached = config->cache && recipe_cache_get(config->cache, build_id, build_id_size, rules_hash, NULL);
+			if (!cached && config->recipe_dir) {
+				char recipe_file[4096];
+				recipe_path(recipe_file, sizeof(recipe_file), config->recipe_dir, build_id, build_id_size, rules_hash);
+				cached = access(recipe_file, R_OK) == 0;
+			}
+		}
+
+		char hex[RECIPE_MAX_BUILD_ID * 2 + 1];
+		hex_build_id(hex, build_id, build_id_size);
+		snprintf(reply, reply_size, "size=%lld build-id=%s recipe=%s",
+		         (long long)st.st_size, build_id_size ? hex : "none", cached ? "yes" : "no");
+		return TRUE;
+	}
+
+	if (type != DAEMON_JOB_PATCH) {
+		snprintf(reply, reply_size, "unknown job type %u", type);
+		return FALSE;
+	}
+
+	int ok = patch_file(path, config);
+	const char* status = ok == PATCH_UNCHANGED ? "unchanged" : ok == PATCH_BUSY ? "busy" : ok == PATCH_CONFLICT ? "conflict"
+	                   : ok ? "patched" : "failed";
+	snprintf(reply, reply_size, "%s %s", status, path);
+	return ok;
+}
+
+static int read_full(int fd, void* data, size_t size) {
+	char* p = data;
+	while (size > 0) {
+		ssize_t got = read(fd, p, size);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return FALSE;
+		p += got;
+		size -= got;
+	}
+	return TRUE;
+}
+
+static int write_full(int fd, const void* data, size_t size) {
+	const char* p = data;
+	while (size > 0) {
+		ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return FALSE;
+		p += sent;
+		size -= sent;
+	}
+	return TRUE;
+}
+
+// wait for the next request, FALSE once the daemon shuts down
+static int wait_readable(PatchDaemon* daemon, int fd) {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	for (;;) {
+		pthread_mutex_lock(&daemon->mutex);
+		int shutdown = daemon->shutdown;
+		pthread_mutex_unlock(&daemon->mutex);
+		if (shutdown) return FALSE;
+
+		int ready = poll(&pfd, 1, POLL_INTERVAL_MS);
+		if (ready > 0) return TRUE;
+		if (ready < 0 && errno != EINTR) return FALSE;
+	}
+}
+
+// read the rule table of a request into 'rules', its prefixes into 'strings'
+static int read_rules(int fd, uint32_t count, PatchRule* rules, char* strings) {
+	for (uint32_t i = 0; i < count; ++i) {
+		DaemonRule rule;
+		char* prefix = &strings[i * (DAEMON_MAX_STRING + 1)];
+		if (!read_full(fd, &rule, sizeof(rule)) || rule.prefix_size > DAEMON_MAX_STRING
+		 || !read_full(fd, prefix, rule.prefix_size)) {
+			return FALSE;
+		}
+		prefix[rule.prefix_size] = '\0';
+
+		rules[i].machine = rule.machine;
+		rules[i].elf_class = rule.elf_class;
+		rules[i].abi = NULL;
+		rules[i].prefix = prefix;
+	}
+	return TRUE;
+}
+
+static void serve_connection(PatchDaemon* daemon, int fd) {
+	char path[DAEMON_MAX_STRING + 1], reply[DAEMON_MAX_STRING];
+	PatchRule rules[DAEMON_MAX_RULES];
+	char* strings = malloc(DAEMON_MAX_RULES * (DAEMON_MAX_STRING + 1));
+	if (!strings) return;
+
+	while (wait_readable(daemon, fd)) {
+		DaemonRequest request;
+		if (!read_full(fd, &request, sizeof(request))
+		 || request.path_size > DAEMON_MAX_STRING || request.rule_count > DAEMON_MAX_RULES
+		 || !read_full(fd, path, request.path_size) || !read_rules(fd, request.rule_count, rules, strings)) {
+			break;
+		}
+		path[request.path_size] = '\0';
+
+		// the client's rules and strategy, the daemon's lock wait, journal and caches
+		PatchConfig job = daemon->patch;
+		job.rules.rules = rules;
+		job.rules.count = request.rule_count;
+		job.strategy = request.strategy;
+
+		DaemonResponse response;
+		response.result = run_job(&job, request.type, path, reply, sizeof(reply));
+		response.message_size = strlen(reply);
+
+		if (!write_full(fd, &response, sizeof(response)) || !write_full(fd, reply, response.message_size)) break;
+	}
+
+	free(strings);
+}
+
+static void* worker_main(void* arg) {
+	PatchDaemon* daemon = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&daemon->mutex);
+		while (daemon->count == 0 && !daemon->shutdown) pthread_cond_wait(&daemon->ready, &daemon->mutex);
+		if (daemon->count == 0) {
+			pthread_mutex_unlock(&daemon->mutex);
+			return NULL;
+		}
+
+		int fd = daemon->queue[daemon->head];
+		daemon->head = (daemon->head + 1) % QUEUE_SIZE;
+		daemon->count--;
+		pthread_mutex_unlock(&daemon->mutex);
+
+		serve_connection(daemon, fd);
+		close(fd);
+	}
+}
+
+static int open_socket(const char* socket_path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) return -1;
+	strcpy(address.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+		if (errno != EADDRINUSE) {
+			close(fd);
+			return -1;
+		}
+
+		// a socket file nobody listens on is left over from a crash
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		int alive = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+		if (probe >= 0) close(probe);
+
+		if (alive || unlink(socket_path) < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+			printf("Daemon socket %s is busy\n", socket_path);
+			close(fd);
+			return -1;
+		}
+	}
+
+	// nobody can connect before listen(), so other users never get a window
+	if (chmod(socket_path, 0600) < 0 || listen(fd, 64) < 0) {
+		close(fd);
+		unlink(socket_path);
+		return -1;
+	}
+	return fd;
+}
+
+// jobs patch files with the daemon's rights: only its own user and root may send them
+static int trusted_peer(int fd) {
+	struct ucred peer;
+	socklen_t size = sizeof(peer);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) < 0 || size != sizeof(peer)) return FALSE;
+	return peer.uid == 0 || peer.uid == getuid();
+}
+
+int patch_daemon_run(const PatchDaemonConfig* config, volatile sig_atomic_t* stop) {
+	int listen_fd = open_socket(config->socket_path);
+	if (listen_fd < 0) return FALSE;
+
+	PatchDaemon daemon;
+	memset(&daemon, 0, sizeof(PatchDaemon));
+	daemon.config = config;
+	daemon.patch = *config->patch;
+	daemon.patch.cache = &daemon.cache;
+	recipe_cache_init(&daemon.cache);
+	pthread_mutex_init(&daemon.mutex, NULL);
+	pthread_cond_init(&daemon.ready, NULL);
+
+	int thread_count = config->threads > 0 ? config->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_count < 1) thread_count = 1;
+
+	pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+	int started = 0;
+	while (threads && started < thread_count && pthread_create(&threads[started], NULL, worker_main, &daemon) == 0) started++;
+
+	if (started == 0) {
+		free(threads);
+		close(listen_fd);
+		unlink(config->socket_path);
+		return FALSE;
+	}
+
+	printf("Daemon listening on %s with %i workers\n", config->socket_path, started);
+
+	struct pollfd pfd = { listen_fd, POLLIN, 0 };
+	while (!*stop) {
+		if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) continue;
+
+		int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) continue;
+		if (!trusted_peer(client)) {
+			printf("%s\n", "Refused a connection from another user");
+			close(client);
+			continue;
+		}
+
+		pthread_mutex_lock(&daemon.mutex);
+		if (daemon.count == QUEUE_SIZE) {
+			pthread_mutex_unlock(&daemon.mutex);
+
+			// told before it is read, so the client knows it may run the job itself
+			DaemonResponse full = { RESULT_QUEUE_FULL, 0 };
+			send(client, &full, sizeof(full), MSG_DONTWAIT | MSG_NOSIGNAL);
+			close(client);
+			continue;
+		}
+		daemon.queue[(daemon.head + daemon.count) % QUEUE_SIZE] = client;
+		daemon.count++;
+		pthread_cond_signal(&daemon.ready);
+		pthread_mutex_unlock(&daemon.mutex);
+	}
+
+	pthread_mutex_lock(&daemon.mutex);
+	daemon.shutdown = TRUE;
+	pthread_cond_broadcast(&daemon.ready);
+	pthread_mutex_unlock(&daemon.mutex);
+
+	for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+	free(threads);
+
+	close(listen_fd);
+	unlink(config->socket_path);
+
+	recipe_cache_free(&daemon.cache);
+	pthread_mutex_destroy(&daemon.mutex);
+	pthread_cond_destroy(&daemon.ready);
+	return TRUE;
+}
+
+int patch_client(const PatchConfig* config, const char* socket_path, int type, const char* path,
+                 char* reply, size_t reply_size) {
+	char local_reply[DAEMON_MAX_STRING];
+	if (!reply) {
+		reply = local_reply;
+		reply_size = sizeof(local_reply);
+	}
+
+	size_t path_size = strlen(path);
+	if (path_size > DAEMON_MAX_STRING || config->rules.count > DAEMON_MAX_RULES) return FALSE;
+	for (int i = 0; i < config->rules.count; ++i) {
+		if (strlen(config->rules.rules[i].prefix) > DAEMON_MAX_STRING) return FALSE;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	int fd = -1;
+	if (socket_path && strlen(socket_path) < sizeof(address.sun_path)) {
+		strcpy(address.sun_path, socket_path);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	// the daemon resolves paths against its own working directory
+	char absolute[PATH_MAX];
+	if (fd >= 0 && !realpath(path, absolute)) {
+		close(fd);
+		snprintf(reply, reply_size, "cannot open %s", path);
+		return FALSE;
+	}
+
+	if (fd >= 0) {
+		path_size = strlen(absolute);
+		DaemonRequest request = { type, config->strategy, path_size, config->rules.count };
+		int sent = write_full(fd, &request, sizeof(request)) && write_full(fd, absolute, path_size);
+		for (int i = 0; sent && i < config->rules.count; ++i) {
+			const PatchRule* rule = &config->rules.rules[i];
+			DaemonRule wire = { rule->machine, rule->elf_class, strlen(rule->prefix) };
+			sent = write_full(fd, &wire, sizeof(wire)) && write_full(fd, rule->prefix, wire.prefix_size);
+		}
+
+		// a full daemon replies without reading, sending may have failed by then
+		DaemonResponse response;
+		int ok = read_full(fd, &response, sizeof(response));
+		if (ok && response.result == RESULT_QUEUE_FULL) {
+			close(fd);
+			return run_job(config, type, path, reply, reply_size);
+		}
+		ok = ok && sent;
+
+		if (ok) {
+			char message[DAEMON_MAX_STRING];
+			uint32_t size = response.message_size < sizeof(message) ? response.message_size : sizeof(message) - 1;
+			ok = read_full(fd, message, size);
+			message[ok ? size : 0] = '\0';
+			snprintf(reply, reply_size, "%s", message);
+		}
+		close(fd);
+
+		if (ok) return response.result;
+
+		// the job may have run already, it is not safe to repeat it here
+		snprintf(reply, reply_size, "lost connection to the daemon");
+		return FALSE;
+	}
+
+	return run_job(config, type, path, reply, reply_size);
+}
@@ -0,0 +1,52 @@
+// elfdaemon.h
+#pragma once
+
+#include "elfpatcher.h"
+
+#include <signal.h>
+
+#define DAEMON_JOB_PATCH 1
+#define DAEMON_JOB_QUERY 2
+
+#define DAEMON_MAX_STRING 4096
+#define DAEMON_MAX_RULES  16
+
+typedef struct {
+	const char* socket_path;
+	const PatchConfig* patch; // lock wait, journal and recipe cache of every job
+	int threads;              // worker threads, 0 picks the CPU count
+} PatchDaemonConfig;
+
+/**
+ * Serve patch and query jobs on a Unix domain socket.
+ * A connection may send any number of jobs and gets one reply per job.
+ *   - The socket is created 0600 and connections from users other than the
+ *     daemon's own and root are refused (SO_PEERCRED).
+ *   - Each job is patched with patch_file, honouring the configured lock
+ *     wait and journal like a local run.
+ *   - Recipes used or recorded are also kept in memory, so repeated inputs
+ *     are replayed without touching the recipe directory.
+ *
+ * Returns when '*stop' becomes non-zero (e.g. from a signal handler).
+ * @return TRUE on clean shutdown, FALSE if the socket could not be set up
+ */
+int patch_daemon_run(const PatchDaemonConfig* config, volatile sig_atomic_t* stop);
+
+/**
+ * Send one job to the daemon at 'socket_path' and wait for its reply.
+ *   - 'path' is sent as an absolute path, the daemon's working directory
+ *     may be another one.
+ *   - Runs the job in-process instead when no daemon is listening, or when
+ *     its queue is full and it turns the connection away.
+ *
+ * @param config its rule table and strategy are sent with the job, so the
+ *               daemon picks the rule by the file's header like a local
+ *               run; the in-process fallback uses the whole config
+ * @param type   DAEMON_JOB_PATCH or DAEMON_JOB_QUERY
+ * @param reply  optional buffer for the text reply
+ * @return what patch_file returned for a patch job (TRUE, PATCH_UNCHANGED,
+ *         PATCH_BUSY, PATCH_CONFLICT), TRUE for an answered query, FALSE
+ *         on error
+ */
+int patch_client(const PatchConfig* config, const char* socket_path, int type, const char* path,
+                 char* reply, size_t reply_size);
@@ -0,0 +1,101 @@
+// elfendian.h
+#pragma once
+
+// elfmod includes this after the libc <elf.h>, which clashes with <linux/elf.h>
+#ifndef ELFMAG
+#include <linux/elf.h>
+#endif
+#include <stdint.h>
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ELFDATA_HOST ELFDATA2LSB
+#else
+#define ELFDATA_HOST ELFDATA2MSB
+#endif
+
+/**
+ * Byte order handling for the fd patcher. elfmod only takes the host order
+ * test from here and swaps field by field through its own accessors.
+ *
+ * Tables are converted as a whole right after they are read and right before
+ * they are written, so the patch logic only ever sees host order. Swapping is
+ * its own inverse: the same routine converts file -> host and host -> file.
+ * Native files skip these routines entirely.
+ */
+
+// TRUE when the file's EI_DATA differs from the host byte order
+static inline int elf_is_foreign(const unsigned char* e_ident) {
+	return e_ident[EI_DATA] != ELFDATA_HOST;
+}
+
+static inline void elf32_swap_ehdr(Elf32_Ehdr* h) {
+	h->e_type = __builtin_bswap16(h->e_type);
+	h->e_machine = __builtin_bswap16(h->e_machine);
+	h->e_version = __builtin_bswap32(h->e_version);
+	h->e_entry = __builtin_bswap32(h->e_entry);
+	h->e_phoff = __builtin_bswap32(h->e_phoff);
+	h->e_shoff = __builtin_bswap32(h->e_shoff);
+	h->e_flags = __builtin_bswap32(h->e_flags);
+	h->e_ehsize = __builtin_bswap16(h->e_ehsize);
+	h->e_phentsize = __builtin_bswap16(h->e_phentsize);
+	h->e_phnum = __builtin_bswap16(h->e_phnum);
+	h->e_shentsize = __builtin_bswap16(h->e_shentsize);
+	h->e_shnum = __builtin_bswap16(h->e_shnum);
+	h->e_shstrndx = __builtin_bswap16(h->e_shstrndx);
+}
+
+static inline void elf32_swap_phdrs(Elf32_Phdr* p, int count) {
+	for (int i = 0; i < count; ++i) {
+		p[i].p_type = __builtin_bswap32(p[i].p_type);
+		p[i].p_offset = __builtin_bswap32(p[i].p_offset);
+		p[i].p_vaddr = __builtin_bswap32(p[i].p_vaddr);
+		p[i].p_paddr = __builtin_bswap32(p[i].p_paddr);
+		p[i].p_filesz = __builtin_bswap32(p[i].p_filesz);
+		p[i].p_memsz = __builtin_bswap32(p[i].p_memsz);
+		p[i].p_flags = __builtin_bswap32(p[i].p_flags);
+		p[i].p_align = __builtin_bswap32(p[i].p_align);
+	}
+}
+
+static inline void elf32_swap_dyns(Elf32_Dyn* d, int count) {
+	for (int i = 0; i < count; ++i) {
+		d[i].d_tag = (Elf32_Sword)__builtin_bswap32((uint32_t)d[i].d_tag);
+		d[i].d_un.d_val = __builtin_bswap32(d[i].d_un.d_val);
+	}
+}
+
+static inline void elf64_swap_ehdr(Elf64_Ehdr* h) {
+	h->e_type = __builtin_bswap16(h->e_type);
+	h->e_machine = __builtin_bswap16(h->e_machine);
+	h->e_version = __builtin_bswap32(h->e_version);
+	h->e_entry = __builtin_bswap64(h->e_entry);
+	h->e_phoff = __builtin_bswap64(h->e_phoff);
+	h->e_shoff = __builtin_bswap64(h->e_shoff);
+	h->e_flags = __builtin_bswap32(h->e_flags);
+	h->e_ehsize = __builtin_bswap16(h->e_ehsize);
+	h->e_phentsize = __builtin_bswap16(h->e_phentsize);
+	h->e_phnum = __builtin_bswap16(h->e_phnum);
+	h->e_shentsize = __builtin_bswap16(h->e_shentsize);
+	h->e_shnum = __builtin_bswap16(h->e_shnum);
+	h->e_shstrndx = __builtin_bswap16(h->e_shstrndx);
+}
+
+static inline void elf64_swap_phdrs(Elf64_Phdr* p, int count) {
+	for (int i = 0; i < count; ++i) {
+		p[i].p_type = __builtin_bswap32(p[i].p_type);
+		p[i].p_flags = __builtin_bswap32(p[i].p_flags);
+		p[i].p_offset = __builtin_bswap64(p[i].p_offset);
+		p[i].p_vaddr = __builtin_bswap64(p[i].p_vaddr);
+		p[i].p_paddr = __builtin_bswap64(p[i].p_paddr);
+		p[i].p_filesz = __builtin_bswap64(p[i].p_filesz);
+		p[i].p_memsz = __builtin_bswap64(p[i].p_memsz);
+		p[i].p_align = __builtin_bswap64(p[i].p_align);
+	}
+}
+
+static inline void elf64_swap_dyns(Elf64_Dyn* d, int count) {
+	for (int i = 0; i < count; ++i) {
+		d[i].d_tag = (Elf64_Sxword)__builtin_bswap64((uint64_t)d[i].d_tag);
+		d[i].d_un.d_val = __builtin_bswap64(d[i].d_un.d_val);
+	}
+}
@@ -0,0 +1,141 @@
+// elfhash.c
+#include "elfhash.h"
+#include "elfpatcher.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t val) {
+	acc ^= round64(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+
+void elfhash_init(ElfHash64* state, uint64_t seed) {
+	memset(state, 0, sizeof(ElfHash64));
+	state->seed = seed;
+	state->v[0] = seed + PRIME1 + PRIME2;
+	state->v[1] = seed + PRIME2;
+	state->v[2] = seed;
+	state->v[3] = seed - PRIME1;
+}
+
+void elfhash_update(ElfHash64* state, const void* data, size_t size) {
+	const unsigned char* p = data;
+	const unsigned char* end = p + size;
+	state->total_length += size;
+
+	if (state->buffered + size < 32) {
+		memcpy(state->buffer + state->buffered, p, size);
+		state->buffered += size;
+		return;
+	}
+
+	if (state->buffered) {
+		size_t fill = 32 - state->buffered;
+		memcpy(state->buffer + state->buffered, p, fill);
+		for (int i = 0; i < 4; ++i) state->v[i] = round64(state->v[i], read64(state->buffer + i * 8));
+		p += fill;
+		state->buffered = 0;
+	}
+
+	while (end - p >= 32) {
+		for (int i = 0; i < 4; ++i) state->v[i] = round64(state->v[i], read64(p + i * 8));
+		p += 32;
+	}
+
+	if (p < end) {
+		memcpy(state->buffer, p, end - p);
+		state->buffered = end - p;
+	}
+}
+
+uint64_t elfhash_final(const ElfHash64* state) {
+	uint64_t h;
+	if (state->total_length >= 32) {
+		h = rotl(state->v[0], 1) + rotl(state->v[1], 7) + rotl(state->v[2], 12) + rotl(state->v[3], 18);
+		for (int i = 0; i < 4; ++i) h = merge64(h, state->v[i]);
+	} else {
+		h = state->seed + PRIME5;
+	}
+
+	h += state->total_length;
+
+	const unsigned char* p = state->buffer;
+	const unsigned char* end = p + state->buffered;
+	while (end - p >= 8) {
+		h ^= round64(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+		p += 8;
+	}
+	if (end - p >= 4) {
+		h ^= (uint64_t)read32(p) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p++) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t elfhash(const void* data, size_t size, uint64_t seed) {
+	ElfHash64 state;
+	elfhash_init(&state, seed);
+	elfhash_update(&state, data, size);
+	return elfhash_final(&state);
+}
+
+int elfhash_fd(ElfHash64* state, int fd, uint64_t offset, uint64_t size) {
+	unsigned char chunk[64 * 1024];
+	while (size > 0) {
+		size_t want = size < sizeof(chunk) ? size : sizeof(chunk);
+		ssize_t got = pread(fd, chunk, want, offset);
+		if (got != (ssize_t)want) return FALSE;
+
+		elfhash_update(state, chunk, want);
+		offset += want;
+		size -= want;
+	}
+	return TRUE;
+}
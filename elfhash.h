@@ -0,0 +1,27 @@
+// elfhash.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming 64-bit content hash (XXH64), used to fingerprint file contents
+ * and rule sets. Not cryptographic.
+ */
+typedef struct {
+	uint64_t total_length;
+	uint64_t v[4];
+	unsigned char buffer[32];
+	uint32_t buffered;
+	uint64_t seed;
+} ElfHash64;
+
+void elfhash_init(ElfHash64* state, uint64_t seed);
+void elfhash_update(ElfHash64* state, const void* data, size_t size);
+uint64_t elfhash_final(const ElfHash64* state);
+
+// one-shot helper
+uint64_t elfhash(const void* data, size_t size, uint64_t seed);
+
+// hash 'size' bytes of fd starting at 'offset' into state, FALSE on short read
+int elfhash_fd(ElfHash64* state, int fd, uint64_t offset, uint64_t size);
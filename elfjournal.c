@@ -0,0 +1,238 @@
+// elfjournal.c
+#include "elfjournal.h"
+#include "elfpatcher.h"
+#include "elflock.h"
+
+#include <limits.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC   0x4e524a45 // "EJRN"
+#define JOURNAL_VERSION 1
+
+// every record starts with this, so records of several runs can follow each other
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t path_size;
+	uint32_t range_count;
+	uint64_t original_size;
+	uint64_t patched_size;
+	uint64_t patched_hash; // of the recorded ranges after patching
+} JournalHeader;
+
+typedef struct {
+	uint64_t offset;
+	uint32_t size;
+	uint32_t reserved;
+} JournalRangeHeader;
+
+// a record read back, 'undo.ranges' points into the journal buffer
+typedef struct {
+	JournalHeader header;
+	char path[PATH_MAX];
+	PatchUndo undo;
+} JournalRecord;
+
+int undo_init(PatchUndo* undo, int fd) {
+	memset(undo, 0, sizeof(PatchUndo));
+	struct stat st;
+	if (fstat(fd, &st) < 0) return FALSE;
+	undo->original_size = st.st_size;
+	return TRUE;
+}
+
+int undo_record(PatchUndo* undo, int fd, uint64_t offset, uint64_t size) {
+	// what lies past the original end goes with the ftruncate
+	if (offset >= undo->original_size) return TRUE;
+	if (size > undo->original_size - offset) size = undo->original_size - offset;
+
+	PatchEdit* ranges = realloc(undo->ranges, (undo->range_count + 1) * sizeof(PatchEdit));
+	if (!ranges) return FALSE;
+	undo->ranges = ranges;
+
+	PatchEdit* range = &undo->ranges[undo->range_count];
+	range->bytes = malloc(size ? size : 1);
+	if (!range->bytes) return FALSE;
+	if (pread(fd, range->bytes, size, offset) != (ssize_t)size) {
+		free(range->bytes);
+		return FALSE;
+	}
+	range->offset = offset;
+	range->size = size;
+	undo->range_count++;
+	return TRUE;
+}
+
+int undo_apply(const PatchUndo* undo, int fd) {
+	// a range written twice holds the original bytes in its first record
+	for (uint32_t i = undo->range_count; i-- > 0;) {
+		const PatchEdit* range = &undo->ranges[i];
+		if (pwrite(fd, range->bytes, range->size, range->offset) != (ssize_t)range->size) return FALSE;
+	}
+	return ftruncate(fd, (off_t)undo->original_size) == 0;
+}
+
+void undo_free(PatchUndo* undo) {
+	for (uint32_t i = 0; i < undo->range_count; ++i) free(undo->ranges[i].bytes);
+	free(undo->ranges);
+	memset(undo, 0, sizeof(PatchUndo));
+}
+
+// hash of what the recorded ranges of fd hold now
+static int hash_ranges(const PatchUndo* undo, int fd, uint64_t* hash) {
+	ElfHash64 state;
+	elfhash_init(&state, JOURNAL_VERSION);
+	for (uint32_t i = 0; i < undo->range_count; ++i) {
+		if (!elfhash_fd(&state, fd, undo->ranges[i].offset, undo->ranges[i].size)) return FALSE;
+	}
+	*hash = elfhash_final(&state);
+	return TRUE;
+}
+
+int journal_append(const char* journal, const char* path, const PatchUndo* undo, int fd) {
+	char real_path[PATH_MAX];
+	struct stat st;
+	JournalHeader header = { JOURNAL_MAGIC, JOURNAL_VERSION, 0, undo->range_count, undo->original_size, 0, 0 };
+	if (!realpath(path, real_path) || fstat(fd, &st) < 0 || !hash_ranges(undo, fd, &header.patched_hash)) return FALSE;
+	header.path_size = strlen(real_path);
+	header.patched_size = st.st_size;
+
+	size_t size = sizeof(header) + header.path_size;
+	for (uint32_t i = 0; i < undo->range_count; ++i) size += sizeof(JournalRangeHeader) + undo->ranges[i].size;
+
+	// the whole record in one buffer: a single O_APPEND write does not interleave with other writers
+	unsigned char* record = malloc(size);
+	if (!record) return FALSE;
+
+	unsigned char* cursor = record;
+	memcpy(cursor, &header, sizeof(header));
+	cursor += sizeof(header);
+	memcpy(cursor, real_path, header.path_size);
+	cursor += header.path_size;
+	for (uint32_t i = 0; i < undo->range_count; ++i) {
+		JournalRangeHeader range = { undo->ranges[i].offset, undo->ranges[i].size, 0 };
+		memcpy(cursor, &range, sizeof(range));
+		cursor += sizeof(range);
+		memcpy(cursor, undo->ranges[i].bytes, range.size);
+		cursor += range.size;
+	}
+
+	int journal_fd = open(journal, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	int ok = journal_fd >= 0 && write(journal_fd, record, size) == (ssize_t)size && fdatasync(journal_fd) == 0;
+	if (journal_fd >= 0) close(journal_fd);
+	free(record);
+	return ok;
+}
+
+// split the journal into records, FALSE if it is truncated or of another format
+static int parse_records(unsigned char* data, size_t size, JournalRecord** records, int* count) {
+	*records = NULL;
+	*count = 0;
+
+	for (size_t cursor = 0; cursor < size;) {
+		JournalHeader header;
+		if (size - cursor < sizeof(header)) return FALSE;
+		memcpy(&header, data + cursor, sizeof(header));
+		cursor += sizeof(header);
+		if (header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION
+		 || header.path_size >= PATH_MAX || size - cursor < header.path_size) return FALSE;
+
+		JournalRecord* grown = realloc(*records, (*count + 1) * sizeof(JournalRecord));
+		if (!grown) return FALSE;
+		*records = grown;
+
+		JournalRecord* record = &(*records)[*count];
+		memset(record, 0, sizeof(JournalRecord));
+		record->header = header;
+		memcpy(record->path, data + cursor, header.path_size);
+		cursor += header.path_size;
+		record->undo.original_size = header.original_size;
+		(*count)++;
+
+		record->undo.ranges = calloc(header.range_count ? header.range_count : 1, sizeof(PatchEdit));
+		if (!record->undo.ranges) return FALSE;
+
+		for (uint32_t i = 0; i < header.range_count; ++i) {
+			JournalRangeHeader range;
+			if (size - cursor < sizeof(range)) return FALSE;
+			memcpy(&range, data + cursor, sizeof(range));
+			cursor += sizeof(range);
+			if (size - cursor < range.size) return FALSE;
+
+			record->undo.ranges[i].offset = range.offset;
+			record->undo.ranges[i].size = range.size;
+			record->undo.ranges[i].bytes = data + cursor;
+			record->undo.range_count++;
+			cursor += range.size;
+		}
+	}
+
+	return TRUE;
+}
+
+static int revert_record(const JournalRecord* record, int wait_ms) {
+	const char* path = record->path;
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		printf("Cannot open %s, not reverted\n", path);
+		return FALSE;
+	}
+
+	int locked = lock_file(fd, wait_ms);
+	if (locked != TRUE) {
+		printf("%s is %s, not reverted\n", path, locked == PATCH_BUSY ? "busy" : "not lockable");
+		close(fd);
+		return FALSE;
+	}
+
+	struct stat st;
+	uint64_t hash;
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size != record->header.patched_size
+	 || !hash_ranges(&record->undo, fd, &hash) || hash != record->header.patched_hash) {
+		printf("%s changed since it was patched, not reverted\n", path);
+		close(fd);
+		return FALSE;
+	}
+
+	int ok = undo_apply(&record->undo, fd);
+	if (ok) mark_clear(fd);
+	printf("%s %s\n", ok ? "Reverted" : "Failed to revert", path);
+	close(fd);
+	return ok;
+}
+
+int journal_revert(const char* journal, int wait_ms) {
+	int fd = open(journal, O_RDWR);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	unsigned char* data = malloc(st.st_size ? st.st_size : 1);
+	JournalRecord* records = NULL;
+	int count = 0;
+	int ok = data && pread(fd, data, st.st_size, 0) == st.st_size && parse_records(data, st.st_size, &records, &count);
+
+	int failed = -1;
+	if (ok) {
+		failed = 0;
+		for (int i = count; i-- > 0;) {
+			if (!revert_record(&records[i], wait_ms)) failed++;
+		}
+		// spent: reverting it again could only find changed files
+		if (failed == 0 && ftruncate(fd, 0) != 0) printf("Failed to empty %s\n", journal);
+	}
+
+	// the range bytes belong to 'data'
+	for (int i = 0; i < count; ++i) free(records[i].undo.ranges);
+	free(records);
+	free(data);
+	close(fd);
+	return failed;
+}
@@ -0,0 +1,47 @@
+// elfjournal.h
+#pragma once
+
+#include "elfrecipe.h"
+
+/**
+ * Undo journal, instead of copying each library before patching it.
+ *   - While a file is patched every write first saves the bytes it
+ *     replaces (PatchUndo). Bytes past the original end are not kept,
+ *     the original length is.
+ *   - Once the file is patched its record is appended to the journal with
+ *     a single O_APPEND write. One journal may collect any number of files
+ *     and runs, e.g. a whole batch.
+ *   - Reverting puts the bytes back with pwrite and cuts the file to its
+ *     original length with ftruncate. Its cost scales with the edits, not
+ *     with the size of the libraries.
+ */
+
+// start keeping the bytes overwritten on 'fd' as it is now
+int undo_init(PatchUndo* undo, int fd);
+// save what [offset, offset + size) of 'fd' holds before it is overwritten
+int undo_record(PatchUndo* undo, int fd, uint64_t offset, uint64_t size);
+// put the saved bytes back, newest first, and restore the length
+int undo_apply(const PatchUndo* undo, int fd);
+void undo_free(PatchUndo* undo);
+
+/**
+ * Append the record of 'path', patched on 'fd', to the journal.
+ * The record holds a hash of the patched bytes, so a revert leaves files
+ * alone that changed again since.
+ *
+ * @return TRUE once the record is written
+ */
+int journal_append(const char* journal, const char* path, const PatchUndo* undo, int fd);
+
+/**
+ * Revert every file recorded in 'journal', newest record first, so files
+ * patched several times end up as before the first patch. Files are taken
+ * under their writer lock and their rule-set marker is removed. A file
+ * whose size or patched bytes no longer match its record is skipped.
+ * A journal that reverted completely is emptied.
+ *
+ * @param wait_ms how long to wait for the writer lock of each file, as for lock_file
+ * @return the number of records that could not be reverted, -1 if the
+ *         journal cannot be read
+ */
+int journal_revert(const char* journal, int wait_ms);
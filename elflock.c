@@ -0,0 +1,81 @@
+// elflock.c
+#define _GNU_SOURCE // F_OFD_SETLK
+#include "elflock.h"
+#include "elfpatcher.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+
+#define MARK_NAME "user.elfpatcher"
+#define MARK_MAX  128
+
+// longest single sleep while polling a busy lock
+#define LOCK_MAX_SLEEP_MS 50
+
+// one non-blocking attempt: TRUE when taken, FALSE if busy, -1 on error
+static int try_lock(int fd) {
+#ifdef F_OFD_SETLK
+	struct flock lock = { 0 };
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	if (fcntl(fd, F_OFD_SETLK, &lock) == 0) return TRUE;
+	if (errno == EAGAIN || errno == EACCES) return FALSE;
+	if (errno != EINVAL) return -1;
+	// kernel without OFD locks
+#endif
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0) return TRUE;
+	return errno == EWOULDBLOCK ? FALSE : -1;
+}
+
+int lock_file(int fd, int wait_ms) {
+	int waited_ms = 0, sleep_ms = 1;
+
+	for (;;) {
+		int locked = try_lock(fd);
+		if (locked != FALSE) return locked == TRUE;
+		if (wait_ms >= 0 && waited_ms >= wait_ms) return PATCH_BUSY;
+
+		if (wait_ms >= 0 && sleep_ms > wait_ms - waited_ms) sleep_ms = wait_ms - waited_ms;
+		struct timespec pause = { sleep_ms / 1000, (sleep_ms % 1000) * 1000000L };
+		nanosleep(&pause, NULL);
+		waited_ms += sleep_ms;
+		if (sleep_ms < LOCK_MAX_SLEEP_MS) sleep_ms *= 2;
+	}
+}
+
+static int format_mark(char* mark, size_t size, int fd, uint64_t rules_hash) {
+	struct stat st;
+	if (fstat(fd, &st) < 0) return -1;
+
+	return snprintf(mark, size, "rules=%016llx size=%lld mtime=%lld.%09ld", (unsigned long long)rules_hash,
+	                (long long)st.st_size, (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+}
+
+int mark_read(int fd, uint64_t rules_hash) {
+	char stored[MARK_MAX + 1], expected[MARK_MAX];
+	ssize_t size = fgetxattr(fd, MARK_NAME, stored, MARK_MAX);
+	int expected_size = format_mark(expected, sizeof(expected), fd, rules_hash);
+	if (size <= 0 || expected_size <= 0) return MARK_NONE;
+	stored[size] = '\0';
+
+	// "rules=<16 hex digits> " first, the file state after it
+	const int rules_len = 23;
+	if (size != expected_size || strcmp(&stored[rules_len], &expected[rules_len]) != 0) return MARK_NONE;
+	return memcmp(stored, expected, rules_len) == 0 ? MARK_SAME : MARK_OTHER;
+}
+
+void mark_write(int fd, uint64_t rules_hash) {
+	char mark[MARK_MAX];
+	int size = format_mark(mark, sizeof(mark), fd, rules_hash);
+	if (size > 0) fsetxattr(fd, MARK_NAME, mark, size, 0);
+}
+
+void mark_clear(int fd) {
+	fremovexattr(fd, MARK_NAME);
+}
@@ -0,0 +1,40 @@
+// elflock.h
+#pragma once
+
+#include <stdint.h>
+
+// lock waits, in milliseconds; anything >= 0 is a bounded wait
+#define LOCK_WAIT_SKIP    0  // give up at once if another writer holds the file
+#define LOCK_WAIT_FOREVER -1
+#define LOCK_WAIT_DEFAULT 30000
+
+// what the rule-set marker of a file says
+#define MARK_NONE  0 // no marker, or a stale one (the file changed since)
+#define MARK_SAME  1 // patched with the given rule set
+#define MARK_OTHER 2 // patched with another rule set
+
+/**
+ * Take the exclusive writer lock of the file open on 'fd'.
+ *   - An OFD lock (F_OFD_SETLK) where the kernel has them, flock otherwise.
+ *     Both belong to the open file description, so threads and processes
+ *     exclude each other alike and the lock goes away with the last fd.
+ *   - Only writers lock: probes stay lock-free and a writer that waited
+ *     re-reads the file, finding the names the other writer already set.
+ *
+ * @param wait_ms how long to wait for another writer, one of LOCK_WAIT_* or
+ *                any bound in milliseconds
+ * @return TRUE when held, PATCH_BUSY if the wait ran out, FALSE on error
+ */
+int lock_file(int fd, int wait_ms);
+
+/**
+ * Rule-set marker kept in the "user.elfpatcher" xattr: the rules hash plus
+ * the size and mtime the file had after patching. A file replaced or
+ * rewritten since no longer matches and reads as MARK_NONE.
+ */
+int mark_read(int fd, uint64_t rules_hash);
+
+// record 'rules_hash' on a file just patched, silently skipped where xattrs are unsupported
+void mark_write(int fd, uint64_t rules_hash);
+// drop the marker of a file that was reverted
+void mark_clear(int fd);
@@ -0,0 +1,87 @@
+/**
+ * elfcost.c - Static load-time cost profile of an ELF file
+ */
+
+#include "elfcost.h"
+#include "elfmod_priv.h"
+#include <string.h>
+
+// Entries of a ':' separated search path
+static size_t count_dirs(const char* path) {
+    if (!path[0]) {
+        return 0;
+    }
+    size_t count = 1;
+    for (const char* p = path; *p; p++) {
+        if (*p == ':') {
+            count++;
+        }
+    }
+    return count;
+}
+
+int elf_load_profile(ElfContext* ctx, uint64_t page_size, size_t default_dirs,
+                     ElfLoadProfile* profile) {
+    if (!ctx || !profile) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+    if (page_size == 0) {
+        page_size = 4096;
+    }
+
+    memset(profile, 0, sizeof(*profile));
+    profile->dynstr_size = ctx->dynstr_size;
+
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) != PT_LOAD) {
+            continue;
+        }
+        uint64_t vaddr = ELF_PHDR(ctx, i, p_vaddr);
+        uint64_t start = vaddr & ~(page_size - 1);
+        uint64_t mem_end = (vaddr + ELF_PHDR(ctx, i, p_memsz) + page_size - 1) & ~(page_size - 1);
+        uint64_t file_end = (vaddr + ELF_PHDR(ctx, i, p_filesz) + page_size - 1) & ~(page_size - 1);
+
+        profile->load_segments++;
+        profile->mapped_pages += (mem_end - start) / page_size;
+        profile->file_pages += (file_end - start) / page_size;
+    }
+
+    // A DT_RUNPATH hides DT_RPATH
+    const char* search_path = NULL;
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        uint64_t val = elf_dyn_val(ctx, i);
+        if (tag == DT_NULL) {
+            break;
+        }
+        if (val >= ctx->dynstr_size) {
+            continue;
+        }
+        if (tag == DT_RUNPATH || (tag == DT_RPATH && !search_path)) {
+            search_path = ctx->dynstr + val;
+        } else if (tag == DT_NEEDED) {
+            profile->needed_count++;
+            if (strchr(ctx->dynstr + val, '/')) {
+                profile->needed_absolute++;
+            } else {
+                profile->needed_bare++;
+            }
+        }
+    }
+    profile->search_dirs = search_path ? count_dirs(search_path) : 0;
+
+    // A path is opened once; a bare name may be tried in every directory
+    profile->search_probes = profile->needed_absolute +
+                             profile->needed_bare * (profile->search_dirs + default_dirs);
+    return 0;
+}
+
+void elf_load_cost(const ElfLoadProfile* before, const ElfLoadProfile* after,
+                   ElfLoadCost* cost) {
+    cost->extra_pages = (int64_t)after->mapped_pages - (int64_t)before->mapped_pages;
+    cost->new_load_segments = (int64_t)after->load_segments - (int64_t)before->load_segments;
+    cost->dynstr_growth = (int64_t)after->dynstr_size - (int64_t)before->dynstr_size;
+    cost->absolute_delta = (int64_t)after->needed_absolute - (int64_t)before->needed_absolute;
+    cost->probe_delta = (int64_t)after->search_probes - (int64_t)before->search_probes;
+}
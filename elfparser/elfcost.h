@@ -0,0 +1,53 @@
+/**
+ * elfcost.h - Static load-time cost profile of an ELF file
+ *
+ * Describes what the dynamic loader has to do for a library: the segments
+ * it maps and how it finds the dependencies. Comparing the profiles of an
+ * original and a patched library tells what a patch costs at run time.
+ */
+
+#ifndef ELFCOST_H
+#define ELFCOST_H
+
+#include "elfmod.h"
+
+typedef struct {
+    size_t load_segments;      // PT_LOAD entries, one mmap each
+    uint64_t mapped_pages;     // pages spanned by the load segments
+    uint64_t file_pages;       // of which backed by the file (the rest is .bss)
+    size_t dynstr_size;
+    size_t needed_count;
+    size_t needed_absolute;    // DT_NEEDED names containing '/', opened as is
+    size_t needed_bare;        // names looked up through the search path
+    size_t search_dirs;        // DT_RUNPATH (or DT_RPATH) directories
+    uint64_t search_probes;    // worst-case open attempts to find every dependency
+} ElfLoadProfile;
+
+typedef struct {
+    int64_t extra_pages;
+    int64_t new_load_segments;
+    int64_t dynstr_growth;
+    int64_t absolute_delta;    // change in DT_NEEDED names given as paths
+    int64_t probe_delta;       // change in worst-case open attempts
+} ElfLoadCost;
+
+/**
+ * Profile a loaded ELF file
+ *
+ * @param ctx Pointer to an initialized ElfContext
+ * @param page_size Page size the loader maps with, 0 for 4096
+ * @param default_dirs Directories searched after the RUNPATH for a bare
+ *                     name (e.g. 2 for /lib and /usr/lib)
+ * @param profile Receives the profile
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_load_profile(ElfContext* ctx, uint64_t page_size, size_t default_dirs,
+                     ElfLoadProfile* profile);
+
+/**
+ * Difference between the profiles of an original and a patched file
+ */
+void elf_load_cost(const ElfLoadProfile* before, const ElfLoadProfile* after,
+                   ElfLoadCost* cost);
+
+#endif // ELFCOST_H
@@ -0,0 +1,387 @@
+/**
+ * elfdynstr.c - Dynamic string table compaction
+ *
+ * Rebuilds .dynstr from the strings that are still referenced, so dead
+ * names left behind by replacements stop taking space.
+ */
+
+#include "elfmod.h"
+#include "elfmod_priv.h"
+#include <string.h>
+
+typedef struct {
+    uint32_t* field;      // 32-bit name field (symbols, versions), NULL for a dynamic entry
+    size_t dyn_index;
+    size_t string_index;  // into the unique string list
+    const char* string;   // in the current table
+} StrRef;
+
+typedef struct {
+    const char* string;
+    size_t length;
+    uint64_t new_offset;
+} UniqueStr;
+
+typedef struct {
+    StrRef* refs;
+    size_t count;
+    size_t capacity;
+} RefList;
+
+// Dynamic tags whose value is an offset into the dynamic string table
+static bool is_string_tag(int64_t tag) {
+    switch (tag) {
+        case DT_NEEDED:
+        case DT_SONAME:
+        case DT_RPATH:
+        case DT_RUNPATH:
+        case DT_AUXILIARY:
+        case DT_FILTER:
+        case DT_CONFIG:
+        case DT_DEPAUDIT:
+        case DT_AUDIT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int add_ref(ElfContext* ctx, RefList* list, uint32_t* field, size_t dyn_index, uint64_t offset) {
+    if (offset >= ctx->dynstr_size ||
+        !memchr(ctx->dynstr + offset, '\0', ctx->dynstr_size - offset)) {
+        elf_set_error("String reference 0x%llx outside the dynamic string table",
+                      (unsigned long long)offset);
+        return -1;
+    }
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        StrRef* refs = realloc(list->refs, capacity * sizeof(StrRef));
+        if (!refs) {
+            elf_set_error("Memory allocation failed");
+            return -1;
+        }
+        list->refs = refs;
+        list->capacity = capacity;
+    }
+
+    StrRef* ref = &list->refs[list->count++];
+    ref->field = field;
+    ref->dyn_index = dyn_index;
+    ref->string = ctx->dynstr + offset;
+    ref->string_index = 0;
+    return 0;
+}
+
+static int collect_dynamic(ElfContext* ctx, RefList* list) {
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        if (tag == DT_NULL) {
+            break;
+        }
+        if (is_string_tag(tag) && add_ref(ctx, list, NULL, i, elf_dyn_val(ctx, i)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int collect_symbols(ElfContext* ctx, RefList* list) {
+    uint64_t symtab;
+    if (elf_dyn_find(ctx, DT_SYMTAB, &symtab) != 0) {
+        return 0;
+    }
+
+    size_t count;
+    if (elf_dynsym_count(ctx, &count) != 0) {
+        return -1;
+    }
+
+    // st_name is the first, 32-bit member of both symbol layouts
+    size_t sym_size = ctx->is_64bit ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    uint8_t* syms = elf_vaddr_ptr(ctx, symtab, (uint64_t)count * sym_size);
+    if (!syms) {
+        elf_set_error("Dynamic symbol table not mapped from the file");
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t* name = (uint32_t*)(syms + i * sym_size);
+        if (add_ref(ctx, list, name, 0, ELF_GET(ctx, *name)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Verneed and verdef records have the same layout in both classes
+static int collect_verneed(ElfContext* ctx, RefList* list) {
+    uint64_t addr, num;
+    if (elf_dyn_find(ctx, DT_VERNEED, &addr) != 0) {
+        return 0;
+    }
+    if (elf_dyn_find(ctx, DT_VERNEEDNUM, &num) != 0) {
+        num = UINT64_MAX;
+    }
+
+    for (uint64_t n = 0; n < num; n++) {
+        Elf32_Verneed* need = elf_vaddr_ptr(ctx, addr, sizeof(Elf32_Verneed));
+        if (!need) {
+            elf_set_error("Version needs not mapped from the file");
+            return -1;
+        }
+        if (add_ref(ctx, list, &need->vn_file, 0, ELF_GET(ctx, need->vn_file)) != 0) {
+            return -1;
+        }
+
+        uint64_t aux_addr = addr + ELF_GET(ctx, need->vn_aux);
+        for (uint16_t a = 0; a < ELF_GET(ctx, need->vn_cnt); a++) {
+            Elf32_Vernaux* aux = elf_vaddr_ptr(ctx, aux_addr, sizeof(Elf32_Vernaux));
+            if (!aux) {
+                elf_set_error("Version need entries not mapped from the file");
+                return -1;
+            }
+            if (add_ref(ctx, list, &aux->vna_name, 0, ELF_GET(ctx, aux->vna_name)) != 0) {
+                return -1;
+            }
+            if (ELF_GET(ctx, aux->vna_next) == 0) {
+                break;
+            }
+            aux_addr += ELF_GET(ctx, aux->vna_next);
+        }
+
+        if (ELF_GET(ctx, need->vn_next) == 0) {
+            break;
+        }
+        addr += ELF_GET(ctx, need->vn_next);
+    }
+    return 0;
+}
+
+static int collect_verdef(ElfContext* ctx, RefList* list) {
+    uint64_t addr, num;
+    if (elf_dyn_find(ctx, DT_VERDEF, &addr) != 0) {
+        return 0;
+    }
+    if (elf_dyn_find(ctx, DT_VERDEFNUM, &num) != 0) {
+        num = UINT64_MAX;
+    }
+
+    for (uint64_t n = 0; n < num; n++) {
+        Elf32_Verdef* def = elf_vaddr_ptr(ctx, addr, sizeof(Elf32_Verdef));
+        if (!def) {
+            elf_set_error("Version definitions not mapped from the file");
+            return -1;
+        }
+
+        uint64_t aux_addr = addr + ELF_GET(ctx, def->vd_aux);
+        for (uint16_t a = 0; a < ELF_GET(ctx, def->vd_cnt); a++) {
+            Elf32_Verdaux* aux = elf_vaddr_ptr(ctx, aux_addr, sizeof(Elf32_Verdaux));
+            if (!aux) {
+                elf_set_error("Version definition names not mapped from the file");
+                return -1;
+            }
+            if (add_ref(ctx, list, &aux->vda_name, 0, ELF_GET(ctx, aux->vda_name)) != 0) {
+                return -1;
+            }
+            if (ELF_GET(ctx, aux->vda_next) == 0) {
+                break;
+            }
+            aux_addr += ELF_GET(ctx, aux->vda_next);
+        }
+
+        if (ELF_GET(ctx, def->vd_next) == 0) {
+            break;
+        }
+        addr += ELF_GET(ctx, def->vd_next);
+    }
+    return 0;
+}
+
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(((const UniqueStr*)a)->string, ((const UniqueStr*)b)->string);
+}
+
+// Descending by reversed string: a string directly follows the longest
+// string it is a suffix of
+static int compare_reversed(const void* a, const void* b) {
+    const UniqueStr* x = *(const UniqueStr* const*)a;
+    const UniqueStr* y = *(const UniqueStr* const*)b;
+    size_t i = x->length, j = y->length;
+
+    while (i > 0 && j > 0) {
+        unsigned char cx = x->string[--i];
+        unsigned char cy = y->string[--j];
+        if (cx != cy) {
+            return cx > cy ? -1 : 1;
+        }
+    }
+    return (i > 0) ? -1 : (j > 0) ? 1 : 0;
+}
+
+/**
+ * Lay out the unique strings with suffix merging into 'table'
+ *
+ * @return the size of the new table
+ */
+static size_t build_table(UniqueStr* unique, size_t count, char* table) {
+    UniqueStr** order = malloc((count + 1) * sizeof(UniqueStr*));
+    if (!order) {
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = &unique[i];
+    }
+    qsort(order, count, sizeof(UniqueStr*), compare_reversed);
+
+    // Offset 0 stays the empty string
+    size_t size = 1;
+    table[0] = '\0';
+
+    const UniqueStr* prev = NULL;
+    for (size_t i = 0; i < count; i++) {
+        UniqueStr* str = order[i];
+        if (str->length == 0) {
+            str->new_offset = 0;
+        } else if (prev && prev->length >= str->length &&
+                   memcmp(prev->string + prev->length - str->length, str->string, str->length) == 0) {
+            str->new_offset = prev->new_offset + (prev->length - str->length);
+        } else {
+            str->new_offset = size;
+            memcpy(table + size, str->string, str->length + 1);
+            size += str->length + 1;
+        }
+        prev = str;
+    }
+
+    free(order);
+    return size;
+}
+
+// Every reference into the table, in the order the collectors find them
+static int collect_all(ElfContext* ctx, RefList* list) {
+    if (collect_dynamic(ctx, list) != 0 || collect_symbols(ctx, list) != 0 ||
+        collect_verneed(ctx, list) != 0 || collect_verdef(ctx, list) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+bool elf_dynstr_shared(ElfContext* ctx, uint64_t offset, size_t dyn_index) {
+    RefList list = {0};
+    bool shared = true;
+
+    if (collect_all(ctx, &list) == 0) {
+        uint64_t end = offset + strlen(ctx->dynstr + offset);
+        shared = false;
+        for (size_t i = 0; i < list.count && !shared; i++) {
+            const StrRef* ref = &list.refs[i];
+            if (!ref->field && ref->dyn_index == dyn_index) {
+                continue;
+            }
+            // Strings end at a NUL, so two overlap exactly when they share it
+            uint64_t ref_offset = ref->string - ctx->dynstr;
+            shared = ref_offset <= end && ref_offset + strlen(ref->string) == end;
+        }
+    }
+
+    free(list.refs);
+    return shared;
+}
+
+int elf_compact_dynstr(ElfContext* ctx, size_t* saved) {
+    if (!ctx || !ctx->dynstr) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+
+    // Match the .dynstr section header while it still describes the table
+    elf_find_sections(ctx);
+
+    RefList list = {0};
+    UniqueStr* unique = NULL;
+    char* table = NULL;
+    int result = -1;
+
+    if (collect_all(ctx, &list) != 0) {
+        goto out;
+    }
+
+    // Unique strings, sorted so references can find theirs
+    unique = malloc((list.count + 1) * sizeof(UniqueStr));
+    table = malloc(ctx->dynstr_size + 1);
+    if (!unique || !table) {
+        elf_set_error("Memory allocation failed");
+        goto out;
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        unique[i].string = list.refs[i].string;
+        unique[i].length = strlen(list.refs[i].string);
+    }
+    qsort(unique, list.count, sizeof(UniqueStr), compare_strings);
+
+    size_t unique_count = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (unique_count == 0 || strcmp(unique[unique_count - 1].string, unique[i].string) != 0) {
+            unique[unique_count++] = unique[i];
+        }
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        UniqueStr key = { list.refs[i].string, 0, 0 };
+        UniqueStr* found = bsearch(&key, unique, unique_count, sizeof(UniqueStr), compare_strings);
+        list.refs[i].string_index = found - unique;
+    }
+
+    size_t new_size = build_table(unique, unique_count, table);
+    if (new_size == 0 || new_size > ctx->dynstr_size) {
+        elf_set_error("Failed to rebuild the dynamic string table");
+        goto out;
+    }
+
+    // Move back to the original extent if the table fits there, else pack
+    // it where it is
+    uint8_t* base = (uint8_t*)ctx->ehdr32;
+    uint64_t old_offset = (uint8_t*)ctx->dynstr - base;
+    size_t old_size = ctx->dynstr_size;
+    bool go_home = old_offset != ctx->dynstr_home_offset && new_size <= ctx->dynstr_home_size;
+
+    char* target = go_home ? (char*)base + ctx->dynstr_home_offset : ctx->dynstr;
+    uint64_t vaddr = go_home ? ctx->dynstr_home_addr : ctx->dynstr_addr;
+
+    // The rest of the old extent is left alone: tables repaired on load may
+    // overlap the next section
+    memcpy(target, table, new_size);
+    elf_touch(ctx, target, new_size);
+
+    for (size_t i = 0; i < list.count; i++) {
+        const StrRef* ref = &list.refs[i];
+        uint64_t offset = unique[ref->string_index].new_offset;
+        if (ref->field) {
+            ELF_SET_TOUCH(ctx, *ref->field, offset);
+        } else {
+            elf_dyn_set_val(ctx, ref->dyn_index, offset);
+        }
+    }
+
+    elf_update_dynstr(ctx, target, vaddr, new_size);
+
+    // Give back appended space the table no longer uses, including a table
+    // appended by an earlier run
+    if (elf_tail_adopt(ctx) && old_offset >= ctx->tail_offset &&
+        old_offset + old_size == ctx->file_size) {
+        elf_tail_truncate(ctx, go_home ? old_offset : old_offset + new_size);
+    }
+
+    if (saved) {
+        *saved = old_size - new_size;
+    }
+    result = 0;
+
+out:
+    free(list.refs);
+    free(unique);
+    free(table);
+    return result;
+}
@@ -0,0 +1,598 @@
+/**
+ * elfdynsym.c - Dynamic symbol renaming and hash table regeneration
+ *
+ * New names are appended to .dynstr through the same growth path as
+ * elf_replace_needed_lib(). DT_HASH is rebuilt in place; DT_GNU_HASH is
+ * rebuilt with the requested geometry, which reorders the hashed symbols
+ * by bucket and remaps .gnu.version and the relocations to match.
+ */
+
+#include "elfmod.h"
+#include "elfmod_priv.h"
+#include <string.h>
+
+// Android packed relocations; their symbol indices cannot be rewritten here
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL 0x6000000f
+#endif
+#ifndef DT_ANDROID_RELA
+#define DT_ANDROID_RELA 0x60000011
+#endif
+
+#define DEFAULT_BLOOM_SHIFT 26
+#define DEFAULT_BLOOM_BITS_PER_SYMBOL 12
+
+static uint32_t gnu_hash(const char* name) {
+    uint32_t h = 5381;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h;
+}
+
+static uint32_t sysv_hash(const char* name) {
+    uint32_t h = 0;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        h = (h << 4) + *p;
+        uint32_t g = h & 0xf0000000;
+        if (g) {
+            h ^= g >> 24;
+        }
+        h &= ~g;
+    }
+    return h;
+}
+
+// The symbol table as currently mapped; re-fetched after anything that may
+// move the image
+typedef struct {
+    uint8_t* syms;
+    size_t count;
+    size_t sym_size;
+} SymTable;
+
+static int get_symtab(ElfContext* ctx, SymTable* table) {
+    uint64_t addr;
+    if (elf_dyn_find(ctx, DT_SYMTAB, &addr) != 0) {
+        elf_set_error("No dynamic symbol table");
+        return -1;
+    }
+    if (elf_dynsym_count(ctx, &table->count) != 0) {
+        return -1;
+    }
+    table->sym_size = ctx->is_64bit ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    table->syms = elf_vaddr_ptr(ctx, addr, (uint64_t)table->count * table->sym_size);
+    if (!table->syms) {
+        elf_set_error("Dynamic symbol table not mapped from the file");
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t* sym_name(const SymTable* table, size_t i) {
+    return (uint32_t*)(table->syms + i * table->sym_size);
+}
+
+static uint16_t sym_shndx(ElfContext* ctx, const SymTable* table, size_t i) {
+    uint8_t* sym = table->syms + i * table->sym_size;
+    return ctx->is_64bit ? ELF_GET(ctx, ((Elf64_Sym*)sym)->st_shndx)
+                         : ELF_GET(ctx, ((Elf32_Sym*)sym)->st_shndx);
+}
+
+static uint8_t sym_type(ElfContext* ctx, const SymTable* table, size_t i) {
+    uint8_t* sym = table->syms + i * table->sym_size;
+    return ELF32_ST_TYPE(ctx->is_64bit ? ((Elf64_Sym*)sym)->st_info : ((Elf32_Sym*)sym)->st_info);
+}
+
+static const char* sym_string(ElfContext* ctx, const SymTable* table, size_t i) {
+    uint32_t name = ELF_GET(ctx, *sym_name(table, i));
+    return name < ctx->dynstr_size ? ctx->dynstr + name : "";
+}
+
+// Point every dynamic entry carrying 'tag' at 'value'
+static void set_dyn(ElfContext* ctx, int64_t tag, uint64_t value) {
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t cur = elf_dyn_tag(ctx, i);
+        if (cur == tag) {
+            elf_dyn_set_val(ctx, i, value);
+        } else if (cur == DT_NULL) {
+            break;
+        }
+    }
+}
+
+// Keep a section header describing the table at 'old_addr' in sync
+static void move_section(ElfContext* ctx, uint32_t type, uint64_t old_addr,
+                         uint64_t offset, uint64_t addr, uint64_t size) {
+    for (size_t i = 1; i < ctx->section_count; i++) {
+        if (ELF_SHDR(ctx, i, sh_type) == type && ELF_SHDR(ctx, i, sh_addr) == old_addr) {
+            ELF_SHDR_SET(ctx, i, sh_offset, offset);
+            ELF_SHDR_SET(ctx, i, sh_addr, addr);
+            ELF_SHDR_SET(ctx, i, sh_size, size);
+            return;
+        }
+    }
+}
+
+/**
+ * Append the new names to .dynstr and point the symbols at them
+ *
+ * @param names per-symbol new name, NULL to keep the current one
+ */
+static int apply_names(ElfContext* ctx, char** names, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (names[i]) {
+            total += strlen(names[i]) + 1;
+        }
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t offset = ctx->dynstr_size;
+    if (elf_expand_dynstr(ctx, total) != 0) {
+        elf_set_error("Failed to expand dynamic string table: %s", elf_get_error());
+        return -1;
+    }
+
+    SymTable table;
+    if (get_symtab(ctx, &table) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!names[i]) {
+            continue;
+        }
+        size_t length = strlen(names[i]);
+        memcpy(ctx->dynstr + offset, names[i], length + 1);
+        ELF_SET_TOUCH(ctx, *sym_name(&table, i), offset);
+        offset += length + 1;
+    }
+    return 0;
+}
+
+static int rebuild_sysv_hash(ElfContext* ctx, const SymTable* table) {
+    uint64_t addr;
+    if (elf_dyn_find(ctx, DT_HASH, &addr) != 0) {
+        return 0;
+    }
+
+    uint32_t* header = elf_vaddr_ptr(ctx, addr, 2 * sizeof(uint32_t));
+    if (!header) {
+        elf_set_error("DT_HASH not mapped from the file");
+        return -1;
+    }
+    uint32_t nbucket = ELF_GET(ctx, header[0]);
+    uint32_t nchain = ELF_GET(ctx, header[1]);
+    if (nbucket == 0 || nchain != table->count) {
+        elf_set_error("DT_HASH does not match the dynamic symbol table");
+        return -1;
+    }
+
+    // Same geometry, so the table is rebuilt where it is
+    uint64_t words = 2 + (uint64_t)nbucket + nchain;
+    uint32_t* hash = elf_vaddr_ptr(ctx, addr, words * sizeof(uint32_t));
+    if (!hash) {
+        elf_set_error("DT_HASH not mapped from the file");
+        return -1;
+    }
+    uint32_t* buckets = hash + 2;
+    uint32_t* chains = buckets + nbucket;
+
+    memset(buckets, 0, ((uint64_t)nbucket + nchain) * sizeof(uint32_t));
+    for (size_t i = table->count; i-- > 1;) {
+        uint32_t b = sysv_hash(sym_string(ctx, table, i)) % nbucket;
+        ELF_SET(ctx, chains[i], ELF_GET(ctx, buckets[b]));
+        ELF_SET(ctx, buckets[b], i);
+    }
+    elf_touch(ctx, buckets, ((uint64_t)nbucket + nchain) * sizeof(uint32_t));
+    return 0;
+}
+
+// Address, size and entry size of one relocation table, false if absent
+static bool reloc_table(ElfContext* ctx, int64_t addr_tag, int64_t size_tag, int64_t ent_tag, bool rela,
+                        uint64_t* addr, uint64_t* size, uint64_t* entsize) {
+    if (elf_dyn_find(ctx, addr_tag, addr) != 0 || elf_dyn_find(ctx, size_tag, size) != 0) {
+        return false;
+    }
+    if (ent_tag == DT_NULL || elf_dyn_find(ctx, ent_tag, entsize) != 0) {
+        *entsize = ctx->is_64bit ? (rela ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel))
+                                 : (rela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel));
+    }
+    return true;
+}
+
+// Rewrite the symbol index of every relocation in [addr, addr + size)
+static void remap_relocs(ElfContext* ctx, uint64_t addr, uint64_t size, uint64_t entsize,
+                         const uint32_t* new_index, size_t symoffset, size_t count) {
+    uint8_t* relocs = elf_vaddr_ptr(ctx, addr, size);
+    if (!relocs || entsize == 0) {
+        return;
+    }
+
+    // r_info follows r_offset in both REL and RELA
+    bool changed = false;
+    for (uint64_t pos = 0; pos + entsize <= size; pos += entsize) {
+        if (ctx->is_64bit) {
+            Elf64_Rel* rel = (Elf64_Rel*)(relocs + pos);
+            uint64_t info = ELF_GET(ctx, rel->r_info);
+            uint64_t sym = ELF64_R_SYM(info);
+            if (sym >= symoffset && sym < count && new_index[sym] != sym) {
+                ELF_SET(ctx, rel->r_info, ELF64_R_INFO((uint64_t)new_index[sym], ELF64_R_TYPE(info)));
+                changed = true;
+            }
+        } else {
+            Elf32_Rel* rel = (Elf32_Rel*)(relocs + pos);
+            uint32_t info = ELF_GET(ctx, rel->r_info);
+            uint32_t sym = ELF32_R_SYM(info);
+            if (sym >= symoffset && sym < count && new_index[sym] != sym) {
+                ELF_SET(ctx, rel->r_info, ELF32_R_INFO(new_index[sym], ELF32_R_TYPE(info)));
+                changed = true;
+            }
+        }
+    }
+    if (changed) {
+        elf_touch(ctx, relocs, size);
+    }
+}
+
+// Move the hashed symbols into bucket order, along with their versions and
+// every relocation that names them
+static int reorder_symbols(ElfContext* ctx, const SymTable* table, size_t symoffset,
+                           const uint32_t* order) {
+    size_t hashed = table->count - symoffset;
+    uint32_t* new_index = malloc(table->count * sizeof(uint32_t) + 1);
+    uint8_t* scratch = malloc(hashed * table->sym_size + 1);
+    if (!new_index || !scratch) {
+        free(new_index);
+        free(scratch);
+        elf_set_error("Memory allocation failed");
+        return -1;
+    }
+
+    for (size_t i = 0; i < table->count; i++) {
+        new_index[i] = i;
+    }
+    for (size_t k = 0; k < hashed; k++) {
+        new_index[order[k]] = symoffset + k;
+    }
+
+    uint8_t* hashed_syms = table->syms + symoffset * table->sym_size;
+    memcpy(scratch, hashed_syms, hashed * table->sym_size);
+    for (size_t k = 0; k < hashed; k++) {
+        memcpy(hashed_syms + k * table->sym_size,
+               scratch + (order[k] - symoffset) * table->sym_size, table->sym_size);
+    }
+    elf_touch(ctx, hashed_syms, hashed * table->sym_size);
+
+    uint64_t versym_addr;
+    if (elf_dyn_find(ctx, DT_VERSYM, &versym_addr) == 0) {
+        uint16_t* versym = elf_vaddr_ptr(ctx, versym_addr, table->count * sizeof(uint16_t));
+        if (versym) {
+            memcpy(scratch, versym + symoffset, hashed * sizeof(uint16_t));
+            for (size_t k = 0; k < hashed; k++) {
+                versym[symoffset + k] = ((uint16_t*)scratch)[order[k] - symoffset];
+            }
+            elf_touch(ctx, versym + symoffset, hashed * sizeof(uint16_t));
+        }
+    }
+
+    uint64_t pltrel = DT_REL;
+    elf_dyn_find(ctx, DT_PLTREL, &pltrel);
+    bool plt_rela = pltrel == DT_RELA;
+
+    // Older binutils (ARM, i386) count .rel.plt in DT_RELSZ as well, which
+    // ld.so allows; the part of DT_JMPREL inside that table is remapped once
+    uint64_t addr, size, entsize, shared_start = 0, shared_end = 0;
+    if (reloc_table(ctx, DT_REL, DT_RELSZ, DT_RELENT, false, &addr, &size, &entsize)) {
+        remap_relocs(ctx, addr, size, entsize, new_index, symoffset, table->count);
+        if (!plt_rela) {
+            shared_start = addr;
+            shared_end = addr + size;
+        }
+    }
+    if (reloc_table(ctx, DT_RELA, DT_RELASZ, DT_RELAENT, true, &addr, &size, &entsize)) {
+        remap_relocs(ctx, addr, size, entsize, new_index, symoffset, table->count);
+        if (plt_rela) {
+            shared_start = addr;
+            shared_end = addr + size;
+        }
+    }
+    if (reloc_table(ctx, DT_JMPREL, DT_PLTRELSZ, DT_NULL, plt_rela, &addr, &size, &entsize)) {
+        uint64_t end = addr + size;
+        if (end <= shared_start || addr >= shared_end) {
+            remap_relocs(ctx, addr, size, entsize, new_index, symoffset, table->count);
+        } else {
+            if (addr < shared_start) {
+                remap_relocs(ctx, addr, shared_start - addr, entsize, new_index, symoffset, table->count);
+            }
+            if (end > shared_end) {
+                remap_relocs(ctx, shared_end, end - shared_end, entsize, new_index, symoffset, table->count);
+            }
+        }
+    }
+
+    free(new_index);
+    free(scratch);
+    return 0;
+}
+
+static int rebuild_gnu_hash(ElfContext* ctx, const ElfHashOptions* options) {
+    uint64_t addr;
+    if (elf_dyn_find(ctx, DT_GNU_HASH, &addr) != 0) {
+        return 0;
+    }
+
+    SymTable table;
+    if (get_symtab(ctx, &table) != 0) {
+        return -1;
+    }
+
+    uint32_t* header = elf_vaddr_ptr(ctx, addr, 4 * sizeof(uint32_t));
+    if (!header) {
+        elf_set_error("DT_GNU_HASH not mapped from the file");
+        return -1;
+    }
+
+    size_t word_size = ctx->is_64bit ? 8 : 4;
+    size_t word_bits = word_size * 8;
+    uint32_t old_buckets = ELF_GET(ctx, header[0]);
+    uint32_t symoffset = ELF_GET(ctx, header[1]);
+    uint32_t old_bloom = ELF_GET(ctx, header[2]);
+    if (symoffset > table.count) {
+        elf_set_error("DT_GNU_HASH symbol offset past the symbol table");
+        return -1;
+    }
+    size_t hashed = table.count - symoffset;
+    uint64_t old_size = 16 + (uint64_t)old_bloom * word_size + ((uint64_t)old_buckets + hashed) * 4;
+
+    // Geometry: requested, or sized for short chains and few bloom false
+    // positives rather than for the smallest table
+    size_t nbuckets = options && options->bucket_count ? options->bucket_count : (hashed + 1) / 2;
+    size_t bloom_words = options && options->bloom_words ? options->bloom_words : 1;
+    uint32_t shift = options && options->bloom_shift ? options->bloom_shift : DEFAULT_BLOOM_SHIFT;
+    if (nbuckets == 0) {
+        nbuckets = 1;
+    }
+    if (!options || !options->bloom_words) {
+        while (bloom_words * word_bits < hashed * DEFAULT_BLOOM_BITS_PER_SYMBOL) {
+            bloom_words *= 2;
+        }
+    }
+    if ((bloom_words & (bloom_words - 1)) != 0 || shift >= word_bits || nbuckets > UINT32_MAX) {
+        elf_set_error("Bloom filter size must be a power of two and the shift below %zu", word_bits);
+        return -1;
+    }
+
+    uint32_t* hashes = malloc(hashed * sizeof(uint32_t) + 1);
+    uint32_t* order = malloc(hashed * sizeof(uint32_t) + 1);
+    uint32_t* fill = calloc(nbuckets + 1, sizeof(uint32_t));
+    uint64_t new_size = 16 + (uint64_t)bloom_words * word_size + ((uint64_t)nbuckets + hashed) * 4;
+    uint8_t* built = calloc(new_size, 1);
+    int result = -1;
+    if (!hashes || !order || !fill || !built) {
+        elf_set_error("Memory allocation failed");
+        goto out;
+    }
+
+    // Stable counting sort of the hashed symbols by bucket
+    for (size_t k = 0; k < hashed; k++) {
+        hashes[k] = gnu_hash(sym_string(ctx, &table, symoffset + k));
+        fill[hashes[k] % nbuckets + 1]++;
+    }
+    for (size_t b = 0; b < nbuckets; b++) {
+        fill[b + 1] += fill[b];
+    }
+    bool identity = true;
+    for (size_t k = 0; k < hashed; k++) {
+        uint32_t slot = fill[hashes[k] % nbuckets]++;
+        order[slot] = symoffset + k;
+        identity = identity && slot == k;
+    }
+
+    if (!identity) {
+        uint64_t unused;
+        if (elf_dyn_find(ctx, DT_ANDROID_REL, &unused) == 0 ||
+            elf_dyn_find(ctx, DT_ANDROID_RELA, &unused) == 0) {
+            elf_set_error("Cannot reorder symbols referenced by packed relocations");
+            goto out;
+        }
+        // The MIPS GOT holds an entry per symbol from DT_MIPS_GOTSYM on, by index
+        if (elf_dyn_find(ctx, DT_MIPS_GOTSYM, &unused) == 0) {
+            elf_set_error("Cannot reorder symbols mapped by the MIPS GOT");
+            goto out;
+        }
+        if (reorder_symbols(ctx, &table, symoffset, order) != 0) {
+            goto out;
+        }
+        for (size_t k = 0; k < hashed; k++) {
+            order[k] = hashes[order[k] - symoffset];
+        }
+        memcpy(hashes, order, hashed * sizeof(uint32_t));
+    }
+
+    // Header, bloom filter, buckets and chains, in file byte order
+    uint32_t* out_header = (uint32_t*)built;
+    ELF_SET(ctx, out_header[0], nbuckets);
+    ELF_SET(ctx, out_header[1], symoffset);
+    ELF_SET(ctx, out_header[2], bloom_words);
+    ELF_SET(ctx, out_header[3], shift);
+
+    uint8_t* bloom = built + 16;
+    uint32_t* buckets = (uint32_t*)(bloom + bloom_words * word_size);
+    uint32_t* chains = buckets + nbuckets;
+
+    for (size_t k = 0; k < hashed; k++) {
+        uint32_t h = hashes[k];
+        size_t word = (h / word_bits) & (bloom_words - 1);
+        uint64_t bits = (1ULL << (h % word_bits)) | (1ULL << ((h >> shift) % word_bits));
+        if (ctx->is_64bit) {
+            uint64_t* w = (uint64_t*)bloom + word;
+            ELF_SET(ctx, *w, ELF_GET(ctx, *w) | bits);
+        } else {
+            uint32_t* w = (uint32_t*)bloom + word;
+            ELF_SET(ctx, *w, ELF_GET(ctx, *w) | (uint32_t)bits);
+        }
+
+        uint32_t b = h % nbuckets;
+        if (ELF_GET(ctx, buckets[b]) == 0) {
+            ELF_SET(ctx, buckets[b], symoffset + k);
+        }
+        // The last symbol of a bucket has the low bit set
+        bool last = k + 1 == hashed || hashes[k + 1] % nbuckets != b;
+        ELF_SET(ctx, chains[k], last ? (h | 1) : (h & ~1u));
+    }
+
+    // Rebuild in place when it fits, else in the appended data
+    if (new_size <= old_size) {
+        uint8_t* target = elf_vaddr_ptr(ctx, addr, old_size);
+        if (!target) {
+            elf_set_error("DT_GNU_HASH not mapped from the file");
+            goto out;
+        }
+        memcpy(target, built, new_size);
+        memset(target + new_size, 0, old_size - new_size);
+        elf_touch(ctx, target, old_size);
+        move_section(ctx, SHT_GNU_HASH, addr, target - (uint8_t*)ctx->ehdr32, addr, new_size);
+    } else {
+        uint64_t offset, vaddr;
+        if (elf_tail_alloc(ctx, new_size, word_size, &offset, &vaddr) != 0) {
+            goto out;
+        }
+        memcpy((uint8_t*)ctx->ehdr32 + offset, built, new_size);
+        set_dyn(ctx, DT_GNU_HASH, vaddr);
+        move_section(ctx, SHT_GNU_HASH, addr, offset, vaddr, new_size);
+    }
+
+    result = 0;
+
+out:
+    free(hashes);
+    free(order);
+    free(fill);
+    free(built);
+    return result;
+}
+
+/**
+ * Rename the symbols given in 'names' (indexed by symbol, NULL = unchanged)
+ * and regenerate both hash tables
+ */
+static int rename_and_rehash(ElfContext* ctx, char** names, size_t count,
+                             const ElfHashOptions* options) {
+    // Match section headers before any table moves
+    elf_find_sections(ctx);
+
+    if (apply_names(ctx, names, count) != 0 || rebuild_gnu_hash(ctx, options) != 0) {
+        return -1;
+    }
+
+    // DT_HASH indexes the final symbol order
+    SymTable table;
+    if (get_symtab(ctx, &table) != 0) {
+        return -1;
+    }
+    return rebuild_sysv_hash(ctx, &table);
+}
+
+int elf_rename_symbols(ElfContext* ctx, const char* const* old_names,
+                       const char* const* new_names, size_t count,
+                       const ElfHashOptions* options) {
+    if (!ctx || (count > 0 && (!old_names || !new_names))) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+
+    SymTable table;
+    if (get_symtab(ctx, &table) != 0) {
+        return -1;
+    }
+
+    char** names = calloc(table.count + 1, sizeof(char*));
+    if (!names) {
+        elf_set_error("Memory allocation failed");
+        return -1;
+    }
+
+    int result = -1;
+    for (size_t n = 0; n < count; n++) {
+        bool found = false;
+        for (size_t i = 1; i < table.count; i++) {
+            if (strcmp(sym_string(ctx, &table, i), old_names[n]) == 0) {
+                names[i] = (char*)new_names[n];
+                found = true;
+            }
+        }
+        if (!found) {
+            elf_set_error("Symbol not found in .dynsym: %s", old_names[n]);
+            goto out;
+        }
+    }
+
+    result = rename_and_rehash(ctx, names, table.count, options);
+
+out:
+    free(names);
+    return result;
+}
+
+int elf_prefix_symbols(ElfContext* ctx, const char* prefix, int which,
+                       const ElfHashOptions* options) {
+    if (!ctx || !prefix) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+
+    SymTable table;
+    if (get_symtab(ctx, &table) != 0) {
+        return -1;
+    }
+
+    char** names = calloc(table.count + 1, sizeof(char*));
+    if (!names) {
+        elf_set_error("Memory allocation failed");
+        return -1;
+    }
+
+    int result = -1;
+    size_t prefix_len = strlen(prefix);
+    for (size_t i = 1; i < table.count; i++) {
+        const char* name = sym_string(ctx, &table, i);
+        bool defined = sym_shndx(ctx, &table, i) != SHN_UNDEF;
+        uint8_t type = sym_type(ctx, &table, i);
+
+        // Unnamed and section symbols, and names already carrying the prefix
+        // (so a second run changes nothing), are left alone
+        if (name[0] == '\0' || type == STT_SECTION || strncmp(name, prefix, prefix_len) == 0 ||
+            !(which & (defined ? ELF_SYMS_DEFINED : ELF_SYMS_UNDEFINED))) {
+            continue;
+        }
+
+        names[i] = malloc(prefix_len + strlen(name) + 1);
+        if (!names[i]) {
+            elf_set_error("Memory allocation failed");
+            goto out;
+        }
+        strcpy(names[i], prefix);
+        strcat(names[i], name);
+    }
+
+    result = rename_and_rehash(ctx, names, table.count, options);
+
+out:
+    for (size_t i = 0; i < table.count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return result;
+}
+
+int elf_rehash_symbols(ElfContext* ctx, const ElfHashOptions* options) {
+    if (!ctx) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+    return rename_and_rehash(ctx, NULL, 0, options);
+}
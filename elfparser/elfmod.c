@@ -4,6 +4,7 @@
  */
 
 #include "elfmod.h"
+#include "elfmod_priv.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
@@ -20,26 +21,48 @@ const char* elf_get_error(void) {
     return error_buffer;
 }
 
-static void set_error(const char* format, ...) {
+void elf_set_error(const char* format, ...) {
     va_list args;
     va_start(args, format);
     vsnprintf(error_buffer, sizeof(error_buffer), format, args);
     va_end(args);
 }
 
-int elf_load(const char* filename, ElfContext* ctx) {
-    if (!filename || !ctx) {
-        set_error("Invalid parameters");
-        return -1;
+// Resolve the .dynamic and .dynstr section indices, if section headers
+// exist and describe the same ranges as the dynamic tags. Sections that
+// disagree are left alone; they are metadata the loader never reads.
+void elf_find_sections(ElfContext* ctx) {
+    if (ctx->sections_resolved) {
+        return;
     }
+    ctx->sections_resolved = true;
+    
+    uint8_t* base = (uint8_t*)ctx->ehdr32;
+    uint64_t dyn_offset = (uint8_t*)ctx->dyn32 - base;
+    uint64_t dynstr_offset = (uint8_t*)ctx->dynstr - base;
     
+    for (size_t i = 1; i < ctx->section_count; i++) {
+        uint32_t type = ELF_SHDR(ctx, i, sh_type);
+        uint64_t offset = ELF_SHDR(ctx, i, sh_offset);
+        
+        if (type == SHT_DYNAMIC && offset == dyn_offset) {
+            ctx->dyn_section_idx = i;
+        } else if (type == SHT_STRTAB && offset == dynstr_offset &&
+                   ELF_SHDR(ctx, i, sh_addr) == ctx->dynstr_addr) {
+            ctx->dynstr_idx = i;
+        }
+    }
+}
+
+// Map the file privately; nothing is parsed yet
+static int map_file(const char* filename, ElfContext* ctx) {
     // Initialize context
     memset(ctx, 0, sizeof(ElfContext));
     
     // Open the file
     int fd = open(filename, O_RDONLY);
     if (fd < 0) {
-        set_error("Failed to open file: %s", strerror(errno));
+        elf_set_error("Failed to open file: %s", strerror(errno));
         return -1;
     }
     
@@ -47,7 +70,7 @@ int elf_load(const char* filename, ElfContext* ctx) {
     struct stat st;
     if (fstat(fd, &st) < 0) {
         close(fd);
-        set_error("Failed to get file stats: %s", strerror(errno));
+        elf_set_error("Failed to get file stats: %s", strerror(errno));
         return -1;
     }
     
@@ -59,7 +82,7 @@ int elf_load(const char* filename, ElfContext* ctx) {
                            MAP_PRIVATE, fd, 0);
     if (ctx->mapped_data == MAP_FAILED) {
         close(fd);
-        set_error("Failed to map file: %s", strerror(errno));
+        elf_set_error("Failed to map file: %s", strerror(errno));
         return -1;
     }
     
@@ -70,95 +93,378 @@ int elf_load(const char* filename, ElfContext* ctx) {
     ctx->filename = strdup(filename);
     if (!ctx->filename) {
         munmap(ctx->mapped_data, ctx->file_size);
-        set_error("Memory allocation failed");
+        elf_set_error("Memory allocation failed");
         return -1;
     }
     
+    return 0;
+}
+
+// Sort the PT_LOAD segments into ctx->segments for binary-search lookups
+static int build_segments(ElfContext* ctx) {
+    segmap_free(&ctx->segments);
+    ctx->segments_valid = false;
+    
+    ElfSegment* loads = malloc((ctx->program_header_count + 1) * sizeof(ElfSegment));
+    if (!loads) {
+        elf_set_error("Memory allocation failed");
+        return -1;
+    }
+    
+    int count = 0;
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) != PT_LOAD) {
+            continue;
+        }
+        
+        ElfSegment segment = {
+            ELF_PHDR(ctx, i, p_vaddr),
+            ELF_PHDR(ctx, i, p_offset),
+            ELF_PHDR(ctx, i, p_filesz),
+            ELF_PHDR(ctx, i, p_memsz),
+            ELF_PHDR(ctx, i, p_align)
+        };
+        loads[count++] = segment;
+    }
+    
+    int ok = segmap_init(&ctx->segments, loads, count);
+    free(loads);
+    if (!ok) {
+        segmap_free(&ctx->segments);
+        elf_set_error("Overlapping PT_LOAD segments");
+        return -1;
+    }
+    
+    ctx->segments_valid = true;
+    return 0;
+}
+
+// Locate the headers, the dynamic table and the dynamic string table
+static int parse_file(ElfContext* ctx) {
     // Check ELF magic number
     ctx->e_ident = (unsigned char*)ctx->mapped_data;
     if (ctx->e_ident[EI_MAG0] != ELFMAG0 || ctx->e_ident[EI_MAG1] != ELFMAG1 ||
         ctx->e_ident[EI_MAG2] != ELFMAG2 || ctx->e_ident[EI_MAG3] != ELFMAG3) {
         elf_close(ctx);
-        set_error("Not a valid ELF file");
+        elf_set_error("Not a valid ELF file");
         return -1;
     }
     
     // Determine if it's 32 or 64 bit
+    if (ctx->e_ident[EI_CLASS] != ELFCLASS32 && ctx->e_ident[EI_CLASS] != ELFCLASS64) {
+        elf_close(ctx);
+        elf_set_error("Unsupported ELF class: %d", ctx->e_ident[EI_CLASS]);
+        return -1;
+    }
     ctx->is_64bit = (ctx->e_ident[EI_CLASS] == ELFCLASS64);
     
+    // Byte order: foreign-endian files go through the swapping accessors
+    if (ctx->e_ident[EI_DATA] != ELFDATA2LSB && ctx->e_ident[EI_DATA] != ELFDATA2MSB) {
+        elf_close(ctx);
+        elf_set_error("Unsupported ELF data encoding: %d", ctx->e_ident[EI_DATA]);
+        return -1;
+    }
+    ctx->needs_swap = elf_is_foreign(ctx->e_ident);
+    
     // Set up header pointers
-    if (ctx->is_64bit) {
-        ctx->ehdr64 = (Elf64_Ehdr*)ctx->mapped_data;
-        ctx->phdr64 = (Elf64_Phdr*)((uint8_t*)ctx->mapped_data + ctx->ehdr64->e_phoff);
-        ctx->shdr64 = (Elf64_Shdr*)((uint8_t*)ctx->mapped_data + ctx->ehdr64->e_shoff);
-        ctx->section_count = ctx->ehdr64->e_shnum;
-        ctx->program_header_count = ctx->ehdr64->e_phnum;
+    uint8_t* base = (uint8_t*)ctx->mapped_data;
+    size_t ehdr_size = ctx->is_64bit ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    size_t phdr_size = ctx->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t shdr_size = ctx->is_64bit ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    size_t dyn_size = ctx->is_64bit ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    
+    if (ctx->file_size < ehdr_size) {
+        elf_close(ctx);
+        elf_set_error("File too small for an ELF header");
+        return -1;
+    }
+    
+    ctx->ehdr32 = (Elf32_Ehdr*)base;
+    ctx->program_header_count = ELF_EHDR(ctx, e_phnum);
+    
+    uint64_t phoff = ELF_EHDR(ctx, e_phoff);
+    if (ctx->program_header_count == 0 || ELF_EHDR(ctx, e_phentsize) != phdr_size ||
+        phoff + ctx->program_header_count * phdr_size > ctx->file_size) {
+        elf_close(ctx);
+        elf_set_error("Missing or truncated program header table");
+        return -1;
+    }
+    ctx->phdr32 = (Elf32_Phdr*)(base + phoff);
+    
+    // Section headers are optional: only remember where they are. They are
+    // consulted lazily, and only when they exist and agree with the
+    // program headers (see elf_find_sections)
+    uint64_t shoff = ELF_EHDR(ctx, e_shoff);
+    size_t shnum = ELF_EHDR(ctx, e_shnum);
+    if (shoff != 0 && shnum != 0 && ELF_EHDR(ctx, e_shentsize) == shdr_size &&
+        shoff + shnum * shdr_size <= ctx->file_size) {
+        ctx->shdr32 = (Elf32_Shdr*)(base + shoff);
+        ctx->section_count = shnum;
+    }
+    
+    if (build_segments(ctx) != 0) {
+        elf_close(ctx);
+        return -1;
+    }
+    
+    // Find the dynamic table through PT_DYNAMIC
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) != PT_DYNAMIC) {
+            continue;
+        }
         
-        // Get section header string table
-        if (ctx->ehdr64->e_shstrndx != SHN_UNDEF) {
-            Elf64_Shdr* shstrtab_hdr = &ctx->shdr64[ctx->ehdr64->e_shstrndx];
-            ctx->shstrtab = (char*)((uint8_t*)ctx->mapped_data + shstrtab_hdr->sh_offset);
+        uint64_t offset = ELF_PHDR(ctx, i, p_offset);
+        uint64_t size = ELF_PHDR(ctx, i, p_filesz);
+        if (offset + size > ctx->file_size) {
+            elf_close(ctx);
+            elf_set_error("PT_DYNAMIC extends past end of file");
+            return -1;
         }
-    } else {
-        ctx->ehdr32 = (Elf32_Ehdr*)ctx->mapped_data;
-        ctx->phdr32 = (Elf32_Phdr*)((uint8_t*)ctx->mapped_data + ctx->ehdr32->e_phoff);
-        ctx->shdr32 = (Elf32_Shdr*)((uint8_t*)ctx->mapped_data + ctx->ehdr32->e_shoff);
-        ctx->section_count = ctx->ehdr32->e_shnum;
-        ctx->program_header_count = ctx->ehdr32->e_phnum;
         
-        // Get section header string table
-        if (ctx->ehdr32->e_shstrndx != SHN_UNDEF) {
-            Elf32_Shdr* shstrtab_hdr = &ctx->shdr32[ctx->ehdr32->e_shstrndx];
-            ctx->shstrtab = (char*)((uint8_t*)ctx->mapped_data + shstrtab_hdr->sh_offset);
+        ctx->dyn32 = (Elf32_Dyn*)(base + offset);
+        ctx->dyn_count = size / dyn_size;
+        break;
+    }
+    
+    if (!ctx->dyn32 || ctx->dyn_count == 0) {
+        elf_close(ctx);
+        elf_set_error("Could not find PT_DYNAMIC");
+        return -1;
+    }
+    
+    // Find the dynamic string table through DT_STRTAB/DT_STRSZ
+    bool have_strtab = false;
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        if (tag == DT_STRTAB) {
+            ctx->dynstr_addr = elf_dyn_val(ctx, i);
+            have_strtab = true;
+        } else if (tag == DT_STRSZ) {
+            ctx->dynstr_size = elf_dyn_val(ctx, i);
+        } else if (tag == DT_NULL) {
+            break;
         }
     }
     
-    // Find dynamic section and dynamic string table
-    for (size_t i = 0; i < ctx->section_count; i++) {
-        const char* name;
-        uint32_t type;
-        uint64_t offset, size;
-        
-        if (ctx->is_64bit) {
-            name = ctx->shstrtab + ctx->shdr64[i].sh_name;
-            type = ctx->shdr64[i].sh_type;
-            offset = ctx->shdr64[i].sh_offset;
-            size = ctx->shdr64[i].sh_size;
-        } else {
-            name = ctx->shstrtab + ctx->shdr32[i].sh_name;
-            type = ctx->shdr32[i].sh_type;
-            offset = ctx->shdr32[i].sh_offset;
-            size = ctx->shdr32[i].sh_size;
+    uint64_t dynstr_offset;
+    if (!have_strtab || ctx->dynstr_size == 0 ||
+        elf_vaddr_to_offset(ctx, ctx->dynstr_addr, &dynstr_offset) != 0 ||
+        dynstr_offset + ctx->dynstr_size > ctx->file_size) {
+        elf_close(ctx);
+        elf_set_error("Could not locate dynamic string table from DT_STRTAB/DT_STRSZ");
+        return -1;
+    }
+    ctx->dynstr = (char*)(base + dynstr_offset);
+    
+    // Files written by earlier elfmod versions only grew the .dynstr section
+    // header, leaving DT_NEEDED names past DT_STRSZ. Only then is the section
+    // table consulted, and only a matching, larger .dynstr section is trusted.
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        if (tag == DT_NULL) {
+            break;
+        }
+        if (tag != DT_NEEDED || elf_dyn_val(ctx, i) < ctx->dynstr_size) {
+            continue;
         }
         
-        // Find dynamic section
-        if (type == SHT_DYNAMIC) {
-            if (ctx->is_64bit) {
-                ctx->dyn64 = (Elf64_Dyn*)((uint8_t*)ctx->mapped_data + offset);
-                ctx->dyn_count = size / sizeof(Elf64_Dyn);
-                ctx->dyn_section_idx = i;
-            } else {
-                ctx->dyn32 = (Elf32_Dyn*)((uint8_t*)ctx->mapped_data + offset);
-                ctx->dyn_count = size / sizeof(Elf32_Dyn);
-                ctx->dyn_section_idx = i;
+        elf_find_sections(ctx);
+        if (ctx->dynstr_idx != 0) {
+            uint64_t size = ELF_SHDR(ctx, ctx->dynstr_idx, sh_size);
+            if (size > ctx->dynstr_size && dynstr_offset + size <= ctx->file_size) {
+                ctx->dynstr_size = size;
             }
         }
-        
-        // Find dynamic string table
-        if (type == SHT_STRTAB && strcmp(name, ".dynstr") == 0) {
-            ctx->dynstr = (char*)((uint8_t*)ctx->mapped_data + offset);
-            ctx->dynstr_size = size;
-            ctx->dynstr_idx = i;
+        break;
+    }
+    
+    ctx->dynstr_home_offset = dynstr_offset;
+    ctx->dynstr_home_addr = ctx->dynstr_addr;
+    ctx->dynstr_home_size = ctx->dynstr_size;
+    
+    return 0;
+}
+
+int elf_load(const char* filename, ElfContext* ctx) {
+    if (!filename || !ctx) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+    
+    ELF_PROBE_ENTRY(load, filename);
+    int result = map_file(filename, ctx);
+    uint64_t size = result == 0 ? ctx->file_size : 0;
+    ELF_PROBE_RETURN(load, filename, size, 0, result);
+    if (result != 0) {
+        return result;
+    }
+    
+    // A failed parse closes ctx
+    ELF_PROBE_ENTRY(parse, filename);
+    result = parse_file(ctx);
+    ELF_PROBE_RETURN(parse, filename, size, 0, result);
+    return result;
+}
+
+void elf_touch(ElfContext* ctx, const void* ptr, size_t size) {
+    uint64_t start = (const uint8_t*)ptr - (const uint8_t*)ctx->ehdr32;
+    uint64_t end = start + size;
+    
+    // A program header changed: the segment map is rebuilt on next use
+    size_t phdr_size = ctx->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    uint64_t phoff = (const uint8_t*)ctx->phdr32 - (const uint8_t*)ctx->ehdr32;
+    if (start < phoff + ctx->program_header_count * phdr_size && phoff < end) {
+        ctx->segments_valid = false;
+    }
+    
+    // Merge with every range this one overlaps or abuts
+    size_t i = 0;
+    while (i < ctx->touched_count) {
+        ElfRange* range = &ctx->touched[i];
+        if (start <= range->offset + range->size && range->offset <= end) {
+            if (range->offset < start) start = range->offset;
+            if (range->offset + range->size > end) end = range->offset + range->size;
+            ctx->touched[i] = ctx->touched[--ctx->touched_count];
+            continue;
         }
+        i++;
     }
     
-    if (!ctx->dynstr || (!ctx->dyn32 && !ctx->dyn64) || ctx->dyn_count == 0) {
-        elf_close(ctx);
-        set_error("Could not find dynamic section or dynamic string table");
+    if (ctx->touched_count == ctx->touched_capacity) {
+        size_t capacity = ctx->touched_capacity ? ctx->touched_capacity * 2 : 16;
+        ElfRange* touched = realloc(ctx->touched, capacity * sizeof(ElfRange));
+        if (!touched) {
+            if (ctx->touched_count == 0) {
+                return;
+            }
+            // Fall back to widening an existing range: a superset still verifies
+            ElfRange* range = &ctx->touched[0];
+            if (start < range->offset) range->offset = start;
+            if (end > range->offset + range->size) range->size = end - range->offset;
+            return;
+        }
+        ctx->touched = touched;
+        ctx->touched_capacity = capacity;
+    }
+    
+    ctx->touched[ctx->touched_count].offset = start;
+    ctx->touched[ctx->touched_count].size = end - start;
+    ctx->touched[ctx->touched_count].crc = 0;
+    ctx->touched_count++;
+}
+
+int elf_vaddr_to_offset(ElfContext* ctx, uint64_t vaddr, uint64_t* offset) {
+    if (!ctx->segments_valid && build_segments(ctx) != 0) {
         return -1;
     }
     
-    return 0;
+    return segmap_vaddr_to_offset(&ctx->segments, vaddr, 1, offset) ? 0 : -1;
+}
+
+void* elf_vaddr_ptr(ElfContext* ctx, uint64_t vaddr, uint64_t size) {
+    if (!ctx->segments_valid && build_segments(ctx) != 0) {
+        return NULL;
+    }
+    
+    uint64_t offset;
+    if (!segmap_vaddr_to_offset(&ctx->segments, vaddr, size, &offset) || offset + size > ctx->file_size) {
+        return NULL;
+    }
+    return (uint8_t*)ctx->ehdr32 + offset;
+}
+
+int elf_dyn_find(const ElfContext* ctx, int64_t tag, uint64_t* value) {
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t cur = elf_dyn_tag(ctx, i);
+        if (cur == tag) {
+            *value = elf_dyn_val(ctx, i);
+            return 0;
+        }
+        if (cur == DT_NULL) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// A symbol count is only believed if that many symbols (at least the
+// null symbol) are mapped
+static bool dynsym_fits(ElfContext* ctx, uint64_t count) {
+    uint64_t symtab;
+    size_t sym_size = ctx->is_64bit ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    return count > 0 && elf_dyn_find(ctx, DT_SYMTAB, &symtab) == 0 &&
+           elf_vaddr_ptr(ctx, symtab, count * sym_size) != NULL;
+}
+
+int elf_dynsym_count(ElfContext* ctx, size_t* count) {
+    uint64_t addr;
+    
+    // DT_HASH: nchain equals the number of symbols
+    if (elf_dyn_find(ctx, DT_HASH, &addr) == 0) {
+        uint32_t* hash = elf_vaddr_ptr(ctx, addr, 2 * sizeof(uint32_t));
+        if (hash && dynsym_fits(ctx, ELF_GET(ctx, hash[1]))) {
+            *count = ELF_GET(ctx, hash[1]);
+            return 0;
+        }
+    }
+    
+    // DT_GNU_HASH: walk the chain of the highest bucket to its end marker
+    if (elf_dyn_find(ctx, DT_GNU_HASH, &addr) == 0) {
+        uint32_t* header = elf_vaddr_ptr(ctx, addr, 4 * sizeof(uint32_t));
+        if (header) {
+            uint32_t nbuckets = ELF_GET(ctx, header[0]);
+            uint32_t symoffset = ELF_GET(ctx, header[1]);
+            uint64_t bloom_bytes = (uint64_t)ELF_GET(ctx, header[2]) * (ctx->is_64bit ? 8 : 4);
+            uint64_t buckets_addr = addr + 16 + bloom_bytes;
+            uint32_t* buckets = elf_vaddr_ptr(ctx, buckets_addr, (uint64_t)nbuckets * 4);
+            
+            if (buckets) {
+                uint32_t last = 0;
+                for (uint32_t b = 0; b < nbuckets; b++) {
+                    uint32_t v = ELF_GET(ctx, buckets[b]);
+                    if (v > last) last = v;
+                }
+                
+                if (last < symoffset) {
+                    // Only unhashed symbols
+                    if (dynsym_fits(ctx, symoffset)) {
+                        *count = symoffset;
+                        return 0;
+                    }
+                } else {
+                    uint64_t chains_addr = buckets_addr + (uint64_t)nbuckets * 4;
+                    for (;;) {
+                        uint32_t* chain = elf_vaddr_ptr(ctx, chains_addr + (uint64_t)(last - symoffset) * 4, 4);
+                        if (!chain) {
+                            break;
+                        }
+                        if (ELF_GET(ctx, *chain) & 1) {
+                            if (!dynsym_fits(ctx, (uint64_t)last + 1)) {
+                                break;
+                            }
+                            *count = (size_t)last + 1;
+                            return 0;
+                        }
+                        last++;
+                    }
+                }
+            }
+        }
+    }
+    
+    // Fall back to a .dynsym section header at DT_SYMTAB
+    if (elf_dyn_find(ctx, DT_SYMTAB, &addr) == 0) {
+        size_t sym_size = ctx->is_64bit ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+        for (size_t i = 1; i < ctx->section_count; i++) {
+            if (ELF_SHDR(ctx, i, sh_type) == SHT_DYNSYM && ELF_SHDR(ctx, i, sh_addr) == addr) {
+                *count = ELF_SHDR(ctx, i, sh_size) / sym_size;
+                return 0;
+            }
+        }
+    }
+    
+    elf_set_error("Cannot determine the number of dynamic symbols");
+    return -1;
 }
 
 void elf_close(ElfContext* ctx) {
@@ -166,47 +472,76 @@ void elf_close(ElfContext* ctx) {
     
     if (ctx->is_expanded && ctx->extended_data) {
         free(ctx->extended_data);
-    } else if (ctx->mapped_data && ctx->file_size > 0) {
-        munmap(ctx->mapped_data, ctx->file_size);
+    }
+    if (ctx->mapped_data && ctx->original_size > 0) {
+        munmap(ctx->mapped_data, ctx->original_size);
     }
     
     if (ctx->filename) {
         free(ctx->filename);
     }
     
+    free(ctx->touched);
+    segmap_free(&ctx->segments);
+    
     memset(ctx, 0, sizeof(ElfContext));
 }
 
+// Count the DT_NEEDED entries up to DT_NULL
+ELF_ALWAYS_INLINE size_t scan_needed(const ElfContext* ctx, bool is_64bit, bool swap) {
+    size_t count = 0;
+    
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t tag = elf_dyn_tag_at(ctx->dyn32, i, is_64bit, swap);
+        if (tag == DT_NEEDED) {
+            count++;
+        } else if (tag == DT_NULL) {
+            // End of dynamic section
+            break;
+        }
+    }
+    
+    return count;
+}
+
+// Duplicate the names of the first 'count' DT_NEEDED entries into 'names'.
+// Returns how many were stored; fewer than 'count' on a bad offset or
+// allocation failure.
+ELF_ALWAYS_INLINE size_t copy_needed(const ElfContext* ctx, char** names, size_t count,
+                                     bool is_64bit, bool swap) {
+    size_t stored = 0;
+    
+    for (size_t i = 0; i < ctx->dyn_count && stored < count; i++) {
+        if (elf_dyn_tag_at(ctx->dyn32, i, is_64bit, swap) != DT_NEEDED) {
+            continue;
+        }
+        
+        uint64_t offset = elf_dyn_val_at(ctx->dyn32, i, is_64bit, swap);
+        if (offset >= ctx->dynstr_size) {
+            elf_set_error("DT_NEEDED offset 0x%llx outside the string table", (unsigned long long)offset);
+            break;
+        }
+        names[stored] = strdup(ctx->dynstr + offset);
+        if (!names[stored]) {
+            elf_set_error("Memory allocation failed");
+            break;
+        }
+        stored++;
+    }
+    
+    return stored;
+}
+
 char** elf_get_needed_libs(ElfContext* ctx, size_t* count) {
     if (!ctx || !count) {
-        set_error("Invalid parameters");
+        elf_set_error("Invalid parameters");
         return NULL;
     }
     
     *count = 0;
     
     // First, count the number of DT_NEEDED entries
-    size_t needed_count = 0;
-    
-    if (ctx->is_64bit) {
-        for (size_t i = 0; i < ctx->dyn_count; i++) {
-            if (ctx->dyn64[i].d_tag == DT_NEEDED) {
-                needed_count++;
-            } else if (ctx->dyn64[i].d_tag == DT_NULL) {
-                // End of dynamic section
-                break;
-            }
-        }
-    } else {
-        for (size_t i = 0; i < ctx->dyn_count; i++) {
-            if (ctx->dyn32[i].d_tag == DT_NEEDED) {
-                needed_count++;
-            } else if (ctx->dyn32[i].d_tag == DT_NULL) {
-                // End of dynamic section
-                break;
-            }
-        }
-    }
+    size_t needed_count = ELF_SPECIALIZE(ctx, scan_needed, ctx);
     
     if (needed_count == 0) {
         return NULL; // No needed libraries
@@ -215,51 +550,18 @@ char** elf_get_needed_libs(ElfContext* ctx, size_t* count) {
     // Allocate array for the strings
     char** needed_libs = malloc(sizeof(char*) * needed_count);
     if (!needed_libs) {
-        set_error("Memory allocation failed");
+        elf_set_error("Memory allocation failed");
         return NULL;
     }
     
     // Fill the array with strings
-    size_t idx = 0;
-    
-    if (ctx->is_64bit) {
-        for (size_t i = 0; i < ctx->dyn_count && idx < needed_count; i++) {
-            if (ctx->dyn64[i].d_tag == DT_NEEDED) {
-                const char* lib_name = ctx->dynstr + ctx->dyn64[i].d_un.d_val;
-                needed_libs[idx] = strdup(lib_name);
-                if (!needed_libs[idx]) {
-                    // Clean up on error
-                    for (size_t j = 0; j < idx; j++) {
-                        free(needed_libs[j]);
-                    }
-                    free(needed_libs);
-                    set_error("Memory allocation failed");
-                    return NULL;
-                }
-                idx++;
-            } else if (ctx->dyn64[i].d_tag == DT_NULL) {
-                break;
-            }
-        }
-    } else {
-        for (size_t i = 0; i < ctx->dyn_count && idx < needed_count; i++) {
-            if (ctx->dyn32[i].d_tag == DT_NEEDED) {
-                const char* lib_name = ctx->dynstr + ctx->dyn32[i].d_un.d_val;
-                needed_libs[idx] = strdup(lib_name);
-                if (!needed_libs[idx]) {
-                    // Clean up on error
-                    for (size_t j = 0; j < idx; j++) {
-                        free(needed_libs[j]);
-                    }
-                    free(needed_libs);
-                    set_error("Memory allocation failed");
-                    return NULL;
-                }
-                idx++;
-            } else if (ctx->dyn32[i].d_tag == DT_NULL) {
-                break;
-            }
+    size_t stored = ELF_SPECIALIZE(ctx, copy_needed, ctx, needed_libs, needed_count);
+    if (stored < needed_count) {
+        for (size_t j = 0; j < stored; j++) {
+            free(needed_libs[j]);
         }
+        free(needed_libs);
+        return NULL;
     }
     
     *count = needed_count;
@@ -267,39 +569,27 @@ char** elf_get_needed_libs(ElfContext* ctx, size_t* count) {
 }
 
 // Helper function to relocate all pointers after file expansion
-static void relocate_pointers(ElfContext* ctx, void* new_data) {
-    uint64_t base_offset = (uint64_t)ctx->mapped_data;
+static void relocate_pointers(ElfContext* ctx, void* old_data, void* new_data) {
+    uint64_t base_offset = (uint64_t)old_data;
     uint64_t new_base = (uint64_t)new_data;
     
     // Update ELF header pointers
-    if (ctx->is_64bit) {
-        ctx->ehdr64 = (Elf64_Ehdr*)new_data;
-        // Adjust program headers if they exist
-        if (ctx->ehdr64->e_phnum > 0) {
-            ctx->phdr64 = (Elf64_Phdr*)(new_base + ctx->ehdr64->e_phoff);
-        }
-        // Adjust section headers
-        ctx->shdr64 = (Elf64_Shdr*)(new_base + ctx->ehdr64->e_shoff);
-        
-        // Update dynamic section pointer
-        if (ctx->dyn64) {
-            uint64_t dyn_offset = (uint64_t)ctx->dyn64 - base_offset;
-            ctx->dyn64 = (Elf64_Dyn*)(new_base + dyn_offset);
-        }
-    } else {
-        ctx->ehdr32 = (Elf32_Ehdr*)new_data;
-        // Adjust program headers if they exist
-        if (ctx->ehdr32->e_phnum > 0) {
-            ctx->phdr32 = (Elf32_Phdr*)(new_base + ctx->ehdr32->e_phoff);
-        }
-        // Adjust section headers
-        ctx->shdr32 = (Elf32_Shdr*)(new_base + ctx->ehdr32->e_shoff);
-        
-        // Update dynamic section pointer
-        if (ctx->dyn32) {
-            uint64_t dyn_offset = (uint64_t)ctx->dyn32 - base_offset;
-            ctx->dyn32 = (Elf32_Dyn*)(new_base + dyn_offset);
-        }
+    ctx->ehdr32 = (Elf32_Ehdr*)new_data;
+    ctx->e_ident = (unsigned char*)new_data;
+    
+    // Adjust program headers if they exist
+    if (ctx->program_header_count > 0) {
+        ctx->phdr32 = (Elf32_Phdr*)(new_base + ELF_EHDR(ctx, e_phoff));
+    }
+    // Adjust section headers
+    if (ctx->section_count > 0) {
+        ctx->shdr32 = (Elf32_Shdr*)(new_base + ELF_EHDR(ctx, e_shoff));
+    }
+    
+    // Update dynamic section pointer
+    if (ctx->dyn32) {
+        uint64_t dyn_offset = (uint64_t)ctx->dyn32 - base_offset;
+        ctx->dyn32 = (Elf32_Dyn*)(new_base + dyn_offset);
     }
     
     // Update string table pointers
@@ -314,139 +604,470 @@ static void relocate_pointers(ElfContext* ctx, void* new_data) {
     }
 }
 
-// Helper function to expand the dynamic string table if needed
-static int expand_dynstr(ElfContext* ctx, size_t additional_size) {
-    if (!ctx || additional_size == 0) {
+// Grow the in-memory image to new_size bytes; the new bytes are zeroed
+static int grow_image(ElfContext* ctx, size_t new_size) {
+    if (new_size <= ctx->file_size) {
+        return 0;
+    }
+    
+    void* old_data = ctx->is_expanded ? ctx->extended_data : ctx->mapped_data;
+    void* new_data = old_data;
+    
+    if (!ctx->is_expanded || new_size > ctx->extended_capacity) {
+        // Grow geometrically so repeated edits do not copy the file each time
+        size_t capacity = ctx->extended_capacity ? ctx->extended_capacity : ctx->file_size;
+        while (capacity < new_size) {
+            capacity += capacity / 2 + 4096;
+        }
+        
+        if (ctx->is_expanded) {
+            new_data = realloc(ctx->extended_data, capacity);
+        } else {
+            // First expansion, keep original mmap for cleanup
+            new_data = malloc(capacity);
+            if (new_data) {
+                memcpy(new_data, old_data, ctx->file_size);
+            }
+        }
+        
+        if (!new_data) {
+            elf_set_error("Memory allocation failed for expanded file");
+            return -1;
+        }
+        
+        ctx->is_expanded = true;
+        ctx->extended_data = new_data;
+        ctx->extended_capacity = capacity;
+    }
+    
+    memset((uint8_t*)new_data + ctx->file_size, 0, new_size - ctx->file_size);
+    
+    // Update all pointers to reference the new memory
+    if (new_data != old_data) {
+        relocate_pointers(ctx, old_data, new_data);
+    }
+    
+    ctx->file_size = new_size;
+    ctx->extended_size = new_size;
+    return 0;
+}
+
+bool elf_tail_adopt(ElfContext* ctx) {
+    if (ctx->has_tail) {
+        return true;
+    }
+    
+    uint64_t max_end = 0;
+    size_t last_load = 0;
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) == PT_LOAD) {
+            uint64_t end = ELF_PHDR(ctx, i, p_vaddr) + ELF_PHDR(ctx, i, p_memsz);
+            if (end >= max_end) {
+                max_end = end;
+                last_load = i;
+            }
+        }
+    }
+    
+    // Appended data is read-only: a writable segment at the end (.data
+    // without .bss, or a .dynamic moved by an earlier edit) is never extended
+    if (max_end == 0 ||
+        ELF_PHDR(ctx, last_load, p_offset) + ELF_PHDR(ctx, last_load, p_filesz) != ctx->original_size ||
+        ELF_PHDR(ctx, last_load, p_filesz) != ELF_PHDR(ctx, last_load, p_memsz) ||
+        (ELF_PHDR(ctx, last_load, p_flags) & PF_W) != 0) {
+        return false;
+    }
+    
+    ctx->tail_phdr_idx = last_load;
+    ctx->tail_offset = ELF_PHDR(ctx, last_load, p_offset);
+    ctx->tail_addr = ELF_PHDR(ctx, last_load, p_vaddr);
+    ctx->has_tail = true;
+    return true;
+}
+
+// No spare program header: move the table into the appended data with one
+// more entry for the new PT_LOAD, plus a PT_PHDR in front if there was none
+// (bionic needs one to find a table that is not at the start of the file),
+// and a spare PT_NULL at the end for a later segment of its own.
+// Every existing entry survives, the PT_NOTE with the build-id included.
+static int relocate_phdrs(ElfContext* ctx, uint64_t offset, size_t last_load,
+                          uint64_t base_addr, uint64_t align) {
+    size_t phdr_size = ctx->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t word_size = ctx->is_64bit ? 8 : 4;
+    size_t count = ctx->program_header_count;
+    
+    size_t phdr_idx = SIZE_MAX;
+    for (size_t i = 0; i < count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) == PT_PHDR) {
+            phdr_idx = i;
+            break;
+        }
+    }
+    
+    size_t added = phdr_idx == SIZE_MAX ? 3 : 2;
+    if (count + added >= PN_XNUM) {
+        elf_set_error("No room for another program header");
         return -1;
     }
     
-    // Get current dynstr section info
-    uint64_t dynstr_offset, dynstr_size;
-    uint64_t dynstr_addr = 0;
+    // Copy the old table first, growing the image may move it
+    uint8_t* old_table = malloc(count * phdr_size);
+    if (!old_table) {
+        elf_set_error("Memory allocation failed");
+        return -1;
+    }
+    memcpy(old_table, ctx->phdr32, count * phdr_size);
     
-    if (ctx->is_64bit) {
-        dynstr_offset = ctx->shdr64[ctx->dynstr_idx].sh_offset;
-        dynstr_size = ctx->shdr64[ctx->dynstr_idx].sh_size;
-        dynstr_addr = ctx->shdr64[ctx->dynstr_idx].sh_addr;
-    } else {
-        dynstr_offset = ctx->shdr32[ctx->dynstr_idx].sh_offset;
-        dynstr_size = ctx->shdr32[ctx->dynstr_idx].sh_size;
-        dynstr_addr = ctx->shdr32[ctx->dynstr_idx].sh_addr;
+    uint64_t table_offset = (offset + word_size - 1) / word_size * word_size;
+    uint64_t table_size = (count + added) * phdr_size;
+    if (grow_image(ctx, table_offset + table_size) != 0) {
+        free(old_table);
+        return -1;
+    }
+    
+    // [PT_PHDR] entries up to the last PT_LOAD, the new PT_LOAD, the rest, PT_NULL
+    uint8_t* table = (uint8_t*)ctx->ehdr32 + table_offset;
+    size_t front = added - 2;
+    memset(table, 0, table_size);
+    memcpy(table + front * phdr_size, old_table, (last_load + 1) * phdr_size);
+    memcpy(table + (front + last_load + 2) * phdr_size, old_table + (last_load + 1) * phdr_size,
+           (count - last_load - 1) * phdr_size);
+    free(old_table);
+    elf_touch(ctx, table, table_size);
+    
+    ELF_EHDR_SET(ctx, e_phoff, table_offset);
+    ELF_EHDR_SET(ctx, e_phnum, count + added);
+    ctx->phdr32 = (Elf32_Phdr*)table;
+    ctx->program_header_count = count + added;
+    ctx->segments_valid = false;
+    
+    uint64_t vaddr = base_addr + (table_offset & (align - 1));
+    size_t slot = front + last_load + 1;
+    phdr_idx = phdr_idx == SIZE_MAX ? 0 : phdr_idx + front;
+    
+    ELF_PHDR_SET(ctx, phdr_idx, p_type, PT_PHDR);
+    ELF_PHDR_SET(ctx, phdr_idx, p_flags, PF_R);
+    ELF_PHDR_SET(ctx, phdr_idx, p_offset, table_offset);
+    ELF_PHDR_SET(ctx, phdr_idx, p_vaddr, vaddr);
+    ELF_PHDR_SET(ctx, phdr_idx, p_paddr, vaddr);
+    ELF_PHDR_SET(ctx, phdr_idx, p_filesz, table_size);
+    ELF_PHDR_SET(ctx, phdr_idx, p_memsz, table_size);
+    ELF_PHDR_SET(ctx, phdr_idx, p_align, word_size);
+    
+    ELF_PHDR_SET(ctx, slot, p_type, PT_LOAD);
+    ELF_PHDR_SET(ctx, slot, p_flags, PF_R);
+    ELF_PHDR_SET(ctx, slot, p_offset, table_offset);
+    ELF_PHDR_SET(ctx, slot, p_vaddr, vaddr);
+    ELF_PHDR_SET(ctx, slot, p_paddr, vaddr);
+    ELF_PHDR_SET(ctx, slot, p_filesz, table_size);
+    ELF_PHDR_SET(ctx, slot, p_memsz, table_size);
+    ELF_PHDR_SET(ctx, slot, p_align, align);
+    
+    ctx->tail_phdr_idx = slot;
+    ctx->tail_offset = table_offset;
+    ctx->tail_addr = vaddr;
+    ctx->has_tail = true;
+    return 0;
+}
+
+// Where a new segment goes: the highest PT_LOAD, the first page boundary
+// above every segment, the largest alignment and a spare PT_NULL (SIZE_MAX
+// if there is none)
+static void find_segment_room(ElfContext* ctx, size_t* last_load, uint64_t* base_addr,
+                              uint64_t* align, size_t* spare) {
+    uint64_t max_end = 0;
+    *align = 0x1000;
+    *last_load = 0;
+    *spare = SIZE_MAX;
+    
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        uint32_t type = ELF_PHDR(ctx, i, p_type);
+        if (type == PT_LOAD) {
+            uint64_t end = ELF_PHDR(ctx, i, p_vaddr) + ELF_PHDR(ctx, i, p_memsz);
+            if (end >= max_end) {
+                max_end = end;
+                *last_load = i;
+            }
+            if (ELF_PHDR(ctx, i, p_align) > *align) {
+                *align = ELF_PHDR(ctx, i, p_align);
+            }
+        } else if (type == PT_NULL) {
+            *spare = i;
+        }
+    }
+    
+    *base_addr = (max_end + *align - 1) & ~(*align - 1);
+}
+
+// Turn the spare entry into a PT_LOAD mapping [offset, offset + size) above
+// every other segment, congruent to the file offset modulo the alignment so
+// no padding is needed. Returns its index.
+static size_t add_load_segment(ElfContext* ctx, size_t spare, size_t last_load, uint64_t base_addr,
+                               uint64_t align, uint32_t flags, uint64_t offset, uint64_t size) {
+    size_t phdr_size = ctx->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    
+    // Keep PT_LOAD entries sorted by address: the new segment is the highest,
+    // so it must come after every existing PT_LOAD in the table
+    size_t slot = spare;
+    if (spare < last_load) {
+        uint8_t* phdrs = (uint8_t*)ctx->phdr32;
+        memmove(phdrs + spare * phdr_size, phdrs + (spare + 1) * phdr_size,
+                (last_load - spare) * phdr_size);
+        elf_touch(ctx, phdrs + spare * phdr_size, (last_load - spare) * phdr_size);
+        slot = last_load;
+    }
+    
+    uint64_t vaddr = base_addr + (offset & (align - 1));
+    ELF_PHDR_SET(ctx, slot, p_type, PT_LOAD);
+    ELF_PHDR_SET(ctx, slot, p_flags, flags);
+    ELF_PHDR_SET(ctx, slot, p_offset, offset);
+    ELF_PHDR_SET(ctx, slot, p_vaddr, vaddr);
+    ELF_PHDR_SET(ctx, slot, p_paddr, vaddr);
+    ELF_PHDR_SET(ctx, slot, p_filesz, size);
+    ELF_PHDR_SET(ctx, slot, p_memsz, size);
+    ELF_PHDR_SET(ctx, slot, p_align, align);
+    return slot;
+}
+
+// Pick the PT_LOAD that will map data appended at 'offset'. A read-only
+// PT_LOAD that already ends at the end of file without a .bss tail is simply
+// extended; otherwise a spare PT_NULL is turned into a new read-only PT_LOAD
+// placed above every other segment. Without one, the program header table
+// moves into the new segment (see relocate_phdrs), which then starts with it.
+static int create_tail_segment(ElfContext* ctx, uint64_t offset) {
+    if (elf_tail_adopt(ctx)) {
+        return 0;
+    }
+    
+    size_t last_load, spare;
+    uint64_t base_addr, align;
+    find_segment_room(ctx, &last_load, &base_addr, &align, &spare);
+    if (spare == SIZE_MAX) {
+        return relocate_phdrs(ctx, offset, last_load, base_addr, align);
+    }
+    
+    size_t slot = add_load_segment(ctx, spare, last_load, base_addr, align, PF_R, offset, 0);
+    uint64_t vaddr = ELF_PHDR(ctx, slot, p_vaddr);
+    
+    ctx->tail_phdr_idx = slot;
+    ctx->tail_offset = offset;
+    ctx->tail_addr = vaddr;
+    ctx->has_tail = true;
+    return 0;
+}
+
+int elf_tail_alloc(ElfContext* ctx, size_t size, size_t align,
+                   uint64_t* offset, uint64_t* vaddr) {
+    if (align == 0) {
+        align = 1;
+    }
+    
+    uint64_t start = (ctx->file_size + align - 1) / align * align;
+    if (!ctx->has_tail) {
+        if (create_tail_segment(ctx, start) != 0) {
+            return -1;
+        }
+        // The segment may open with the relocated program headers
+        start = (ctx->file_size + align - 1) / align * align;
     }
     
-    // Approach: We will add the new string at the end of the file,
-    // then update the dynstr section header to include this area
+    size_t old_size = ctx->file_size;
+    if (grow_image(ctx, start + size) != 0) {
+        return -1;
+    }
+    elf_touch(ctx, (uint8_t*)ctx->ehdr32 + old_size, start + size - old_size);
+    
+    uint64_t seg_size = start + size - ctx->tail_offset;
+    ELF_PHDR_SET(ctx, ctx->tail_phdr_idx, p_filesz, seg_size);
+    ELF_PHDR_SET(ctx, ctx->tail_phdr_idx, p_memsz, seg_size);
+    
+    *offset = start;
+    *vaddr = ctx->tail_addr + (start - ctx->tail_offset);
+    return 0;
+}
+
+int elf_segment_alloc(ElfContext* ctx, size_t size, size_t align, uint32_t flags,
+                      uint64_t* offset, uint64_t* vaddr) {
+    if (align == 0) {
+        align = 1;
+    }
     
-    // Calculate new file size with padding for alignment
-    size_t padding = 16 - (ctx->file_size % 16);
-    if (padding == 16) padding = 0;
-    size_t new_size = ctx->file_size + padding + additional_size;
+    size_t last_load, spare;
+    uint64_t base_addr, page;
+    find_segment_room(ctx, &last_load, &base_addr, &page, &spare);
+    if (spare == SIZE_MAX) {
+        // The program headers move into a read-only segment first, which
+        // leaves a spare entry behind them
+        if (relocate_phdrs(ctx, ctx->file_size, last_load, base_addr, page) != 0) {
+            return -1;
+        }
+        find_segment_room(ctx, &last_load, &base_addr, &page, &spare);
+    }
     
-    // Allocate memory for the expanded file
-    void* new_data = calloc(1, new_size);
-    if (!new_data) {
-        set_error("Memory allocation failed for expanded file");
+    uint64_t start = (ctx->file_size + align - 1) / align * align;
+    size_t old_size = ctx->file_size;
+    if (grow_image(ctx, start + size) != 0) {
         return -1;
     }
+    elf_touch(ctx, (uint8_t*)ctx->ehdr32 + old_size, start + size - old_size);
     
-    // Copy the original file content
-    memcpy(new_data, ctx->is_expanded ? ctx->extended_data : ctx->mapped_data, ctx->file_size);
+    size_t slot = add_load_segment(ctx, spare, last_load, base_addr, page, flags, start, size);
     
-    // Update context to use the expanded memory
-    if (!ctx->is_expanded) {
-        // First expansion, keep original mmap for cleanup
-        ctx->is_expanded = true;
-        ctx->extended_data = new_data;
-        ctx->extended_size = new_size;
+    // The tail now lies below this segment and cannot grow any more, later
+    // data goes into a new one above it
+    ctx->has_tail = false;
+    
+    *offset = start;
+    *vaddr = ELF_PHDR(ctx, slot, p_vaddr);
+    return 0;
+}
+
+void elf_tail_truncate(ElfContext* ctx, uint64_t end) {
+    // Program headers moved into the tail stay
+    size_t phdr_size = ctx->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    uint64_t phoff = ELF_EHDR(ctx, e_phoff);
+    uint64_t phdr_end = phoff + ctx->program_header_count * phdr_size;
+    if (ctx->has_tail && phoff >= ctx->tail_offset && end < phdr_end) {
+        end = phdr_end;
+    }
+    
+    // An adopted segment keeps at least the bytes it started with
+    if (!ctx->has_tail || end >= ctx->file_size ||
+        (end < ctx->original_size && end <= ctx->tail_offset)) {
+        return;
+    }
+    
+    elf_set_file_size(ctx, end);
+    
+    uint64_t seg_size = end > ctx->tail_offset ? end - ctx->tail_offset : 0;
+    if (seg_size == 0) {
+        // Only a segment converted from a spare header can become empty
+        uint8_t* phdr = (uint8_t*)ctx->phdr32 + ctx->tail_phdr_idx * phdr_size;
+        memset(phdr, 0, phdr_size);
+        elf_touch(ctx, phdr, phdr_size);
+        ctx->has_tail = false;
     } else {
-        // Already expanded, free previous extended data
-        free(ctx->extended_data);
-        ctx->extended_data = new_data;
-        ctx->extended_size = new_size;
+        ELF_PHDR_SET(ctx, ctx->tail_phdr_idx, p_filesz, seg_size);
+        ELF_PHDR_SET(ctx, ctx->tail_phdr_idx, p_memsz, seg_size);
     }
+}
+
+void elf_set_file_size(ElfContext* ctx, uint64_t end) {
+    ctx->file_size = end;
+    ctx->extended_size = end;
     
-    // Update all pointers to reference the new memory
-    relocate_pointers(ctx, new_data);
+    // Nothing past the end is written any more
+    size_t i = 0;
+    while (i < ctx->touched_count) {
+        ElfRange* range = &ctx->touched[i];
+        if (range->offset >= end) {
+            ctx->touched[i] = ctx->touched[--ctx->touched_count];
+            continue;
+        }
+        if (range->offset + range->size > end) {
+            range->size = end - range->offset;
+        }
+        i++;
+    }
+}
+
+// Set the value of every dynamic entry carrying 'tag'
+static void set_dyn_value(ElfContext* ctx, int64_t tag, uint64_t value) {
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t cur = elf_dyn_tag(ctx, i);
+        if (cur == tag) {
+            elf_dyn_set_val(ctx, i, value);
+        } else if (cur == DT_NULL) {
+            break;
+        }
+    }
+}
+
+void elf_update_dynstr(ElfContext* ctx, char* dynstr, uint64_t vaddr, size_t size) {
+    ctx->dynstr = dynstr;
+    ctx->dynstr_addr = vaddr;
+    ctx->dynstr_size = size;
+    set_dyn_value(ctx, DT_STRTAB, vaddr);
+    set_dyn_value(ctx, DT_STRSZ, size);
     
-    // Update the dynstr section to include the appended data
-    if (ctx->is_64bit) {
-        // Store the original end of the dynstr section as the offset where we'll put our new string
-        uint64_t new_string_offset = dynstr_offset + dynstr_size;
-        
-        // Update the size of the dynstr section to include the new space
-        ctx->shdr64[ctx->dynstr_idx].sh_size += additional_size;
-        
-        // Return the updated file size
-        ctx->file_size = new_size;
-        ctx->dynstr_size += additional_size;
-        
-        return 0;
+    // Keep the .dynstr section header (if any) describing the live table
+    if (ctx->dynstr_idx != 0) {
+        ELF_SHDR_SET(ctx, ctx->dynstr_idx, sh_offset, (uint8_t*)dynstr - (uint8_t*)ctx->ehdr32);
+        ELF_SHDR_SET(ctx, ctx->dynstr_idx, sh_addr, vaddr);
+        ELF_SHDR_SET(ctx, ctx->dynstr_idx, sh_size, size);
+    }
+}
+
+static int expand_dynstr(ElfContext* ctx, size_t additional_size) {
+
+    // Match section headers against the current location before moving it
+    elf_find_sections(ctx);
+    
+    uint64_t dynstr_offset = (uint8_t*)ctx->dynstr - (uint8_t*)ctx->ehdr32;
+    uint64_t offset, vaddr;
+    
+    // A table appended by an earlier run is still last in the file
+    elf_tail_adopt(ctx);
+    
+    if (ctx->has_tail && dynstr_offset >= ctx->tail_offset &&
+        dynstr_offset + ctx->dynstr_size == ctx->file_size) {
+        // Already relocated and last in the file: grow it in place
+        if (elf_tail_alloc(ctx, additional_size, 1, &offset, &vaddr) != 0) {
+            return -1;
+        }
     } else {
-        // Store the original end of the dynstr section as the offset where we'll put our new string
-        uint32_t new_string_offset = dynstr_offset + dynstr_size;
-        
-        // Update the size of the dynstr section to include the new space
-        ctx->shdr32[ctx->dynstr_idx].sh_size += additional_size;
-        
-        // Return the updated file size
-        ctx->file_size = new_size;
-        ctx->dynstr_size += additional_size;
+        // Approach: copy the table into the appended load segment and
+        // repoint DT_STRTAB there. The old copy becomes dead bytes.
+        if (elf_tail_alloc(ctx, ctx->dynstr_size + additional_size, 1, &offset, &vaddr) != 0) {
+            return -1;
+        }
         
+        char* moved = (char*)ctx->ehdr32 + offset;
+        memcpy(moved, ctx->dynstr, ctx->dynstr_size);
+        elf_update_dynstr(ctx, moved, vaddr, ctx->dynstr_size + additional_size);
         return 0;
     }
+    
+    elf_update_dynstr(ctx, ctx->dynstr, ctx->dynstr_addr, ctx->dynstr_size + additional_size);
+    return 0;
 }
 
-int elf_replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new_lib) {
-    if (!ctx || !old_lib || !new_lib) {
-        set_error("Invalid parameters");
+int elf_expand_dynstr(ElfContext* ctx, size_t additional_size) {
+    if (!ctx || additional_size == 0) {
         return -1;
     }
     
+    ELF_PROBE_ENTRY(grow, ctx->filename);
+    int result = expand_dynstr(ctx, additional_size);
+    ELF_PROBE_RETURN(grow, ctx->filename, ctx->file_size, additional_size, result);
+    return result;
+}
+
+static int replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new_lib) {
     // Find the DT_NEEDED entry with the old_lib name
     bool found = false;
     size_t dynamic_index = 0;
     uint64_t string_offset = 0;
     
-    if (ctx->is_64bit) {
-        for (size_t i = 0; i < ctx->dyn_count; i++) {
-            if (ctx->dyn64[i].d_tag == DT_NEEDED) {
-                uint64_t str_idx = ctx->dyn64[i].d_un.d_val;
-                if (str_idx < ctx->dynstr_size) {  // Sanity check
-                    const char* lib_name = ctx->dynstr + str_idx;
-                    if (strcmp(lib_name, old_lib) == 0) {
-                        found = true;
-                        dynamic_index = i;
-                        string_offset = str_idx;
-                        break;
-                    }
-                }
-            } else if (ctx->dyn64[i].d_tag == DT_NULL) {
-                // End of dynamic section
-                break;
-            }
+    for (size_t i = 0; i < ctx->dyn_count && !found; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        if (tag == DT_NULL) {
+            break;
         }
-    } else {
-        for (size_t i = 0; i < ctx->dyn_count; i++) {
-            if (ctx->dyn32[i].d_tag == DT_NEEDED) {
-                uint32_t str_idx = ctx->dyn32[i].d_un.d_val;
-                if (str_idx < ctx->dynstr_size) {  // Sanity check
-                    const char* lib_name = ctx->dynstr + str_idx;
-                    if (strcmp(lib_name, old_lib) == 0) {
-                        found = true;
-                        dynamic_index = i;
-                        string_offset = str_idx;
-                        break;
-                    }
-                }
-            } else if (ctx->dyn32[i].d_tag == DT_NULL) {
-                // End of dynamic section
-                break;
-            }
+        if (tag != DT_NEEDED) {
+            continue;
+        }
+        
+        uint64_t str_idx = elf_dyn_val(ctx, i);
+        if (str_idx < ctx->dynstr_size && strcmp(ctx->dynstr + str_idx, old_lib) == 0) {  // Sanity check
+            found = true;
+            dynamic_index = i;
+            string_offset = str_idx;
         }
     }
     
     if (!found) {
-        set_error("Library not found in DT_NEEDED: %s", old_lib);
+        elf_set_error("Library not found in DT_NEEDED: %s", old_lib);
         return -1;
     }
     
@@ -454,28 +1075,23 @@ int elf_replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new
     size_t new_len = strlen(new_lib);
     
     // Case 1: New string fits in the old string space (including NULL terminator)
-    if (new_len <= old_len) {
+    // and nothing else uses those bytes
+    if (new_len <= old_len && !elf_dynstr_shared(ctx, string_offset, dynamic_index)) {
         // Just replace the string in place
         strcpy(ctx->dynstr + string_offset, new_lib);
+        elf_touch(ctx, ctx->dynstr + string_offset, new_len + 1);
         return 0;
     }
     
-    // Case 2: New string is longer, need to add it to the end of the dynstr table
+    // Case 2: New string is longer or the old one is shared, need to add it to
+    // the end of the dynstr table
     
     // First, expand the file to make room for the new string
-    if (expand_dynstr(ctx, new_len + 1) != 0) {
-        set_error("Failed to expand dynamic string table");
+    if (elf_expand_dynstr(ctx, new_len + 1) != 0) {
+        elf_set_error("Failed to expand dynamic string table: %s", elf_get_error());
         return -1;
     }
     
-    // Calculate the offset for the new string (at the end of the original dynstr section)
-    uint64_t dynstr_offset;
-    if (ctx->is_64bit) {
-        dynstr_offset = ctx->shdr64[ctx->dynstr_idx].sh_offset;
-    } else {
-        dynstr_offset = ctx->shdr32[ctx->dynstr_idx].sh_offset;
-    }
-    
     // Original dynstr size before expansion
     uint64_t orig_dynstr_size = ctx->dynstr_size - (new_len + 1);
     
@@ -484,7 +1100,7 @@ int elf_replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new
     
     // Ensure we're writing within bounds
     if (new_offset + new_len >= ctx->dynstr_size) {
-        set_error("String offset calculation error");
+        elf_set_error("String offset calculation error");
         return -1;
     }
     
@@ -492,25 +1108,29 @@ int elf_replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new
     strcpy(ctx->dynstr + new_offset, new_lib);
     
     // Update the DT_NEEDED entry to point to the new string
-    if (ctx->is_64bit) {
-        ctx->dyn64[dynamic_index].d_un.d_val = new_offset;
-    } else {
-        ctx->dyn32[dynamic_index].d_un.d_val = new_offset;
-    }
+    elf_dyn_set_val(ctx, dynamic_index, new_offset);
     
     return 0;
 }
 
-int elf_save(ElfContext* ctx, const char* output_filename) {
-    if (!ctx || !output_filename) {
-        set_error("Invalid parameters");
+int elf_replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new_lib) {
+    if (!ctx || !old_lib || !new_lib) {
+        elf_set_error("Invalid parameters");
         return -1;
     }
     
+    ELF_PROBE_ENTRY(plan, ctx->filename);
+    size_t dynstr_size = ctx->dynstr_size;
+    int result = replace_needed_lib(ctx, old_lib, new_lib);
+    ELF_PROBE_RETURN(plan, ctx->filename, ctx->file_size, ctx->dynstr_size - dynstr_size, result);
+    return result;
+}
+
+static int save_file(ElfContext* ctx, const char* output_filename) {
     // Open output file
     int fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0755);
     if (fd < 0) {
-        set_error("Failed to open output file: %s", strerror(errno));
+        elf_set_error("Failed to open output file: %s", strerror(errno));
         return -1;
     }
     
@@ -529,10 +1149,182 @@ int elf_save(ElfContext* ctx, const char* output_filename) {
     ssize_t written = write(fd, data_to_write, size_to_write);
     if (written != (ssize_t)size_to_write) {
         close(fd);
-        set_error("Failed to write entire file: %s", strerror(errno));
+        elf_set_error("Failed to write entire file: %s", strerror(errno));
         return -1;
     }
     
     close(fd);
+    
+    // Remember what the modified ranges look like on disk for elf_verify()
+    for (size_t i = 0; i < ctx->touched_count; i++) {
+        ElfRange* range = &ctx->touched[i];
+        range->crc = elf_crc32(0, (uint8_t*)data_to_write + range->offset, range->size);
+    }
+    ctx->saved_size = size_to_write;
+    
     return 0;
 }
+
+int elf_save(ElfContext* ctx, const char* output_filename) {
+    if (!ctx || !output_filename) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+    
+    ELF_PROBE_ENTRY(write, output_filename);
+    int result = save_file(ctx, output_filename);
+    ELF_PROBE_RETURN(write, output_filename, ctx->file_size, ctx->file_size - ctx->original_size, result);
+    return result;
+}
+
+static int read_exact(int fd, void* buf, size_t size, uint64_t offset) {
+    return pread(fd, buf, size, offset) == (ssize_t)size ? 0 : -1;
+}
+
+static int verify_file(ElfContext* ctx, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        elf_set_error("Failed to open file: %s", strerror(errno));
+        return -1;
+    }
+    
+    // Buffers for the headers and dynamic table as found on disk; the view
+    // lets the usual accessors and address translation work on them
+    ElfContext view;
+    memset(&view, 0, sizeof(view));
+    view.is_64bit = ctx->is_64bit;
+    view.needs_swap = ctx->needs_swap;
+    
+    uint8_t ehdr[sizeof(Elf64_Ehdr)];
+    uint8_t* buf = NULL;
+    void* phdrs = NULL;
+    void* dyn = NULL;
+    int result = -1;
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != ctx->saved_size) {
+        elf_set_error("File size does not match the saved size");
+        goto out;
+    }
+    
+    // Modified ranges must read back exactly as they were written
+    size_t largest = 0;
+    for (size_t i = 0; i < ctx->touched_count; i++) {
+        if (ctx->touched[i].size > largest) largest = ctx->touched[i].size;
+    }
+    buf = malloc(largest ? largest : 1);
+    if (!buf) {
+        elf_set_error("Memory allocation failed");
+        goto out;
+    }
+    
+    for (size_t i = 0; i < ctx->touched_count; i++) {
+        const ElfRange* range = &ctx->touched[i];
+        if (read_exact(fd, buf, range->size, range->offset) != 0 ||
+            elf_crc32(0, buf, range->size) != range->crc) {
+            elf_set_error("Modified range at 0x%llx (%llu bytes) does not match",
+                      (unsigned long long)range->offset, (unsigned long long)range->size);
+            goto out;
+        }
+    }
+    
+    // Header and program headers
+    size_t ehdr_size = view.is_64bit ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    size_t phdr_size = view.is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t dyn_size = view.is_64bit ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    
+    if (read_exact(fd, ehdr, ehdr_size, 0) != 0 || memcmp(ehdr, ctx->e_ident, EI_NIDENT) != 0) {
+        elf_set_error("ELF identification does not match");
+        goto out;
+    }
+    view.ehdr32 = (Elf32_Ehdr*)ehdr;
+    view.program_header_count = ELF_EHDR(&view, e_phnum);
+    
+    phdrs = malloc(view.program_header_count * phdr_size + 1);
+    if (!phdrs || read_exact(fd, phdrs, view.program_header_count * phdr_size, ELF_EHDR(&view, e_phoff)) != 0) {
+        elf_set_error("Failed to read program headers");
+        goto out;
+    }
+    view.phdr32 = phdrs;
+    
+    // Dynamic table
+    for (size_t i = 0; i < view.program_header_count; i++) {
+        if (ELF_PHDR(&view, i, p_type) != PT_DYNAMIC) {
+            continue;
+        }
+        view.dyn_count = ELF_PHDR(&view, i, p_filesz) / dyn_size;
+        dyn = malloc(view.dyn_count * dyn_size + 1);
+        if (!dyn || read_exact(fd, dyn, view.dyn_count * dyn_size, ELF_PHDR(&view, i, p_offset)) != 0) {
+            elf_set_error("Failed to read the dynamic table");
+            goto out;
+        }
+        view.dyn32 = dyn;
+        break;
+    }
+    
+    if (!view.dyn32) {
+        elf_set_error("PT_DYNAMIC missing");
+        goto out;
+    }
+    
+    uint64_t strtab = 0, strsz = 0;
+    for (size_t i = 0; i < view.dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(&view, i);
+        if (tag == DT_STRTAB) {
+            strtab = elf_dyn_val(&view, i);
+        } else if (tag == DT_STRSZ) {
+            strsz = elf_dyn_val(&view, i);
+        } else if (tag == DT_NULL) {
+            break;
+        }
+    }
+    
+    // The whole string table must be mapped from the file by one segment
+    uint64_t first, last;
+    if (strsz == 0 || elf_vaddr_to_offset(&view, strtab, &first) != 0 ||
+        elf_vaddr_to_offset(&view, strtab + strsz - 1, &last) != 0 ||
+        last != first + strsz - 1 || last >= (uint64_t)st.st_size) {
+        elf_set_error("DT_STRTAB/DT_STRSZ not covered by a load segment");
+        goto out;
+    }
+    
+    char terminator;
+    if (read_exact(fd, &terminator, 1, last) != 0 || terminator != '\0') {
+        elf_set_error("Dynamic string table is not terminated");
+        goto out;
+    }
+    
+    for (size_t i = 0; i < view.dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(&view, i);
+        if (tag == DT_NULL) {
+            break;
+        }
+        if (tag == DT_NEEDED && elf_dyn_val(&view, i) >= strsz) {
+            elf_set_error("DT_NEEDED offset 0x%llx outside DT_STRSZ",
+                      (unsigned long long)elf_dyn_val(&view, i));
+            goto out;
+        }
+    }
+    
+    result = 0;
+    
+out:
+    segmap_free(&view.segments);
+    free(buf);
+    free(phdrs);
+    free(dyn);
+    close(fd);
+    return result;
+}
+
+int elf_verify(ElfContext* ctx, const char* filename) {
+    if (!ctx || !filename) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+    
+    ELF_PROBE_ENTRY(verify, filename);
+    int result = verify_file(ctx, filename);
+    ELF_PROBE_RETURN(verify, filename, ctx->saved_size, ctx->saved_size - ctx->original_size, result);
+    return result;
+}
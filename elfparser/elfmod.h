@@ -7,11 +7,20 @@
 #ifndef ELFMOD_H
 #define ELFMOD_H
 
+#include "../elfsegmap.h"
 #include <elf.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+// A byte range of the file modified in memory, with the CRC-32 of the
+// bytes written for it by the last elf_save()
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t crc;
+} ElfRange;
+
 typedef struct {
     // ELF file metadata
     char* filename;
@@ -36,7 +45,8 @@ typedef struct {
         Elf64_Shdr* shdr64;
     };
     
-    // Dynamic section 
+    // Dynamic section (located through PT_DYNAMIC; section index is 0
+    // unless matching section headers exist)
     size_t dyn_section_idx;
     size_t dyn_count;
     union {
@@ -44,27 +54,54 @@ typedef struct {
         Elf64_Dyn* dyn64;
     };
     
-    // String tables
+    // String tables (located through DT_STRTAB/DT_STRSZ)
     char* dynstr;
     size_t dynstr_size;
     size_t dynstr_idx;
+    uint64_t dynstr_addr;
+    
+    // Where the string table was when loaded; a compacted table that fits
+    // is moved back here (see elf_compact_dynstr)
+    uint64_t dynstr_home_offset;
+    uint64_t dynstr_home_addr;
+    size_t dynstr_home_size;
     
     // ELF identification
     unsigned char* e_ident;
     
     // ELF properties
     bool is_64bit;
+    bool needs_swap;  // EI_DATA differs from the host byte order
     size_t section_count;
     size_t program_header_count;
     
+    // PT_LOAD address lookups; marked stale whenever a program header is
+    // touched and rebuilt by the next lookup
+    ElfSegmentMap segments;
+    bool segments_valid;
+    
     // Section header string table
     char* shstrtab;
+    bool sections_resolved;
     
     // For expanded file handling
     bool is_expanded;
     size_t original_size;
     void* extended_data;
     size_t extended_size;
+    size_t extended_capacity;
+    
+    // Load segment mapping data appended past the original end of file
+    bool has_tail;
+    size_t tail_phdr_idx;
+    uint64_t tail_offset;
+    uint64_t tail_addr;
+    
+    // Ranges modified since load, recorded for elf_verify()
+    ElfRange* touched;
+    size_t touched_count;
+    size_t touched_capacity;
+    size_t saved_size;
 } ElfContext;
 
 /**
@@ -85,6 +122,21 @@ int elf_load(const char* filename, ElfContext* ctx);
  */
 int elf_save(ElfContext* ctx, const char* output_filename);
 
+/**
+ * Cheaply check a file written by elf_save()
+ *
+ * Re-reads only the ELF header, the program headers, the dynamic table and
+ * the ranges modified since load, instead of parsing the whole file again.
+ * The ranges must match the checksums recorded by elf_save(). The file size
+ * must match, DT_STRTAB/DT_STRSZ must be covered by a PT_LOAD segment, and
+ * every DT_NEEDED offset must fall inside DT_STRSZ.
+ *
+ * @param ctx Pointer to the ElfContext that was saved
+ * @param filename Path the context was saved to
+ * @return 0 if the file is consistent, non-zero error code on failure
+ */
+int elf_verify(ElfContext* ctx, const char* filename);
+
 /**
  * Free resources associated with an ELF context
  *
@@ -111,6 +163,133 @@ char** elf_get_needed_libs(ElfContext* ctx, size_t* count);
  */
 int elf_replace_needed_lib(ElfContext* ctx, const char* old_lib, const char* new_lib);
 
+/**
+ * Add DT_NEEDED entries
+ *
+ * The new entries are placed before the existing ones, so a shim library is
+ * searched first. Libraries already needed are skipped. The entries use the
+ * DT_NULL slack at the end of .dynamic; without enough of it the table is
+ * moved into appended data (updating PT_DYNAMIC, the .dynamic section header
+ * and _DYNAMIC) with spare room for later additions.
+ *
+ * @param ctx Pointer to an initialized ElfContext
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_add_needed_lib(ElfContext* ctx, const char* lib);
+int elf_add_needed_libs(ElfContext* ctx, const char* const* libs, size_t count);
+
+/**
+ * Remove DT_NEEDED entries
+ *
+ * The remaining entries move up and the freed slots become DT_NULL slack.
+ * A library named by a version requirement (.gnu.version_r) cannot be
+ * removed, since the loader requires it to be loaded.
+ *
+ * @param ctx Pointer to an initialized ElfContext
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_remove_needed_lib(ElfContext* ctx, const char* lib);
+int elf_remove_needed_libs(ElfContext* ctx, const char* const* libs, size_t count);
+
+/**
+ * Rebuild the dynamic string table from the strings still referenced
+ *
+ * Every reference is collected first: string-valued dynamic tags
+ * (DT_NEEDED, DT_SONAME, DT_RPATH, DT_RUNPATH, ...), .dynsym names and the
+ * verneed/verdef chains. The table is then rebuilt packed, with identical
+ * strings shared and strings that are a suffix of another one stored only
+ * once, and all references are rewritten to the new offsets.
+ *
+ * If the rebuilt table fits where the table was when the file was loaded it
+ * moves back there; a table that sat last in data appended by elfmod is
+ * truncated, so repeated edits do not grow the file.
+ *
+ * @param ctx Pointer to an initialized ElfContext
+ * @param saved Optional, receives how many bytes the table shrank by
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_compact_dynstr(ElfContext* ctx, size_t* saved);
+
+// Geometry of a regenerated DT_GNU_HASH table; zero fields pick defaults
+// tuned for lookup speed (about two symbols per bucket, 12 bloom filter
+// bits per symbol, shift 26)
+typedef struct {
+    size_t bucket_count;
+    size_t bloom_words;    // power of two, in ELF class words
+    uint32_t bloom_shift;  // shift of the second bloom filter bit
+} ElfHashOptions;
+
+// Which symbols elf_prefix_symbols() renames
+#define ELF_SYMS_DEFINED   1  // exported
+#define ELF_SYMS_UNDEFINED 2  // imported
+
+/**
+ * Rename dynamic symbols
+ *
+ * Every .dynsym entry named old_names[i] is renamed to new_names[i]. The new
+ * names are added to .dynstr (which grows like for elf_replace_needed_lib)
+ * and DT_HASH and DT_GNU_HASH are regenerated. The GNU hash table needs its
+ * symbols ordered by bucket, so hashed symbols may be reordered; the
+ * matching .gnu.version entries and relocations are remapped with them.
+ * Files whose symbol order cannot be changed that way (packed Android
+ * relocations, a MIPS GOT) are refused when a reorder is needed.
+ *
+ * @param ctx Pointer to an initialized ElfContext
+ * @param options GNU hash geometry, or NULL for the defaults
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_rename_symbols(ElfContext* ctx, const char* const* old_names,
+                       const char* const* new_names, size_t count,
+                       const ElfHashOptions* options);
+
+/**
+ * Prefix dynamic symbol names, for namespace isolation
+ *
+ * Renames like elf_rename_symbols() every named symbol selected by 'which'
+ * (ELF_SYMS_DEFINED and/or ELF_SYMS_UNDEFINED). Names that already start
+ * with the prefix are left alone, so a second run changes nothing.
+ *
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_prefix_symbols(ElfContext* ctx, const char* prefix, int which,
+                       const ElfHashOptions* options);
+
+/**
+ * Regenerate DT_GNU_HASH (and DT_HASH) with a different geometry
+ *
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_rehash_symbols(ElfContext* ctx, const ElfHashOptions* options);
+
+// How much section metadata elf_strip() keeps
+#define ELF_STRIP_MINIMAL 0  // .dynamic, .dynstr and .shstrtab headers only, the Android mode
+#define ELF_STRIP_ALL     1  // no section header table at all, not loadable by bionic
+
+/**
+ * Shrink the file to what the loader reads, for size-optimised output
+ *
+ * Everything past the last segment is dropped: non-allocated sections
+ * (.symtab, .comment, debug info, ...) and the section header table. Data
+ * appended by elfmod moves down to the first offset congruent to its
+ * address, closing the gap that was left for it behind those sections.
+ *
+ * ELF_STRIP_MINIMAL writes a new section table with just .dynamic, .dynstr
+ * and .shstrtab, which is what bionic checks; if that would not make the
+ * file smaller the file is left alone. Use it for anything Android loads.
+ *
+ * ELF_STRIP_ALL drops the table, leaving e_shnum 0. bionic refuses such a
+ * library ("has no section headers"), so it is only for loaders that go by
+ * the program headers alone, such as glibc's ld.so.
+ *
+ * Call it last, after all other edits and before elf_save().
+ *
+ * @param ctx Pointer to an initialized ElfContext
+ * @param mode ELF_STRIP_MINIMAL or ELF_STRIP_ALL
+ * @param saved Optional, receives how many bytes the file shrank by
+ * @return 0 on success, non-zero error code on failure
+ */
+int elf_strip(ElfContext* ctx, int mode, size_t* saved);
+
 /**
  * Get error message for the last error
  *
@@ -0,0 +1,221 @@
+/**
+ * elfmod_priv.h - Internal helpers shared by the elfmod sources
+ *
+ * Every multi-byte ELF field is read and written through the accessors
+ * below so that foreign-endian files (EI_DATA differs from the host) are
+ * byte-swapped transparently.
+ */
+
+#ifndef ELFMOD_PRIV_H
+#define ELFMOD_PRIV_H
+
+#include "elfmod.h"
+#include "../elfcrc.h"
+#include "../elfendian.h"
+
+// USDT probes (provider "elfmod") around each phase, see ../elfprobe.h
+#define ELF_PROBE_PROVIDER elfmod
+#include "../elfprobe.h"
+
+// Hot loops are compiled once per (class, byte order) combination so that
+// native files never evaluate a swap. ELF_SPECIALIZE calls fn with the two
+// flags appended as compile-time constants; fn must be ELF_ALWAYS_INLINE.
+#define ELF_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+#define ELF_SPECIALIZE(ctx, fn, ...) \
+    ((ctx)->needs_swap \
+        ? ((ctx)->is_64bit ? fn(__VA_ARGS__, true, true) : fn(__VA_ARGS__, false, true)) \
+        : ((ctx)->is_64bit ? fn(__VA_ARGS__, true, false) : fn(__VA_ARGS__, false, false)))
+
+ELF_ALWAYS_INLINE uint64_t elf_swap_if(uint64_t v, size_t size, bool swap) {
+    if (!swap) {
+        return v;
+    }
+
+    switch (size) {
+        case 2: return __builtin_bswap16((uint16_t)v);
+        case 4: return __builtin_bswap32((uint32_t)v);
+        case 8: return __builtin_bswap64(v);
+        default: return v;
+    }
+}
+
+ELF_ALWAYS_INLINE int64_t elf_dyn_tag_at(const void* dyn, size_t i, bool is_64bit, bool swap) {
+    return is_64bit ? (int64_t)elf_swap_if(((const Elf64_Dyn*)dyn)[i].d_tag, 8, swap)
+                    : (int32_t)elf_swap_if((uint32_t)((const Elf32_Dyn*)dyn)[i].d_tag, 4, swap);
+}
+
+ELF_ALWAYS_INLINE uint64_t elf_dyn_val_at(const void* dyn, size_t i, bool is_64bit, bool swap) {
+    return is_64bit ? elf_swap_if(((const Elf64_Dyn*)dyn)[i].d_un.d_val, 8, swap)
+                    : elf_swap_if(((const Elf32_Dyn*)dyn)[i].d_un.d_val, 4, swap);
+}
+
+// Read a raw field in file byte order and return it in host byte order
+#define ELF_GET(ctx, field) \
+    ((__typeof__(field))elf_swap_if((uint64_t)(field), sizeof(field), (ctx)->needs_swap))
+
+// Store a host-order value into a raw field in file byte order
+#define ELF_SET(ctx, field, value) \
+    ((field) = (__typeof__(field))elf_swap_if((uint64_t)(value), sizeof(field), (ctx)->needs_swap))
+
+// Store a value and record the field as modified for elf_verify()
+#define ELF_SET_TOUCH(ctx, field, value) do { \
+    ELF_SET(ctx, field, value); \
+    elf_touch(ctx, &(field), sizeof(field)); \
+} while (0)
+
+void elf_touch(ElfContext* ctx, const void* ptr, size_t size);
+
+// Class-independent header field access
+#define ELF_EHDR(ctx, f) \
+    ((ctx)->is_64bit ? (uint64_t)ELF_GET(ctx, (ctx)->ehdr64->f) \
+                     : (uint64_t)ELF_GET(ctx, (ctx)->ehdr32->f))
+
+#define ELF_EHDR_SET(ctx, f, v) do { \
+    if ((ctx)->is_64bit) ELF_SET_TOUCH(ctx, (ctx)->ehdr64->f, v); \
+    else ELF_SET_TOUCH(ctx, (ctx)->ehdr32->f, v); \
+} while (0)
+
+#define ELF_PHDR(ctx, i, f) \
+    ((ctx)->is_64bit ? (uint64_t)ELF_GET(ctx, (ctx)->phdr64[i].f) \
+                     : (uint64_t)ELF_GET(ctx, (ctx)->phdr32[i].f))
+
+#define ELF_PHDR_SET(ctx, i, f, v) do { \
+    if ((ctx)->is_64bit) ELF_SET_TOUCH(ctx, (ctx)->phdr64[i].f, v); \
+    else ELF_SET_TOUCH(ctx, (ctx)->phdr32[i].f, v); \
+} while (0)
+
+#define ELF_SHDR(ctx, i, f) \
+    ((ctx)->is_64bit ? (uint64_t)ELF_GET(ctx, (ctx)->shdr64[i].f) \
+                     : (uint64_t)ELF_GET(ctx, (ctx)->shdr32[i].f))
+
+#define ELF_SHDR_SET(ctx, i, f, v) do { \
+    if ((ctx)->is_64bit) ELF_SET_TOUCH(ctx, (ctx)->shdr64[i].f, v); \
+    else ELF_SET_TOUCH(ctx, (ctx)->shdr32[i].f, v); \
+} while (0)
+
+// Dynamic entries: tags are signed, values are unsigned
+static inline int64_t elf_dyn_tag(const ElfContext* ctx, size_t i) {
+    return elf_dyn_tag_at(ctx->dyn32, i, ctx->is_64bit, ctx->needs_swap);
+}
+
+static inline uint64_t elf_dyn_val(const ElfContext* ctx, size_t i) {
+    return elf_dyn_val_at(ctx->dyn32, i, ctx->is_64bit, ctx->needs_swap);
+}
+
+static inline void elf_dyn_set(ElfContext* ctx, size_t i, int64_t tag, uint64_t val) {
+    if (ctx->is_64bit) {
+        ELF_SET(ctx, ctx->dyn64[i].d_tag, tag);
+        ELF_SET(ctx, ctx->dyn64[i].d_un.d_val, val);
+        elf_touch(ctx, &ctx->dyn64[i], sizeof(Elf64_Dyn));
+    } else {
+        ELF_SET(ctx, ctx->dyn32[i].d_tag, tag);
+        ELF_SET(ctx, ctx->dyn32[i].d_un.d_val, val);
+        elf_touch(ctx, &ctx->dyn32[i], sizeof(Elf32_Dyn));
+    }
+}
+
+static inline void elf_dyn_set_val(ElfContext* ctx, size_t i, uint64_t val) {
+    if (ctx->is_64bit) {
+        ELF_SET_TOUCH(ctx, ctx->dyn64[i].d_un.d_val, val);
+    } else {
+        ELF_SET_TOUCH(ctx, ctx->dyn32[i].d_un.d_val, val);
+    }
+}
+
+void elf_set_error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// Match section headers to the dynamic table and string table (lazily)
+void elf_find_sections(ElfContext* ctx);
+
+/**
+ * Translate a virtual address to a file offset through the segment map
+ *
+ * @return 0 on success, -1 if no segment maps the address from the file
+ */
+int elf_vaddr_to_offset(ElfContext* ctx, uint64_t vaddr, uint64_t* offset);
+
+/**
+ * Reserve zeroed space past the end of the file, mapped by a load segment
+ *
+ * The first call either extends the highest PT_LOAD (when it is read-only
+ * and already ends at the end of the file) or converts a spare PT_NULL into
+ * a new one. Without a spare, the program header table moves into the new
+ * segment, growing by the new PT_LOAD (and a PT_PHDR if there was none)
+ * plus a spare PT_NULL, so no entry is lost.
+ * Pointers held in ctx stay valid; raw pointers held by the caller do not.
+ *
+ * @return 0 on success with the file offset and virtual address of the space
+ */
+int elf_tail_alloc(ElfContext* ctx, size_t size, size_t align,
+                   uint64_t* offset, uint64_t* vaddr);
+
+/**
+ * Append 'size' zeroed bytes mapped by a new PT_LOAD of their own with
+ * 'flags', above every other segment
+ *
+ * For data that must not share the tail's permissions. A spare PT_NULL is
+ * used, or the program headers move into a read-only segment first. The
+ * tail is closed: the next elf_tail_alloc starts a new one above.
+ *
+ * @return 0 on success with the file offset and virtual address of the space
+ */
+int elf_segment_alloc(ElfContext* ctx, size_t size, size_t align, uint32_t flags,
+                      uint64_t* offset, uint64_t* vaddr);
+
+/**
+ * Use the highest PT_LOAD as the tail segment if it is read-only and ends
+ * at the end of the file without a .bss tail, e.g. one appended by an
+ * earlier edit
+ *
+ * @return true if a tail segment is in use afterwards
+ */
+bool elf_tail_adopt(ElfContext* ctx);
+
+/**
+ * Give back the end of the appended data from 'end' on
+ *
+ * The tail segment shrinks with it; a segment elfmod created that ends up
+ * empty becomes PT_NULL again, an adopted one never shrinks to nothing, and
+ * program headers moved into the tail are kept. Everything past 'end' must
+ * be dead. Modified ranges past 'end' are dropped.
+ */
+void elf_tail_truncate(ElfContext* ctx, uint64_t end);
+
+// Cut the image at 'end' (not past the current size), dropping modified
+// ranges past it
+void elf_set_file_size(ElfContext* ctx, uint64_t end);
+
+// Image pointer for [vaddr, vaddr + size), NULL unless one load segment
+// maps the whole range from the file
+void* elf_vaddr_ptr(ElfContext* ctx, uint64_t vaddr, uint64_t size);
+
+// Value of the first dynamic entry with 'tag', 0 if found
+int elf_dyn_find(const ElfContext* ctx, int64_t tag, uint64_t* value);
+
+// Number of .dynsym entries, from DT_HASH, DT_GNU_HASH or the section headers
+int elf_dynsym_count(ElfContext* ctx, size_t* count);
+
+/**
+ * Grow the dynamic string table by 'additional_size' zeroed bytes at its end
+ *
+ * A table that is last in the appended data grows in place, otherwise it is
+ * copied there first. Raw pointers into the image become invalid.
+ */
+int elf_expand_dynstr(ElfContext* ctx, size_t additional_size);
+
+/**
+ * Whether any string reference other than dynamic entry 'dyn_index' reaches
+ * into the string at 'offset', e.g. a version need naming the same library
+ * or a name the linker stored as its suffix. True as well when not every
+ * reference can be found (no symbol count), so callers stay on the safe side.
+ */
+bool elf_dynstr_shared(ElfContext* ctx, uint64_t offset, size_t dyn_index);
+
+/**
+ * Point ctx, DT_STRTAB/DT_STRSZ and a matching .dynstr section header at a
+ * string table already written at 'dynstr' (inside the image)
+ */
+void elf_update_dynstr(ElfContext* ctx, char* dynstr, uint64_t vaddr, size_t size);
+
+#endif /* ELFMOD_PRIV_H */
@@ -0,0 +1,342 @@
+/**
+ * elfneeded.c - Adding and removing DT_NEEDED entries
+ *
+ * New entries go into the DT_NULL slack at the end of .dynamic. When there
+ * is not enough of it, the dynamic table is moved into the appended data
+ * with room to spare, and PT_DYNAMIC, the .dynamic section header and the
+ * _DYNAMIC symbols are pointed at the copy.
+ *
+ * A table that was writable gets a writable PT_LOAD of its own, so the
+ * string table and program headers appended with it stay read-only. The
+ * copy is outside PT_GNU_RELRO: an object has one such range and it cannot
+ * reach over .data up to the new segment, so the moved table stays
+ * writable after relocation, as on targets without RELRO.
+ */
+
+#include "elfmod.h"
+#include "elfmod_priv.h"
+#include <string.h>
+
+// Spare DT_NULL entries given to a relocated dynamic table, so later
+// additions fit in place
+#define DYNAMIC_SPARE_ENTRIES 8
+
+// Number of entries before the first DT_NULL
+static size_t dyn_used(const ElfContext* ctx) {
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        if (elf_dyn_tag(ctx, i) == DT_NULL) {
+            return i;
+        }
+    }
+    return ctx->dyn_count;
+}
+
+static bool has_needed(const ElfContext* ctx, const char* lib) {
+    for (size_t i = 0; i < ctx->dyn_count; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        if (tag == DT_NULL) {
+            break;
+        }
+        uint64_t name = elf_dyn_val(ctx, i);
+        if (tag == DT_NEEDED && name < ctx->dynstr_size && strcmp(ctx->dynstr + name, lib) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Offset of 'lib' in .dynstr, also as the suffix of a longer string
+static bool find_string(const ElfContext* ctx, const char* lib, uint64_t* offset) {
+    size_t length = strlen(lib);
+    const char* end = ctx->dynstr + ctx->dynstr_size;
+    for (const char* nul = ctx->dynstr; (nul = memchr(nul, '\0', end - nul)) != NULL; nul++) {
+        if ((size_t)(nul - ctx->dynstr) >= length && memcmp(nul - length, lib, length) == 0) {
+            *offset = nul - length - ctx->dynstr;
+            return true;
+        }
+    }
+    return false;
+}
+
+// A file named by a version requirement must stay loaded: the loader
+// insists on finding it when it checks the versions
+static bool has_version_needs(ElfContext* ctx, const char* lib) {
+    uint64_t addr, num;
+    if (elf_dyn_find(ctx, DT_VERNEED, &addr) != 0) {
+        return false;
+    }
+    if (elf_dyn_find(ctx, DT_VERNEEDNUM, &num) != 0) {
+        num = UINT64_MAX;
+    }
+
+    for (uint64_t n = 0; n < num; n++) {
+        Elf32_Verneed* need = elf_vaddr_ptr(ctx, addr, sizeof(Elf32_Verneed));
+        if (!need) {
+            break;
+        }
+        uint32_t file = ELF_GET(ctx, need->vn_file);
+        if (file < ctx->dynstr_size && strcmp(ctx->dynstr + file, lib) == 0) {
+            return true;
+        }
+        if (ELF_GET(ctx, need->vn_next) == 0) {
+            break;
+        }
+        addr += ELF_GET(ctx, need->vn_next);
+    }
+    return false;
+}
+
+// Point the _DYNAMIC symbols of a symbol table at the moved table
+static void move_dynamic_symbol(ElfContext* ctx, uint8_t* syms, size_t count, size_t sym_size,
+                                const char* strtab, uint64_t strtab_size,
+                                uint64_t old_addr, uint64_t new_addr) {
+    for (size_t i = 1; i < count; i++) {
+        uint8_t* sym = syms + i * sym_size;
+        uint32_t name = ELF_GET(ctx, *(uint32_t*)sym);
+        if (name >= strtab_size || strcmp(strtab + name, "_DYNAMIC") != 0) {
+            continue;
+        }
+        if (ctx->is_64bit) {
+            Elf64_Sym* sym64 = (Elf64_Sym*)sym;
+            if (ELF_GET(ctx, sym64->st_value) == old_addr) {
+                ELF_SET_TOUCH(ctx, sym64->st_value, new_addr);
+            }
+        } else {
+            Elf32_Sym* sym32 = (Elf32_Sym*)sym;
+            if (ELF_GET(ctx, sym32->st_value) == old_addr) {
+                ELF_SET_TOUCH(ctx, sym32->st_value, new_addr);
+            }
+        }
+    }
+}
+
+static void move_dynamic_symbols(ElfContext* ctx, uint64_t old_addr, uint64_t new_addr) {
+    uint8_t* base = (uint8_t*)ctx->ehdr32;
+    size_t sym_size = ctx->is_64bit ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+    // .dynsym through the dynamic tags, so stripped files are covered too
+    uint64_t symtab;
+    size_t count;
+    if (elf_dyn_find(ctx, DT_SYMTAB, &symtab) == 0 && elf_dynsym_count(ctx, &count) == 0) {
+        uint8_t* syms = elf_vaddr_ptr(ctx, symtab, (uint64_t)count * sym_size);
+        if (syms) {
+            move_dynamic_symbol(ctx, syms, count, sym_size, ctx->dynstr, ctx->dynstr_size,
+                                old_addr, new_addr);
+        }
+    }
+
+    // .symtab only exists as a section
+    for (size_t i = 1; i < ctx->section_count; i++) {
+        if (ELF_SHDR(ctx, i, sh_type) != SHT_SYMTAB) {
+            continue;
+        }
+        uint64_t offset = ELF_SHDR(ctx, i, sh_offset);
+        uint64_t size = ELF_SHDR(ctx, i, sh_size);
+        uint64_t link = ELF_SHDR(ctx, i, sh_link);
+        if (link == 0 || link >= ctx->section_count || offset + size > ctx->file_size) {
+            continue;
+        }
+        uint64_t str_offset = ELF_SHDR(ctx, link, sh_offset);
+        uint64_t str_size = ELF_SHDR(ctx, link, sh_size);
+        if (str_offset + str_size > ctx->file_size) {
+            continue;
+        }
+        move_dynamic_symbol(ctx, base + offset, size / sym_size, sym_size,
+                            (const char*)base + str_offset, str_size, old_addr, new_addr);
+    }
+}
+
+// Index of PT_DYNAMIC, SIZE_MAX if there is none
+static size_t find_dynamic_phdr(const ElfContext* ctx) {
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) == PT_DYNAMIC) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+// Move the dynamic table into the appended data with room for 'count' entries
+static int relocate_dynamic(ElfContext* ctx, size_t count) {
+    size_t dyn_size = ctx->is_64bit ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    size_t used = dyn_used(ctx);
+
+    size_t dyn_phdr = find_dynamic_phdr(ctx);
+    if (dyn_phdr == SIZE_MAX) {
+        elf_set_error("Could not find PT_DYNAMIC");
+        return -1;
+    }
+    uint64_t old_addr = ELF_PHDR(ctx, dyn_phdr, p_vaddr);
+
+    // The copy must be as writable as the original (DT_DEBUG is written at
+    // run time)
+    bool writable = false;
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) == PT_LOAD && old_addr >= ELF_PHDR(ctx, i, p_vaddr) &&
+            old_addr - ELF_PHDR(ctx, i, p_vaddr) < ELF_PHDR(ctx, i, p_memsz)) {
+            writable = (ELF_PHDR(ctx, i, p_flags) & PF_W) != 0;
+            break;
+        }
+    }
+
+    uint64_t offset, vaddr;
+    int allocated = writable ? elf_segment_alloc(ctx, count * dyn_size, dyn_size, PF_R | PF_W, &offset, &vaddr)
+                             : elf_tail_alloc(ctx, count * dyn_size, dyn_size, &offset, &vaddr);
+    if (allocated != 0) {
+        return -1;
+    }
+    // The program headers may have moved or shifted
+    dyn_phdr = find_dynamic_phdr(ctx);
+
+    // Everything past the used entries is already zero, i.e. DT_NULL
+    uint8_t* moved = (uint8_t*)ctx->ehdr32 + offset;
+    memcpy(moved, ctx->dyn32, used * dyn_size);
+    ctx->dyn32 = (Elf32_Dyn*)moved;
+    ctx->dyn_count = count;
+
+    ELF_PHDR_SET(ctx, dyn_phdr, p_offset, offset);
+    ELF_PHDR_SET(ctx, dyn_phdr, p_vaddr, vaddr);
+    ELF_PHDR_SET(ctx, dyn_phdr, p_paddr, vaddr);
+    ELF_PHDR_SET(ctx, dyn_phdr, p_filesz, count * dyn_size);
+    ELF_PHDR_SET(ctx, dyn_phdr, p_memsz, count * dyn_size);
+
+    if (ctx->dyn_section_idx != 0) {
+        ELF_SHDR_SET(ctx, ctx->dyn_section_idx, sh_offset, offset);
+        ELF_SHDR_SET(ctx, ctx->dyn_section_idx, sh_addr, vaddr);
+        ELF_SHDR_SET(ctx, ctx->dyn_section_idx, sh_size, count * dyn_size);
+    }
+
+    move_dynamic_symbols(ctx, old_addr, vaddr);
+    return 0;
+}
+
+int elf_add_needed_libs(ElfContext* ctx, const char* const* libs, size_t count) {
+    if (!ctx || (count > 0 && !libs)) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+
+    // Match section headers before any table moves
+    elf_find_sections(ctx);
+
+    // Libraries already needed are skipped, so a second run changes nothing
+    const char** add = malloc((count + 1) * sizeof(const char*));
+    uint64_t* names = malloc((count + 1) * sizeof(uint64_t));
+    int result = -1;
+    if (!add || !names) {
+        elf_set_error("Memory allocation failed");
+        goto out;
+    }
+    size_t add_count = 0;
+    size_t string_bytes = 0;
+    for (size_t n = 0; n < count; n++) {
+        bool duplicate = has_needed(ctx, libs[n]);
+        for (size_t k = 0; k < add_count && !duplicate; k++) {
+            duplicate = strcmp(add[k], libs[n]) == 0;
+        }
+        if (duplicate) {
+            continue;
+        }
+        if (!find_string(ctx, libs[n], &names[add_count])) {
+            names[add_count] = UINT64_MAX;
+            string_bytes += strlen(libs[n]) + 1;
+        }
+        add[add_count++] = libs[n];
+    }
+    if (add_count == 0) {
+        result = 0;
+        goto out;
+    }
+
+    // Names not in the table yet are appended to it
+    if (string_bytes > 0) {
+        uint64_t offset = ctx->dynstr_size;
+        if (elf_expand_dynstr(ctx, string_bytes) != 0) {
+            elf_set_error("Failed to expand dynamic string table: %s", elf_get_error());
+            goto out;
+        }
+        for (size_t k = 0; k < add_count; k++) {
+            if (names[k] == UINT64_MAX) {
+                size_t length = strlen(add[k]) + 1;
+                memcpy(ctx->dynstr + offset, add[k], length);
+                names[k] = offset;
+                offset += length;
+            }
+        }
+    }
+
+    // One DT_NULL must stay behind the entries
+    size_t used = dyn_used(ctx);
+    if (used + add_count + 1 > ctx->dyn_count &&
+        relocate_dynamic(ctx, used + add_count + 1 + DYNAMIC_SPARE_ENTRIES) != 0) {
+        goto out;
+    }
+
+    // New entries come first, so they are searched before the existing ones
+    size_t dyn_size = ctx->is_64bit ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    uint8_t* dyn = (uint8_t*)ctx->dyn32;
+    memmove(dyn + add_count * dyn_size, dyn, used * dyn_size);
+    elf_touch(ctx, dyn, (used + add_count) * dyn_size);
+    for (size_t k = 0; k < add_count; k++) {
+        elf_dyn_set(ctx, k, DT_NEEDED, names[k]);
+    }
+    elf_dyn_set(ctx, used + add_count, DT_NULL, 0);
+    result = 0;
+
+out:
+    free(add);
+    free(names);
+    return result;
+}
+
+int elf_add_needed_lib(ElfContext* ctx, const char* lib) {
+    return elf_add_needed_libs(ctx, &lib, 1);
+}
+
+int elf_remove_needed_libs(ElfContext* ctx, const char* const* libs, size_t count) {
+    if (!ctx || (count > 0 && !libs)) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+
+    for (size_t n = 0; n < count; n++) {
+        if (!has_needed(ctx, libs[n])) {
+            elf_set_error("Library not found in DT_NEEDED: %s", libs[n]);
+            return -1;
+        }
+        if (has_version_needs(ctx, libs[n])) {
+            elf_set_error("Library still has version requirements: %s", libs[n]);
+            return -1;
+        }
+    }
+
+    // Close the gaps; the freed entries become DT_NULL slack. The names
+    // stay in .dynstr until elf_compact_dynstr()
+    size_t used = dyn_used(ctx);
+    size_t kept = 0;
+    for (size_t i = 0; i < used; i++) {
+        int64_t tag = elf_dyn_tag(ctx, i);
+        uint64_t val = elf_dyn_val(ctx, i);
+        bool removed = false;
+        if (tag == DT_NEEDED && val < ctx->dynstr_size) {
+            for (size_t n = 0; n < count && !removed; n++) {
+                removed = strcmp(ctx->dynstr + val, libs[n]) == 0;
+            }
+        }
+        if (removed) {
+            continue;
+        }
+        if (kept != i) {
+            elf_dyn_set(ctx, kept, tag, val);
+        }
+        kept++;
+    }
+    for (size_t i = kept; i < used; i++) {
+        elf_dyn_set(ctx, i, DT_NULL, 0);
+    }
+    return 0;
+}
+
+int elf_remove_needed_lib(ElfContext* ctx, const char* lib) {
+    return elf_remove_needed_libs(ctx, &lib, 1);
+}
@@ -0,0 +1,223 @@
+/**
+ * elfstrip.c - Size-optimised output
+ *
+ * Drops what the loader never reads: non-allocated sections past the last
+ * segment, the section header table and the gap between the original end
+ * of the mapped data and data appended by elfmod. bionic does read a few
+ * section headers, so Android output keeps a minimal table; dropping it
+ * entirely (ELF_STRIP_ALL) is for other loaders only.
+ */
+
+#include "elfmod.h"
+#include "elfmod_priv.h"
+#include <string.h>
+
+// Names of the minimal section table: "", .dynamic, .dynstr, .shstrtab
+static const char minimal_names[] = "\0.dynamic\0.dynstr\0.shstrtab";
+#define NAME_DYNAMIC  1
+#define NAME_DYNSTR   10
+#define NAME_SHSTRTAB 18
+
+// Move a pointer into [from, from + size) down by 'delta' bytes
+static void* rebase(void* ptr, uint8_t* from, uint64_t size, uint64_t delta) {
+    uint8_t* p = ptr;
+    return p && p >= from && p < from + size ? p - delta : ptr;
+}
+
+// The first offset at or after 'end' that is congruent to the tail's
+// address, so no padding is left in front of it; the current offset if
+// that is no lower
+static uint64_t packed_tail_offset(const ElfContext* ctx, uint64_t end) {
+    uint64_t align = ELF_PHDR(ctx, ctx->tail_phdr_idx, p_align);
+    if (align == 0) {
+        align = 1;
+    }
+    if ((align & (align - 1)) != 0) {
+        return ctx->tail_offset;
+    }
+
+    uint64_t offset = end + ((ctx->tail_addr - end) & (align - 1));
+    return offset < ctx->tail_offset ? offset : ctx->tail_offset;
+}
+
+// Slide the tail segment down to 'offset'
+static void move_tail(ElfContext* ctx, uint64_t offset) {
+    uint8_t* base = (uint8_t*)ctx->ehdr32;
+    uint8_t* from = base + ctx->tail_offset;
+    uint64_t size = ctx->file_size - ctx->tail_offset;
+    uint64_t delta = ctx->tail_offset - offset;
+    memmove(base + offset, from, size);
+    elf_touch(ctx, base + offset, size);
+
+    // Program headers kept in the segment are edited at their new place,
+    // the old copy is about to be cut off
+    uint64_t phoff = ELF_EHDR(ctx, e_phoff);
+    if (phoff >= ctx->tail_offset) {
+        ELF_EHDR_SET(ctx, e_phoff, phoff - delta);
+        ctx->phdr32 = (Elf32_Phdr*)(base + phoff - delta);
+    }
+
+    // Everything that pointed into the segment moves with it
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        uint64_t p_offset = ELF_PHDR(ctx, i, p_offset);
+        if (ELF_PHDR(ctx, i, p_type) != PT_NULL && p_offset >= ctx->tail_offset && p_offset < ctx->file_size) {
+            ELF_PHDR_SET(ctx, i, p_offset, p_offset - delta);
+        }
+    }
+
+    ctx->dyn32 = rebase(ctx->dyn32, from, size, delta);
+    ctx->dynstr = rebase(ctx->dynstr, from, size, delta);
+    if (ctx->dynstr_home_offset >= ctx->tail_offset) {
+        ctx->dynstr_home_offset -= delta;
+    }
+
+    ctx->tail_offset = offset;
+}
+
+// Bytes the minimal section table takes when written at 'end'
+static uint64_t minimal_sections_size(const ElfContext* ctx, uint64_t end) {
+    size_t shdr_size = ctx->is_64bit ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    size_t word_size = ctx->is_64bit ? 8 : 4;
+    uint64_t shoff = (end + sizeof(minimal_names) + word_size - 1) / word_size * word_size;
+    return shoff + 4 * shdr_size - end;
+}
+
+// Write .shstrtab and a section table describing .dynamic and .dynstr at
+// 'names_offset'; the image must already hold them
+static void write_minimal_sections(ElfContext* ctx, uint64_t names_offset) {
+    size_t shdr_size = ctx->is_64bit ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    size_t dyn_size = ctx->is_64bit ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    size_t word_size = ctx->is_64bit ? 8 : 4;
+    uint64_t shoff = (names_offset + sizeof(minimal_names) + word_size - 1) / word_size * word_size;
+    uint64_t new_end = shoff + 4 * shdr_size;
+
+    size_t dynamic = SIZE_MAX;
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        if (ELF_PHDR(ctx, i, p_type) == PT_DYNAMIC) {
+            dynamic = i;
+            break;
+        }
+    }
+
+    uint8_t* base = (uint8_t*)ctx->ehdr32;
+    memcpy(base + names_offset, minimal_names, sizeof(minimal_names));
+    memset(base + names_offset + sizeof(minimal_names), 0, new_end - names_offset - sizeof(minimal_names));
+    elf_touch(ctx, base + names_offset, new_end - names_offset);
+
+    ctx->shdr32 = (Elf32_Shdr*)(base + shoff);
+    ctx->section_count = 4;
+    ctx->shstrtab = (char*)base + names_offset;
+    ctx->dyn_section_idx = 1;
+    ctx->dynstr_idx = 2;
+    ctx->sections_resolved = true;
+
+    ELF_SHDR_SET(ctx, 1, sh_name, NAME_DYNAMIC);
+    ELF_SHDR_SET(ctx, 1, sh_type, SHT_DYNAMIC);
+    ELF_SHDR_SET(ctx, 1, sh_flags, SHF_ALLOC | SHF_WRITE);
+    ELF_SHDR_SET(ctx, 1, sh_addr, ELF_PHDR(ctx, dynamic, p_vaddr));
+    ELF_SHDR_SET(ctx, 1, sh_offset, ELF_PHDR(ctx, dynamic, p_offset));
+    ELF_SHDR_SET(ctx, 1, sh_size, ELF_PHDR(ctx, dynamic, p_filesz));
+    ELF_SHDR_SET(ctx, 1, sh_link, 2);
+    ELF_SHDR_SET(ctx, 1, sh_addralign, word_size);
+    ELF_SHDR_SET(ctx, 1, sh_entsize, dyn_size);
+
+    ELF_SHDR_SET(ctx, 2, sh_name, NAME_DYNSTR);
+    ELF_SHDR_SET(ctx, 2, sh_type, SHT_STRTAB);
+    ELF_SHDR_SET(ctx, 2, sh_flags, SHF_ALLOC);
+    ELF_SHDR_SET(ctx, 2, sh_addr, ctx->dynstr_addr);
+    ELF_SHDR_SET(ctx, 2, sh_offset, (uint8_t*)ctx->dynstr - base);
+    ELF_SHDR_SET(ctx, 2, sh_size, ctx->dynstr_size);
+    ELF_SHDR_SET(ctx, 2, sh_addralign, 1);
+
+    ELF_SHDR_SET(ctx, 3, sh_name, NAME_SHSTRTAB);
+    ELF_SHDR_SET(ctx, 3, sh_type, SHT_STRTAB);
+    ELF_SHDR_SET(ctx, 3, sh_offset, names_offset);
+    ELF_SHDR_SET(ctx, 3, sh_size, sizeof(minimal_names));
+    ELF_SHDR_SET(ctx, 3, sh_addralign, 1);
+
+    ELF_EHDR_SET(ctx, e_shoff, shoff);
+    ELF_EHDR_SET(ctx, e_shentsize, shdr_size);
+    ELF_EHDR_SET(ctx, e_shnum, 4);
+    ELF_EHDR_SET(ctx, e_shstrndx, 3);
+}
+
+int elf_strip(ElfContext* ctx, int mode, size_t* saved) {
+    if (!ctx || (mode != ELF_STRIP_MINIMAL && mode != ELF_STRIP_ALL)) {
+        elf_set_error("Invalid parameters");
+        return -1;
+    }
+
+    size_t ehdr_size = ctx->is_64bit ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    size_t phdr_size = ctx->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t old_size = ctx->file_size;
+
+    // Files from earlier elfmod versions have names past DT_STRSZ that only
+    // the .dynstr section header covers; without it DT_STRSZ must
+    uint64_t strsz;
+    if (elf_dyn_find(ctx, DT_STRSZ, &strsz) == 0 && strsz != ctx->dynstr_size) {
+        elf_update_dynstr(ctx, ctx->dynstr, ctx->dynstr_addr, ctx->dynstr_size);
+    }
+
+    // A table appended by an earlier run is still the tail
+    elf_tail_adopt(ctx);
+    uint64_t tail_start = ctx->has_tail ? ctx->tail_offset : old_size;
+
+    // End of everything the loader reads in front of the tail
+    uint64_t end = ehdr_size;
+    uint64_t phoff = ELF_EHDR(ctx, e_phoff);
+    if (phoff < tail_start && phoff + ctx->program_header_count * phdr_size > end) {
+        end = phoff + ctx->program_header_count * phdr_size;
+    }
+    for (size_t i = 0; i < ctx->program_header_count; i++) {
+        uint64_t offset = ELF_PHDR(ctx, i, p_offset);
+        uint64_t size = ELF_PHDR(ctx, i, p_filesz);
+        if (ELF_PHDR(ctx, i, p_type) == PT_NULL || size == 0 || offset >= tail_start) {
+            continue;
+        }
+        if (offset + size > end) {
+            end = offset + size;
+        }
+    }
+
+    uint64_t tail_offset = ctx->has_tail ? packed_tail_offset(ctx, end) : end;
+    uint64_t new_size = tail_offset + (old_size - tail_start);
+    uint64_t sections_offset = new_size;
+    if (mode == ELF_STRIP_MINIMAL) {
+        new_size += minimal_sections_size(ctx, sections_offset);
+    }
+
+    // Nothing to gain: a minimal table would not fit in what is dropped
+    if (new_size >= old_size && mode == ELF_STRIP_MINIMAL) {
+        if (saved) {
+            *saved = 0;
+        }
+        return 0;
+    }
+
+    if (ctx->has_tail && tail_offset < ctx->tail_offset) {
+        move_tail(ctx, tail_offset);
+    }
+
+    if (mode == ELF_STRIP_MINIMAL) {
+        write_minimal_sections(ctx, sections_offset);
+    } else {
+        ELF_EHDR_SET(ctx, e_shoff, 0);
+        ELF_EHDR_SET(ctx, e_shnum, 0);
+        ELF_EHDR_SET(ctx, e_shstrndx, SHN_UNDEF);
+        ctx->shdr32 = NULL;
+        ctx->section_count = 0;
+        ctx->shstrtab = NULL;
+        ctx->dyn_section_idx = 0;
+        ctx->dynstr_idx = 0;
+        ctx->sections_resolved = true;
+    }
+
+    if (new_size < old_size) {
+        elf_set_file_size(ctx, new_size);
+    }
+
+    if (saved) {
+        *saved = old_size - ctx->file_size;
+    }
+    return 0;
+}
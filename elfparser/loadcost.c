@@ -0,0 +1,200 @@
+/**
+ * loadcost.c - Compare the load-time cost of original and patched libraries
+ *
+ * Usage: loadcost [-n iterations] [-p page_size] [-d default_dirs]
+ *                 <original> <patched> [<original> <patched> ...]
+ *
+ * Every pair gets a static comparison (mapped pages, load segments,
+ * .dynstr growth, dependency search) and, unless -n 0 is given, a dlopen
+ * latency comparison: both libraries are loaded and unloaded alternately
+ * 'iterations' times and the median latencies are compared. Totals over
+ * all pairs are printed at the end. Nothing needs the network.
+ */
+
+#include "elfcost.h"
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    int64_t extra_pages;
+    int64_t new_load_segments;
+    int64_t dynstr_growth;
+    int64_t longest_dynstr_growth;
+    int64_t probe_delta;
+    double latency_delta;     // sum of median differences, in microseconds
+    size_t latency_pairs;
+    size_t pairs;
+    size_t failed;
+} Totals;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double* samples, int count) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+    return count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+}
+
+// One timed dlopen/dlclose; the path is absolute so no search is involved
+static int time_dlopen(const char* path, double* latency) {
+    double start = now_us();
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    double end = now_us();
+    if (!handle) {
+        printf("  dlopen failed:   %s\n", dlerror());
+        return -1;
+    }
+    dlclose(handle);
+    *latency = end - start;
+    return 0;
+}
+
+/**
+ * Alternate between the two libraries so drift affects both alike
+ *
+ * @return 0 with the median latencies in microseconds, -1 if either fails to load
+ */
+static int bench_pair(const char* original, const char* patched, int iterations,
+                      double* before, double* after) {
+    char original_path[PATH_MAX], patched_path[PATH_MAX];
+    if (!realpath(original, original_path) || !realpath(patched, patched_path)) {
+        return -1;
+    }
+
+    double* samples = malloc(2 * iterations * sizeof(double));
+    if (!samples) {
+        return -1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < iterations && result == 0; i++) {
+        if (time_dlopen(original_path, &samples[i]) != 0 ||
+            time_dlopen(patched_path, &samples[iterations + i]) != 0) {
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        *before = median(samples, iterations);
+        *after = median(samples + iterations, iterations);
+    }
+
+    free(samples);
+    return result;
+}
+
+static int profile_file(const char* path, uint64_t page_size, size_t default_dirs,
+                        ElfLoadProfile* profile) {
+    ElfContext ctx;
+    if (elf_load(path, &ctx) != 0) {
+        fprintf(stderr, "Failed to load %s: %s\n", path, elf_get_error());
+        return -1;
+    }
+    int result = elf_load_profile(&ctx, page_size, default_dirs, profile);
+    if (result != 0) {
+        fprintf(stderr, "Failed to profile %s: %s\n", path, elf_get_error());
+    }
+    elf_close(&ctx);
+    return result;
+}
+
+static void compare_pair(const char* original, const char* patched, int iterations,
+                         uint64_t page_size, size_t default_dirs, Totals* totals) {
+    ElfLoadProfile before, after;
+    ElfLoadCost cost;
+
+    printf("%s -> %s\n", original, patched);
+    if (profile_file(original, page_size, default_dirs, &before) != 0 ||
+        profile_file(patched, page_size, default_dirs, &after) != 0) {
+        totals->failed++;
+        return;
+    }
+    elf_load_cost(&before, &after, &cost);
+
+    printf("  load segments:   %zu -> %zu (%+lld)\n", before.load_segments, after.load_segments,
+           (long long)cost.new_load_segments);
+    printf("  mapped pages:    %llu -> %llu (%+lld)\n", (unsigned long long)before.mapped_pages,
+           (unsigned long long)after.mapped_pages, (long long)cost.extra_pages);
+    printf("  .dynstr bytes:   %zu -> %zu (%+lld)\n", before.dynstr_size, after.dynstr_size,
+           (long long)cost.dynstr_growth);
+    printf("  DT_NEEDED paths: %zu -> %zu of %zu (%+lld)\n", before.needed_absolute,
+           after.needed_absolute, after.needed_count, (long long)cost.absolute_delta);
+    printf("  search probes:   %llu -> %llu (%+lld)\n", (unsigned long long)before.search_probes,
+           (unsigned long long)after.search_probes, (long long)cost.probe_delta);
+
+    totals->pairs++;
+    totals->extra_pages += cost.extra_pages;
+    totals->new_load_segments += cost.new_load_segments;
+    totals->dynstr_growth += cost.dynstr_growth;
+    totals->probe_delta += cost.probe_delta;
+    if (cost.dynstr_growth > totals->longest_dynstr_growth) {
+        totals->longest_dynstr_growth = cost.dynstr_growth;
+    }
+
+    if (iterations > 0) {
+        double latency_before, latency_after;
+        if (bench_pair(original, patched, iterations, &latency_before, &latency_after) == 0) {
+            printf("  dlopen median:   %.1f us -> %.1f us (%+.1f us, %d runs)\n",
+                   latency_before, latency_after, latency_after - latency_before, iterations);
+            totals->latency_delta += latency_after - latency_before;
+            totals->latency_pairs++;
+        } else {
+            printf("  dlopen:          not measured\n");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = 100;
+    uint64_t page_size = 4096;
+    size_t default_dirs = 2;
+
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-n") == 0) {
+            iterations = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-p") == 0) {
+            page_size = strtoull(argv[arg + 1], NULL, 0);
+        } else if (strcmp(argv[arg], "-d") == 0) {
+            default_dirs = strtoul(argv[arg + 1], NULL, 0);
+        } else {
+            break;
+        }
+        arg += 2;
+    }
+
+    if (argc - arg < 2 || (argc - arg) % 2 != 0 || page_size == 0 || (page_size & (page_size - 1))) {
+        printf("Usage: %s [-n iterations] [-p page_size] [-d default_dirs] "
+               "<original> <patched> [<original> <patched> ...]\n", argv[0]);
+        return 1;
+    }
+
+    Totals totals;
+    memset(&totals, 0, sizeof(totals));
+    for (; arg + 1 < argc; arg += 2) {
+        compare_pair(argv[arg], argv[arg + 1], iterations, page_size, default_dirs, &totals);
+    }
+
+    printf("\n%zu pairs compared, %zu failed\n", totals.pairs, totals.failed);
+    printf("  extra mapped pages:     %+lld\n", (long long)totals.extra_pages);
+    printf("  new load segments:      %+lld\n", (long long)totals.new_load_segments);
+    printf("  .dynstr growth total:   %+lld bytes\n", (long long)totals.dynstr_growth);
+    printf("  .dynstr growth longest: %lld bytes\n", (long long)totals.longest_dynstr_growth);
+    printf("  search probes:          %+lld\n", (long long)totals.probe_delta);
+    if (totals.latency_pairs > 0) {
+        printf("  dlopen median change:   %+.1f us average over %zu pairs\n",
+               totals.latency_delta / totals.latency_pairs, totals.latency_pairs);
+    }
+
+    return totals.failed ? 1 : 0;
+}
@@ -8,14 +8,27 @@
 
 int main(int argc, char** argv) {
     if (argc < 4) {
-        printf("Usage: %s <elf_file> <old_library> <new_library>\n", argv[0]);
+        printf("Usage: %s <elf_file> <old_library> <new_library> [--strip|--strip-all]\n", argv[0]);
         printf("Example: %s ./myprogram.so libc.so.6 libcustom.so\n", argv[0]);
+        printf("  --strip      drop what the loader does not read, keeping the section headers bionic checks\n");
+        printf("  --strip-all  drop the section header table too; not for Android, bionic refuses such files\n");
         return 1;
     }
     
     const char* filename = argv[1];
     const char* old_lib = argv[2];
     const char* new_lib = argv[3];
+    int strip_mode = -1;
+    if (argc > 4) {
+        if (strcmp(argv[4], "--strip") == 0) {
+            strip_mode = ELF_STRIP_MINIMAL;
+        } else if (strcmp(argv[4], "--strip-all") == 0) {
+            strip_mode = ELF_STRIP_ALL;
+        } else {
+            printf("Unknown option: %s\n", argv[4]);
+            return 1;
+        }
+    }
     ElfContext ctx;
     
     // Load the ELF file
@@ -66,7 +79,27 @@ int main(int argc, char** argv) {
         elf_close(&ctx);
         return 1;
     }
-    
+
+    // Drop strings the replacement left unreferenced; a table that cannot be
+    // compacted (e.g. no symbol count without hash tables or sections) is
+    // left as it is, the replacement stands on its own
+    size_t saved;
+    if (elf_compact_dynstr(&ctx, &saved) != 0) {
+        fprintf(stderr, "Warning: .dynstr not compacted: %s\n", elf_get_error());
+    } else {
+        printf("Compacted .dynstr, %zu bytes saved\n", saved);
+    }
+
+    // Drop the section metadata the loader never reads
+    if (strip_mode >= 0) {
+        if (elf_strip(&ctx, strip_mode, &saved) != 0) {
+            fprintf(stderr, "Failed to strip: %s\n", elf_get_error());
+            elf_close(&ctx);
+            return 1;
+        }
+        printf("Stripped section metadata, %zu bytes saved\n", saved);
+    }
+
     // Create output filename
     char output_filename[256];
     snprintf(output_filename, sizeof(output_filename), "%s.modified", filename);
@@ -80,23 +113,26 @@ int main(int argc, char** argv) {
     
     printf("Successfully saved modified ELF to: %s\n", output_filename);
     
-    // Check the modifications
-    ElfContext new_ctx;
-    if (elf_load(output_filename, &new_ctx) == 0) {
-        needed_libs = elf_get_needed_libs(&new_ctx, &needed_count);
-        if (needed_libs) {
-            printf("\nVerifying modified DT_NEEDED libraries (%zu entries):\n", needed_count);
-            for (size_t i = 0; i < needed_count; i++) {
-                printf("%2zu. %s\n", i + 1, needed_libs[i]);
-            }
-            
-            // Free the allocated strings
-            for (size_t i = 0; i < needed_count; i++) {
-                free(needed_libs[i]);
-            }
-            free(needed_libs);
+    // Check the modifications: only the header, dynamic table and the
+    // ranges we changed are read back
+    if (elf_verify(&ctx, output_filename) != 0) {
+        fprintf(stderr, "Verification of modified ELF failed: %s\n", elf_get_error());
+        elf_close(&ctx);
+        return 1;
+    }
+    
+    needed_libs = elf_get_needed_libs(&ctx, &needed_count);
+    if (needed_libs) {
+        printf("\nVerified modified DT_NEEDED libraries (%zu entries):\n", needed_count);
+        for (size_t i = 0; i < needed_count; i++) {
+            printf("%2zu. %s\n", i + 1, needed_libs[i]);
         }
-        elf_close(&new_ctx);
+        
+        // Free the allocated strings
+        for (size_t i = 0; i < needed_count; i++) {
+            free(needed_libs[i]);
+        }
+        free(needed_libs);
     }
     
     // Clean up
@@ -0,0 +1,65 @@
+/**
+ * needbench.c - Time elf_get_needed_libs() on one file
+ *
+ * The DT_NEEDED scan is specialised per (class, byte order), so a native
+ * file must not pay for the swapping accessors. Run this on a native file
+ * and on a byte-swapped copy of it before and after touching the accessors
+ * or ELF_SPECIALIZE; the best of several runs is reported.
+ */
+
+#include "elfmod.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Usage: %s <elf_file> [iterations] [runs]\n", argv[0]);
+        return 1;
+    }
+
+    long iterations = argc > 2 ? atol(argv[2]) : 1000000;
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+    if (iterations <= 0 || runs <= 0) {
+        printf("Iterations and runs must be positive\n");
+        return 1;
+    }
+
+    ElfContext ctx;
+    if (elf_load(argv[1], &ctx) != 0) {
+        fprintf(stderr, "Failed to load ELF file: %s\n", elf_get_error());
+        return 1;
+    }
+
+    double best = 0;
+    size_t checksum = 0;
+    for (int run = 0; run < runs; run++) {
+        double start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            size_t count;
+            char** libs = elf_get_needed_libs(&ctx, &count);
+            for (size_t j = 0; j < count; j++) {
+                checksum += strlen(libs[j]);
+                free(libs[j]);
+            }
+            free(libs);
+        }
+        double per_call = (now_ns() - start) / iterations;
+        if (run == 0 || per_call < best) {
+            best = per_call;
+        }
+    }
+
+    printf("%s (%s, %s): %.1f ns per call, best of %d runs of %ld (%zu)\n", argv[1],
+           ctx.is_64bit ? "64-bit" : "32-bit", ctx.needs_swap ? "swapped" : "native",
+           best, runs, iterations, checksum);
+
+    elf_close(&ctx);
+    return 0;
+}
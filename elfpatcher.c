@@ -1,32 +1,256 @@
 // elfpatcher.c
 #include "elfpatcher.h"
+#include "elfendian.h"
+#include "elfjournal.h"
+#include "elflock.h"
+
+#define ELF_PROBE_PROVIDER elfpatcher
+#include "elfprobe.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <unistd.h>
 
-int patch_auto(const char* path, const char* prefix) {
-	int fd = open(path, O_RDWR);
-    if (fd < 0) return FALSE;
-
+// with 'probe' set nothing is written and fd may be read-only
+static int patch_fd(int fd, const char* path, const char* prefix, int strategy, PatchRecipe* recipe, int probe, int verbose) {
     /* 1) read ELF header */
     Elf32_Ehdr eh;
-    if (read(fd, &eh, sizeof(eh)) != sizeof(eh)
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh)
      || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) {
      	printf("%s\n", "Failed to load ELF! Is the ELF valid?");
         close(fd);
         return FALSE;
     }
 
-	printf("Loaded ELF with class : %i\n", eh.e_ident[EI_CLASS]);
+	if (verbose) printf("Loaded ELF with class : %i\n", eh.e_ident[EI_CLASS]);
 	switch (eh.e_ident[EI_CLASS]) {
 		case ELFCLASS32:
-			return patch32(fd, prefix);
-		/* case ELFCLASS64:
-			return patch64(fd, prefix); */
+			return probe ? probe32(fd, path, prefix, strategy) : patch32(fd, path, prefix, strategy, recipe, verbose);
+		case ELFCLASS64:
+			return probe ? probe64(fd, path, prefix, strategy) : patch64(fd, path, prefix, strategy, recipe, verbose);
+		default:
+			close(fd);
+			return FALSE;
+
+	}
+}
+
+// a file patched with other rules is left alone: its names would get a
+// second prefix, or a prefix on top of a runpath
+static int rules_conflict(int fd, const char* path) {
+	printf("%s was patched with another rule set, revert it first\n", path);
+	close(fd);
+	return PATCH_CONFLICT;
+}
+
+// patch_probe on an open fd, which is closed on return
+static int probe_fd(int fd, const char* path, const char* prefix, int strategy) {
+	int mark = mark_read(fd, recipe_rules_hash(prefix, strategy));
+	if (mark == MARK_SAME) {
+		close(fd);
+		return PATCH_UNCHANGED;
+	}
+	if (mark == MARK_OTHER) return rules_conflict(fd, path);
+
+	return patch_fd(fd, path, prefix, strategy, NULL, TRUE, FALSE);
+}
+
+int patch_probe(const char* path, const char* prefix, int strategy) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return FALSE;
+	return probe_fd(fd, path, prefix, strategy);
+}
+
+// EI_CLASS and e_machine, FALSE if 'fd' is not an ELF file
+static int read_abi(int fd, int* elf_class, int* machine) {
+	// e_ident and e_machine sit at the same place in both classes
+	Elf32_Ehdr header;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) return FALSE;
+
+	*elf_class = header.e_ident[EI_CLASS];
+	*machine = elf_is_foreign(header.e_ident) ? __builtin_bswap16(header.e_machine) : header.e_machine;
+	return TRUE;
+}
+
+const PatchRule* patch_rule_find(const PatchRules* rules, int elf_class, int machine) {
+	for (int i = 0; i < rules->count; ++i) {
+		const PatchRule* rule = &rules->rules[i];
+		if ((rule->elf_class == PATCH_ANY || rule->elf_class == elf_class)
+		 && (rule->machine == PATCH_ANY || rule->machine == machine)) return rule;
+	}
+	return NULL;
+}
+
+const PatchRule* patch_rule_read(const PatchRules* rules, int fd) {
+	int elf_class, machine;
+	return read_abi(fd, &elf_class, &machine) ? patch_rule_find(rules, elf_class, machine) : NULL;
+}
+
+int read_deps(const char* path, ElfDeps* deps) {
+	memset(deps, 0, sizeof(ElfDeps));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return FALSE;
+
+	unsigned char ident[EI_NIDENT];
+	if (pread(fd, ident, EI_NIDENT, 0) != EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG) != 0) {
+		close(fd);
+		return FALSE;
+	}
+
+	switch (ident[EI_CLASS]) {
+		case ELFCLASS32:
+			return deps32(fd, deps);
+		case ELFCLASS64:
+			return deps64(fd, deps);
 		default:
+			close(fd);
 			return FALSE;
-			
 	}
 }
+
+void free_deps(ElfDeps* deps) {
+	for (int i = 0; i < deps->needed_count; ++i) free(deps->needed[i]);
+	free(deps->needed);
+	free(deps->search_path);
+	memset(deps, 0, sizeof(ElfDeps));
+}
+
+// open 'path' for writing and take its writer lock; -1 with the result to return if not
+static int open_locked(const char* path, int wait_ms, int* result) {
+	int fd = open(path, O_RDWR);
+	*result = fd < 0 ? FALSE : lock_file(fd, wait_ms);
+	if (*result == TRUE) return fd;
+
+	if (*result == PATCH_BUSY) printf("%s is busy, skipped\n", path);
+	if (fd >= 0) close(fd);
+	return -1;
+}
+
+int patch_fd_edits(int fd, const char* path, const char* prefix, const PatchConfig* config, PatchUndo* undo, PatchRecipe* edits) {
+	int strategy = config->strategy;
+	const char* recipe_dir = config->recipe_dir;
+	unsigned char build_id[RECIPE_MAX_BUILD_ID];
+	int build_id_size = elf_read_build_id(fd, build_id, sizeof(build_id));
+	uint64_t rules_hash = recipe_rules_hash(prefix, strategy);
+
+	if (config->cache && build_id_size > 0 && recipe_cache_get(config->cache, build_id, build_id_size, rules_hash, edits)) {
+		if (recipe_apply(edits, fd, undo)) {
+			if (config->verbose) printf("%s\n", "Applied cached recipe");
+			close(fd);
+			return TRUE;
+		}
+		recipe_free(edits);
+	}
+
+	char recipe_file[4096] = "";
+	if (recipe_dir && build_id_size > 0) {
+		recipe_path(recipe_file, sizeof(recipe_file), recipe_dir, build_id, build_id_size, rules_hash);
+
+		if (recipe_load(edits, recipe_file)) {
+			if (recipe_apply(edits, fd, undo)) {
+				if (config->verbose) printf("Applied recipe %s\n", recipe_file);
+				if (config->cache) recipe_cache_put(config->cache, edits);
+				close(fd);
+				return TRUE;
+			}
+			recipe_free(edits);
+
+			// same build, different bytes (e.g. already patched): patch it, keep the recipe
+			if (config->verbose) printf("%s\n", "Recipe precondition failed, patching");
+			recipe_file[0] = '\0';
+		}
+	}
+
+	struct stat st;
+	recipe_init(edits, build_id, build_id_size, rules_hash, fstat(fd, &st) == 0 ? st.st_size : 0);
+	edits->undo = undo;
+
+	int ok = patch_fd(fd, path, prefix, strategy, edits, FALSE, config->verbose);
+	if (ok == TRUE && recipe_file[0] && !recipe_save(edits, recipe_file)) printf("Failed to save recipe %s\n", recipe_file);
+	if (ok == TRUE && config->cache && build_id_size > 0) recipe_cache_put(config->cache, edits);
+	return ok;
+}
+
+// patch_file without the probes
+static int patch_path(const char* path, const PatchConfig* config) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return FALSE;
+
+	// the header picks the rule, the probe goes on reading the same fd
+	int elf_class, machine;
+	if (!read_abi(fd, &elf_class, &machine)) {
+		printf("%s\n", "Failed to load ELF! Is the ELF valid?");
+		close(fd);
+		return FALSE;
+	}
+
+	const PatchRule* rule = patch_rule_find(&config->rules, elf_class, machine);
+	if (!rule) {
+		printf("No rule for ELFCLASS%i e_machine %i, %s left alone\n", elf_class == ELFCLASS64 ? 64 : 32, machine, path);
+		close(fd);
+		return PATCH_UNCHANGED;
+	}
+	if (rule->abi && config->verbose) printf("Using the %s rule\n", rule->abi);
+	const char* prefix = rule->prefix;
+	int strategy = config->strategy;
+
+	int probe = probe_fd(fd, path, prefix, strategy);
+	if (probe != TRUE) return probe;
+
+	fd = open_locked(path, config->lock_wait_ms, &probe);
+	if (fd < 0) return probe;
+
+	// the writer we may have waited for could have used other rules
+	if (mark_read(fd, recipe_rules_hash(prefix, strategy)) == MARK_OTHER) return rules_conflict(fd, path);
+
+	// with a journal, the replaced bytes are collected through a recipe
+	const char* journal = config->journal;
+	PatchUndo undo;
+	if (journal && !undo_init(&undo, fd)) {
+		close(fd);
+		return FALSE;
+	}
+
+	// the fd given away is closed by the patcher, the lock stays until 'fd' closes
+	int ok;
+	if (config->recipe_dir || config->cache || journal) {
+		PatchRecipe edits;
+		ok = patch_fd_edits(dup(fd), path, prefix, config, journal ? &undo : NULL, &edits);
+		recipe_free(&edits);
+	} else {
+		ok = patch_fd(dup(fd), path, prefix, strategy, NULL, FALSE, config->verbose);
+	}
+
+	// a patch that cannot be journaled is taken back at once
+	if (journal && ok == TRUE && !journal_append(journal, path, &undo, fd)) {
+		printf("Failed to journal %s, reverting\n", path);
+		if (!undo_apply(&undo, fd)) printf("Failed to revert %s\n", path);
+		ok = FALSE;
+	}
+	if (journal) undo_free(&undo);
+
+	if (ok == TRUE) mark_write(fd, recipe_rules_hash(prefix, strategy));
+	close(fd);
+	return ok;
+}
+
+int patch_file(const char* path, const PatchConfig* config) {
+	ELF_PROBE_ENTRY(file, path);
+	int ok = patch_path(path, config);
+	ELF_PROBE_RESULT(file, path, ok);
+	return ok;
+}
+
+int patch_auto(const char* path, const char* prefix, int strategy) {
+	return patch_auto_recipe(path, prefix, strategy, NULL);
+}
+
+int patch_auto_recipe(const char* path, const char* prefix, int strategy, const char* recipe_dir) {
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, prefix };
+	PatchConfig config = { { &rule, 1 }, strategy, recipe_dir, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+	return patch_file(path, &config);
+}
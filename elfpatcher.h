@@ -1,6 +1,8 @@
 // elfpatcher.h
 #pragma once
 
+#include "elfrecipe.h"
+
 #include <linux/elf.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -8,18 +10,157 @@
 #define TRUE  1
 #define FALSE 0
 
+// returned instead of TRUE when the file already had the wanted names
+#define PATCH_UNCHANGED 2
+// returned when another writer held the file for longer than the lock wait
+#define PATCH_BUSY 3
+// returned when the file's marker records another rule set: patching on top
+// would stack prefixes, so it is left alone until it is reverted
+#define PATCH_CONFLICT 4
+
+// how the prefix is applied
+#define PATCH_STRATEGY_PREFIX  0 // prepend it to every DT_NEEDED name
+#define PATCH_STRATEGY_RUNPATH 1 // put the prefix directory first in DT_RUNPATH, only on request
+
+// matches every e_machine or ELF class in a PatchRule
+#define PATCH_ANY 0
+
+/**
+ * The prefix for one ABI. A file takes the first rule matching the
+ * e_machine and EI_CLASS of its header, so a tree mixing armeabi-v7a,
+ * arm64-v8a, x86 and x86_64 libraries is patched in one pass.
+ */
+typedef struct {
+	int machine;        // e_machine (EM_ARM, EM_AARCH64, ...) or PATCH_ANY
+	int elf_class;      // ELFCLASS32, ELFCLASS64 or PATCH_ANY
+	const char* abi;    // Android ABI name, e.g. "arm64-v8a", for messages
+	const char* prefix;
+} PatchRule;
+
+typedef struct {
+	const PatchRule* rules;
+	int count;
+} PatchRules;
+
+/**
+ * How files get patched, set up once (e.g. from the command line) and
+ * passed down to every entry point: single files, batches, the watcher,
+ * the daemon and archives.
+ */
+typedef struct {
+	PatchRules rules;       // prefix of each file by its ELF header
+	int strategy;           // one of PATCH_STRATEGY_*
+	const char* recipe_dir; // on-disk recipe cache, or NULL
+	const char* journal;    // undo journal of every file patched in place, or NULL
+	int lock_wait_ms;       // how long to wait for another writer, see LOCK_WAIT_* in elflock.h
+	int verbose;            // print the progress of every file, not only errors
+	RecipeCache* cache;     // in-memory recipes shared by the threads of a process, or NULL
+} PatchConfig;
+
 /**
  * Patch all DT_NEEDED entries by prefixing them with 'prefix'.
- *   - In‑place if the new string fits.
- *   - Otherwise grows .dynstr at EOF and updates DT_STRTAB/DT_STRSZ.
+ *   - Names that already start with 'prefix' are kept, so re-runs are no-ops.
+ *   - With PATCH_STRATEGY_RUNPATH the names stay bare and 'prefix', which
+ *     must then end in '/', becomes the first DT_RUNPATH directory instead:
+ *     one string for all dependencies. An existing DT_RPATH is extended
+ *     rather than hidden.
+ *     This is NOT equivalent to prefixing and is never picked on its own:
+ *     DT_RUNPATH is searched after LD_LIBRARY_PATH, a library missing from
+ *     the directory is silently loaded from the system paths instead, and
+ *     it does not apply to the dependencies' own DT_NEEDED lookups (an
+ *     extended DT_RPATH does). Check the result with sysroot_check, which
+ *     resolves bare names through the search path the way the loader does.
+ *   - The file is probed read-only first and only reopened for writing
+ *     when some name has to change, leaving mtime alone otherwise.
+ *   - Writing happens under the file's writer lock (see elflock.h), so
+ *     parallel workers may share a tree. A successful patch records the
+ *     rule set in a marker that later probes answer from without parsing.
+ *   - New names go to a copy of .dynstr at EOF, DT_STRTAB/DT_STRSZ follow.
+ *   - The writer lock is waited for LOCK_WAIT_DEFAULT and nothing is
+ *     journaled; patch_file takes both from a PatchConfig.
  *
  * @param path   path to the ELF file (must be writable)
  * @param prefix string to prepend to each DT_NEEDED name
- * @return TRUE on success, FALSE on error
+ * @param strategy one of PATCH_STRATEGY_*
+ * @return TRUE when patched, PATCH_UNCHANGED if nothing had to change,
+ *         PATCH_BUSY if another writer kept the lock, PATCH_CONFLICT if it
+ *         was patched with another rule set, FALSE on error
+ */
+int patch_auto(const char* path, const char* prefix, int strategy);
+
+/**
+ * Read-only check of what patch_auto would do.
+ *
+ * @return TRUE if the file needs patching, PATCH_UNCHANGED if not,
+ *         PATCH_CONFLICT if it was patched with another rule set, FALSE on error
  */
-int patch_auto(const char* path, const char* prefix);
+int patch_probe(const char* path, const char* prefix, int strategy);
+
+/**
+ * patch_auto with a recipe cache keyed by GNU build-id, prefix and strategy.
+ *   - A matching recipe in 'recipe_dir' is replayed with plain pwrites.
+ *   - Otherwise the file is patched normally and the writes are saved as a
+ *     new recipe. Files without a build-id are just patched.
+ *
+ * @param recipe_dir existing directory holding *.recipe files
+ * @return as patch_auto
+ */
+int patch_auto_recipe(const char* path, const char* prefix, int strategy, const char* recipe_dir);
+
+/**
+ * patch_auto with the prefix taken from 'config->rules' by the file's header.
+ *   - A file no rule matches is left alone and reported as PATCH_UNCHANGED.
+ *   - A file whose marker records another rule set is left alone and
+ *     reported as PATCH_CONFLICT; revert it with its journal first.
+ *   - The writer lock is waited for 'config->lock_wait_ms'.
+ *   - With 'config->journal' set the replaced bytes are journaled, so the
+ *     patch can be reverted (see journal_revert).
+ *   - 'config->recipe_dir' is the recipe cache, as for patch_auto_recipe.
+ *
+ * @return as patch_auto
+ */
+int patch_file(const char* path, const PatchConfig* config);
+
+// the first rule for a class and e_machine, NULL if none matches
+const PatchRule* patch_rule_find(const PatchRules* rules, int elf_class, int machine);
+// same, from the ELF header of 'fd'; NULL also if it is not an ELF file
+const PatchRule* patch_rule_read(const PatchRules* rules, int fd);
+
+/**
+ * Core of patch_file on an open fd, which is closed on return, with the
+ * prefix already picked. Strategy, recipe cache and verbosity come from
+ * 'config', the lock and journal are up to the caller. A recipe in
+ * 'config->cache' is replayed before one in 'config->recipe_dir', and any
+ * recipe that applied or was recorded goes to the cache.
+ * 'edits' receives the writes that were made, replayed or recorded, and
+ * must be released with recipe_free. If 'undo' is not NULL (see undo_init)
+ * it receives the bytes the writes replaced. 'path' names the file in
+ * the probes.
+ */
+int patch_fd_edits(int fd, const char* path, const char* prefix, const PatchConfig* config, PatchUndo* undo, PatchRecipe* edits);
+
+// same as patch_auto but architecture implementation, recording into 'recipe' if not NULL
+int patch32(int fd, const char* path, const char* prefix, int strategy, PatchRecipe* recipe, int verbose);
+int patch64(int fd, const char* path, const char* prefix, int strategy, PatchRecipe* recipe, int verbose);
+
+// same as patch_probe, 'fd' may be read-only and is closed on return
+int probe32(int fd, const char* path, const char* prefix, int strategy);
+int probe64(int fd, const char* path, const char* prefix, int strategy);
+
+// what the loader needs to find the dependencies of a file
+typedef struct {
+	int elf_class;
+	int machine;       // e_machine
+	char** needed;     // DT_NEEDED names, in order
+	int needed_count;
+	char* search_path; // DT_RUNPATH, else DT_RPATH, else NULL
+} ElfDeps;
+
+// read the dependencies of 'path', FALSE if it is not a supported ELF file
+int read_deps(const char* path, ElfDeps* deps);
+void free_deps(ElfDeps* deps);
 
-// same as patch_auto but architecture implementation
-int patch32(int fd, const char* prefix);
-// int patch64(int fd, const char* prefix);
+// same as read_deps, 'fd' is closed on return
+int deps32(int fd, ElfDeps* deps);
+int deps64(int fd, ElfDeps* deps);
 
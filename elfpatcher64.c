@@ -0,0 +1,3 @@
+// elfpatcher64.c
+#define ELF_BITS 64
+#include "elfpatcher_class.inc"
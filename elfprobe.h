@@ -0,0 +1,40 @@
+// elfprobe.h
+#pragma once
+
+/**
+ * USDT probes at the phase boundaries of a patch, for perf or bpftrace on
+ * production runs; see elfpatcher.bt. Shared by the fd patcher (provider
+ * "elfpatcher") and elfparser (provider "elfmod"): the includer defines
+ * ELF_PROBE_PROVIDER first, so both report the same probes with the same
+ * arguments.
+ *   <phase>_entry(path)     <phase>_return(path, file size, bytes grown, result)
+ * for the phases load, parse, plan, grow (the string table), write and
+ * verify, plus file_entry(path) and file_return(path, result) around a
+ * whole file where the provider has them.
+ *
+ * A probe site is a single nop plus an ELF note, and its arguments are
+ * values the patcher already has, so an untraced run pays nothing. Built
+ * without <sys/sdt.h> (systemtap-sdt-dev) the probes compile away.
+ */
+#ifndef ELF_PROBE_PROVIDER
+#error "define ELF_PROBE_PROVIDER before including elfprobe.h"
+#endif
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ELF_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef ELF_HAVE_SDT
+#define ELF_PROBE_ENTRY(phase, path) DTRACE_PROBE1(ELF_PROBE_PROVIDER, phase##_entry, path)
+#define ELF_PROBE_RETURN(phase, path, size, grown, result) \
+	DTRACE_PROBE4(ELF_PROBE_PROVIDER, phase##_return, path, size, grown, result)
+#define ELF_PROBE_RESULT(phase, path, result) DTRACE_PROBE2(ELF_PROBE_PROVIDER, phase##_return, path, result)
+#else
+#define ELF_PROBE_ENTRY(phase, path) ((void)(path))
+#define ELF_PROBE_RETURN(phase, path, size, grown, result) \
+	((void)(path), (void)(size), (void)(grown), (void)(result))
+#define ELF_PROBE_RESULT(phase, path, result) ((void)(path), (void)(result))
+#endif
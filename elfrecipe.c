@@ -0,0 +1,409 @@
+// elfrecipe.c
+#include "elfrecipe.h"
+#include "elfpatcher.h"
+#include "elfendian.h"
+#include "elfjournal.h"
+
+#include <linux/elf.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+#define RECIPE_MAGIC   0x50435245 // "ERCP"
+#define RECIPE_VERSION 1
+
+// notes larger than this are not worth scanning for a build-id
+#define MAX_NOTE_SEGMENT (64 * 1024)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t build_id_size;
+	uint32_t guard_count;
+	uint32_t edit_count;
+	uint32_t reserved;
+	uint64_t rules_hash;
+	uint64_t input_size;
+	uint64_t output_size;
+	uint64_t guard_hash;
+} RecipeHeader;
+
+typedef struct {
+	uint64_t offset;
+	uint32_t size;
+	uint32_t reserved;
+} RecipeEditHeader;
+
+static int find_build_id(const unsigned char* notes, uint64_t size, uint64_t align, int foreign,
+                         unsigned char* build_id, int max_size) {
+	uint64_t cursor = 0;
+	while (cursor + sizeof(Elf32_Nhdr) <= size) {
+		Elf32_Nhdr note;
+		memcpy(&note, notes + cursor, sizeof(note));
+		if (foreign) {
+			note.n_namesz = __builtin_bswap32(note.n_namesz);
+			note.n_descsz = __builtin_bswap32(note.n_descsz);
+			note.n_type = __builtin_bswap32(note.n_type);
+		}
+		cursor += sizeof(Elf32_Nhdr);
+
+		uint64_t name_offset = cursor;
+		cursor += ((uint64_t)note.n_namesz + align - 1) & ~(align - 1);
+		uint64_t desc_offset = cursor;
+		cursor += ((uint64_t)note.n_descsz + align - 1) & ~(align - 1);
+		if (cursor > size) break;
+
+		if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4
+		 && memcmp(notes + name_offset, "GNU", 4) == 0) {
+			if (note.n_descsz == 0 || note.n_descsz > (uint32_t)max_size) return 0;
+			memcpy(build_id, notes + desc_offset, note.n_descsz);
+			return note.n_descsz;
+		}
+	}
+	return 0;
+}
+
+int elf_read_build_id(int fd, unsigned char* build_id, int max_size) {
+	unsigned char ident[EI_NIDENT];
+	if (pread(fd, ident, EI_NIDENT, 0) != EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG) != 0) return 0;
+
+	int foreign = elf_is_foreign(ident);
+	int count = 0;
+	PatchRange notes[64];
+	uint64_t aligns[64];
+
+	if (ident[EI_CLASS] == ELFCLASS32) {
+		Elf32_Ehdr header;
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) return 0;
+		if (foreign) elf32_swap_ehdr(&header);
+		if (header.e_phentsize != sizeof(Elf32_Phdr) || header.e_phnum == 0) return 0;
+
+		size_t size = header.e_phnum * sizeof(Elf32_Phdr);
+		Elf32_Phdr* program_tables = malloc(size);
+		if (!program_tables) return 0;
+		if (pread(fd, program_tables, size, header.e_phoff) != (ssize_t)size) {
+			free(program_tables);
+			return 0;
+		}
+		if (foreign) elf32_swap_phdrs(program_tables, header.e_phnum);
+
+		for (int i = 0; i < header.e_phnum && count < 64; ++i) {
+			if (program_tables[i].p_type != PT_NOTE) continue;
+			notes[count].offset = program_tables[i].p_offset;
+			notes[count].size = program_tables[i].p_filesz;
+			aligns[count++] = program_tables[i].p_align;
+		}
+		free(program_tables);
+	} else if (ident[EI_CLASS] == ELFCLASS64) {
+		Elf64_Ehdr header;
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) return 0;
+		if (foreign) elf64_swap_ehdr(&header);
+		if (header.e_phentsize != sizeof(Elf64_Phdr) || header.e_phnum == 0) return 0;
+
+		size_t size = header.e_phnum * sizeof(Elf64_Phdr);
+		Elf64_Phdr* program_tables = malloc(size);
+		if (!program_tables) return 0;
+		if (pread(fd, program_tables, size, header.e_phoff) != (ssize_t)size) {
+			free(program_tables);
+			return 0;
+		}
+		if (foreign) elf64_swap_phdrs(program_tables, header.e_phnum);
+
+		for (int i = 0; i < header.e_phnum && count < 64; ++i) {
+			if (program_tables[i].p_type != PT_NOTE) continue;
+			notes[count].offset = program_tables[i].p_offset;
+			notes[count].size = program_tables[i].p_filesz;
+			aligns[count++] = program_tables[i].p_align;
+		}
+		free(program_tables);
+	} else {
+		return 0;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		if (notes[i].size == 0 || notes[i].size > MAX_NOTE_SEGMENT) continue;
+
+		unsigned char* data = malloc(notes[i].size);
+		if (!data) return 0;
+
+		int size = 0;
+		if (pread(fd, data, notes[i].size, notes[i].offset) == (ssize_t)notes[i].size) {
+			size = find_build_id(data, notes[i].size, aligns[i] == 8 ? 8 : 4, foreign, build_id, max_size);
+		}
+		free(data);
+
+		if (size > 0) return size;
+	}
+
+	return 0;
+}
+
+uint64_t recipe_rules_hash(const char* prefix, int strategy) {
+	ElfHash64 state;
+	unsigned char strategy_byte = strategy;
+	elfhash_init(&state, RECIPE_VERSION);
+	elfhash_update(&state, prefix, strlen(prefix));
+	elfhash_update(&state, &strategy_byte, 1);
+	return elfhash_final(&state);
+}
+
+void recipe_init(PatchRecipe* recipe, const unsigned char* build_id, int build_id_size, uint64_t rules_hash, uint64_t input_size) {
+	memset(recipe, 0, sizeof(PatchRecipe));
+	if (build_id_size > RECIPE_MAX_BUILD_ID) build_id_size = RECIPE_MAX_BUILD_ID;
+	memcpy(recipe->build_id, build_id, build_id_size);
+	recipe->build_id_size = build_id_size;
+	recipe->rules_hash = rules_hash;
+	recipe->input_size = input_size;
+	recipe->output_size = input_size;
+	elfhash_init(&recipe->guard_state, 0);
+	recipe->guard_hash = elfhash_final(&recipe->guard_state);
+}
+
+int recipe_guard(PatchRecipe* recipe, int fd, uint64_t offset, uint64_t size) {
+	if (!recipe) return TRUE;
+
+	// only bytes of the original input can be checked before replaying
+	if (offset >= recipe->input_size) return TRUE;
+	if (size > recipe->input_size - offset) size = recipe->input_size - offset;
+
+	PatchRange* guards = realloc(recipe->guards, (recipe->guard_count + 1) * sizeof(PatchRange));
+	if (!guards) return FALSE;
+	recipe->guards = guards;
+	recipe->guards[recipe->guard_count].offset = offset;
+	recipe->guards[recipe->guard_count].size = size;
+	recipe->guard_count++;
+
+	if (!elfhash_fd(&recipe->guard_state, fd, offset, size)) return FALSE;
+	recipe->guard_hash = elfhash_final(&recipe->guard_state);
+	return TRUE;
+}
+
+int recipe_pwrite(PatchRecipe* recipe, int fd, const void* data, size_t size, uint64_t offset) {
+	if (recipe && !recipe_guard(recipe, fd, offset, size)) return FALSE;
+	if (recipe && recipe->undo && !undo_record(recipe->undo, fd, offset, size)) return FALSE;
+
+	if (pwrite(fd, data, size, offset) != (ssize_t)size) return FALSE;
+	if (!recipe) return TRUE;
+
+	PatchEdit* edits = realloc(recipe->edits, (recipe->edit_count + 1) * sizeof(PatchEdit));
+	if (!edits) return FALSE;
+	recipe->edits = edits;
+
+	PatchEdit* edit = &recipe->edits[recipe->edit_count];
+	edit->bytes = malloc(size);
+	if (!edit->bytes) return FALSE;
+	memcpy(edit->bytes, data, size);
+	edit->offset = offset;
+	edit->size = size;
+	recipe->edit_count++;
+
+	if (offset + size > recipe->output_size) recipe->output_size = offset + size;
+	return TRUE;
+}
+
+void recipe_path(char* path, size_t path_size, const char* dir,
+                 const unsigned char* build_id, int build_id_size, uint64_t rules_hash) {
+	char hex[RECIPE_MAX_BUILD_ID * 2 + 1];
+	for (int i = 0; i < build_id_size && i < RECIPE_MAX_BUILD_ID; ++i) {
+		sprintf(&hex[i * 2], "%02x", build_id[i]);
+	}
+	hex[build_id_size * 2] = '\0';
+
+	snprintf(path, path_size, "%s/%s-%016llx.recipe", dir, hex, (unsigned long long)rules_hash);
+}
+
+int recipe_save(const PatchRecipe* recipe, const char* path) {
+	// unique per call: threads of one process may save the same recipe at once
+	char temp_path[4096];
+	snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+	int fd = mkstemp(temp_path);
+	if (fd < 0) return FALSE;
+
+	// mkstemp creates 0600, recipes are as readable as before
+	FILE* file = fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : NULL;
+	if (!file) {
+		close(fd);
+		unlink(temp_path);
+		return FALSE;
+	}
+
+	RecipeHeader header = {
+		.magic = RECIPE_MAGIC,
+		.version = RECIPE_VERSION,
+		.build_id_size = recipe->build_id_size,
+		.guard_count = recipe->guard_count,
+		.edit_count = recipe->edit_count,
+		.rules_hash = recipe->rules_hash,
+		.input_size = recipe->input_size,
+		.output_size = recipe->output_size,
+		.guard_hash = recipe->guard_hash
+	};
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1
+	      && fwrite(recipe->build_id, 1, recipe->build_id_size, file) == recipe->build_id_size
+	      && fwrite(recipe->guards, sizeof(PatchRange), recipe->guard_count, file) == recipe->guard_count;
+
+	for (uint32_t i = 0; ok && i < recipe->edit_count; ++i) {
+		RecipeEditHeader edit = { recipe->edits[i].offset, recipe->edits[i].size, 0 };
+		ok = fwrite(&edit, sizeof(edit), 1, file) == 1
+		  && fwrite(recipe->edits[i].bytes, 1, edit.size, file) == edit.size;
+	}
+
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(temp_path, path) != 0) {
+		unlink(temp_path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int recipe_load(PatchRecipe* recipe, const char* path) {
+	memset(recipe, 0, sizeof(PatchRecipe));
+
+	FILE* file = fopen(path, "rb");
+	if (!file) return FALSE;
+
+	RecipeHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+	 || header.magic != RECIPE_MAGIC || header.version != RECIPE_VERSION
+	 || header.build_id_size > RECIPE_MAX_BUILD_ID) {
+		fclose(file);
+		return FALSE;
+	}
+
+	recipe->build_id_size = header.build_id_size;
+	recipe->rules_hash = header.rules_hash;
+	recipe->input_size = header.input_size;
+	recipe->output_size = header.output_size;
+	recipe->guard_hash = header.guard_hash;
+
+	int ok = fread(recipe->build_id, 1, header.build_id_size, file) == header.build_id_size;
+
+	recipe->guards = malloc((header.guard_count + 1) * sizeof(PatchRange));
+	recipe->edits = calloc(header.edit_count + 1, sizeof(PatchEdit));
+	ok = ok && recipe->guards && recipe->edits
+	  && fread(recipe->guards, sizeof(PatchRange), header.guard_count, file) == header.guard_count;
+	if (ok) recipe->guard_count = header.guard_count;
+
+	for (uint32_t i = 0; ok && i < header.edit_count; ++i) {
+		RecipeEditHeader edit;
+		ok = fread(&edit, sizeof(edit), 1, file) == 1 && edit.offset + edit.size <= header.output_size;
+		if (!ok) break;
+
+		PatchEdit* target = &recipe->edits[i];
+		target->offset = edit.offset;
+		target->size = edit.size;
+		target->bytes = malloc(edit.size ? edit.size : 1);
+		recipe->edit_count++;
+		ok = target->bytes && fread(target->bytes, 1, edit.size, file) == edit.size;
+	}
+
+	fclose(file);
+	if (!ok) recipe_free(recipe);
+	return ok;
+}
+
+int recipe_apply(const PatchRecipe* recipe, int fd, PatchUndo* undo) {
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size != recipe->input_size) return FALSE;
+
+	ElfHash64 state;
+	elfhash_init(&state, 0);
+	for (uint32_t i = 0; i < recipe->guard_count; ++i) {
+		if (!elfhash_fd(&state, fd, recipe->guards[i].offset, recipe->guards[i].size)) return FALSE;
+	}
+	if (elfhash_final(&state) != recipe->guard_hash) return FALSE;
+
+	for (uint32_t i = 0; i < recipe->edit_count; ++i) {
+		const PatchEdit* edit = &recipe->edits[i];
+		if (undo && !undo_record(undo, fd, edit->offset, edit->size)) return FALSE;
+		if (pwrite(fd, edit->bytes, edit->size, edit->offset) != (ssize_t)edit->size) return FALSE;
+	}
+
+	return TRUE;
+}
+
+void recipe_free(PatchRecipe* recipe) {
+	for (uint32_t i = 0; i < recipe->edit_count; ++i) free(recipe->edits[i].bytes);
+	free(recipe->edits);
+	free(recipe->guards);
+	memset(recipe, 0, sizeof(PatchRecipe));
+}
+
+// deep copy without the recording state, FALSE when out of memory
+static int recipe_copy(PatchRecipe* copy, const PatchRecipe* recipe) {
+	*copy = *recipe;
+	copy->undo = NULL;
+	copy->guards = malloc((recipe->guard_count ? recipe->guard_count : 1) * sizeof(PatchRange));
+	copy->edits = calloc(recipe->edit_count ? recipe->edit_count : 1, sizeof(PatchEdit));
+	copy->edit_count = 0;
+
+	int ok = copy->guards && copy->edits;
+	if (ok) memcpy(copy->guards, recipe->guards, recipe->guard_count * sizeof(PatchRange));
+	for (uint32_t i = 0; ok && i < recipe->edit_count; ++i) {
+		PatchEdit* edit = &copy->edits[copy->edit_count++];
+		*edit = recipe->edits[i];
+		edit->bytes = malloc(edit->size ? edit->size : 1);
+		ok = edit->bytes != NULL;
+		if (ok) memcpy(edit->bytes, recipe->edits[i].bytes, edit->size);
+	}
+
+	if (!ok) recipe_free(copy);
+	return ok;
+}
+
+void recipe_cache_init(RecipeCache* cache) {
+	memset(cache, 0, sizeof(RecipeCache));
+	pthread_rwlock_init(&cache->lock, NULL);
+}
+
+void recipe_cache_free(RecipeCache* cache) {
+	for (int i = 0; i < cache->count; ++i) recipe_free(&cache->recipes[i]);
+	free(cache->recipes);
+	pthread_rwlock_destroy(&cache->lock);
+}
+
+// caller holds the lock
+static PatchRecipe* cache_find(RecipeCache* cache, const unsigned char* build_id, int build_id_size, uint64_t rules_hash) {
+	for (int i = 0; i < cache->count; ++i) {
+		PatchRecipe* recipe = &cache->recipes[i];
+		if (recipe->rules_hash == rules_hash && recipe->build_id_size == (uint32_t)build_id_size
+		 && memcmp(recipe->build_id, build_id, build_id_size) == 0) {
+			return recipe;
+		}
+	}
+	return NULL;
+}
+
+int recipe_cache_get(RecipeCache* cache, const unsigned char* build_id, int build_id_size, uint64_t rules_hash,
+                     PatchRecipe* recipe) {
+	pthread_rwlock_rdlock(&cache->lock);
+	PatchRecipe* found = cache_find(cache, build_id, build_id_size, rules_hash);
+	int ok = found && (!recipe || recipe_copy(recipe, found));
+	pthread_rwlock_unlock(&cache->lock);
+	return ok;
+}
+
+void recipe_cache_put(RecipeCache* cache, const PatchRecipe* recipe) {
+	pthread_rwlock_wrlock(&cache->lock);
+
+	if (!cache_find(cache, recipe->build_id, recipe->build_id_size, recipe->rules_hash)) {
+		if (cache->count == cache->capacity) {
+			int capacity = cache->capacity ? cache->capacity * 2 : 64;
+			PatchRecipe* recipes = realloc(cache->recipes, capacity * sizeof(PatchRecipe));
+			if (recipes) {
+				cache->recipes = recipes;
+				cache->capacity = capacity;
+			}
+		}
+		if (cache->count < cache->capacity && recipe_copy(&cache->recipes[cache->count], recipe)) cache->count++;
+	}
+
+	pthread_rwlock_unlock(&cache->lock);
+}
@@ -0,0 +1,118 @@
+// elfrecipe.h
+#pragma once
+
+#include "elfhash.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECIPE_MAX_BUILD_ID 64
+
+typedef struct {
+	uint64_t offset;
+	uint32_t size;
+	unsigned char* bytes;
+} PatchEdit;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t size;
+} PatchRange;
+
+// the bytes a patch replaced, to take it back (see elfjournal.h)
+typedef struct {
+	uint64_t original_size;
+	PatchEdit* ranges; // original bytes, in write order
+	uint32_t range_count;
+} PatchUndo;
+
+/**
+ * A recorded patch: the raw writes one run of the patcher made, keyed by the
+ * input's GNU build-id and the rules it was patched with.
+ *
+ * The precondition is the input size plus a hash over every byte the edits
+ * depended on or replaced (guards). Replaying checks that hash with pread and
+ * then issues the edits with pwrite, without parsing the ELF at all.
+ */
+typedef struct {
+	unsigned char build_id[RECIPE_MAX_BUILD_ID];
+	uint32_t build_id_size;
+	uint64_t rules_hash;
+	uint64_t input_size;
+	uint64_t output_size;
+
+	PatchRange* guards;
+	uint32_t guard_count;
+	ElfHash64 guard_state; // while recording
+	uint64_t guard_hash;
+
+	PatchEdit* edits;
+	uint32_t edit_count;
+
+	PatchUndo* undo; // while recording: if set, what each write replaces is saved there first
+} PatchRecipe;
+
+/**
+ * Recipes kept in memory and shared by the threads of one process, e.g. the
+ * daemon's workers. Recipes are copied in and out, so one being replayed is
+ * never changed or freed by another thread.
+ */
+typedef struct {
+	PatchRecipe* recipes;
+	int count;
+	int capacity;
+	pthread_rwlock_t lock;
+} RecipeCache;
+
+/**
+ * Read the NT_GNU_BUILD_ID note through the program headers.
+ *
+ * @return the build-id length, 0 if the file has none or is not an ELF
+ */
+int elf_read_build_id(int fd, unsigned char* build_id, int max_size);
+
+// hash of everything that decides the output besides the input bytes
+uint64_t recipe_rules_hash(const char* prefix, int strategy);
+
+// start recording for an input of 'input_size' bytes
+void recipe_init(PatchRecipe* recipe, const unsigned char* build_id, int build_id_size, uint64_t rules_hash, uint64_t input_size);
+
+// add [offset, offset + size) of the current input to the precondition
+int recipe_guard(PatchRecipe* recipe, int fd, uint64_t offset, uint64_t size);
+
+/**
+ * pwrite wrapper every patcher write goes through. With a recipe the replaced
+ * input bytes become a guard (and go to its undo record, if any) and the
+ * write is logged as an edit; with NULL it is a plain pwrite.
+ *
+ * @return TRUE if all bytes were written
+ */
+int recipe_pwrite(PatchRecipe* recipe, int fd, const void* data, size_t size, uint64_t offset);
+
+// "<dir>/<build-id hex>-<rules hash hex>.recipe"
+void recipe_path(char* path, size_t path_size, const char* dir,
+                 const unsigned char* build_id, int build_id_size, uint64_t rules_hash);
+
+// write atomically (temp file + rename), TRUE on success
+int recipe_save(const PatchRecipe* recipe, const char* path);
+// FALSE if missing, truncated or of another format
+int recipe_load(PatchRecipe* recipe, const char* path);
+
+/**
+ * Replay onto fd. Nothing is written unless the size and guard hash match.
+ *
+ * @param undo if not NULL, receives what each edit replaces before it is written
+ * @return TRUE if applied, FALSE if the precondition failed or a write failed
+ */
+int recipe_apply(const PatchRecipe* recipe, int fd, PatchUndo* undo);
+
+void recipe_free(PatchRecipe* recipe);
+
+void recipe_cache_init(RecipeCache* cache);
+void recipe_cache_free(RecipeCache* cache);
+// copy the recipe for the key to 'recipe' (NULL only checks), FALSE if there is none
+int recipe_cache_get(RecipeCache* cache, const unsigned char* build_id, int build_id_size, uint64_t rules_hash,
+                     PatchRecipe* recipe);
+// keep a copy of 'recipe', the first recipe for a key wins
+void recipe_cache_put(RecipeCache* cache, const PatchRecipe* recipe);
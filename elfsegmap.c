@@ -0,0 +1,98 @@
+// elfsegmap.c
+#include "elfsegmap.h"
+#include "elfpatcher.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_vaddr(const void* a, const void* b) {
+	const ElfSegment* x = a;
+	const ElfSegment* y = b;
+	return (x->virtual_address > y->virtual_address) - (x->virtual_address < y->virtual_address);
+}
+
+// index of the last segment starting at or below 'vaddr', or -1
+static int find_floor(const ElfSegment* table, int count, uint64_t vaddr) {
+	int low = 0, high = count - 1, found = -1;
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		if (table[mid].virtual_address <= vaddr) {
+			found = mid;
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return found;
+}
+
+static int sort_and_check(ElfSegmentMap* map) {
+	qsort(map->by_vaddr, map->count, sizeof(ElfSegment), compare_vaddr);
+
+	// overlapping address ranges would make lookups ambiguous
+	for (int i = 1; i < map->count; ++i) {
+		const ElfSegment* prev = &map->by_vaddr[i - 1];
+		if (prev->virtual_address + prev->memory_size > map->by_vaddr[i].virtual_address) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+int segmap_init(ElfSegmentMap* map, const ElfSegment* segments, int count) {
+	memset(map, 0, sizeof(ElfSegmentMap));
+
+	if (count == 0) return TRUE;
+
+	map->by_vaddr = malloc(count * sizeof(ElfSegment));
+	if (!map->by_vaddr) return FALSE;
+
+	memcpy(map->by_vaddr, segments, count * sizeof(ElfSegment));
+	map->count = count;
+
+	return sort_and_check(map);
+}
+
+int segmap_add(ElfSegmentMap* map, const ElfSegment* segment) {
+	ElfSegment* by_vaddr = realloc(map->by_vaddr, (map->count + 1) * sizeof(ElfSegment));
+	if (!by_vaddr) return FALSE;
+	map->by_vaddr = by_vaddr;
+
+	map->by_vaddr[map->count] = *segment;
+	map->count++;
+
+	return sort_and_check(map);
+}
+
+int segmap_vaddr_to_offset(const ElfSegmentMap* map, uint64_t vaddr, uint64_t size, uint64_t* offset) {
+	int i = find_floor(map->by_vaddr, map->count, vaddr);
+	if (i < 0) return FALSE;
+
+	const ElfSegment* segment = &map->by_vaddr[i];
+	uint64_t delta = vaddr - segment->virtual_address;
+	if (delta >= segment->file_size || size > segment->file_size - delta) return FALSE;
+
+	*offset = segment->offset + delta;
+	return TRUE;
+}
+
+uint64_t segmap_next_free_vaddr(const ElfSegmentMap* map, uint64_t* align) {
+	uint64_t max_align = 0x1000;
+	uint64_t end = 0;
+	for (int i = 0; i < map->count; ++i) {
+		const ElfSegment* segment = &map->by_vaddr[i];
+		if (segment->align > max_align) max_align = segment->align;
+		if (segment->virtual_address + segment->memory_size > end) {
+			end = segment->virtual_address + segment->memory_size;
+		}
+	}
+
+	if (align) *align = max_align;
+	return (end + max_align - 1) & ~(max_align - 1);
+}
+
+void segmap_free(ElfSegmentMap* map) {
+	free(map->by_vaddr);
+	memset(map, 0, sizeof(ElfSegmentMap));
+}
@@ -0,0 +1,42 @@
+// elfsegmap.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint64_t virtual_address;
+	uint64_t offset;
+	uint64_t file_size;
+	uint64_t memory_size;
+	uint64_t align;
+} ElfSegment;
+
+/**
+ * PT_LOAD segments as an interval table sorted by virtual address, so
+ * vaddr -> offset translation is a binary search.
+ * Built once per file and shared by every DT_* address lookup.
+ */
+typedef struct {
+	ElfSegment* by_vaddr;
+	int count;
+} ElfSegmentMap;
+
+// the PT_LOAD segments in any order; FALSE on allocation failure or overlapping segments
+int segmap_init(ElfSegmentMap* map, const ElfSegment* segments, int count);
+
+// add a segment (e.g. one appended by the patcher), keeping the table sorted
+int segmap_add(ElfSegmentMap* map, const ElfSegment* segment);
+
+/**
+ * Translate [vaddr, vaddr + size) to a file offset.
+ * The whole range must be backed by file contents of a single segment.
+ *
+ * @return TRUE on success, FALSE if the range is not mapped from the file
+ */
+int segmap_vaddr_to_offset(const ElfSegmentMap* map, uint64_t vaddr, uint64_t size, uint64_t* offset);
+
+// first page-aligned address above every segment, using the largest p_align
+uint64_t segmap_next_free_vaddr(const ElfSegmentMap* map, uint64_t* align);
+
+void segmap_free(ElfSegmentMap* map);
@@ -0,0 +1,154 @@
+// elfwatch.c
+#include "elfwatch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WATCH_MAX_PENDING 256
+#define POLL_INTERVAL_MS 200
+
+typedef struct {
+	int dir;          // index into the configured directories
+	int64_t last_ms;  // time of the latest event
+	char name[NAME_MAX + 1];
+} PendingFile;
+
+static int64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// "lib.so" or "lib.so.1.2"
+static int is_library(const char* name) {
+	for (const char* so = strstr(name, ".so"); so; so = strstr(so + 1, ".so")) {
+		const char* rest = so + 3;
+		if (*rest != '\0' && *rest != '.') continue;
+		while (*rest == '.' || (*rest >= '0' && *rest <= '9')) rest++;
+		if (*rest == '\0') return TRUE;
+	}
+	return FALSE;
+}
+
+static void patch_pending(const PatchWatchConfig* config, const PendingFile* file) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", config->dirs[file->dir], file->name);
+
+	int result = patch_file(path, config->patch);
+
+	// the echo of our own write, or a rewrite that kept the names
+	if (result == PATCH_UNCHANGED) return;
+
+	const char* status = result == PATCH_BUSY ? "busy" : result == PATCH_CONFLICT ? "conflict" : result ? "patched" : "failed";
+	printf("Watch: %s %s (%lld ms after the last write)\n", status, path, (long long)(now_ms() - file->last_ms));
+	fflush(stdout);
+}
+
+// record an event, restarting the file's quiet time
+static void add_pending(const PatchWatchConfig* config, PendingFile* pending, int* count, int dir, const char* name) {
+	for (int i = 0; i < *count; ++i) {
+		if (pending[i].dir == dir && strcmp(pending[i].name, name) == 0) {
+			pending[i].last_ms = now_ms();
+			return;
+		}
+	}
+
+	// too many files in flight: the oldest goes now
+	if (*count == WATCH_MAX_PENDING) {
+		patch_pending(config, &pending[0]);
+		pending[0] = pending[--*count];
+	}
+
+	PendingFile* file = &pending[(*count)++];
+	file->dir = dir;
+	file->last_ms = now_ms();
+	snprintf(file->name, sizeof(file->name), "%s", name);
+}
+
+static void read_events(const PatchWatchConfig* config, int fd, const int* watches, PendingFile* pending, int* count) {
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	for (;;) {
+		ssize_t size = read(fd, buffer, sizeof(buffer));
+		if (size <= 0) return;
+
+		for (char* p = buffer; p < buffer + size; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+			const struct inotify_event* event = (const struct inotify_event*)p;
+
+			if (event->mask & IN_Q_OVERFLOW) printf("%s\n", "Watch: event queue overflowed, some changes were missed");
+
+			int dir = 0;
+			while (dir < config->dir_count && watches[dir] != event->wd) dir++;
+			if (dir == config->dir_count) continue;
+
+			if (event->mask & IN_IGNORED) {
+				printf("Watch: %s is no longer watched\n", config->dirs[dir]);
+				continue;
+			}
+			if (event->len > 0 && is_library(event->name)) add_pending(config, pending, count, dir, event->name);
+		}
+	}
+}
+
+int patch_watch_run(const PatchWatchConfig* config, volatile sig_atomic_t* stop) {
+	int debounce_ms = config->debounce_ms > 0 ? config->debounce_ms : WATCH_DEBOUNCE_MS;
+
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) return FALSE;
+
+	int* watches = calloc(config->dir_count ? config->dir_count : 1, sizeof(int));
+	PendingFile* pending = calloc(WATCH_MAX_PENDING, sizeof(PendingFile));
+	int ok = watches && pending;
+
+	for (int i = 0; ok && i < config->dir_count; ++i) {
+		watches[i] = inotify_add_watch(fd, config->dirs[i], IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+		if (watches[i] < 0) {
+			printf("Cannot watch %s\n", config->dirs[i]);
+			ok = FALSE;
+		}
+	}
+
+	if (ok) {
+		printf("Watching %i directories\n", config->dir_count);
+		fflush(stdout);
+	}
+
+	int count = 0;
+	while (ok && !*stop) {
+		// sleep until the first file falls quiet, still checking 'stop' regularly
+		int64_t now = now_ms();
+		int timeout = POLL_INTERVAL_MS;
+		for (int i = 0; i < count; ++i) {
+			int64_t wait = pending[i].last_ms + debounce_ms - now;
+			if (wait < timeout) timeout = wait > 0 ? (int)wait : 0;
+		}
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, timeout);
+		if (ready < 0 && errno != EINTR) break;
+		if (ready > 0) read_events(config, fd, watches, pending, &count);
+
+		now = now_ms();
+		for (int i = 0; i < count;) {
+			if (now - pending[i].last_ms < debounce_ms) {
+				i++;
+				continue;
+			}
+			PendingFile file = pending[i];
+			pending[i] = pending[--count];
+			patch_pending(config, &file);
+		}
+	}
+
+	free(pending);
+	free(watches);
+	close(fd);
+	return ok;
+}
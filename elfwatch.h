@@ -0,0 +1,31 @@
+// elfwatch.h
+#pragma once
+
+#include "elfpatcher.h"
+
+#include <signal.h>
+
+#define WATCH_DEBOUNCE_MS 50
+
+typedef struct {
+	const char* const* dirs;
+	int dir_count;
+	const PatchConfig* patch; // how each file is patched, see patch_file
+	int debounce_ms;          // quiet time before a file is patched, 0 picks WATCH_DEBOUNCE_MS
+} PatchWatchConfig;
+
+/**
+ * Patch shared libraries as they appear in the watched directories.
+ *   - inotify reports files closed after writing (a linker finishing) or
+ *     moved in (a linker writing to a temporary and renaming it).
+ *   - A file is patched once no event came for it during 'debounce_ms',
+ *     so a burst of writes costs one patch. Other files are not touched.
+ *   - Patching closes a written fd too; that echo finds the file marked
+ *     and is dropped without parsing it.
+ * Only names with a ".so" or ".so.<version>" suffix are considered,
+ * subdirectories are not watched.
+ *
+ * Returns when '*stop' becomes non-zero (e.g. from a signal handler).
+ * @return TRUE on clean shutdown, FALSE if a directory could not be watched
+ */
+int patch_watch_run(const PatchWatchConfig* config, volatile sig_atomic_t* stop);
@@ -0,0 +1,469 @@
+// elfzip.c
+#define _GNU_SOURCE
+#include "elfzip.h"
+#include "elfcrc.h"
+#include "elflock.h"
+
+#include <linux/fs.h>
+#include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZIP_LOCAL_SIGNATURE   0x04034b50
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50
+#define ZIP_END_SIGNATURE     0x06054b50
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+
+#define ZIP_LOCAL_SIZE   30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE     22
+
+#define ZIP_FLAG_DATA_DESCRIPTOR 0x0008
+#define ZIP_METHOD_STORED 0
+
+// extra field used by zipalign to pad local headers
+#define ZIP_ALIGNMENT_EXTRA 0xD935
+
+#define APK_SIG_BLOCK_MAGIC "APK Sig Block 42"
+
+#define COPY_CHUNK (64 * 1024)
+
+typedef struct {
+	int fd;
+	off_t size;
+
+	uint8_t* central;
+	uint32_t central_offset;
+	uint32_t central_size;
+	uint16_t entry_count;
+
+	uint8_t* end; // end of central directory record and comment
+	uint32_t end_size;
+
+	uint32_t entries_end; // where entry data stops: signing block or central directory
+	int signed_apk;
+} ZipArchive;
+
+static inline uint16_t get16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get64(const uint8_t* p) {
+	return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static inline void put16(uint8_t* p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put32(uint8_t* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/**
+ * Copy 'size' bytes between descriptors with pread/pwrite.
+ * memfd and the archive live on different filesystems, so copy_file_range
+ * is not an option. The CRC-32 of the copied bytes goes to 'crc' if set.
+ */
+static int copy_range(int in, off_t in_offset, int out, off_t out_offset, uint64_t size, uint32_t* crc) {
+	uint8_t chunk[COPY_CHUNK];
+	if (crc) *crc = 0;
+
+	while (size > 0) {
+		size_t want = size < sizeof(chunk) ? size : sizeof(chunk);
+		if (pread(in, chunk, want, in_offset) != (ssize_t)want) return FALSE;
+		if (pwrite(out, chunk, want, out_offset) != (ssize_t)want) return FALSE;
+		if (crc) *crc = elf_crc32(*crc, chunk, want);
+
+		in_offset += want;
+		out_offset += want;
+		size -= want;
+	}
+	return TRUE;
+}
+
+static int crc_range(int fd, uint64_t size, uint32_t* crc) {
+	uint8_t chunk[COPY_CHUNK];
+	*crc = 0;
+
+	for (uint64_t offset = 0; offset < size;) {
+		size_t want = size - offset < sizeof(chunk) ? size - offset : sizeof(chunk);
+		if (pread(fd, chunk, want, offset) != (ssize_t)want) return FALSE;
+		*crc = elf_crc32(*crc, chunk, want);
+		offset += want;
+	}
+	return TRUE;
+}
+
+static void free_zip(ZipArchive* zip) {
+	free(zip->central);
+	free(zip->end);
+}
+
+static int load_zip(int fd, ZipArchive* zip) {
+	memset(zip, 0, sizeof(ZipArchive));
+	zip->fd = fd;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < ZIP_END_SIZE) return FALSE;
+	zip->size = st.st_size;
+
+	// the end record is followed by at most 64K of comment
+	uint32_t tail_size = st.st_size < 0xFFFF + ZIP_END_SIZE ? st.st_size : 0xFFFF + ZIP_END_SIZE;
+	uint8_t* tail = malloc(tail_size);
+	if (!tail || pread(fd, tail, tail_size, st.st_size - tail_size) != (ssize_t)tail_size) {
+		free(tail);
+		return FALSE;
+	}
+
+	int end = -1;
+	for (int i = tail_size - ZIP_END_SIZE; i >= 0; --i) {
+		if (get32(&tail[i]) == ZIP_END_SIGNATURE && (uint32_t)(i + ZIP_END_SIZE + get16(&tail[i + 20])) == tail_size) {
+			end = i;
+			break;
+		}
+	}
+
+	if (end < 0) {
+		printf("%s\n", "Failed to find the ZIP end of central directory!");
+		free(tail);
+		return FALSE;
+	}
+
+	uint8_t* record = &tail[end];
+	zip->entry_count = get16(&record[10]);
+	zip->central_size = get32(&record[12]);
+	zip->central_offset = get32(&record[16]);
+
+	if (get16(&record[4]) != 0 || get16(&record[6]) != 0 || zip->entry_count == 0xFFFF
+	 || zip->central_offset == 0xFFFFFFFF || (end >= 20 && get32(&tail[end - 20]) == ZIP64_LOCATOR_SIGNATURE)) {
+		printf("%s\n", "ZIP64 and multi-disk archives are not supported!");
+		free(tail);
+		return FALSE;
+	}
+
+	zip->end_size = tail_size - end;
+	zip->end = malloc(zip->end_size);
+	if (!zip->end) {
+		free(tail);
+		return FALSE;
+	}
+	memcpy(zip->end, record, zip->end_size);
+	free(tail);
+
+	if ((uint64_t)zip->central_offset + zip->central_size > (uint64_t)st.st_size) return FALSE;
+
+	zip->central = malloc(zip->central_size ? zip->central_size : 1);
+	if (!zip->central || pread(fd, zip->central, zip->central_size, zip->central_offset) != (ssize_t)zip->central_size) {
+		return FALSE;
+	}
+
+	// APK signature scheme v2+ keeps a block between the entries and the central directory
+	zip->entries_end = zip->central_offset;
+	uint8_t footer[24];
+	if (zip->central_offset >= sizeof(footer)
+	 && pread(fd, footer, sizeof(footer), zip->central_offset - sizeof(footer)) == sizeof(footer)
+	 && memcmp(&footer[8], APK_SIG_BLOCK_MAGIC, 16) == 0) {
+		uint64_t block_size = get64(footer);
+		if (block_size + 8 <= zip->central_offset) {
+			zip->entries_end = zip->central_offset - block_size - 8;
+			zip->signed_apk = TRUE;
+		}
+	}
+
+	return TRUE;
+}
+
+// "lib/<abi>/<name>.so", with 'abi' matching when given
+static int is_native_library(const uint8_t* name, uint16_t length, const char* abi) {
+	if (length < 8 || memcmp(name, "lib/", 4) != 0 || memcmp(&name[length - 3], ".so", 3) != 0) return FALSE;
+
+	const uint8_t* slash = memchr(&name[4], '/', length - 4);
+	if (!slash || slash == &name[4] || memchr(slash + 1, '/', &name[length] - slash - 1)) return FALSE;
+
+	if (!abi) return TRUE;
+	return (size_t)(slash - &name[4]) == strlen(abi) && memcmp(&name[4], abi, strlen(abi)) == 0;
+}
+
+static uint32_t data_alignment(uint32_t data_offset) {
+	if (data_offset % 16384 == 0) return 16384;
+	if (data_offset % 4096 == 0) return 4096;
+	return 4;
+}
+
+/**
+ * Write the patched entry held in 'source' at 'offset': local header with an
+ * alignment extra field, then the data. Updates the central entry to match.
+ *
+ * @return offset right after the written data, 0 on error
+ */
+static uint32_t write_relocated_entry(ZipArchive* zip, uint8_t* central_entry, int source, uint32_t size,
+                                      uint32_t offset, uint32_t alignment) {
+	uint16_t name_length = get16(&central_entry[28]);
+	uint32_t header_end = offset + ZIP_LOCAL_SIZE + name_length;
+	uint16_t extra_length = 6 + (alignment - (header_end + 6) % alignment) % alignment;
+	uint32_t data_offset = header_end + extra_length;
+
+	if ((uint64_t)data_offset + size > 0xFFFFFFFF) {
+		printf("%s\n", "Archive would need ZIP64!");
+		return 0;
+	}
+
+	uint32_t crc;
+	if (!copy_range(source, 0, zip->fd, data_offset, size, &crc)) return 0;
+
+	uint8_t header[ZIP_LOCAL_SIZE + 0xFFFF];
+	memset(header, 0, ZIP_LOCAL_SIZE + name_length + extra_length);
+	put32(&header[0], ZIP_LOCAL_SIGNATURE);
+	put16(&header[4], get16(&central_entry[6]));                               // version needed
+	put16(&header[6], get16(&central_entry[8]) & ~ZIP_FLAG_DATA_DESCRIPTOR);   // sizes are known now
+	put16(&header[8], ZIP_METHOD_STORED);
+	put16(&header[10], get16(&central_entry[12]));                             // time
+	put16(&header[12], get16(&central_entry[14]));                             // date
+	put32(&header[14], crc);
+	put32(&header[18], size);
+	put32(&header[22], size);
+	put16(&header[26], name_length);
+	put16(&header[28], extra_length);
+	memcpy(&header[ZIP_LOCAL_SIZE], &central_entry[ZIP_CENTRAL_SIZE], name_length);
+
+	uint8_t* extra = &header[ZIP_LOCAL_SIZE + name_length];
+	put16(&extra[0], ZIP_ALIGNMENT_EXTRA);
+	put16(&extra[2], extra_length - 4);
+	put16(&extra[4], alignment);
+
+	uint32_t header_size = ZIP_LOCAL_SIZE + name_length + extra_length;
+	if (pwrite(zip->fd, header, header_size, offset) != (ssize_t)header_size) return 0;
+
+	put16(&central_entry[8], get16(&central_entry[8]) & ~ZIP_FLAG_DATA_DESCRIPTOR);
+	put32(&central_entry[16], crc);
+	put32(&central_entry[20], size);
+	put32(&central_entry[24], size);
+	put32(&central_entry[42], offset);
+
+	return data_offset + size;
+}
+
+/**
+ * A private copy of the archive next to it, into 'temp_path': a reflink
+ * where the filesystem has them, a plain copy otherwise. It keeps the
+ * archive's mode, and its owner when run as root.
+ *
+ * @return the copy's fd, -1 on error
+ */
+static int open_work_copy(int fd, const char* path, char* temp_path, size_t temp_path_size) {
+	struct stat st;
+	if (fstat(fd, &st) < 0) return -1;
+
+	snprintf(temp_path, temp_path_size, "%s.XXXXXX", path);
+	int copy = mkstemp(temp_path);
+	if (copy < 0) return -1;
+
+	if ((ioctl(copy, FICLONE, fd) != 0 && !copy_range(fd, 0, copy, 0, st.st_size, NULL))
+	 || fchmod(copy, st.st_mode & 07777) != 0 || (geteuid() == 0 && fchown(copy, st.st_uid, st.st_gid) != 0)) {
+		close(copy);
+		unlink(temp_path);
+		return -1;
+	}
+	return copy;
+}
+
+// open 'path' and take its writer lock, -1 with the result to return if not.
+// The writer we waited for may have renamed its copy over the path, leaving
+// us the lock of the old, unlinked archive: then the path is opened again.
+static int open_locked_archive(const char* path, int wait_ms, int* result) {
+	for (;;) {
+		int fd = open(path, O_RDWR);
+		*result = fd < 0 ? FALSE : lock_file(fd, wait_ms);
+		if (*result != TRUE) {
+			if (*result == PATCH_BUSY) printf("%s is busy, skipped\n", path);
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+
+		struct stat held, current;
+		if (fstat(fd, &held) < 0) {
+			close(fd);
+			*result = FALSE;
+			return -1;
+		}
+		if (stat(path, &current) == 0 && held.st_dev == current.st_dev && held.st_ino == current.st_ino) return fd;
+		close(fd);
+	}
+}
+
+int patch_zip(const char* path, const PatchConfig* config, const char* abi) {
+	// the whole archive is one file to other writers
+	int locked;
+	int original = open_locked_archive(path, config->lock_wait_ms, &locked);
+	if (original < 0) return locked;
+
+	// every write goes to a copy renamed over the archive at the end, so a
+	// crash or a failed entry never leaves a half-rewritten archive behind
+	char temp_path[4096];
+	int fd = open_work_copy(original, path, temp_path, sizeof(temp_path));
+	if (fd < 0) {
+		printf("Cannot copy %s to patch it\n", path);
+		close(original);
+		return FALSE;
+	}
+
+	ZipArchive zip;
+	if (!load_zip(fd, &zip)) {
+		printf("Failed to read ZIP archive %s\n", path);
+		free_zip(&zip);
+		close(fd);
+		unlink(temp_path);
+		close(original);
+		return FALSE;
+	}
+
+	int failed = 0, patched = 0, central_dirty = FALSE;
+	uint32_t cursor = zip.entries_end; // where grown entries are written
+
+	uint32_t position = 0;
+	for (int i = 0; i < zip.entry_count; ++i) {
+		uint8_t* entry = &zip.central[position];
+		if (position + ZIP_CENTRAL_SIZE > zip.central_size || get32(entry) != ZIP_CENTRAL_SIGNATURE) {
+			printf("%s\n", "Corrupted ZIP central directory!");
+			failed++;
+			break;
+		}
+
+		uint16_t flags = get16(&entry[8]);
+		uint16_t method = get16(&entry[10]);
+		uint32_t compressed_size = get32(&entry[20]);
+		uint32_t size = get32(&entry[24]);
+		uint16_t name_length = get16(&entry[28]);
+		uint32_t local_offset = get32(&entry[42]);
+		const uint8_t* name = &entry[ZIP_CENTRAL_SIZE];
+		position += ZIP_CENTRAL_SIZE + name_length + get16(&entry[30]) + get16(&entry[32]);
+
+		if (position > zip.central_size || !is_native_library(name, name_length, abi)) continue;
+
+		if (method != ZIP_METHOD_STORED || compressed_size != size) {
+			printf("Skipping compressed entry %.*s\n", name_length, name);
+			continue;
+		}
+
+		uint8_t local[ZIP_LOCAL_SIZE];
+		if (pread(fd, local, ZIP_LOCAL_SIZE, local_offset) != ZIP_LOCAL_SIZE || get32(local) != ZIP_LOCAL_SIGNATURE) {
+			printf("Bad local header for %.*s\n", name_length, name);
+			failed++;
+			continue;
+		}
+		uint32_t data_offset = local_offset + ZIP_LOCAL_SIZE + get16(&local[26]) + get16(&local[28]);
+
+		// the patcher works on a private copy of just this entry
+		int memfd = memfd_create("elfzip-entry", MFD_CLOEXEC);
+		if (memfd < 0 || !copy_range(fd, data_offset, memfd, 0, size, NULL)) {
+			if (memfd >= 0) close(memfd);
+			failed++;
+			continue;
+		}
+
+		const PatchRule* rule = patch_rule_read(&config->rules, memfd);
+		if (!rule) {
+			printf("No rule for %.*s, left alone\n", name_length, name);
+			close(memfd);
+			continue;
+		}
+
+		if (config->verbose) printf("Patching %.*s\n", name_length, name);
+
+		// the probes see the entry as "archive!entry"
+		char entry_path[4096];
+		snprintf(entry_path, sizeof(entry_path), "%s!%.*s", path, name_length, name);
+
+		PatchRecipe edits;
+		int ok = patch_fd_edits(dup(memfd), entry_path, rule->prefix, config, NULL, &edits);
+
+		struct stat st;
+		if (!ok || fstat(memfd, &st) < 0) {
+			failed++;
+		} else if (edits.edit_count > 0) {
+			uint32_t crc = 0;
+			int in_place = (uint64_t)st.st_size == size && !(flags & ZIP_FLAG_DATA_DESCRIPTOR);
+
+			if (in_place) {
+				// same size: replay the edits straight into the archive
+				for (uint32_t e = 0; ok && e < edits.edit_count; ++e) {
+					ok = pwrite(fd, edits.edits[e].bytes, edits.edits[e].size, data_offset + edits.edits[e].offset)
+					  == (ssize_t)edits.edits[e].size;
+				}
+
+				uint8_t crc_bytes[4];
+				ok = ok && crc_range(memfd, size, &crc);
+				put32(crc_bytes, crc);
+				ok = ok && pwrite(fd, crc_bytes, 4, local_offset + 14) == 4;
+				put32(&entry[16], crc);
+				central_dirty = TRUE;
+			} else {
+				// the last entry can grow where it is, others move after it
+				if (cursor == zip.entries_end && data_offset + size == zip.entries_end) cursor = local_offset;
+
+				cursor = write_relocated_entry(&zip, entry, memfd, st.st_size, cursor, data_alignment(data_offset));
+				ok = cursor != 0;
+				central_dirty = TRUE;
+			}
+
+			if (ok) patched++;
+			else failed++;
+		}
+
+		recipe_free(&edits);
+		close(memfd);
+
+		// a failed relocation leaves nowhere safe to continue writing
+		if (cursor == 0) break;
+	}
+
+	if (central_dirty && cursor != 0) {
+		int ok;
+		if (cursor == zip.entries_end && zip.entries_end == zip.central_offset) {
+			// nothing moved, only CRCs changed
+			ok = pwrite(fd, zip.central, zip.central_size, zip.central_offset) == (ssize_t)zip.central_size;
+		} else {
+			put32(&zip.end[16], cursor);
+			ok = pwrite(fd, zip.central, zip.central_size, cursor) == (ssize_t)zip.central_size
+			  && pwrite(fd, zip.end, zip.end_size, cursor + zip.central_size) == (ssize_t)zip.end_size
+			  && ftruncate(fd, (off_t)cursor + zip.central_size + zip.end_size) == 0;
+		}
+
+		if (!ok) {
+			printf("%s\n", "Failed to write the ZIP central directory!");
+			failed++;
+		} else if (zip.signed_apk) {
+			printf("%s\n", "APK signing block is no longer valid, re-sign the archive");
+		}
+	}
+
+	// all or nothing: the archive is only replaced once every entry made it
+	int replaced = failed == 0 && central_dirty && fsync(fd) == 0 && rename(temp_path, path) == 0;
+	if (!replaced) unlink(temp_path);
+	if (failed == 0 && central_dirty && !replaced) {
+		printf("Failed to replace %s\n", path);
+		failed++;
+	}
+
+	if (failed == 0) printf("Patched %i native libraries in %s\n", patched, path);
+	else printf("%i native libraries failed in %s, the archive is left as it was\n", failed, path);
+
+	free_zip(&zip);
+	close(fd);
+	close(original);
+	return failed == 0;
+}
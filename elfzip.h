@@ -0,0 +1,30 @@
+// elfzip.h
+#pragma once
+
+#include "elfpatcher.h"
+
+/**
+ * Patch the stored native libraries of an APK/ZIP without unpacking it.
+ *   - Every stored "lib/<abi>/<name>.so" entry is copied to memory and patched
+ *     with patch_fd_edits, nothing else in the archive is read.
+ *   - Entries that keep their size are patched in place in the archive.
+ *   - Entries that grow are rewritten after the last entry (over any APK
+ *     signing block), keeping their 4 KB / 16 KB data alignment through
+ *     zipalign-style extra field padding. The central directory follows.
+ *   - CRC-32s are updated in both local and central headers.
+ *   - All of this happens on a copy next to the archive (a reflink where
+ *     the filesystem allows), which is synced and renamed over it once
+ *     every entry is done. After a crash or a failed entry the archive is
+ *     untouched; only a leftover "<path>.XXXXXX" copy may remain.
+ * Compressed entries and ZIP64 archives are not supported.
+ * A signed APK has to be re-signed afterwards.
+ *
+ * @param config the prefix of each entry is picked from its rules by the ELF
+ *               header, entries no rule matches are left alone. Its lock
+ *               wait and recipe cache apply, the journal does not: archives
+ *               are not journaled.
+ * @param abi    only patch lib/<abi>/ entries, or NULL for all
+ * @return TRUE if every matching entry was patched, PATCH_BUSY if another
+ *         writer kept the archive locked, FALSE otherwise (nothing changed)
+ */
+int patch_zip(const char* path, const PatchConfig* config, const char* abi);
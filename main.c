@@ -1,15 +1,241 @@
 #include "elfpatcher.h"
+#include "elfbatch.h"
+#include "elfcheck.h"
+#include "elfdaemon.h"
+#include "elfjournal.h"
+#include "elfwatch.h"
+#include "elflock.h"
+#include "elfzip.h"
 
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
 
-int main() {
-	int res = patch_auto("libcustom.so", "/data/data/com.test/files/lib/armeavi-v7a/");
+// the lib/<abi>/ trees of an app, each library gets the prefix of its own ABI
+static const PatchRule default_rules[] = {
+	{ EM_ARM,     ELFCLASS32, "armeabi-v7a", "/data/data/com.test/files/lib/armeabi-v7a/" },
+	{ EM_AARCH64, ELFCLASS64, "arm64-v8a",   "/data/data/com.test/files/lib/arm64-v8a/" },
+	{ EM_386,     ELFCLASS32, "x86",         "/data/data/com.test/files/lib/x86/" },
+	{ EM_X86_64,  ELFCLASS64, "x86_64",      "/data/data/com.test/files/lib/x86_64/" },
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+	(void)sig;
+	stop_requested = 1;
+}
+
+static int is_archive(const char* path) {
+	size_t length = strlen(path);
+	return length > 4 && (strcmp(&path[length - 4], ".apk") == 0 || strcmp(&path[length - 4], ".zip") == 0);
+}
+
+static void usage(const char* name) {
+	printf("Usage: %s [options] [path ...]\n", name);
+	printf("       %s [options] --check <sysroot> <path> [path ...]\n", name);
+	printf("       %s [options] --watch <dir> [dir ...]\n", name);
+	printf("       %s [options] --daemon <socket>\n", name);
+	printf("       %s [options] --revert <journal>\n", name);
+	printf("Options:\n");
+	printf("  --strategy prefix|runpath  prefix every DT_NEEDED name (default), or use DT_RUNPATH\n");
+	printf("  --recipes <dir>            recipe cache directory\n");
+	printf("  --journal <file>           record how to undo every file patched in place\n");
+	printf("  --lock-wait <ms>           wait for other writers, 0 skips busy files, -1 waits for ever\n");
+	printf("  --socket <socket>          send the paths to a running daemon\n");
+	printf("  --post-check <sysroot>     resolve the dependencies of every file in the sysroot after patching\n");
+	printf("  --threads <count>          files patched at once by a batch or the daemon, 0 picks the CPU count\n");
+	printf("  -v, --verbose              print the progress of every file\n");
+}
+
+static const struct option long_options[] = {
+	{ "strategy",   required_argument, NULL, 's' },
+	{ "recipes",    required_argument, NULL, 'r' },
+	{ "journal",    required_argument, NULL, 'j' },
+	{ "lock-wait",  required_argument, NULL, 'w' },
+	{ "socket",     required_argument, NULL, 'S' },
+	{ "threads",    required_argument, NULL, 't' },
+	{ "check",      required_argument, NULL, 'c' },
+	{ "post-check", required_argument, NULL, 'P' },
+	{ "watch",      no_argument,       NULL, 'W' },
+	{ "daemon",     required_argument, NULL, 'D' },
+	{ "revert",     required_argument, NULL, 'R' },
+	{ "verbose",    no_argument,       NULL, 'v' },
+	{ "help",       no_argument,       NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char** argv) {
+	PatchConfig config = {
+		{ default_rules, sizeof(default_rules) / sizeof(default_rules[0]) },
+		PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL
+	};
+	const char* socket_path = NULL;
+	const char* sysroot = NULL;
+	const char* post_check = NULL;
+	const char* daemon_socket = NULL;
+	const char* revert_journal = NULL;
+	int watch = FALSE, threads = 0;
+
+	int option;
+	while ((option = getopt_long(argc, argv, "vh", long_options, NULL)) != -1) {
+		switch (option) {
+			case 's':
+				if (strcmp(optarg, "runpath") == 0) config.strategy = PATCH_STRATEGY_RUNPATH;
+				else if (strcmp(optarg, "prefix") == 0) config.strategy = PATCH_STRATEGY_PREFIX;
+				else {
+					printf("Unknown strategy : %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'r': config.recipe_dir = optarg; break;
+			case 'j': config.journal = optarg; break;
+			case 'w': config.lock_wait_ms = atoi(optarg); break;
+			case 'S': socket_path = optarg; break;
+			case 't': threads = atoi(optarg); break;
+			case 'c': sysroot = optarg; break;
+			case 'P': post_check = optarg; break;
+			case 'W': watch = TRUE; break;
+			case 'D': daemon_socket = optarg; break;
+			case 'R': revert_journal = optarg; break;
+			case 'v': config.verbose = TRUE; break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	const char* const* paths = (const char* const*)&argv[optind];
+	int path_count = argc - optind;
+
+	// putting the files a journal recorded back as they were
+	if (revert_journal) {
+		int failed = journal_revert(revert_journal, config.lock_wait_ms);
+		if (failed < 0) printf("Cannot read journal %s\n", revert_journal);
+		else if (failed > 0) printf("%i files were not reverted\n", failed);
+		return failed == 0 ? 0 : 1;
+	}
+
+	if (daemon_socket) {
+		signal(SIGINT, handle_stop);
+		signal(SIGTERM, handle_stop);
+		PatchDaemonConfig daemon_config = { daemon_socket, &config, threads };
+		return patch_daemon_run(&daemon_config, &stop_requested) ? 0 : 1;
+	}
+
+	// resolving the dependencies of the paths inside the sysroot
+	if (sysroot) {
+		if (path_count == 0) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		SysrootIndex index;
+		if (!sysroot_index_init(&index, sysroot)) {
+			printf("Cannot index %s\n", sysroot);
+			return 1;
+		}
+
+		int broken = 0, unreadable = 0;
+		for (int i = 0; i < path_count; ++i) {
+			int result = sysroot_check(&index, paths[i], NULL);
+			if (result < 0) unreadable++;
+			else broken += result;
+		}
+		sysroot_index_free(&index);
+
+		printf("Checked %i files: %i broken references, %i unreadable\n", path_count, broken, unreadable);
+		return broken || unreadable ? 1 : 0;
+	}
+
+	// patching libraries as they are written into the directories
+	if (watch) {
+		if (path_count == 0) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		signal(SIGINT, handle_stop);
+		signal(SIGTERM, handle_stop);
+		PatchWatchConfig watch_config = { paths, path_count, &config, 0 };
+		return patch_watch_run(&watch_config, &stop_requested) ? 0 : 1;
+	}
+
+	// handled by the daemon if one is running, one job per path
+	if (socket_path) {
+		int failed = path_count == 0;
+		for (int i = 0; i < path_count; ++i) {
+			char reply[DAEMON_MAX_STRING];
+			int result = patch_client(&config, socket_path, DAEMON_JOB_PATCH, paths[i], reply, sizeof(reply));
+			if (!result || result == PATCH_CONFLICT) failed++;
+			printf("%s\n", reply);
+		}
+		return failed ? 1 : 0;
+	}
+
+	// a whole mixed-ABI tree in one pass, optionally checked against the device afterwards;
+	// archives among the paths are patched one by one behind it, without the check
+	if (path_count > 1 || (post_check && path_count == 1 && !is_archive(paths[0]))) {
+		const char** libraries = malloc(path_count * sizeof(const char*));
+		if (!libraries) {
+			printf("%s\n", "Fail!");
+			return 1;
+		}
+		int library_count = 0;
+		for (int i = 0; i < path_count; ++i) {
+			if (!is_archive(paths[i])) libraries[library_count++] = paths[i];
+		}
+
+		int ok = TRUE;
+		if (library_count > 0) {
+			SysrootIndex index;
+			if (post_check && !sysroot_index_init(&index, post_check)) {
+				printf("Cannot index %s\n", post_check);
+				free(libraries);
+				return 1;
+			}
+			ok = patch_batch(libraries, library_count, &config, threads, post_check ? &index : NULL, NULL);
+			if (post_check) sysroot_index_free(&index);
+		}
+		free(libraries);
+
+		for (int i = 0; i < path_count; ++i) {
+			if (is_archive(paths[i]) && !patch_zip(paths[i], &config, NULL)) ok = FALSE;
+		}
+		return ok ? 0 : 1;
+	}
+
+	const char* path = path_count > 0 ? paths[0] : "libcustom.so";
+
+	int res = is_archive(path) ? patch_zip(path, &config, NULL) : patch_file(path, &config);
+
+	if (res == PATCH_UNCHANGED) {
+		printf("%s\n", "Already patched!");
+		return 0;
+	}
+
+	// another worker is on it
+	if (res == PATCH_BUSY) {
+		printf("%s\n", "Busy!");
+		return 0;
+	}
+
+	if (res == PATCH_CONFLICT) {
+		printf("%s\n", "Patched with other rules, revert first!");
+		return 1;
+	}
 
 	if (res) {
 		printf("%s\n", "Succeed!");
 		return 0;
 	}
-	
+
 	printf("%s\n", "Fail!");
 	return 1;
 }
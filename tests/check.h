@@ -0,0 +1,20 @@
+// check.h
+#pragma once
+
+#include <stdio.h>
+
+// failed CHECKs so far; a test's main returns check_report()
+static int check_failures;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			printf("%s:%i: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			check_failures++; \
+		} \
+	} while (0)
+
+static inline int check_report(const char* name) {
+	printf("%s: %s\n", name, check_failures ? "FAILED" : "ok");
+	return check_failures != 0;
+}
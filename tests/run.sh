@@ -0,0 +1,50 @@
+#!/bin/sh
+# run.sh - Build and run the round-trip tests on synthetic ELF files
+#
+# Usage: tests/run.sh [name ...]
+#
+# Every tests/test_<name>.c is linked with the patcher and elfparser
+# sources (their main.c files excluded) and tests/synth.c, then run in a
+# scratch directory of its own. With names only those tests run.
+# CC and CFLAGS are honoured; no build system is needed.
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-Wall -Wextra -O2 -g"}
+
+build=$(mktemp -d) || exit 1
+trap 'rm -rf "$build"' EXIT
+
+sources="$(ls "$root"/*.c | grep -v '/main\.c$')
+$root/elfparser/elfmod.c
+$root/elfparser/elfdynstr.c
+$root/elfparser/elfdynsym.c
+$root/elfparser/elfneeded.c
+$root/elfparser/elfstrip.c
+$root/elfparser/elfcost.c
+$root/tests/synth.c"
+
+for source in $sources; do
+	$CC $CFLAGS -c -o "$build/$(basename "$source" .c).o" "$source" || exit 1
+done
+
+if [ $# -gt 0 ]; then
+	tests=""
+	for name in "$@"; do tests="$tests $root/tests/test_$name.c"; done
+else
+	tests=$(ls "$root"/tests/test_*.c)
+fi
+
+failed=0
+for test in $tests; do
+	name=$(basename "$test" .c)
+	mkdir "$build/$name"
+	if ! $CC $CFLAGS -pthread -o "$build/$name/$name" "$test" "$build"/*.o; then
+		failed=$((failed + 1))
+		continue
+	fi
+	(cd "$build/$name" && "./$name") || failed=$((failed + 1))
+done
+
+[ $failed -eq 0 ] && echo "All tests passed" || echo "$failed test(s) failed"
+[ $failed -eq 0 ]
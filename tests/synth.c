@@ -0,0 +1,688 @@
+// synth.c
+#include "synth.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define SYNTH_DATA_DELTA 0x10000 // the writable segment's address minus its offset
+#define SYNTH_MAX_STRINGS 4096
+#define SYNTH_MAX_SYMBOLS 256
+
+typedef struct {
+	unsigned char* bytes;
+	int msb;
+	int word; // 4 or 8
+} Image;
+
+typedef struct {
+	char data[SYNTH_MAX_STRINGS];
+	size_t size;
+} Strings;
+
+static void put(Image* image, uint64_t offset, uint64_t value, int size) {
+	for (int i = 0; i < size; ++i) {
+		int shift = image->msb ? (size - 1 - i) * 8 : i * 8;
+		image->bytes[offset + i] = (unsigned char)(value >> shift);
+	}
+}
+
+static void put_word(Image* image, uint64_t offset, uint64_t value) {
+	put(image, offset, value, image->word);
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align) {
+	return (value + align - 1) & ~(align - 1);
+}
+
+// equal strings are stored once, as a linker does
+static uint32_t add_string(Strings* strings, const char* string) {
+	for (size_t offset = 1; offset < strings->size; offset += strlen(&strings->data[offset]) + 1) {
+		if (strcmp(&strings->data[offset], string) == 0) return offset;
+	}
+
+	size_t size = strlen(string) + 1;
+	if (strings->size + size > SYNTH_MAX_STRINGS) return 0;
+	memcpy(&strings->data[strings->size], string, size);
+	strings->size += size;
+	return strings->size - size;
+}
+
+static uint32_t gnu_hash(const char* name) {
+	uint32_t h = 5381;
+	for (const unsigned char* c = (const unsigned char*)name; *c; ++c) h = h * 33 + *c;
+	return h;
+}
+
+static uint32_t sysv_hash(const char* name) {
+	uint32_t h = 0;
+	for (const unsigned char* c = (const unsigned char*)name; *c; ++c) {
+		h = (h << 4) + *c;
+		uint32_t g = h & 0xf0000000;
+		if (g) h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+static void write_phdr(Image* image, uint64_t at, uint32_t type, uint32_t flags, uint64_t offset, uint64_t address,
+                       uint64_t size, uint64_t align) {
+	if (image->word == 8) {
+		put(image, at, type, 4);
+		put(image, at + 4, flags, 4);
+		put(image, at + 8, offset, 8);
+		put(image, at + 16, address, 8);
+		put(image, at + 24, address, 8);
+		put(image, at + 32, size, 8);
+		put(image, at + 40, size, 8);
+		put(image, at + 48, align, 8);
+	} else {
+		put(image, at, type, 4);
+		put(image, at + 4, offset, 4);
+		put(image, at + 8, address, 4);
+		put(image, at + 12, address, 4);
+		put(image, at + 16, size, 4);
+		put(image, at + 20, size, 4);
+		put(image, at + 24, flags, 4);
+		put(image, at + 28, align, 4);
+	}
+}
+
+static void write_symbol(Image* image, uint64_t at, uint32_t name, uint64_t value, uint64_t size, int section) {
+	unsigned char info = (STB_GLOBAL << 4) | STT_FUNC;
+	put(image, at, name, 4);
+	if (image->word == 8) {
+		image->bytes[at + 4] = info;
+		put(image, at + 6, section, 2);
+		put(image, at + 8, value, 8);
+		put(image, at + 16, size, 8);
+	} else {
+		put(image, at + 4, value, 4);
+		put(image, at + 8, size, 4);
+		image->bytes[at + 12] = info;
+		put(image, at + 14, section, 2);
+	}
+}
+
+// the field order is the same in both classes, only the address sized ones widen
+static void write_shdr(Image* image, uint64_t at, uint32_t name, uint32_t type, uint64_t flags, uint64_t address,
+                       uint64_t offset, uint64_t size, uint32_t link, uint32_t info, uint64_t align, uint64_t entsize) {
+	int w = image->word;
+	put(image, at, name, 4);
+	put(image, at + 4, type, 4);
+	put_word(image, at + 8, flags);
+	put_word(image, at + 8 + w, address);
+	put_word(image, at + 8 + 2 * w, offset);
+	put_word(image, at + 8 + 3 * w, size);
+	put(image, at + 8 + 4 * w, link, 4);
+	put(image, at + 12 + 4 * w, info, 4);
+	put_word(image, at + 16 + 4 * w, align);
+	put_word(image, at + 16 + 5 * w, entsize);
+}
+
+int synth_write(const char* path, const SynthSpec* spec) {
+	int wide = spec->elf_class == ELFCLASS64;
+	int w = wide ? 8 : 4;
+	uint64_t ehsize = wide ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+	uint64_t phentsize = wide ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	uint64_t symsize = wide ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	uint64_t dynsize = wide ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+	uint64_t shentsize = wide ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+
+	int symbol_count = 1 + spec->undefined_count + spec->defined_count;
+	if (symbol_count > SYNTH_MAX_SYMBOLS) return FALSE;
+
+	// .dynstr
+	Strings dynstr = { "", 1 };
+	uint32_t needed[SYNTH_MAX_SYMBOLS];
+	for (int i = 0; i < spec->needed_count; ++i) needed[i] = add_string(&dynstr, spec->needed[i]);
+	uint32_t soname = spec->soname ? add_string(&dynstr, spec->soname) : 0;
+	uint32_t runpath = spec->runpath ? add_string(&dynstr, spec->runpath) : 0;
+
+	// symbols: the null one, the imports, then the exports ordered by GNU hash bucket
+	const char* names[SYNTH_MAX_SYMBOLS] = { "" };
+	int defined_index[SYNTH_MAX_SYMBOLS]; // position in spec->defined, -1 for imports
+	for (int i = 0; i < spec->undefined_count; ++i) {
+		names[1 + i] = spec->undefined[i];
+		defined_index[1 + i] = -1;
+	}
+	int symbol_offset = 1 + spec->undefined_count;
+	int bucket_count = spec->defined_count / 2 + 1;
+	int next = symbol_offset;
+	for (int bucket = 0; bucket < bucket_count; ++bucket) {
+		for (int i = 0; i < spec->defined_count; ++i) {
+			if (spec->gnu_hash ? (int)(gnu_hash(spec->defined[i]) % bucket_count) != bucket : bucket != 0) continue;
+			names[next] = spec->defined[i];
+			defined_index[next++] = i;
+		}
+	}
+	uint32_t symbol_names[SYNTH_MAX_SYMBOLS] = { 0 };
+	for (int i = 1; i < symbol_count; ++i) symbol_names[i] = add_string(&dynstr, names[i]);
+
+	uint32_t version_name = spec->verneed ? add_string(&dynstr, "V_1") : 0;
+	uint32_t version_file = spec->verneed ? add_string(&dynstr, spec->verneed) : 0;
+	if (spec->unused) add_string(&dynstr, spec->unused);
+
+	// sections, indices first: symbols refer to .text
+	int section_count = 0;
+	int note_section = spec->build_id ? ++section_count : 0;
+	int dynsym_section = ++section_count;
+	int dynstr_section = ++section_count;
+	int gnu_hash_section = spec->gnu_hash ? ++section_count : 0;
+	int hash_section = spec->sysv_hash ? ++section_count : 0;
+	int versym_section = spec->verneed ? ++section_count : 0;
+	int verneed_section = spec->verneed ? ++section_count : 0;
+	int reldyn_section = spec->relocs ? ++section_count : 0;
+	int relplt_section = spec->relocs ? ++section_count : 0;
+	int text_section = ++section_count;
+	int dynamic_section = ++section_count;
+	int comment_section = ++section_count;
+	int debug_section = spec->sections && spec->debug_size ? ++section_count : 0;
+	int shstrtab_section = ++section_count;
+	section_count++;
+
+	// layout
+	int phnum = spec->build_id ? 4 : 3;
+	uint64_t offset = ehsize + phnum * phentsize;
+	uint64_t note_offset = align_up(offset, 4);
+	uint64_t note_size = spec->build_id ? 16 + 20 : 0;
+	uint64_t dynsym_offset = align_up(note_offset + note_size, w);
+	uint64_t dynstr_offset = dynsym_offset + symbol_count * symsize;
+	uint64_t gnu_hash_offset = align_up(dynstr_offset + dynstr.size, w);
+	uint64_t gnu_hash_size = spec->gnu_hash ? 16 + w + bucket_count * 4 + spec->defined_count * 4 : 0;
+	uint64_t hash_offset = align_up(gnu_hash_offset + gnu_hash_size, 4);
+	int sysv_buckets = symbol_count / 2 + 1;
+	uint64_t hash_size = spec->sysv_hash ? (2 + sysv_buckets + symbol_count) * 4 : 0;
+	uint64_t versym_offset = align_up(hash_offset + hash_size, 2);
+	uint64_t versym_size = spec->verneed ? symbol_count * 2 : 0;
+	uint64_t verneed_offset = align_up(versym_offset + versym_size, 4);
+	uint64_t verneed_size = spec->verneed ? 32 : 0;
+	// RELA for 64-bit, REL for 32-bit, as the usual ABIs of each class
+	uint64_t relsize = wide ? sizeof(Elf64_Rela) : sizeof(Elf32_Rel);
+	uint64_t reldyn_offset = align_up(verneed_offset + verneed_size, w);
+	uint64_t reldyn_size = spec->relocs ? (symbol_count - 1) * relsize : 0;
+	uint64_t relplt_offset = reldyn_offset + reldyn_size;
+	uint64_t relplt_size = reldyn_size;
+	uint64_t text_offset = align_up(relplt_offset + relplt_size, 16);
+	uint64_t text_size = 16 * (spec->defined_count ? spec->defined_count : 1);
+	uint64_t text_end = text_offset + text_size;
+
+	int dyn_count = spec->needed_count + (spec->soname != NULL) + (spec->runpath != NULL) + 4 + (spec->gnu_hash != 0)
+	              + (spec->sysv_hash != 0) + (spec->verneed ? 3 : 0) + (spec->relocs ? 6 : 0) + (spec->mips_gotsym != 0) + 1
+	              + spec->spare_dyn;
+	uint64_t dynamic_offset = align_up(text_end, 16);
+	uint64_t dynamic_address = dynamic_offset + SYNTH_DATA_DELTA;
+	uint64_t dynamic_size = dyn_count * dynsize;
+	uint64_t data_end = dynamic_offset + dynamic_size;
+
+	Strings shstrtab = { "", 1 };
+	static const char comment[] = "GCC: (synth) 1.0";
+	uint64_t comment_offset = data_end;
+	uint64_t debug_offset = comment_offset + sizeof(comment);
+	uint64_t debug_size = debug_section ? spec->debug_size : 0;
+	uint64_t shstrtab_offset = debug_offset + debug_size;
+	uint32_t section_names[32] = { 0 };
+	if (spec->sections) {
+		if (note_section) section_names[note_section] = add_string(&shstrtab, ".note.gnu.build-id");
+		section_names[dynsym_section] = add_string(&shstrtab, ".dynsym");
+		section_names[dynstr_section] = add_string(&shstrtab, ".dynstr");
+		if (gnu_hash_section) section_names[gnu_hash_section] = add_string(&shstrtab, ".gnu.hash");
+		if (hash_section) section_names[hash_section] = add_string(&shstrtab, ".hash");
+		if (versym_section) section_names[versym_section] = add_string(&shstrtab, ".gnu.version");
+		if (verneed_section) section_names[verneed_section] = add_string(&shstrtab, ".gnu.version_r");
+		if (reldyn_section) section_names[reldyn_section] = add_string(&shstrtab, wide ? ".rela.dyn" : ".rel.dyn");
+		if (relplt_section) section_names[relplt_section] = add_string(&shstrtab, wide ? ".rela.plt" : ".rel.plt");
+		section_names[text_section] = add_string(&shstrtab, ".text");
+		section_names[dynamic_section] = add_string(&shstrtab, ".dynamic");
+		section_names[comment_section] = add_string(&shstrtab, ".comment");
+		if (debug_section) section_names[debug_section] = add_string(&shstrtab, ".debug_info");
+		section_names[shstrtab_section] = add_string(&shstrtab, ".shstrtab");
+	}
+	uint64_t shoff = spec->sections ? align_up(shstrtab_offset + shstrtab.size, w) : 0;
+	uint64_t file_size = spec->sections ? shoff + section_count * shentsize : data_end;
+
+	Image image = { calloc(1, file_size), spec->data == ELFDATA2MSB, w };
+	if (!image.bytes) return FALSE;
+
+	// ELF header
+	memcpy(image.bytes, ELFMAG, SELFMAG);
+	image.bytes[EI_CLASS] = spec->elf_class;
+	image.bytes[EI_DATA] = spec->data;
+	image.bytes[EI_VERSION] = EV_CURRENT;
+	put(&image, 16, ET_DYN, 2);
+	put(&image, 18, spec->machine, 2);
+	put(&image, 20, EV_CURRENT, 4);
+	put_word(&image, 24 + w, ehsize);
+	put_word(&image, 24 + 2 * w, shoff);
+	put(&image, 28 + 3 * w, ehsize, 2);
+	put(&image, 30 + 3 * w, phentsize, 2);
+	put(&image, 32 + 3 * w, phnum, 2);
+	put(&image, 34 + 3 * w, spec->sections ? shentsize : 0, 2);
+	put(&image, 36 + 3 * w, spec->sections ? section_count : 0, 2);
+	put(&image, 38 + 3 * w, spec->sections ? shstrtab_section : 0, 2);
+
+	// program headers
+	uint64_t at = ehsize;
+	write_phdr(&image, at, PT_LOAD, PF_R | PF_X, 0, 0, text_end, 0x1000);
+	write_phdr(&image, at += phentsize, PT_LOAD, PF_R | PF_W, dynamic_offset, dynamic_address, dynamic_size, 0x1000);
+	write_phdr(&image, at += phentsize, PT_DYNAMIC, PF_R | PF_W, dynamic_offset, dynamic_address, dynamic_size, w);
+	if (spec->build_id) write_phdr(&image, at += phentsize, PT_NOTE, PF_R, note_offset, note_offset, note_size, 4);
+
+	if (spec->build_id) {
+		put(&image, note_offset, 4, 4);
+		put(&image, note_offset + 4, 20, 4);
+		put(&image, note_offset + 8, NT_GNU_BUILD_ID, 4);
+		memcpy(&image.bytes[note_offset + 12], "GNU", 4);
+		for (int i = 0; i < 20; ++i) image.bytes[note_offset + 16 + i] = (unsigned char)(spec->build_id * 31 + i * 7);
+	}
+
+	// .dynsym and .dynstr
+	for (int i = 1; i < symbol_count; ++i) {
+		int defined = defined_index[i];
+		uint64_t value = defined < 0 ? 0 : text_offset + 16 * defined;
+		write_symbol(&image, dynsym_offset + i * symsize, symbol_names[i], value, defined < 0 ? 0 : 16,
+		             defined < 0 ? SHN_UNDEF : text_section);
+	}
+	memcpy(&image.bytes[dynstr_offset], dynstr.data, dynstr.size);
+
+	// .gnu.hash: one bloom word, shift 6
+	if (spec->gnu_hash) {
+		put(&image, gnu_hash_offset, bucket_count, 4);
+		put(&image, gnu_hash_offset + 4, symbol_offset, 4);
+		put(&image, gnu_hash_offset + 8, 1, 4);
+		put(&image, gnu_hash_offset + 12, 6, 4);
+
+		uint64_t bloom = 0;
+		uint64_t buckets = gnu_hash_offset + 16 + w;
+		uint64_t chains = buckets + bucket_count * 4;
+		for (int i = symbol_offset; i < symbol_count; ++i) {
+			uint32_t h = gnu_hash(names[i]);
+			int bucket = h % bucket_count;
+			bloom |= (uint64_t)1 << (h % (w * 8));
+			bloom |= (uint64_t)1 << ((h >> 6) % (w * 8));
+
+			if (i == symbol_offset || gnu_hash(names[i - 1]) % bucket_count != (uint32_t)bucket) {
+				put(&image, buckets + bucket * 4, i, 4);
+			}
+			int last = i + 1 == symbol_count || gnu_hash(names[i + 1]) % bucket_count != (uint32_t)bucket;
+			put(&image, chains + (i - symbol_offset) * 4, (h & ~1u) | last, 4);
+		}
+		put_word(&image, gnu_hash_offset + 16, bloom);
+	}
+
+	// .hash
+	if (spec->sysv_hash) {
+		uint32_t bucket_heads[SYNTH_MAX_SYMBOLS] = { 0 };
+		uint32_t chain[SYNTH_MAX_SYMBOLS] = { 0 };
+		for (int i = 1; i < symbol_count; ++i) {
+			uint32_t bucket = sysv_hash(names[i]) % sysv_buckets;
+			chain[i] = bucket_heads[bucket];
+			bucket_heads[bucket] = i;
+		}
+		put(&image, hash_offset, sysv_buckets, 4);
+		put(&image, hash_offset + 4, symbol_count, 4);
+		for (int i = 0; i < sysv_buckets; ++i) put(&image, hash_offset + 8 + i * 4, bucket_heads[i], 4);
+		for (int i = 0; i < symbol_count; ++i) put(&image, hash_offset + 8 + (sysv_buckets + i) * 4, chain[i], 4);
+	}
+
+	// .gnu.version and .gnu.version_r: the imports need V_1 of spec->verneed
+	if (spec->verneed) {
+		for (int i = 1; i < symbol_count; ++i) put(&image, versym_offset + i * 2, defined_index[i] < 0 ? 2 : 1, 2);
+
+		put(&image, verneed_offset, 1, 2);
+		put(&image, verneed_offset + 2, 1, 2);
+		put(&image, verneed_offset + 4, version_file, 4);
+		put(&image, verneed_offset + 8, 16, 4);
+		put(&image, verneed_offset + 16, sysv_hash("V_1"), 4);
+		put(&image, verneed_offset + 22, 2, 2);
+		put(&image, verneed_offset + 24, version_name, 4);
+	}
+
+	// .rel(a).dyn and .rel(a).plt: a GLOB_DAT and a JUMP_SLOT (6 and 7 on x86 of
+	// either class) for every symbol, at distinct addresses nothing reads
+	if (spec->relocs) {
+		for (int i = 1; i < symbol_count; ++i) {
+			for (int plt = 0; plt < 2; ++plt) {
+				uint64_t entry = (plt ? relplt_offset : reldyn_offset) + (i - 1) * relsize;
+				uint64_t target = dynamic_address + (2 * i + plt) * w;
+				put_word(&image, entry, target);
+				put_word(&image, entry + w, wide ? ((uint64_t)i << 32) | (6 + plt) : ((uint64_t)i << 8) | (6 + plt));
+			}
+		}
+	}
+
+	// .dynamic, the trailing slots are DT_NULL already
+	at = dynamic_offset;
+#define DYN(tag, value) (put_word(&image, at, (tag)), put_word(&image, at + w, (value)), at += dynsize)
+	for (int i = 0; i < spec->needed_count; ++i) DYN(DT_NEEDED, needed[i]);
+	if (spec->soname) DYN(DT_SONAME, soname);
+	if (spec->runpath) DYN(DT_RUNPATH, runpath);
+	DYN(DT_STRTAB, dynstr_offset);
+	DYN(DT_STRSZ, dynstr.size);
+	DYN(DT_SYMTAB, dynsym_offset);
+	DYN(DT_SYMENT, symsize);
+	if (spec->gnu_hash) DYN(DT_GNU_HASH, gnu_hash_offset);
+	if (spec->sysv_hash) DYN(DT_HASH, hash_offset);
+	if (spec->verneed) {
+		DYN(DT_VERSYM, versym_offset);
+		DYN(DT_VERNEED, verneed_offset);
+		DYN(DT_VERNEEDNUM, 1);
+	}
+	if (spec->relocs) {
+		uint64_t shared = spec->relocs == SYNTH_RELOCS_SHARED ? relplt_size : 0;
+		DYN(wide ? DT_RELA : DT_REL, reldyn_offset);
+		DYN(wide ? DT_RELASZ : DT_RELSZ, reldyn_size + shared);
+		DYN(wide ? DT_RELAENT : DT_RELENT, relsize);
+		DYN(DT_JMPREL, relplt_offset);
+		DYN(DT_PLTRELSZ, relplt_size);
+		DYN(DT_PLTREL, wide ? DT_RELA : DT_REL);
+	}
+	if (spec->mips_gotsym) DYN(DT_MIPS_GOTSYM, symbol_offset);
+#undef DYN
+
+	if (spec->sections) {
+		memcpy(&image.bytes[comment_offset], comment, sizeof(comment));
+		memset(&image.bytes[debug_offset], 0xdb, debug_size);
+		memcpy(&image.bytes[shstrtab_offset], shstrtab.data, shstrtab.size);
+
+		uint64_t shdr = shoff + shentsize;
+		if (note_section) {
+			write_shdr(&image, shdr, section_names[note_section], SHT_NOTE, SHF_ALLOC, note_offset, note_offset, note_size, 0, 0, 4, 0);
+			shdr += shentsize;
+		}
+		write_shdr(&image, shdr, section_names[dynsym_section], SHT_DYNSYM, SHF_ALLOC, dynsym_offset, dynsym_offset,
+		           symbol_count * symsize, dynstr_section, 1, w, symsize);
+		write_shdr(&image, shdr += shentsize, section_names[dynstr_section], SHT_STRTAB, SHF_ALLOC, dynstr_offset, dynstr_offset,
+		           dynstr.size, 0, 0, 1, 0);
+		if (gnu_hash_section) {
+			write_shdr(&image, shdr += shentsize, section_names[gnu_hash_section], SHT_GNU_HASH, SHF_ALLOC, gnu_hash_offset,
+			           gnu_hash_offset, gnu_hash_size, dynsym_section, 0, w, 0);
+		}
+		if (hash_section) {
+			write_shdr(&image, shdr += shentsize, section_names[hash_section], SHT_HASH, SHF_ALLOC, hash_offset, hash_offset,
+			           hash_size, dynsym_section, 0, 4, 4);
+		}
+		if (spec->verneed) {
+			write_shdr(&image, shdr += shentsize, section_names[versym_section], SHT_GNU_versym, SHF_ALLOC, versym_offset,
+			           versym_offset, versym_size, dynsym_section, 0, 2, 2);
+			write_shdr(&image, shdr += shentsize, section_names[verneed_section], SHT_GNU_verneed, SHF_ALLOC, verneed_offset,
+			           verneed_offset, verneed_size, dynstr_section, 1, 4, 0);
+		}
+		if (spec->relocs) {
+			uint32_t type = wide ? SHT_RELA : SHT_REL;
+			write_shdr(&image, shdr += shentsize, section_names[reldyn_section], type, SHF_ALLOC, reldyn_offset, reldyn_offset,
+			           reldyn_size, dynsym_section, 0, w, relsize);
+			write_shdr(&image, shdr += shentsize, section_names[relplt_section], type, SHF_ALLOC | SHF_INFO_LINK, relplt_offset,
+			           relplt_offset, relplt_size, dynsym_section, text_section, w, relsize);
+		}
+		write_shdr(&image, shdr += shentsize, section_names[text_section], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, text_offset,
+		           text_offset, text_size, 0, 0, 16, 0);
+		write_shdr(&image, shdr += shentsize, section_names[dynamic_section], SHT_DYNAMIC, SHF_ALLOC | SHF_WRITE,
+		           dynamic_address, dynamic_offset, dynamic_size, dynstr_section, 0, w, dynsize);
+		write_shdr(&image, shdr += shentsize, section_names[comment_section], SHT_PROGBITS, SHF_MERGE | SHF_STRINGS, 0,
+		           comment_offset, sizeof(comment), 0, 0, 1, 1);
+		if (debug_section) {
+			write_shdr(&image, shdr += shentsize, section_names[debug_section], SHT_PROGBITS, 0, 0, debug_offset, debug_size, 0, 0,
+			           1, 0);
+		}
+		write_shdr(&image, shdr += shentsize, section_names[shstrtab_section], SHT_STRTAB, 0, 0, shstrtab_offset, shstrtab.size,
+		           0, 0, 1, 0);
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int ok = fd >= 0 && write(fd, image.bytes, file_size) == (ssize_t)file_size;
+	if (fd >= 0) close(fd);
+	free(image.bytes);
+	return ok;
+}
+
+uint64_t synth_get(const SynthFile* file, uint64_t offset, int size) {
+	if (offset + size > file->size) return 0;
+
+	int msb = file->data[EI_DATA] == ELFDATA2MSB;
+	uint64_t value = 0;
+	for (int i = 0; i < size; ++i) {
+		int shift = msb ? (size - 1 - i) * 8 : i * 8;
+		value |= (uint64_t)file->data[offset + i] << shift;
+	}
+	return value;
+}
+
+static uint64_t get_word(const SynthFile* file, uint64_t offset) {
+	return synth_get(file, offset, file->elf_class == ELFCLASS64 ? 8 : 4);
+}
+
+static int read_file(const char* path, unsigned char** data, size_t* size) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return FALSE;
+
+	struct stat st;
+	*data = fstat(fd, &st) == 0 ? malloc(st.st_size ? st.st_size : 1) : NULL;
+	*size = st.st_size;
+	int ok = *data && read(fd, *data, *size) == (ssize_t)*size;
+	close(fd);
+	if (!ok) free(*data);
+	return ok;
+}
+
+int synth_load(const char* path, SynthFile* file) {
+	memset(file, 0, sizeof(SynthFile));
+	if (!read_file(path, &file->data, &file->size)) return FALSE;
+	if (file->size < sizeof(Elf32_Ehdr) || memcmp(file->data, ELFMAG, SELFMAG) != 0) {
+		synth_free(file);
+		return FALSE;
+	}
+
+	int w = file->data[EI_CLASS] == ELFCLASS64 ? 8 : 4;
+	int host_msb = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+	file->elf_class = file->data[EI_CLASS];
+	file->foreign = (file->data[EI_DATA] == ELFDATA2MSB) != host_msb;
+	file->machine = synth_get(file, 18, 2);
+	file->phoff = get_word(file, 24 + w);
+	file->shoff = get_word(file, 24 + 2 * w);
+	file->phnum = synth_get(file, 32 + 3 * w, 2);
+	file->shnum = synth_get(file, 36 + 3 * w, 2);
+
+	// PT_DYNAMIC
+	uint64_t phentsize = w == 8 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	uint64_t dynamic_size = 0;
+	for (int i = 0; i < file->phnum; ++i) {
+		uint64_t phdr = file->phoff + i * phentsize;
+		if (synth_get(file, phdr, 4) != PT_DYNAMIC) continue;
+		file->dynamic_offset = get_word(file, phdr + (w == 8 ? 8 : 4));
+		dynamic_size = get_word(file, phdr + (w == 8 ? 32 : 16));
+	}
+
+	int capacity = dynamic_size / (2 * w);
+	file->dyn_tags = calloc(capacity ? capacity : 1, sizeof(int64_t));
+	file->dyn_values = calloc(capacity ? capacity : 1, sizeof(uint64_t));
+	while (file->dyn_count < capacity) {
+		uint64_t entry = file->dynamic_offset + file->dyn_count * 2 * w;
+		uint64_t tag = get_word(file, entry);
+		file->dyn_tags[file->dyn_count] = w == 8 ? (int64_t)tag : (int64_t)(int32_t)tag;
+		file->dyn_values[file->dyn_count++] = get_word(file, entry + w);
+		if (tag == DT_NULL) break;
+	}
+
+	uint64_t strtab, strsz, offset;
+	if (!synth_dyn(file, DT_STRTAB, &strtab) || !synth_dyn(file, DT_STRSZ, &strsz)
+	    || !synth_offset(file, strtab, strsz, &offset)) {
+		synth_free(file);
+		return FALSE;
+	}
+	file->strtab = (const char*)&file->data[offset];
+	file->strsz = strsz;
+	return TRUE;
+}
+
+void synth_free(SynthFile* file) {
+	free(file->data);
+	free(file->dyn_tags);
+	free(file->dyn_values);
+	memset(file, 0, sizeof(SynthFile));
+}
+
+int synth_dyn(const SynthFile* file, int64_t tag, uint64_t* value) {
+	for (int i = 0; i < file->dyn_count; ++i) {
+		if (file->dyn_tags[i] == tag) {
+			*value = file->dyn_values[i];
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+int synth_offset(const SynthFile* file, uint64_t address, uint64_t size, uint64_t* offset) {
+	int w = file->elf_class == ELFCLASS64 ? 8 : 4;
+	uint64_t phentsize = w == 8 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+
+	for (int i = 0; i < file->phnum; ++i) {
+		uint64_t phdr = file->phoff + i * phentsize;
+		if (synth_get(file, phdr, 4) != PT_LOAD) continue;
+
+		uint64_t p_offset = get_word(file, phdr + (w == 8 ? 8 : 4));
+		uint64_t p_vaddr = get_word(file, phdr + (w == 8 ? 16 : 8));
+		uint64_t p_filesz = get_word(file, phdr + (w == 8 ? 32 : 16));
+		if (address >= p_vaddr && address + size <= p_vaddr + p_filesz && p_offset + p_filesz <= file->size) {
+			*offset = p_offset + (address - p_vaddr);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+const char* synth_string(const SynthFile* file, uint64_t offset) {
+	if (offset >= file->strsz || !memchr(&file->strtab[offset], '\0', file->strsz - offset)) return NULL;
+	return &file->strtab[offset];
+}
+
+int synth_needed(const SynthFile* file, const char** names, int max) {
+	int count = 0;
+	for (int i = 0; i < file->dyn_count; ++i) {
+		if (file->dyn_tags[i] != DT_NEEDED) continue;
+		if (count < max) names[count] = synth_string(file, file->dyn_values[i]);
+		count++;
+	}
+	return count;
+}
+
+static uint64_t symbol_entry(const SynthFile* file, int index) {
+	uint64_t symtab, offset;
+	uint64_t symsize = file->elf_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	if (!synth_dyn(file, DT_SYMTAB, &symtab) || !synth_offset(file, symtab + index * symsize, symsize, &offset)) return 0;
+	return offset;
+}
+
+const char* synth_symbol_name(const SynthFile* file, int index) {
+	uint64_t entry = symbol_entry(file, index);
+	return entry ? synth_string(file, synth_get(file, entry, 4)) : NULL;
+}
+
+uint64_t synth_symbol_value(const SynthFile* file, int index) {
+	uint64_t entry = symbol_entry(file, index);
+	if (!entry) return 0;
+	return file->elf_class == ELFCLASS64 ? synth_get(file, entry + 8, 8) : synth_get(file, entry + 4, 4);
+}
+
+int synth_relocations(const SynthFile* file, int64_t addr_tag, int64_t size_tag, int* symbols, int max) {
+	uint64_t address, size, offset, pltrel = DT_REL;
+	if (!synth_dyn(file, addr_tag, &address) || !synth_dyn(file, size_tag, &size) || !synth_offset(file, address, size, &offset)) {
+		return -1;
+	}
+	synth_dyn(file, DT_PLTREL, &pltrel);
+
+	int w = file->elf_class == ELFCLASS64 ? 8 : 4;
+	int rela = addr_tag == DT_RELA || (addr_tag == DT_JMPREL && pltrel == DT_RELA);
+	uint64_t entsize = (rela ? 3 : 2) * w;
+	int count = size / entsize;
+	for (int i = 0; i < count && i < max; ++i) {
+		uint64_t info = get_word(file, offset + i * entsize + w);
+		symbols[i] = w == 8 ? (int)(info >> 32) : (int)(info >> 8);
+	}
+	return count;
+}
+
+int synth_gnu_lookup(const SynthFile* file, const char* name) {
+	uint64_t address, table;
+	if (!synth_dyn(file, DT_GNU_HASH, &address) || !synth_offset(file, address, 16, &table)) return -1;
+
+	int w = file->elf_class == ELFCLASS64 ? 8 : 4;
+	uint32_t bucket_count = synth_get(file, table, 4);
+	uint32_t symbol_offset = synth_get(file, table + 4, 4);
+	uint32_t bloom_size = synth_get(file, table + 8, 4);
+	uint32_t bloom_shift = synth_get(file, table + 12, 4);
+	if (bucket_count == 0 || bloom_size == 0) return -1;
+
+	// a symbol missing from the bloom filter is not looked for at all, as in ld.so
+	uint32_t h = gnu_hash(name);
+	int bits = w * 8;
+	uint64_t word = get_word(file, table + 16 + (uint64_t)((h / bits) % bloom_size) * w);
+	uint64_t mask = ((uint64_t)1 << (h % bits)) | ((uint64_t)1 << ((h >> bloom_shift) % bits));
+	if ((word & mask) != mask) return -1;
+
+	uint64_t buckets = table + 16 + (uint64_t)bloom_size * w;
+	uint64_t chains = buckets + (uint64_t)bucket_count * 4;
+	uint32_t index = synth_get(file, buckets + (h % bucket_count) * 4, 4);
+	if (index == 0) return -1;
+
+	for (; index >= symbol_offset; ++index) {
+		uint32_t chain = synth_get(file, chains + (uint64_t)(index - symbol_offset) * 4, 4);
+		const char* symbol = synth_symbol_name(file, index);
+		if ((chain | 1) == (h | 1) && symbol && strcmp(symbol, name) == 0) return index;
+		if (chain & 1) break;
+	}
+	return -1;
+}
+
+int synth_sysv_lookup(const SynthFile* file, const char* name) {
+	uint64_t address, table;
+	if (!synth_dyn(file, DT_HASH, &address) || !synth_offset(file, address, 8, &table)) return -1;
+
+	uint32_t bucket_count = synth_get(file, table, 4);
+	uint32_t chain_count = synth_get(file, table + 4, 4);
+	if (bucket_count == 0) return -1;
+
+	uint32_t index = synth_get(file, table + 8 + (sysv_hash(name) % bucket_count) * 4, 4);
+	for (uint32_t steps = 0; index != 0 && index < chain_count && steps < chain_count; ++steps) {
+		const char* symbol = synth_symbol_name(file, index);
+		if (symbol && strcmp(symbol, name) == 0) return index;
+		index = synth_get(file, table + 8 + (uint64_t)(bucket_count + index) * 4, 4);
+	}
+	return -1;
+}
+
+int synth_same_file(const char* a, const char* b) {
+	unsigned char *x, *y;
+	size_t x_size, y_size;
+	if (!read_file(a, &x, &x_size)) return FALSE;
+	if (!read_file(b, &y, &y_size)) {
+		free(x);
+		return FALSE;
+	}
+
+	int same = x_size == y_size && memcmp(x, y, x_size) == 0;
+	free(y);
+	free(x);
+	return same;
+}
+
+int synth_copy(const char* from, const char* to) {
+	unsigned char* data;
+	size_t size;
+	if (!read_file(from, &data, &size)) return FALSE;
+
+	int fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int ok = fd >= 0 && write(fd, data, size) == (ssize_t)size;
+	if (fd >= 0) close(fd);
+	free(data);
+	return ok;
+}
@@ -0,0 +1,108 @@
+// synth.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Synthetic shared objects for the tests: small, fully described ELF files
+ * of either class and byte order, written without a toolchain.
+ *
+ * The layout is what a linker produces for a library without code:
+ *   - a read-only PT_LOAD at address 0 with the build-id note, .dynsym,
+ *     .dynstr, the hash tables, the version tables, the relocation tables
+ *     and a stub .text;
+ *   - a writable PT_LOAD holding .dynamic, mapped 64 KiB above its file
+ *     offset so addresses and offsets differ;
+ *   - optionally a section header table with .comment (and .debug_info)
+ *     behind the segments.
+ *
+ * The reader half decodes such files (and anything the patchers write into
+ * them) on its own, so the code under test is never its own witness.
+ */
+
+typedef struct {
+	int elf_class;   // ELFCLASS32 or ELFCLASS64
+	int data;        // ELFDATA2LSB or ELFDATA2MSB
+	int machine;     // e_machine
+	const char* const* needed;
+	int needed_count;
+	const char* soname;   // or NULL
+	const char* runpath;  // or NULL
+	const char* const* defined;   // exported symbols
+	int defined_count;
+	const char* const* undefined; // imported symbols
+	int undefined_count;
+	const char* verneed;  // a DT_NEEDED library a version is required from, or NULL
+	const char* unused;   // a string in .dynstr nothing refers to, or NULL
+	int spare_dyn;        // DT_NULL slots behind the terminating one
+	int build_id;         // 0 for none, else the seed of a 20 byte build-id
+	int gnu_hash;
+	int sysv_hash;
+	int sections;         // write the section header table
+	int debug_size;       // bytes of non-allocated .debug_info behind the segments, with sections
+	int relocs;           // SYNTH_RELOCS_*: one dynamic and one PLT relocation per symbol
+	int mips_gotsym;      // a DT_MIPS_GOTSYM entry naming the first export
+} SynthSpec;
+
+#define SYNTH_RELOCS_NONE     0
+#define SYNTH_RELOCS_SEPARATE 1 // DT_JMPREL behind DT_REL(A)SZ, as ld.bfd writes it today
+#define SYNTH_RELOCS_SHARED   2 // DT_REL(A)SZ covering DT_JMPREL too, as older ARM and i386 binutils did
+
+// write 'spec' to 'path' (mode 0644), FALSE on failure
+int synth_write(const char* path, const SynthSpec* spec);
+
+// a file decoded by the reader, every value in host order
+typedef struct {
+	unsigned char* data;
+	size_t size;
+	int elf_class;
+	int foreign;
+	int machine;
+	int phnum;
+	uint64_t phoff;
+	uint64_t shoff;
+	int shnum;
+	uint64_t dynamic_offset;
+	int dyn_count;          // up to and including the first DT_NULL
+	int64_t* dyn_tags;
+	uint64_t* dyn_values;
+	const char* strtab;
+	uint64_t strsz;
+} SynthFile;
+
+// FALSE if the file is not one the reader understands
+int synth_load(const char* path, SynthFile* file);
+void synth_free(SynthFile* file);
+
+// an integer of 'size' bytes at 'offset', in the file's byte order; 0 past the end
+uint64_t synth_get(const SynthFile* file, uint64_t offset, int size);
+
+// the value of the first dynamic entry with 'tag', FALSE if there is none
+int synth_dyn(const SynthFile* file, int64_t tag, uint64_t* value);
+
+// file offset of [address, address + size) through the PT_LOADs, FALSE if unmapped
+int synth_offset(const SynthFile* file, uint64_t address, uint64_t size, uint64_t* offset);
+
+// the string at 'offset' in the dynamic string table, NULL if out of range
+const char* synth_string(const SynthFile* file, uint64_t offset);
+
+// DT_NEEDED names in table order; returns the count, fills at most 'max'
+int synth_needed(const SynthFile* file, const char** names, int max);
+
+// the dynamic symbol 'name' through DT_GNU_HASH or DT_HASH: its index, -1 if not found
+int synth_gnu_lookup(const SynthFile* file, const char* name);
+int synth_sysv_lookup(const SynthFile* file, const char* name);
+
+// st_value and name of dynamic symbol 'index'
+uint64_t synth_symbol_value(const SynthFile* file, int index);
+const char* synth_symbol_name(const SynthFile* file, int index);
+
+// symbol indices of the relocations in the table at 'addr_tag' (DT_REL, DT_RELA or
+// DT_JMPREL) sized by 'size_tag'; returns the count, fills at most 'max', -1 if absent
+int synth_relocations(const SynthFile* file, int64_t addr_tag, int64_t size_tag, int* symbols, int max);
+
+// TRUE if the two files have the same bytes
+int synth_same_file(const char* a, const char* b);
+// copy a file, keeping nothing but its bytes
+int synth_copy(const char* from, const char* to);
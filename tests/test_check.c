@@ -0,0 +1,82 @@
+// test_check.c
+//
+// Dependencies resolved against a sysroot the way the loader would: through
+// symlinked files and directories, through $ORIGIN when the file sits in the
+// sysroot, and skipping candidates of another class or machine.
+#include "../elfcheck.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void write_library(const char* path, int elf_class, int machine, const char* const* needed, int needed_count,
+                          const char* runpath) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = ELFDATA2LSB;
+	spec.machine = machine;
+	spec.needed = needed;
+	spec.needed_count = needed_count;
+	spec.runpath = runpath;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+static void make_dirs(const char* const* dirs, int count) {
+	for (int i = 0; i < count; ++i) CHECK(mkdir(dirs[i], 0755) == 0);
+}
+
+int main(void) {
+	const char* dirs[] = { "root", "root/system", "root/system/lib64", "root/odm", "root/odm/lib64", "root/vendor",
+	                       "root/data", "root/data/app", "root/data/app/lib", "root/data/app/lib/deps" };
+	make_dirs(dirs, 10);
+
+	write_library("root/system/lib64/libc.so", ELFCLASS64, EM_AARCH64, NULL, 0, NULL);
+	CHECK(symlink("libc.so", "root/system/lib64/libc_alias.so") == 0);
+	// /vendor/lib64 is /odm/lib64, by a link absolute on the device
+	write_library("root/odm/lib64/libvendor.so", ELFCLASS64, EM_AARCH64, NULL, 0, NULL);
+	CHECK(symlink("/odm/lib64", "root/vendor/lib64") == 0);
+	// found first for the wrong ABI, then for the right one
+	write_library("root/system/lib64/libboth.so", ELFCLASS32, EM_ARM, NULL, 0, NULL);
+	write_library("root/odm/lib64/libboth.so", ELFCLASS64, EM_AARCH64, NULL, 0, NULL);
+	write_library("root/system/lib64/libarm32.so", ELFCLASS32, EM_ARM, NULL, 0, NULL);
+	write_library("root/system/lib64/libx86.so", ELFCLASS64, EM_X86_64, NULL, 0, NULL);
+	FILE* text = fopen("root/system/lib64/libtext.so", "w");
+	CHECK(text && fputs("INPUT(-lc)\n", text) >= 0 && fclose(text) == 0);
+	write_library("root/data/app/lib/deps/libdep.so", ELFCLASS64, EM_AARCH64, NULL, 0, NULL);
+
+	SysrootIndex index;
+	CHECK(sysroot_index_init(&index, "root") == TRUE);
+
+	// everything resolves: directly, through both kinds of link, past a mismatch, by $ORIGIN
+	const char* good[] = { "libc.so", "libc_alias.so", "libvendor.so", "/vendor/lib64/libvendor.so", "libboth.so", "libdep.so" };
+	write_library("root/data/app/lib/libapp.so", ELFCLASS64, EM_AARCH64, good, 6, "$ORIGIN/deps");
+	CHECK(sysroot_check(&index, "root/data/app/lib/libapp.so", NULL) == 0);
+	CHECK(sysroot_check(&index, "root/data/app/lib/libapp.so", "/system/lib64") == 2); // no /vendor
+	write_library("root/data/app/lib/libbraced.so", ELFCLASS64, EM_AARCH64, good, 6, "${ORIGIN}/deps");
+	CHECK(sysroot_check(&index, "root/data/app/lib/libbraced.so", NULL) == 0);
+
+	// outside the sysroot $ORIGIN stands for nothing
+	CHECK(synth_copy("root/data/app/lib/libapp.so", "libapp.so"));
+	CHECK(sysroot_check(&index, "libapp.so", NULL) == 1);
+
+	// only the wrong class, the wrong machine, not an ELF file, or nothing at all
+	const char* bad[] = { "libarm32.so", "libx86.so", "libtext.so", "libmissing.so", "/system/lib64/libarm32.so", "libc.so" };
+	write_library("root/data/app/lib/libbad.so", ELFCLASS64, EM_AARCH64, bad, 6, NULL);
+	CHECK(sysroot_check(&index, "root/data/app/lib/libbad.so", NULL) == 5);
+
+	// the same names are fine for a 32-bit ARM library looking in lib64
+	const char* arm[] = { "libarm32.so", "libboth.so" };
+	write_library("libarm.so", ELFCLASS32, EM_ARM, arm, 2, NULL);
+	CHECK(sysroot_check(&index, "libarm.so", "/system/lib64") == 0);
+	CHECK(sysroot_check(&index, "libarm.so", NULL) == 2); // /system/lib is empty
+
+	CHECK(sysroot_check(&index, "no_such.so", NULL) == -1);
+	sysroot_index_free(&index);
+
+	CHECK(sysroot_index_init(&index, "no_such_root") == FALSE);
+	return check_report("check");
+}
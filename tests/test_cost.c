@@ -0,0 +1,121 @@
+// test_cost.c
+//
+// Load-time cost profiles from elfcost before and after a patch: pages and
+// segments against the program headers as read back independently, .dynstr
+// growth against DT_STRSZ, and how many opens finding the dependencies takes.
+#include "../elfparser/elfcost.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRUE 1
+#define FALSE 0
+
+#define DEFAULT_DIRS 2
+
+static const char* needed[] = { "libc.so", "libm.so", "libold.so" };
+
+// PT_LOAD count and pages they span at 'page_size', from the file on disk
+static size_t load_pages(const char* path, uint64_t page_size, uint64_t* pages, uint64_t* strsz) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+	int wide = file.elf_class == ELFCLASS64;
+	int w = wide ? 8 : 4;
+	size_t loads = 0;
+	*pages = 0;
+	for (int i = 0; i < file.phnum; ++i) {
+		uint64_t phdr = file.phoff + i * (wide ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr));
+		if (synth_get(&file, phdr, 4) != PT_LOAD) continue;
+		uint64_t vaddr = synth_get(&file, phdr + (wide ? 16 : 8), w);
+		uint64_t memsz = synth_get(&file, phdr + (wide ? 40 : 20), w);
+		loads++;
+		*pages += (vaddr + memsz + page_size - 1) / page_size - vaddr / page_size;
+	}
+	*strsz = file.strsz;
+	synth_free(&file);
+	return loads;
+}
+
+static void profile_of(const char* path, uint64_t page_size, ElfLoadProfile* profile) {
+	ElfContext ctx;
+	CHECK(elf_load(path, &ctx) == 0);
+	CHECK(elf_load_profile(&ctx, page_size, DEFAULT_DIRS, profile) == 0);
+	elf_close(&ctx);
+
+	uint64_t pages, strsz;
+	CHECK(profile->load_segments == load_pages(path, page_size ? page_size : 4096, &pages, &strsz));
+	CHECK(profile->mapped_pages == pages);
+	CHECK(profile->file_pages == pages); // no .bss in these files
+	CHECK(profile->dynstr_size == strsz);
+}
+
+static void before_and_after(int elf_class, int data, uint64_t page_size) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.runpath = "$ORIGIN:/vendor/lib";
+	spec.sysv_hash = TRUE;
+	spec.sections = TRUE;
+	CHECK(synth_write("lib.so", &spec));
+
+	ElfLoadProfile before, after;
+	profile_of("lib.so", page_size, &before);
+	CHECK(before.load_segments == 2);
+	CHECK(before.needed_count == 3 && before.needed_absolute == 0 && before.needed_bare == 3);
+	CHECK(before.search_dirs == 2);
+	CHECK(before.search_probes == 3 * (2 + DEFAULT_DIRS));
+
+	// nothing changed, nothing to pay
+	ElfLoadCost cost;
+	elf_load_cost(&before, &before, &cost);
+	CHECK(cost.extra_pages == 0 && cost.new_load_segments == 0 && cost.dynstr_growth == 0);
+	CHECK(cost.absolute_delta == 0 && cost.probe_delta == 0);
+
+	// a path in place of a bare name: opened once, and appended in a segment of its own
+	ElfContext ctx;
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", "/data/app/lib/libold.so") == 0);
+	CHECK(elf_save(&ctx, "path.so") == 0);
+	elf_close(&ctx);
+	profile_of("path.so", page_size, &after);
+	CHECK(after.needed_count == 3 && after.needed_absolute == 1 && after.needed_bare == 2);
+	CHECK(after.search_probes == 1 + 2 * (2 + DEFAULT_DIRS));
+
+	elf_load_cost(&before, &after, &cost);
+	CHECK(cost.new_load_segments == 1);
+	CHECK(cost.extra_pages == (int64_t)(after.mapped_pages - before.mapped_pages) && cost.extra_pages >= 1);
+	CHECK(cost.dynstr_growth == (int64_t)strlen("/data/app/lib/libold.so") + 1);
+	CHECK(cost.absolute_delta == 1);
+	CHECK(cost.probe_delta == 1 - (2 + DEFAULT_DIRS));
+
+	// and back: the same costs, negated
+	ElfLoadCost back;
+	elf_load_cost(&after, &before, &back);
+	CHECK(back.extra_pages == -cost.extra_pages && back.new_load_segments == -1);
+	CHECK(back.dynstr_growth == -cost.dynstr_growth && back.absolute_delta == -1 && back.probe_delta == -cost.probe_delta);
+
+	// a shorter bare name is rewritten in place and costs nothing
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", "libnew.so") == 0);
+	CHECK(elf_save(&ctx, "bare.so") == 0);
+	elf_close(&ctx);
+	profile_of("bare.so", page_size, &after);
+	elf_load_cost(&before, &after, &cost);
+	CHECK(cost.extra_pages == 0 && cost.new_load_segments == 0 && cost.dynstr_growth == 0);
+	CHECK(cost.absolute_delta == 0 && cost.probe_delta == 0);
+}
+
+int main(void) {
+	before_and_after(ELFCLASS32, ELFDATA2LSB, 0);
+	before_and_after(ELFCLASS64, ELFDATA2MSB, 4096);
+	before_and_after(ELFCLASS64, ELFDATA2LSB, 0x10000);
+
+	ElfLoadProfile profile;
+	CHECK(elf_load_profile(NULL, 0, DEFAULT_DIRS, &profile) != 0);
+	return check_report("cost");
+}
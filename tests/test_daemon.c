@@ -0,0 +1,166 @@
+// test_daemon.c
+//
+// The daemon in its own process and working directory, fed by the client
+// with relative paths: patch, query, conflict and busy replies, the
+// in-process fallback without a daemon, and the explicit turn-away of a
+// full queue.
+#include "../elfdaemon.h"
+#include "../elflock.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PREFIX "/data/app/lib/"
+#define QUEUE_SIZE 256 // as in elfdaemon.c
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_stop(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+static void write_library(const char* path) {
+	static const char* needed[] = { "libc.so", "libm.so" };
+	SynthSpec spec = { 0 };
+	spec.elf_class = ELFCLASS64;
+	spec.data = ELFDATA2LSB;
+	spec.machine = EM_AARCH64;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.build_id = 9;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+static void first_needed_is(const char* path, const char* expected) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[0] && strcmp(names[0], expected) == 0);
+	synth_free(&file);
+}
+
+// a daemon with one worker, serving from '/' so relative paths would miss
+static pid_t start_daemon(const char* socket_path, const PatchConfig* config) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		signal(SIGTERM, handle_stop);
+		if (chdir("/") < 0) _exit(1);
+		PatchDaemonConfig daemon = { socket_path, config, 1 };
+		_exit(patch_daemon_run(&daemon, &stop) ? 0 : 1);
+	}
+
+	struct stat st;
+	struct timespec pause = { 0, 10 * 1000000L };
+	for (int i = 0; i < 500 && stat(socket_path, &st) < 0; ++i) nanosleep(&pause, NULL);
+	CHECK(S_ISSOCK(st.st_mode));
+	return pid;
+}
+
+static void stop_daemon(pid_t pid) {
+	int status = 0;
+	kill(pid, SIGTERM);
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static int connect_raw(const char* socket_path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(void) {
+	char cwd[PATH_MAX], socket_path[PATH_MAX + 16], expected[PATH_MAX + 64];
+	CHECK(getcwd(cwd, sizeof(cwd)) != NULL);
+	snprintf(socket_path, sizeof(socket_path), "%s/d.sock", cwd);
+
+	write_library("a.so");
+	CHECK(synth_copy("a.so", "orig.so"));
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, PREFIX };
+	PatchConfig config = { { &rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+	pid_t daemon = start_daemon(socket_path, &config);
+
+	// relative to the client, not to the daemon
+	char reply[DAEMON_MAX_STRING];
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_PATCH, "a.so", reply, sizeof(reply)) == TRUE);
+	snprintf(expected, sizeof(expected), "patched %s/a.so", cwd);
+	CHECK(strcmp(reply, expected) == 0);
+	first_needed_is("a.so", PREFIX "libc.so");
+
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_PATCH, "./a.so", reply, sizeof(reply)) == PATCH_UNCHANGED);
+	CHECK(strncmp(reply, "unchanged ", 10) == 0);
+
+	// the daemon kept the recipe it recorded
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_QUERY, "orig.so", reply, sizeof(reply)) == TRUE);
+	CHECK(strstr(reply, "build-id=") && strstr(reply, "recipe=yes"));
+
+	// the client's strategy travels with the job
+	PatchConfig runpath = config;
+	runpath.strategy = PATCH_STRATEGY_RUNPATH;
+	CHECK(patch_client(&runpath, socket_path, DAEMON_JOB_PATCH, "a.so", reply, sizeof(reply)) == PATCH_CONFLICT);
+	CHECK(strncmp(reply, "conflict ", 9) == 0);
+
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_PATCH, "missing.so", reply, sizeof(reply)) == FALSE);
+
+	// one connection keeps the only worker, a full queue turns the next ones
+	// away with a reply the client runs the job on itself
+	write_library("b.so");
+	int held[QUEUE_SIZE + 1];
+	for (int i = 0; i < QUEUE_SIZE + 1; ++i) {
+		held[i] = connect_raw(socket_path);
+		CHECK(held[i] >= 0);
+	}
+	PatchConfig journaled = config;
+	journaled.journal = "client.journal"; // only the in-process run sees it
+	CHECK(patch_client(&journaled, socket_path, DAEMON_JOB_PATCH, "b.so", reply, sizeof(reply)) == TRUE);
+	first_needed_is("b.so", PREFIX "libc.so");
+	struct stat st;
+	CHECK(stat("client.journal", &st) == 0 && st.st_size > 0);
+	for (int i = 0; i < QUEUE_SIZE + 1; ++i) close(held[i]);
+
+	stop_daemon(daemon);
+
+	// the daemon's own lock wait applies: one that skips busy files says so
+	write_library("d.so");
+	CHECK(synth_copy("d.so", "d.orig"));
+	PatchConfig skipping = config;
+	skipping.lock_wait_ms = LOCK_WAIT_SKIP;
+	daemon = start_daemon(socket_path, &skipping);
+	int holder = open("d.so", O_RDWR);
+	CHECK(holder >= 0 && lock_file(holder, LOCK_WAIT_SKIP) == TRUE);
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_PATCH, "d.so", reply, sizeof(reply)) == PATCH_BUSY);
+	snprintf(expected, sizeof(expected), "busy %s/d.so", cwd);
+	CHECK(strcmp(reply, expected) == 0);
+	CHECK(synth_same_file("d.so", "d.orig"));
+	close(holder);
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_PATCH, "d.so", reply, sizeof(reply)) == TRUE);
+	first_needed_is("d.so", PREFIX "libc.so");
+	stop_daemon(daemon);
+
+	// nobody listening: the job runs here
+	write_library("c.so");
+	CHECK(patch_client(&config, socket_path, DAEMON_JOB_PATCH, "c.so", reply, sizeof(reply)) == TRUE);
+	first_needed_is("c.so", PREFIX "libc.so");
+
+	return check_report("daemon");
+}
@@ -0,0 +1,112 @@
+// test_dedupe.c
+//
+// A batch patches each distinct content once: copies take the result by
+// reflink or hard link, links to one inode are patched through it, and a
+// journaled batch patches every copy in place so it can be reverted.
+#include "../elfbatch.h"
+#include "../elfjournal.h"
+#include "../elflock.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* paths[] = { "a.so", "copy.so", "link.so", "same_id.so", "other.so" };
+
+static void write_library(const char* path, const char* second_needed, int build_id) {
+	const char* needed[] = { "libc.so", second_needed };
+	SynthSpec spec = { 0 };
+	spec.elf_class = ELFCLASS32;
+	spec.data = ELFDATA2LSB;
+	spec.machine = EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.build_id = build_id;
+	CHECK(synth_write(path, &spec));
+}
+
+static void write_inputs(void) {
+	for (int i = 0; i < 5; ++i) unlink(paths[i]);
+	write_library("a.so", "libz.so", 1);
+	CHECK(synth_copy("a.so", "copy.so"));
+	CHECK(link("a.so", "link.so") == 0);
+	write_library("same_id.so", "libq.so", 1); // same size and build-id, other bytes
+	write_library("other.so", "libz.so", 2);
+
+	char orig[64];
+	for (int i = 0; i < 5; ++i) {
+		snprintf(orig, sizeof(orig), "%s.orig", paths[i]);
+		CHECK(synth_copy(paths[i], orig));
+	}
+}
+
+static void second_needed_is(const char* path, const char* expected) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[1] && strcmp(names[1], expected) == 0);
+	synth_free(&file);
+}
+
+static ino_t inode_of(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_ino : 0;
+}
+
+static void linked(PatchConfig* config) {
+	write_inputs();
+
+	PatchBatchStats stats;
+	CHECK(patch_batch(paths, 5, config, 2, NULL, &stats));
+	CHECK(stats.inputs == 5 && stats.failed == 0);
+	CHECK(stats.patched == 3);  // a.so, same_id.so and other.so
+	CHECK(stats.shared == 1);   // link.so
+	CHECK(stats.reflinked + stats.hardlinked == 1);
+
+	CHECK(synth_same_file("a.so", "copy.so"));
+	CHECK(inode_of("a.so") == inode_of("link.so"));
+	CHECK(stats.hardlinked == (inode_of("a.so") == inode_of("copy.so")));
+	second_needed_is("a.so", "/lib/libz.so");
+	second_needed_is("same_id.so", "/lib/libq.so");
+	second_needed_is("other.so", "/lib/libz.so");
+
+	// nothing left to do, and nothing is touched; a hard linked copy now shares the inode
+	ino_t copy_inode = inode_of("copy.so");
+	CHECK(patch_batch(paths, 5, config, 2, NULL, &stats));
+	CHECK(stats.patched == 0 && stats.failed == 0 && stats.unchanged + stats.shared == 5);
+	CHECK(inode_of("copy.so") == copy_inode);
+}
+
+static void journaled(PatchConfig* config) {
+	write_inputs();
+	unlink("journal");
+	config->journal = "journal";
+
+	ino_t copy_inode = inode_of("copy.so");
+	PatchBatchStats stats;
+	CHECK(patch_batch(paths, 5, config, 2, NULL, &stats));
+	CHECK(stats.patched == 4 && stats.shared == 1 && stats.reflinked + stats.hardlinked == 0);
+	CHECK(inode_of("copy.so") == copy_inode);
+	CHECK(synth_same_file("a.so", "copy.so"));
+
+	CHECK(journal_revert("journal", LOCK_WAIT_DEFAULT) == 0);
+	char orig[64];
+	for (int i = 0; i < 5; ++i) {
+		snprintf(orig, sizeof(orig), "%s.orig", paths[i]);
+		CHECK(synth_same_file(paths[i], orig));
+	}
+	config->journal = NULL;
+}
+
+int main(void) {
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, "/lib/" };
+	PatchConfig config = { { &rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+
+	linked(&config);
+	journaled(&config);
+	return check_report("dedupe");
+}
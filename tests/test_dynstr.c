@@ -0,0 +1,247 @@
+// test_dynstr.c
+//
+// .dynstr compaction in elfmod: unreferenced and replaced strings go,
+// every kind of reference (dynamic tags, symbols, version needs) still
+// resolves, and repeated edits do not grow the file. A replaced name that
+// other references share is left to them, and a table that cannot be
+// compacted does not stop a replacement.
+#define _GNU_SOURCE
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TRUE 1
+#define FALSE 0
+
+static const char* needed[] = { "libc.so", "libm.so", "libold.so" };
+static const char* defined[] = { "codec_open", "codec_close", "codec_decode", "codec_encode", "open" };
+static const char* undefined[] = { "malloc", "free" };
+
+static size_t file_size(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+// everything a loader resolves by string offset, read back on its own
+static void check_references(const char* path, const char* third_needed) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+
+	const char* names[4] = { NULL };
+	CHECK(synth_needed(&file, names, 4) == 3);
+	CHECK(names[0] && strcmp(names[0], "libc.so") == 0);
+	CHECK(names[1] && strcmp(names[1], "libm.so") == 0);
+	CHECK(names[2] && strcmp(names[2], third_needed) == 0);
+
+	uint64_t value;
+	CHECK(synth_dyn(&file, DT_SONAME, &value) && synth_string(&file, value) && strcmp(synth_string(&file, value), "libcodec.so") == 0);
+	CHECK(synth_dyn(&file, DT_RUNPATH, &value) && synth_string(&file, value) && strcmp(synth_string(&file, value), "$ORIGIN") == 0);
+
+	for (int i = 0; i < 5; ++i) CHECK(synth_gnu_lookup(&file, defined[i]) > 0 && synth_sysv_lookup(&file, defined[i]) > 0);
+	for (int i = 0; i < 2; ++i) CHECK(synth_sysv_lookup(&file, undefined[i]) > 0);
+
+	// version need: the file and the version name
+	uint64_t offset;
+	CHECK(synth_dyn(&file, DT_VERNEED, &value) && synth_offset(&file, value, 32, &offset));
+	const char* version_file = synth_string(&file, synth_get(&file, offset + 4, 4));
+	uint64_t aux = offset + synth_get(&file, offset + 8, 4);
+	const char* version_name = synth_string(&file, synth_get(&file, aux + 8, 4));
+	CHECK(version_file && strcmp(version_file, "libc.so") == 0);
+	CHECK(version_name && strcmp(version_name, "V_1") == 0);
+
+	// nothing unreferenced is left
+	CHECK(!memmem(file.strtab, file.strsz, "stale_string", 12));
+	CHECK(!memmem(file.strtab, file.strsz, "libold.so", 9) || strcmp(third_needed, "libold.so") == 0);
+	synth_free(&file);
+}
+
+static void compact(int elf_class, int data) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_X86_64;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.soname = "libcodec.so";
+	spec.runpath = "$ORIGIN";
+	spec.defined = defined;
+	spec.defined_count = 5;
+	spec.undefined = undefined;
+	spec.undefined_count = 2;
+	spec.verneed = "libc.so";
+	spec.unused = "stale_string";
+	spec.gnu_hash = TRUE;
+	spec.sysv_hash = TRUE;
+	spec.sections = TRUE;
+	CHECK(synth_write("lib.so", &spec));
+
+	SynthFile original;
+	CHECK(synth_load("lib.so", &original));
+	uint64_t original_strsz = original.strsz;
+	synth_free(&original);
+
+	// stored once the table is packed: "open" is the tail of "codec_open"
+	size_t garbage = strlen("stale_string") + 1 + strlen("open") + 1;
+
+	// only garbage: the table shrinks in place
+	ElfContext ctx;
+	size_t saved = 0;
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_compact_dynstr(&ctx, &saved) == 0);
+	CHECK(saved == garbage);
+	CHECK(elf_save(&ctx, "compact.so") == 0);
+	CHECK(elf_verify(&ctx, "compact.so") == 0);
+	elf_close(&ctx);
+	CHECK(file_size("compact.so") == file_size("lib.so"));
+	check_references("compact.so", "libold.so");
+
+	// a longer name, then the replaced one collected
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", "libreplacement_with_a_long_name.so") == 0);
+	CHECK(elf_compact_dynstr(&ctx, &saved) == 0);
+	CHECK(elf_save(&ctx, "first.so") == 0);
+	CHECK(elf_verify(&ctx, "first.so") == 0);
+	elf_close(&ctx);
+	check_references("first.so", "libreplacement_with_a_long_name.so");
+
+	SynthFile first;
+	CHECK(synth_load("first.so", &first));
+	CHECK(first.strsz == original_strsz - garbage - strlen("libold.so") + strlen("libreplacement_with_a_long_name.so"));
+	synth_free(&first);
+
+	// editing the output again reuses its appended table instead of adding another
+	CHECK(elf_load("first.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libreplacement_with_a_long_name.so", "libreplacement_with_a_long_nam2.so") == 0);
+	CHECK(elf_compact_dynstr(&ctx, &saved) == 0);
+	CHECK(elf_save(&ctx, "second.so") == 0);
+	CHECK(elf_verify(&ctx, "second.so") == 0);
+	elf_close(&ctx);
+	check_references("second.so", "libreplacement_with_a_long_nam2.so");
+	CHECK(file_size("second.so") == file_size("first.so"));
+
+	// grown and back to the original name in one go: the table fits its home again
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", "libreplacement_with_a_long_name.so") == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libreplacement_with_a_long_name.so", "libold.so") == 0);
+	CHECK(elf_compact_dynstr(&ctx, &saved) == 0);
+	CHECK(elf_save(&ctx, "back.so") == 0);
+	CHECK(elf_verify(&ctx, "back.so") == 0);
+	elf_close(&ctx);
+	check_references("back.so", "libold.so");
+
+	SynthFile back;
+	CHECK(synth_load("back.so", &back));
+	uint64_t strtab;
+	CHECK(synth_dyn(&back, DT_STRTAB, &strtab) && back.strsz == original_strsz - garbage);
+	CHECK(synth_load("lib.so", &original));
+	uint64_t original_strtab;
+	CHECK(synth_dyn(&original, DT_STRTAB, &original_strtab) && strtab == original_strtab);
+	synth_free(&original);
+	synth_free(&back);
+	// the appended copy is given back, only the program headers moved to make room stay
+	CHECK(file_size("back.so") < file_size("first.so"));
+}
+
+// the two DT_NEEDED names of 'path', and the size of its string table
+static uint64_t two_needed(const char* path, const char* first, const char* second) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[0] && strcmp(names[0], first) == 0);
+	CHECK(names[1] && strcmp(names[1], second) == 0);
+	uint64_t strsz = file.strsz;
+	synth_free(&file);
+	return strsz;
+}
+
+static void replace(const char* from, const char* to, const char* old_lib, const char* new_lib) {
+	ElfContext ctx;
+	CHECK(elf_load(from, &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, old_lib, new_lib) == 0);
+	CHECK(elf_save(&ctx, to) == 0);
+	CHECK(elf_verify(&ctx, to) == 0);
+	elf_close(&ctx);
+}
+
+static void shared_strings(int elf_class, int data) {
+	static const char* libs[] = { "libc.so", "libm.so" };
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_X86_64;
+	spec.needed = libs;
+	spec.needed_count = 2;
+	spec.undefined = undefined;
+	spec.undefined_count = 2;
+	spec.verneed = "libc.so";
+	spec.sysv_hash = TRUE;
+	spec.sections = TRUE;
+	CHECK(synth_write("versioned.so", &spec));
+	uint64_t strsz = two_needed("versioned.so", "libc.so", "libm.so");
+
+	// the version need names the same "libc.so": the new name goes elsewhere
+	replace("versioned.so", "renamed.so", "libc.so", "libz.so");
+	CHECK(two_needed("renamed.so", "libz.so", "libm.so") > strsz);
+	SynthFile file;
+	uint64_t value, offset;
+	CHECK(synth_load("renamed.so", &file));
+	CHECK(synth_dyn(&file, DT_VERNEED, &value) && synth_offset(&file, value, 16, &offset));
+	const char* version_file = synth_string(&file, synth_get(&file, offset + 4, 4));
+	CHECK(version_file && strcmp(version_file, "libc.so") == 0);
+	synth_free(&file);
+
+	// a name used once is still rewritten where it is
+	replace("versioned.so", "in_place.so", "libm.so", "libq.so");
+	CHECK(two_needed("in_place.so", "libc.so", "libq.so") == strsz);
+
+	// "foo.so" stored as the tail of "libfoo.so" once packed
+	static const char* nested[] = { "foo.so", "libfoo.so" };
+	spec.needed = nested;
+	spec.verneed = NULL;
+	CHECK(synth_write("nested.so", &spec));
+	ElfContext ctx;
+	CHECK(elf_load("nested.so", &ctx) == 0);
+	CHECK(elf_compact_dynstr(&ctx, NULL) == 0);
+	CHECK(elf_save(&ctx, "packed.so") == 0);
+	elf_close(&ctx);
+	CHECK(synth_load("packed.so", &file));
+	uint64_t first = file.dyn_values[0], second = file.dyn_values[1];
+	CHECK(file.dyn_tags[0] == DT_NEEDED && file.dyn_tags[1] == DT_NEEDED && first == second + 3);
+	synth_free(&file);
+
+	replace("packed.so", "outer.so", "foo.so", "bar.so");
+	two_needed("outer.so", "bar.so", "libfoo.so");
+	replace("packed.so", "inner.so", "libfoo.so", "libxyz.so");
+	two_needed("inner.so", "foo.so", "libxyz.so");
+
+	// no hash table and no sections: the symbol count, so every reference,
+	// is unknown; the name is appended and compaction refused
+	static const char* exports[] = { "codec_open", "codec_close" };
+	spec.needed = libs;
+	spec.defined = exports;
+	spec.defined_count = 2;
+	spec.sysv_hash = FALSE;
+	spec.sections = FALSE;
+	CHECK(synth_write("bare.so", &spec));
+	strsz = two_needed("bare.so", "libc.so", "libm.so");
+	CHECK(elf_load("bare.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libm.so", "libq.so") == 0);
+	CHECK(elf_compact_dynstr(&ctx, NULL) != 0);
+	CHECK(elf_save(&ctx, "bare_replaced.so") == 0);
+	CHECK(elf_verify(&ctx, "bare_replaced.so") == 0);
+	elf_close(&ctx);
+	CHECK(two_needed("bare_replaced.so", "libc.so", "libq.so") > strsz);
+}
+
+int main(void) {
+	compact(ELFCLASS64, ELFDATA2LSB);
+	compact(ELFCLASS32, ELFDATA2MSB);
+	shared_strings(ELFCLASS64, ELFDATA2LSB);
+	shared_strings(ELFCLASS32, ELFDATA2MSB);
+	return check_report("dynstr");
+}
@@ -0,0 +1,104 @@
+// test_endian.c
+//
+// Both classes in both byte orders through the fd patcher: patch, read
+// back with the test's own decoder, patch again, revert.
+#include "../elfpatcher.h"
+#include "../elfjournal.h"
+#include "../elflock.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// not in <linux/elf.h>
+#ifndef DT_RUNPATH
+#define DT_RUNPATH 29
+#endif
+
+static const char* needed[] = { "libc.so", "libm.so", "liblog.so" };
+static const char* defined[] = { "open_session", "close_session", "read_frame" };
+
+static SynthSpec spec_for(int elf_class, int data) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = elf_class == ELFCLASS64 ? EM_AARCH64 : EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.soname = "libsession.so";
+	spec.defined = defined;
+	spec.defined_count = 3;
+	spec.gnu_hash = TRUE;
+	spec.sysv_hash = TRUE;
+	spec.spare_dyn = 2; // room for a new DT_RUNPATH
+	spec.build_id = elf_class + data;
+	spec.sections = TRUE;
+	return spec;
+}
+
+// the fd patcher with the given strategy, then again, then revert
+static void patch_round_trip(int elf_class, int data, int strategy) {
+	SynthSpec spec = spec_for(elf_class, data);
+	CHECK(synth_write("lib.so", &spec));
+	CHECK(synth_copy("lib.so", "orig.so"));
+	unlink("journal");
+
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, "/data/app/lib/" };
+	PatchConfig config = { { &rule, 1 }, strategy, NULL, "journal", LOCK_WAIT_DEFAULT, FALSE, NULL };
+	CHECK(patch_file("lib.so", &config) == TRUE);
+
+	SynthFile file;
+	CHECK(synth_load("lib.so", &file));
+	CHECK(file.elf_class == elf_class);
+	CHECK(file.foreign == (data != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? ELFDATA2LSB : ELFDATA2MSB)));
+
+	const char* names[8];
+	CHECK(synth_needed(&file, names, 8) == 3);
+	uint64_t value;
+	for (int i = 0; i < 3; ++i) {
+		char expected[64];
+		snprintf(expected, sizeof(expected), "%s%s", strategy == PATCH_STRATEGY_PREFIX ? "/data/app/lib/" : "", needed[i]);
+		CHECK(names[i] && strcmp(names[i], expected) == 0);
+	}
+	if (strategy == PATCH_STRATEGY_RUNPATH) {
+		CHECK(synth_dyn(&file, DT_RUNPATH, &value) && synth_string(&file, value)
+		      && strcmp(synth_string(&file, value), "/data/app/lib") == 0);
+	}
+	CHECK(synth_dyn(&file, DT_SONAME, &value) && strcmp(synth_string(&file, value), "libsession.so") == 0);
+
+	// symbol names still resolve through the moved string table
+	for (int i = 0; i < 3; ++i) {
+		CHECK(synth_gnu_lookup(&file, defined[i]) > 0);
+		CHECK(synth_sysv_lookup(&file, defined[i]) > 0);
+	}
+	synth_free(&file);
+
+	CHECK(synth_copy("lib.so", "patched.so"));
+	CHECK(patch_file("lib.so", &config) == PATCH_UNCHANGED);
+	CHECK(synth_same_file("lib.so", "patched.so"));
+
+	// the other strategy would stack a prefix on a runpath or the reverse
+	PatchConfig other = config;
+	other.strategy = strategy == PATCH_STRATEGY_PREFIX ? PATCH_STRATEGY_RUNPATH : PATCH_STRATEGY_PREFIX;
+	CHECK(patch_file("lib.so", &other) == PATCH_CONFLICT);
+	CHECK(synth_same_file("lib.so", "patched.so"));
+
+	CHECK(journal_revert("journal", LOCK_WAIT_DEFAULT) == 0);
+	CHECK(synth_same_file("lib.so", "orig.so"));
+}
+
+int main(void) {
+	int classes[] = { ELFCLASS32, ELFCLASS64 };
+	int orders[] = { ELFDATA2LSB, ELFDATA2MSB };
+
+	for (int c = 0; c < 2; ++c) {
+		for (int o = 0; o < 2; ++o) {
+			patch_round_trip(classes[c], orders[o], PATCH_STRATEGY_PREFIX);
+			patch_round_trip(classes[c], orders[o], PATCH_STRATEGY_RUNPATH);
+		}
+	}
+
+	return check_report("endian");
+}
@@ -0,0 +1,74 @@
+// test_endian_elfmod.c
+//
+// Both classes in both byte orders through elfmod, which swaps field by
+// field instead of whole tables.
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRUE 1
+
+static const char* needed[] = { "libc.so", "libm.so", "liblog.so" };
+static const char* defined[] = { "open_session", "close_session", "read_frame" };
+
+static SynthSpec spec_for(int elf_class, int data) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = elf_class == ELFCLASS64 ? EM_AARCH64 : EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.soname = "libsession.so";
+	spec.defined = defined;
+	spec.defined_count = 3;
+	spec.gnu_hash = TRUE;
+	spec.sysv_hash = TRUE;
+	spec.build_id = elf_class + data;
+	spec.sections = TRUE;
+	return spec;
+}
+
+static void round_trip(int elf_class, int data) {
+	SynthSpec spec = spec_for(elf_class, data);
+	CHECK(synth_write("mod.so", &spec));
+
+	ElfContext ctx;
+	CHECK(elf_load("mod.so", &ctx) == 0);
+	CHECK(ctx.is_64bit == (elf_class == ELFCLASS64));
+	CHECK(elf_replace_needed_lib(&ctx, "libm.so", "libm_shim.so") == 0);
+	CHECK(elf_save(&ctx, "mod.out.so") == 0);
+	CHECK(elf_verify(&ctx, "mod.out.so") == 0);
+	elf_close(&ctx);
+
+	SynthFile file;
+	CHECK(synth_load("mod.out.so", &file));
+	const char* names[8];
+	CHECK(synth_needed(&file, names, 8) == 3);
+	CHECK(names[0] && strcmp(names[0], "libc.so") == 0);
+	CHECK(names[1] && strcmp(names[1], "libm_shim.so") == 0);
+	CHECK(names[2] && strcmp(names[2], "liblog.so") == 0);
+	synth_free(&file);
+
+	// and back, through the output
+	CHECK(elf_load("mod.out.so", &ctx) == 0);
+	size_t count;
+	char** libs = elf_get_needed_libs(&ctx, &count);
+	CHECK(libs && count == 3 && strcmp(libs[1], "libm_shim.so") == 0);
+	for (size_t i = 0; libs && i < count; ++i) free(libs[i]);
+	free(libs);
+	elf_close(&ctx);
+}
+
+int main(void) {
+	int classes[] = { ELFCLASS32, ELFCLASS64 };
+	int orders[] = { ELFDATA2LSB, ELFDATA2MSB };
+
+	for (int c = 0; c < 2; ++c) {
+		for (int o = 0; o < 2; ++o) round_trip(classes[c], orders[o]);
+	}
+
+	return check_report("endian_elfmod");
+}
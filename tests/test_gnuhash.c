@@ -0,0 +1,208 @@
+// test_gnuhash.c
+//
+// Symbols renamed and rehashed by elfmod, looked up afterwards the way
+// ld.so does: bloom filter, bucket, chain. Values, versions and relocations
+// must follow their symbols when the GNU hash order moves them, once each
+// when DT_RELSZ covers the PLT relocations too.
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRUE 1
+#define FALSE 0
+#define SYMBOLS 24
+
+static char defined_names[SYMBOLS][32];
+static const char* defined[SYMBOLS];
+static const char* undefined[] = { "malloc", "free", "memcpy" };
+
+// the symbol of every relocation as written, per table
+static char reloc_names[2][2 * SYMBOLS + 8][32];
+static int reloc_counts[2];
+
+static void write_library(int elf_class, int data, int machine, int relocs) {
+	for (int i = 0; i < SYMBOLS; ++i) {
+		snprintf(defined_names[i], sizeof(defined_names[i]), "render_%c_%i", 'a' + i % 5, i);
+		defined[i] = defined_names[i];
+	}
+	static const char* needed[] = { "libc.so" };
+
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = machine;
+	spec.needed = needed;
+	spec.needed_count = 1;
+	spec.defined = defined;
+	spec.defined_count = SYMBOLS;
+	spec.undefined = undefined;
+	spec.undefined_count = 3;
+	spec.verneed = "libc.so";
+	spec.gnu_hash = TRUE;
+	spec.sysv_hash = TRUE;
+	spec.sections = TRUE;
+	spec.relocs = relocs;
+	spec.mips_gotsym = machine == EM_MIPS;
+	CHECK(synth_write("lib.so", &spec));
+}
+
+static int64_t reloc_tag(int elf_class, int table, int size) {
+	if (table == 1) return size ? DT_PLTRELSZ : DT_JMPREL;
+	if (elf_class == ELFCLASS64) return size ? DT_RELASZ : DT_RELA;
+	return size ? DT_RELSZ : DT_REL;
+}
+
+static void read_relocs(const char* path) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+	for (int table = 0; table < 2; ++table) {
+		int symbols[2 * SYMBOLS + 8];
+		reloc_counts[table] = synth_relocations(&file, reloc_tag(file.elf_class, table, FALSE),
+		                                        reloc_tag(file.elf_class, table, TRUE), symbols, 2 * SYMBOLS + 8);
+		CHECK(reloc_counts[table] > 0 && reloc_counts[table] <= 2 * SYMBOLS + 8);
+		for (int i = 0; i < reloc_counts[table]; ++i) {
+			const char* name = synth_symbol_name(&file, symbols[i]);
+			CHECK(name != NULL);
+			snprintf(reloc_names[table][i], sizeof(reloc_names[table][i]), "%s", name ? name : "");
+		}
+	}
+	synth_free(&file);
+}
+
+static int is_import(const char* name) {
+	for (int i = 0; i < 3; ++i) {
+		if (strcmp(name, undefined[i]) == 0) return TRUE;
+	}
+	return FALSE;
+}
+
+// .gnu.version entry of dynamic symbol 'index'
+static int version_of(const SynthFile* file, int index) {
+	uint64_t versym, offset;
+	if (index < 0 || !synth_dyn(file, DT_VERSYM, &versym) || !synth_offset(file, versym + index * 2, 2, &offset)) return -1;
+	return synth_get(file, offset, 2);
+}
+
+// every export under 'prefix' + its name with its old value, imports untouched
+static void check_symbols(const char* path, const char* prefix, const uint64_t* values) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+
+	for (int i = 0; i < SYMBOLS; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s%s", prefix, defined[i]);
+		int gnu = synth_gnu_lookup(&file, name);
+		CHECK(gnu > 0 && gnu == synth_sysv_lookup(&file, name));
+		CHECK(synth_symbol_value(&file, gnu) == values[i]);
+		CHECK(version_of(&file, gnu) == 1);
+		if (prefix[0]) CHECK(synth_gnu_lookup(&file, defined[i]) < 0 && synth_sysv_lookup(&file, defined[i]) < 0);
+	}
+	for (int i = 0; i < 3; ++i) {
+		int index = synth_sysv_lookup(&file, undefined[i]);
+		CHECK(index > 0 && version_of(&file, index) == 2 && synth_symbol_value(&file, index) == 0);
+	}
+	CHECK(synth_gnu_lookup(&file, "render_missing") < 0 && synth_sysv_lookup(&file, "render_missing") < 0);
+
+	// every relocation still names the symbol it was written for
+	for (int table = 0; table < 2; ++table) {
+		int symbols[2 * SYMBOLS + 8];
+		int count = synth_relocations(&file, reloc_tag(file.elf_class, table, FALSE), reloc_tag(file.elf_class, table, TRUE),
+		                              symbols, 2 * SYMBOLS + 8);
+		CHECK(count == reloc_counts[table]);
+		for (int i = 0; i < count && i < reloc_counts[table]; ++i) {
+			char name[64];
+			const char* original = reloc_names[table][i];
+			snprintf(name, sizeof(name), "%s%s", is_import(original) ? "" : prefix, original);
+			const char* symbol = synth_symbol_name(&file, symbols[i]);
+			CHECK(symbol && strcmp(symbol, name) == 0);
+		}
+	}
+	synth_free(&file);
+}
+
+static void rehash(int elf_class, int data, int relocs) {
+	write_library(elf_class, data, EM_X86_64, relocs);
+	read_relocs("lib.so");
+
+	uint64_t values[SYMBOLS];
+	SynthFile file;
+	CHECK(synth_load("lib.so", &file));
+	for (int i = 0; i < SYMBOLS; ++i) values[i] = synth_symbol_value(&file, synth_gnu_lookup(&file, defined[i]));
+	synth_free(&file);
+	check_symbols("lib.so", "", values);
+
+	// another geometry, then read the header back
+	ElfContext ctx;
+	ElfHashOptions options = { 7, 4, 10 };
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_rehash_symbols(&ctx, &options) == 0);
+	CHECK(elf_save(&ctx, "rehashed.so") == 0);
+	CHECK(elf_verify(&ctx, "rehashed.so") == 0);
+	elf_close(&ctx);
+	check_symbols("rehashed.so", "", values);
+
+	uint64_t address, table;
+	CHECK(synth_load("rehashed.so", &file));
+	CHECK(synth_dyn(&file, DT_GNU_HASH, &address) && synth_offset(&file, address, 16, &table));
+	CHECK(synth_get(&file, table, 4) == 7 && synth_get(&file, table + 4, 4) == 4);
+	CHECK(synth_get(&file, table + 8, 4) == 4 && synth_get(&file, table + 12, 4) == 10);
+	synth_free(&file);
+
+	// a shift as wide as a bloom word is refused
+	ElfHashOptions bad = { 0, 1, elf_class == ELFCLASS64 ? 64 : 32 };
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_rehash_symbols(&ctx, &bad) != 0);
+	elf_close(&ctx);
+
+	// prefixed exports: new names, reordered by bucket, values and versions kept
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_prefix_symbols(&ctx, "iso_", ELF_SYMS_DEFINED, NULL) == 0);
+	CHECK(elf_save(&ctx, "prefixed.so") == 0);
+	CHECK(elf_verify(&ctx, "prefixed.so") == 0);
+	elf_close(&ctx);
+	check_symbols("prefixed.so", "iso_", values);
+
+	// a second run changes nothing
+	CHECK(elf_load("prefixed.so", &ctx) == 0);
+	CHECK(elf_prefix_symbols(&ctx, "iso_", ELF_SYMS_DEFINED, NULL) == 0);
+	CHECK(elf_save(&ctx, "prefixed2.so") == 0);
+	elf_close(&ctx);
+	CHECK(synth_same_file("prefixed.so", "prefixed2.so"));
+
+	// and single renames back to the original names
+	const char* old_names[SYMBOLS];
+	char prefixed_names[SYMBOLS][40];
+	for (int i = 0; i < SYMBOLS; ++i) {
+		snprintf(prefixed_names[i], sizeof(prefixed_names[i]), "iso_%s", defined[i]);
+		old_names[i] = prefixed_names[i];
+	}
+	CHECK(elf_load("prefixed.so", &ctx) == 0);
+	CHECK(elf_rename_symbols(&ctx, old_names, defined, SYMBOLS, NULL) == 0);
+	CHECK(elf_save(&ctx, "renamed.so") == 0);
+	CHECK(elf_verify(&ctx, "renamed.so") == 0);
+	elf_close(&ctx);
+	check_symbols("renamed.so", "", values);
+}
+
+// the MIPS GOT maps symbols by index, a reorder would break it
+static void mips_got(void) {
+	write_library(ELFCLASS32, ELFDATA2MSB, EM_MIPS, SYNTH_RELOCS_SEPARATE);
+	CHECK(synth_copy("lib.so", "mips.orig"));
+	ElfContext ctx;
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_prefix_symbols(&ctx, "iso_", ELF_SYMS_DEFINED, NULL) != 0);
+	CHECK(strstr(elf_get_error(), "MIPS") != NULL);
+	elf_close(&ctx);
+	CHECK(synth_same_file("lib.so", "mips.orig"));
+}
+
+int main(void) {
+	rehash(ELFCLASS64, ELFDATA2LSB, SYNTH_RELOCS_SEPARATE);
+	rehash(ELFCLASS32, ELFDATA2LSB, SYNTH_RELOCS_SHARED);
+	rehash(ELFCLASS64, ELFDATA2MSB, SYNTH_RELOCS_SHARED);
+	mips_got();
+	return check_report("gnuhash");
+}
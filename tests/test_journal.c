@@ -0,0 +1,110 @@
+// test_journal.c
+//
+// One undo journal across several files, repeated runs and recipe
+// replays: a revert puts every file back byte for byte, after which other
+// rules may patch it, and leaves alone a file that changed since.
+#include "../elfpatcher.h"
+#include "../elfjournal.h"
+#include "../elflock.h"
+#include "check.h"
+#include "synth.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* needed[] = { "libc.so", "libdl.so", "libz.so" };
+
+static void write_library(const char* path, int elf_class, int data, int build_id) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = elf_class == ELFCLASS64 ? EM_AARCH64 : EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.soname = "libjournal.so";
+	spec.build_id = build_id;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+static off_t file_size(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static int recipe_count(const char* dir) {
+	DIR* d = opendir(dir);
+	if (!d) return 0;
+	int count = 0;
+	for (struct dirent* entry; (entry = readdir(d));) count += strstr(entry->d_name, ".recipe") != NULL;
+	closedir(d);
+	return count;
+}
+
+static void first_needed_is(const char* path, const char* expected) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 4) == 3);
+	CHECK(names[0] && strcmp(names[0], expected) == 0);
+	synth_free(&file);
+}
+
+int main(void) {
+	write_library("a.so", ELFCLASS64, ELFDATA2LSB, 1);
+	write_library("b.so", ELFCLASS32, ELFDATA2MSB, 2);
+	CHECK(synth_copy("a.so", "c.so")); // the same build, patched from a recipe
+	CHECK(synth_copy("a.so", "a.orig") && synth_copy("b.so", "b.orig"));
+	CHECK(mkdir("recipes", 0755) == 0);
+
+	PatchRule first_rule = { PATCH_ANY, PATCH_ANY, NULL, "/system/lib/" };
+	PatchRule second_rule = { PATCH_ANY, PATCH_ANY, NULL, "/vendor/lib/" };
+	PatchConfig first = { { &first_rule, 1 }, PATCH_STRATEGY_PREFIX, "recipes", "journal", LOCK_WAIT_DEFAULT, FALSE, NULL };
+	PatchConfig second = { { &second_rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, "journal", LOCK_WAIT_DEFAULT, FALSE, NULL };
+
+	// a planned patch that leaves a recipe, its replay, another file
+	CHECK(patch_file("a.so", &first) == TRUE);
+	CHECK(recipe_count("recipes") == 1);
+	CHECK(patch_file("c.so", &first) == TRUE);
+	CHECK(synth_same_file("a.so", "c.so"));
+	CHECK(patch_file("b.so", &first) == TRUE);
+
+	// nothing to do adds no record, neither does another rule set, which is refused
+	off_t journal_size = file_size("journal");
+	CHECK(patch_file("a.so", &first) == PATCH_UNCHANGED);
+	CHECK(file_size("journal") == journal_size);
+	CHECK(patch_file("a.so", &second) == PATCH_CONFLICT);
+	CHECK(file_size("journal") == journal_size);
+	CHECK(synth_same_file("a.so", "c.so"));
+	first_needed_is("a.so", "/system/lib/libc.so");
+
+	// everything back as before the first patch, the journal emptied
+	CHECK(journal_revert("journal", LOCK_WAIT_DEFAULT) == 0);
+	CHECK(synth_same_file("a.so", "a.orig"));
+	CHECK(synth_same_file("b.so", "b.orig"));
+	CHECK(synth_same_file("c.so", "a.orig"));
+	CHECK(file_size("journal") == 0);
+	CHECK(journal_revert("journal", LOCK_WAIT_DEFAULT) == 0);
+
+	// and patchable with the other rules as if never touched
+	CHECK(patch_file("a.so", &second) == TRUE);
+	first_needed_is("a.so", "/vendor/lib/libc.so");
+	CHECK(patch_file("b.so", &second) == TRUE);
+
+	// a file changed after patching is left as it is, the others reverted
+	int fd = open("b.so", O_WRONLY | O_APPEND);
+	CHECK(fd >= 0 && write(fd, "x", 1) == 1);
+	close(fd);
+	CHECK(synth_copy("b.so", "b.changed"));
+	CHECK(journal_revert("journal", LOCK_WAIT_DEFAULT) == 1);
+	CHECK(synth_same_file("a.so", "a.orig"));
+	CHECK(synth_same_file("b.so", "b.changed"));
+	CHECK(file_size("journal") > 0);
+
+	CHECK(journal_revert("no_such_journal", LOCK_WAIT_DEFAULT) == -1);
+	return check_report("journal");
+}
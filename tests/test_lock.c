@@ -0,0 +1,137 @@
+// test_lock.c
+//
+// Writers of one file exclude each other through its lock: a busy file is
+// skipped or waited for as configured. The rule-set marker only counts
+// while the file is as the patch left it; once rewritten it is stale and
+// the file is probed again.
+#include "../elfpatcher.h"
+#include "../elflock.h"
+#include "../elfrecipe.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIRST  "/data/app/lib/"
+#define SECOND "/data/other/lib/"
+
+static void write_library(const char* path) {
+	static const char* needed[] = { "libc.so", "libm.so" };
+	SynthSpec spec = { 0 };
+	spec.elf_class = ELFCLASS64;
+	spec.data = ELFDATA2LSB;
+	spec.machine = EM_AARCH64;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.build_id = 5;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+static void first_needed_is(const char* path, const char* expected) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[0] && strcmp(names[0], expected) == 0);
+	synth_free(&file);
+}
+
+static long elapsed_ms(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// lets go of the lock held on 'fd' after a while
+static void* release_later(void* arg) {
+	struct timespec pause = { 0, 100 * 1000000L };
+	nanosleep(&pause, NULL);
+	close(*(int*)arg);
+	return NULL;
+}
+
+static void contention(void) {
+	write_library("a.so");
+	CHECK(synth_copy("a.so", "a.orig"));
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, FIRST };
+	PatchConfig config = { { &rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_SKIP, FALSE, NULL };
+
+	// another writer holds the file: skipped at once, or after a bounded wait
+	int holder = open("a.so", O_RDWR);
+	CHECK(holder >= 0 && lock_file(holder, LOCK_WAIT_SKIP) == TRUE);
+	int other = open("a.so", O_RDWR);
+	CHECK(lock_file(other, LOCK_WAIT_SKIP) == PATCH_BUSY);
+	close(other);
+
+	CHECK(patch_file("a.so", &config) == PATCH_BUSY);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	config.lock_wait_ms = 80;
+	CHECK(patch_file("a.so", &config) == PATCH_BUSY);
+	CHECK(elapsed_ms(&start) >= 80);
+	CHECK(synth_same_file("a.so", "a.orig"));
+
+	// a probe takes no lock
+	CHECK(patch_probe("a.so", FIRST, PATCH_STRATEGY_PREFIX) == TRUE);
+
+	// waiting long enough: patched once the holder lets go
+	pthread_t thread;
+	CHECK(pthread_create(&thread, NULL, release_later, &holder) == 0);
+	config.lock_wait_ms = LOCK_WAIT_DEFAULT;
+	CHECK(patch_file("a.so", &config) == TRUE);
+	pthread_join(thread, NULL);
+	first_needed_is("a.so", FIRST "libc.so");
+	CHECK(patch_file("a.so", &config) == PATCH_UNCHANGED);
+}
+
+static int marker_of(const char* path, const char* prefix) {
+	int fd = open(path, O_RDONLY);
+	int mark = mark_read(fd, recipe_rules_hash(prefix, PATCH_STRATEGY_PREFIX));
+	close(fd);
+	return mark;
+}
+
+static void staleness(void) {
+	write_library("b.so");
+	CHECK(synth_copy("b.so", "b.orig"));
+	PatchRule first_rule = { PATCH_ANY, PATCH_ANY, NULL, FIRST };
+	PatchRule second_rule = { PATCH_ANY, PATCH_ANY, NULL, SECOND };
+	PatchConfig first = { { &first_rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+	PatchConfig second = { { &second_rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+
+	CHECK(marker_of("b.so", FIRST) == MARK_NONE);
+	CHECK(patch_file("b.so", &first) == TRUE);
+	CHECK(marker_of("b.so", FIRST) == MARK_SAME);
+	CHECK(marker_of("b.so", SECOND) == MARK_OTHER);
+
+	// written over in place with the original bytes: the marker is still
+	// there but no longer describes the file, so other rules may patch it
+	CHECK(synth_copy("b.orig", "b.so"));
+	char stored[128];
+	CHECK(getxattr("b.so", "user.elfpatcher", stored, sizeof(stored)) > 0);
+	CHECK(marker_of("b.so", FIRST) == MARK_NONE);
+	CHECK(marker_of("b.so", SECOND) == MARK_NONE);
+	CHECK(patch_file("b.so", &second) == TRUE);
+	first_needed_is("b.so", SECOND "libc.so");
+	CHECK(marker_of("b.so", SECOND) == MARK_SAME);
+
+	// only the mtime changed: probed again rather than trusted, and found patched
+	struct timespec times[2] = { { 0, UTIME_OMIT }, { 12345, 0 } };
+	CHECK(utimensat(AT_FDCWD, "b.so", times, 0) == 0);
+	CHECK(marker_of("b.so", SECOND) == MARK_NONE);
+	CHECK(patch_file("b.so", &second) == PATCH_UNCHANGED);
+	first_needed_is("b.so", SECOND "libc.so");
+}
+
+int main(void) {
+	contention();
+	staleness();
+	return check_report("lock");
+}
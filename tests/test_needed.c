@@ -0,0 +1,198 @@
+// test_needed.c
+//
+// DT_NEEDED entries added and removed by elfmod: first in the DT_NULL
+// slack, then in a dynamic table moved to appended data, and back out
+// again, with PT_DYNAMIC and the .dynamic section header kept in step.
+// Only the moved table is writable, the data appended with it is not.
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRUE 1
+#define FALSE 0
+
+static const char* needed[] = { "libc.so", "libm.so", "liblog.so" };
+
+// the DT_NEEDED names of 'path' must be 'expected', in order
+static void needed_are(const char* path, const char* const* expected, int count) {
+	SynthFile file;
+	const char* names[16] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 16) == count);
+	for (int i = 0; i < count && i < 16; ++i) CHECK(names[i] && strcmp(names[i], expected[i]) == 0);
+
+	// the other entries survive every move
+	uint64_t value;
+	CHECK(synth_dyn(&file, DT_SONAME, &value) && strcmp(synth_string(&file, value), "libapp.so") == 0);
+	CHECK(synth_dyn(&file, DT_VERNEEDNUM, &value) && value == 1);
+	synth_free(&file);
+}
+
+// PT_DYNAMIC and the SHT_DYNAMIC section header describe the same table
+static void dynamic_agrees(const char* path, uint64_t* dynamic_offset) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+	int w = file.elf_class == ELFCLASS64 ? 8 : 4;
+	uint64_t shentsize = w == 8 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+
+	int found = 0;
+	for (int i = 0; i < file.shnum; ++i) {
+		uint64_t shdr = file.shoff + i * shentsize;
+		if (synth_get(&file, shdr + 4, 4) != SHT_DYNAMIC) continue;
+
+		uint64_t address = synth_get(&file, shdr + 8 + w, w);
+		uint64_t offset = synth_get(&file, shdr + 8 + 2 * w, w);
+		uint64_t mapped;
+		CHECK(offset == file.dynamic_offset);
+		CHECK(synth_offset(&file, address, 1, &mapped) && mapped == offset);
+		found++;
+	}
+	CHECK(found == (file.shnum ? 1 : 0));
+	*dynamic_offset = file.dynamic_offset;
+	synth_free(&file);
+}
+
+typedef struct {
+	uint32_t type, flags;
+	uint64_t vaddr, memsz;
+} Segment;
+
+static Segment segment(const SynthFile* file, int index) {
+	int wide = file->elf_class == ELFCLASS64;
+	uint64_t phdr = file->phoff + index * (wide ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr));
+	Segment s = { synth_get(file, phdr, 4), synth_get(file, phdr + (wide ? 4 : 24), 4),
+	              synth_get(file, phdr + (wide ? 16 : 8), wide ? 8 : 4), synth_get(file, phdr + (wide ? 40 : 20), wide ? 8 : 4) };
+	return s;
+}
+
+// p_flags of the PT_LOAD mapping 'address', -1 if none does
+static int load_flags(const SynthFile* file, uint64_t address) {
+	for (int i = 0; i < file->phnum; ++i) {
+		Segment s = segment(file, i);
+		if (s.type == PT_LOAD && address >= s.vaddr && address < s.vaddr + s.memsz) return s.flags;
+	}
+	return -1;
+}
+
+// .dynamic writable, the strings and the program headers not, and no page
+// mapped by two segments with different permissions
+static void segments_apart(const char* path) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+
+	uint64_t strtab, phdr = UINT64_MAX;
+	int dynamic = -1;
+	for (int i = 0; i < file.phnum; ++i) {
+		Segment s = segment(&file, i);
+		if (s.type == PT_DYNAMIC) dynamic = load_flags(&file, s.vaddr);
+		if (s.type == PT_PHDR) phdr = s.vaddr;
+	}
+	CHECK(dynamic >= 0 && (dynamic & PF_W));
+	CHECK(synth_dyn(&file, DT_STRTAB, &strtab) && load_flags(&file, strtab) == PF_R);
+	if (phdr != UINT64_MAX) CHECK(load_flags(&file, phdr) == PF_R);
+
+	for (int i = 0; i < file.phnum; ++i) {
+		for (int k = i + 1; k < file.phnum; ++k) {
+			Segment a = segment(&file, i), b = segment(&file, k);
+			if (a.type != PT_LOAD || b.type != PT_LOAD || a.memsz == 0 || b.memsz == 0) continue;
+			CHECK((a.vaddr + a.memsz - 1) / 0x1000 < b.vaddr / 0x1000 || (b.vaddr + b.memsz - 1) / 0x1000 < a.vaddr / 0x1000);
+		}
+	}
+	synth_free(&file);
+}
+
+static void add_and_remove(int elf_class, int data, int sections) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_AARCH64;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.soname = "libapp.so";
+	spec.verneed = "libc.so";
+	spec.spare_dyn = 2;
+	spec.sections = sections;
+	CHECK(synth_write("lib.so", &spec));
+
+	uint64_t home, offset;
+	dynamic_agrees("lib.so", &home);
+
+	// one entry fits the slack: the table stays, the shim goes first
+	ElfContext ctx;
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_add_needed_lib(&ctx, "libshim.so") == 0);
+	CHECK(elf_add_needed_lib(&ctx, "libm.so") == 0); // already needed, skipped
+	CHECK(elf_save(&ctx, "one.so") == 0);
+	CHECK(elf_verify(&ctx, "one.so") == 0);
+	elf_close(&ctx);
+	const char* one[] = { "libshim.so", "libc.so", "libm.so", "liblog.so" };
+	needed_are("one.so", one, 4);
+	dynamic_agrees("one.so", &offset);
+	CHECK(offset == home);
+
+	// and out again: the same names in the same order
+	CHECK(elf_load("one.so", &ctx) == 0);
+	CHECK(elf_remove_needed_lib(&ctx, "libshim.so") == 0);
+	CHECK(elf_save(&ctx, "none.so") == 0);
+	CHECK(elf_verify(&ctx, "none.so") == 0);
+	elf_close(&ctx);
+	needed_are("none.so", needed, 3);
+
+	// more than the slack holds: the table moves behind the file
+	const char* shims[] = { "libshim_a.so", "libshim_b.so", "libshim_c.so", "libshim_d.so" };
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_add_needed_libs(&ctx, shims, 4) == 0);
+	CHECK(elf_save(&ctx, "many.so") == 0);
+	CHECK(elf_verify(&ctx, "many.so") == 0);
+	elf_close(&ctx);
+	const char* many[] = { "libshim_a.so", "libshim_b.so", "libshim_c.so", "libshim_d.so", "libc.so", "libm.so", "liblog.so" };
+	needed_are("many.so", many, 7);
+	dynamic_agrees("many.so", &offset);
+	CHECK(offset != home);
+	segments_apart("many.so");
+
+	// the moved table has room to spare for the next one
+	CHECK(elf_load("many.so", &ctx) == 0);
+	CHECK(elf_add_needed_lib(&ctx, "libshim_e.so") == 0);
+	CHECK(elf_save(&ctx, "more.so") == 0);
+	CHECK(elf_verify(&ctx, "more.so") == 0);
+	elf_close(&ctx);
+	uint64_t more_offset;
+	dynamic_agrees("more.so", &more_offset);
+	CHECK(more_offset == offset);
+	segments_apart("more.so");
+
+	// strings appended after the move go above it, not into its segment
+	CHECK(elf_load("more.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "liblog.so", "liblog_with_a_much_longer_name.so") == 0);
+	CHECK(elf_save(&ctx, "longer.so") == 0);
+	CHECK(elf_verify(&ctx, "longer.so") == 0);
+	elf_close(&ctx);
+	const char* longer[] = { "libshim_e.so", "libshim_a.so", "libshim_b.so", "libshim_c.so", "libshim_d.so", "libc.so", "libm.so",
+	                         "liblog_with_a_much_longer_name.so" };
+	needed_are("longer.so", longer, 8);
+	segments_apart("longer.so");
+
+	// removing: several at once, a version need's file refused, an unknown name refused
+	CHECK(elf_load("more.so", &ctx) == 0);
+	const char* removed[] = { "libshim_a.so", "libshim_b.so", "libshim_c.so", "libshim_d.so", "libshim_e.so" };
+	CHECK(elf_remove_needed_libs(&ctx, removed, 5) == 0);
+	CHECK(elf_remove_needed_lib(&ctx, "libc.so") != 0);
+	CHECK(elf_remove_needed_lib(&ctx, "libnot_there.so") != 0);
+	CHECK(elf_remove_needed_lib(&ctx, "liblog.so") == 0);
+	CHECK(elf_save(&ctx, "fewer.so") == 0);
+	CHECK(elf_verify(&ctx, "fewer.so") == 0);
+	elf_close(&ctx);
+	needed_are("fewer.so", needed, 2);
+}
+
+int main(void) {
+	add_and_remove(ELFCLASS64, ELFDATA2LSB, TRUE);
+	add_and_remove(ELFCLASS32, ELFDATA2MSB, TRUE);
+	add_and_remove(ELFCLASS64, ELFDATA2LSB, FALSE); // .dynamic's segment ends the file
+	add_and_remove(ELFCLASS32, ELFDATA2MSB, FALSE);
+	return check_report("needed");
+}
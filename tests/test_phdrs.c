@@ -0,0 +1,152 @@
+// test_phdrs.c
+//
+// elfmod on files without section headers: loaded through the program
+// headers alone, and a name that does not fit .dynstr appended behind a
+// writable last segment, which takes a new PT_LOAD. With no spare entry the
+// program header table moves into that segment, gaining a PT_PHDR and a
+// spare PT_NULL; PT_NOTE keeps describing the build-id.
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TRUE 1
+#define FALSE 0
+
+static const char* needed[] = { "libc.so", "libold.so" };
+
+typedef struct {
+	uint32_t type, flags;
+	uint64_t offset, vaddr, filesz;
+} Segment;
+
+static Segment segment(const SynthFile* file, int index) {
+	int wide = file->elf_class == ELFCLASS64;
+	uint64_t phdr = file->phoff + index * (wide ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr));
+	int w = wide ? 8 : 4;
+	Segment s = { synth_get(file, phdr, 4), synth_get(file, phdr + (wide ? 4 : 24), 4),
+	              synth_get(file, phdr + (wide ? 8 : 4), w), synth_get(file, phdr + (wide ? 16 : 8), w),
+	              synth_get(file, phdr + (wide ? 32 : 16), w) };
+	return s;
+}
+
+// index of the first segment of 'type', -1 if none
+static int find_segment(const SynthFile* file, uint32_t type) {
+	for (int i = 0; i < file->phnum; ++i) {
+		if (segment(file, i).type == type) return i;
+	}
+	return -1;
+}
+
+static void needed_are(const SynthFile* file, const char* second) {
+	const char* names[4] = { NULL };
+	CHECK(synth_needed(file, names, 4) == 2);
+	CHECK(names[0] && strcmp(names[0], "libc.so") == 0);
+	CHECK(names[1] && strcmp(names[1], second) == 0);
+}
+
+static size_t file_size(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+static void round_trip(int elf_class, int data) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_AARCH64;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.soname = "libapp.so";
+	spec.build_id = 3;
+	spec.sysv_hash = TRUE; // the symbol count, without section headers
+	spec.sections = FALSE;
+	CHECK(synth_write("bare.so", &spec));
+
+	SynthFile original;
+	CHECK(synth_load("bare.so", &original));
+	CHECK(original.shnum == 0 && find_segment(&original, PT_PHDR) < 0);
+	Segment note = segment(&original, find_segment(&original, PT_NOTE));
+	int phnum = original.phnum;
+	size_t size = original.size;
+	synth_free(&original);
+
+	// no room in .dynstr: appended, behind the writable segment ending the file
+	ElfContext ctx;
+	CHECK(elf_load("bare.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", "libreplacement_with_a_long_name.so") == 0);
+	CHECK(elf_save(&ctx, "long.so") == 0);
+	CHECK(elf_verify(&ctx, "long.so") == 0);
+	elf_close(&ctx);
+
+	SynthFile file;
+	CHECK(synth_load("long.so", &file));
+	CHECK(file.shnum == 0);
+	needed_are(&file, "libreplacement_with_a_long_name.so");
+	uint64_t value;
+	CHECK(synth_dyn(&file, DT_SONAME, &value) && strcmp(synth_string(&file, value), "libapp.so") == 0);
+
+	// PT_PHDR, a PT_LOAD starting with the table and a spare PT_NULL were added
+	CHECK(file.phnum == phnum + 3);
+	CHECK(file.phoff >= size);
+	int phdr = find_segment(&file, PT_PHDR);
+	CHECK(phdr == 0);
+	Segment table = segment(&file, phdr);
+	CHECK(table.offset == file.phoff);
+	int loads = 0, spare = 0;
+	for (int i = 0; i < file.phnum; ++i) {
+		Segment s = segment(&file, i);
+		spare += s.type == PT_NULL;
+		if (s.type != PT_LOAD) continue;
+		loads++;
+		if (s.offset != file.phoff) continue;
+		CHECK(i > phdr && s.flags == PF_R && s.vaddr == table.vaddr);
+		CHECK(s.offset + s.filesz == file.size); // the new string table follows
+	}
+	CHECK(loads == 3 && spare == 1);
+	uint64_t mapped;
+	CHECK(synth_offset(&file, table.vaddr, table.filesz, &mapped) && mapped == file.phoff);
+	CHECK(synth_dyn(&file, DT_STRTAB, &value) && synth_offset(&file, value, file.strsz, &mapped) && mapped > file.phoff);
+
+	// the note is still the note
+	int note_index = find_segment(&file, PT_NOTE);
+	CHECK(note_index >= 0);
+	Segment moved = segment(&file, note_index);
+	CHECK(moved.offset == note.offset && moved.filesz == note.filesz);
+	CHECK(synth_get(&file, moved.offset + 8, 4) == NT_GNU_BUILD_ID);
+	synth_free(&file);
+
+	// loaded again the same way; the appended segment is reused, not repeated
+	CHECK(elf_load("long.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libreplacement_with_a_long_name.so", "libreplacement_with_a_long_nam2.so") == 0);
+	CHECK(elf_save(&ctx, "again.so") == 0);
+	CHECK(elf_verify(&ctx, "again.so") == 0);
+	elf_close(&ctx);
+	CHECK(synth_load("again.so", &file));
+	needed_are(&file, "libreplacement_with_a_long_nam2.so");
+	CHECK(file.phnum == phnum + 3);
+	synth_free(&file);
+	CHECK(file_size("again.so") <= file_size("long.so") + strlen("libreplacement_with_a_long_nam2.so") + 1);
+
+	// a shorter name nothing else refers to stays in place
+	CHECK(elf_load("bare.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", "libnew.so") == 0);
+	CHECK(elf_save(&ctx, "short.so") == 0);
+	CHECK(elf_verify(&ctx, "short.so") == 0);
+	elf_close(&ctx);
+	CHECK(file_size("short.so") == file_size("bare.so"));
+	CHECK(synth_load("short.so", &file));
+	needed_are(&file, "libnew.so");
+	CHECK(file.phnum == phnum);
+	synth_free(&file);
+}
+
+int main(void) {
+	round_trip(ELFCLASS64, ELFDATA2LSB);
+	round_trip(ELFCLASS32, ELFDATA2MSB);
+	round_trip(ELFCLASS32, ELFDATA2LSB);
+	return check_report("phdrs");
+}
@@ -0,0 +1,166 @@
+// test_recipe.c
+//
+// Recipes recorded by the fd patcher, replayed onto copies of the input,
+// and refused by their guards on anything else.
+#include "../elfpatcher.h"
+#include "../elflock.h"
+#include "../elfrecipe.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PREFIX "/data/app/lib/"
+
+static void write_library(const char* path, const char* second_needed) {
+	const char* needed[] = { "libc.so", second_needed };
+	SynthSpec spec = { 0 };
+	spec.elf_class = ELFCLASS64;
+	spec.data = ELFDATA2LSB;
+	spec.machine = EM_AARCH64;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.build_id = 5;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+// replay 'recipe' onto 'path', TRUE if it applied
+static int replay(const PatchRecipe* recipe, const char* path) {
+	int fd = open(path, O_RDWR);
+	int ok = fd >= 0 && recipe_apply(recipe, fd, NULL);
+	if (fd >= 0) close(fd);
+	return ok;
+}
+
+static void second_needed_is(const char* path, const char* expected) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load(path, &file));
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[1] && strcmp(names[1], expected) == 0);
+	synth_free(&file);
+}
+
+static void record_and_replay(void) {
+	mkdir("recipes", 0755);
+	write_library("a.so", "libz.so");
+	CHECK(synth_copy("a.so", "orig.so"));
+	CHECK(synth_copy("a.so", "b.so"));
+	write_library("same_id.so", "libq.so"); // same build-id and size, other names
+
+	CHECK(patch_auto_recipe("a.so", PREFIX, PATCH_STRATEGY_PREFIX, "recipes") == TRUE);
+	second_needed_is("a.so", PREFIX "libz.so");
+
+	// the recipe sits under the input's build-id and the rules
+	unsigned char build_id[RECIPE_MAX_BUILD_ID];
+	int fd = open("orig.so", O_RDONLY);
+	int build_id_size = elf_read_build_id(fd, build_id, sizeof(build_id));
+	close(fd);
+	CHECK(build_id_size == 20);
+
+	char path[4096];
+	recipe_path(path, sizeof(path), "recipes", build_id, build_id_size, recipe_rules_hash(PREFIX, PATCH_STRATEGY_PREFIX));
+	PatchRecipe recipe;
+	CHECK(recipe_load(&recipe, path));
+	CHECK(recipe.edit_count > 0 && recipe.guard_count > 0);
+
+	struct stat st;
+	CHECK(stat("a.so", &st) == 0 && recipe.output_size == (uint64_t)st.st_size);
+
+	// a copy of the input gets the same bytes without being parsed
+	CHECK(replay(&recipe, "b.so"));
+	CHECK(synth_same_file("a.so", "b.so"));
+
+	// guards: other names at the same size, the patched output, a longer file
+	CHECK(synth_copy("same_id.so", "same_id.orig"));
+	CHECK(!replay(&recipe, "same_id.so"));
+	CHECK(synth_same_file("same_id.so", "same_id.orig"));
+	CHECK(!replay(&recipe, "a.so"));
+	CHECK(synth_copy("orig.so", "longer.so"));
+	fd = open("longer.so", O_WRONLY | O_APPEND);
+	CHECK(fd >= 0 && write(fd, "x", 1) == 1);
+	close(fd);
+	CHECK(!replay(&recipe, "longer.so"));
+	recipe_free(&recipe);
+
+	// a refused recipe falls back to patching, and is kept for the inputs it fits
+	CHECK(patch_auto_recipe("same_id.so", PREFIX, PATCH_STRATEGY_PREFIX, "recipes") == TRUE);
+	second_needed_is("same_id.so", PREFIX "libq.so");
+	CHECK(recipe_load(&recipe, path));
+	CHECK(synth_copy("orig.so", "c.so"));
+	CHECK(replay(&recipe, "c.so"));
+	CHECK(synth_same_file("a.so", "c.so"));
+	recipe_free(&recipe);
+
+	CHECK(patch_auto_recipe("a.so", PREFIX, PATCH_STRATEGY_PREFIX, "recipes") == PATCH_UNCHANGED);
+
+	// an output met before any input (an archive entry has no marker to skip
+	// it) leaves no recipe behind, the first input then records the real one
+	mkdir("fresh_recipes", 0755);
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, PREFIX };
+	PatchConfig config = { { &rule, 1 }, PATCH_STRATEGY_PREFIX, "fresh_recipes", NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+	char fresh_path[4096];
+	recipe_path(fresh_path, sizeof(fresh_path), "fresh_recipes", build_id, build_id_size,
+	            recipe_rules_hash(PREFIX, PATCH_STRATEGY_PREFIX));
+	CHECK(synth_copy("a.so", "patched_copy.so"));
+	CHECK(patch_fd_edits(open("patched_copy.so", O_RDWR), "patched_copy.so", PREFIX, &config, NULL, &recipe) == PATCH_UNCHANGED);
+	recipe_free(&recipe);
+	CHECK(access(fresh_path, F_OK) != 0);
+
+	CHECK(synth_copy("orig.so", "g.so") && synth_copy("orig.so", "h.so"));
+	CHECK(patch_fd_edits(open("g.so", O_RDWR), "g.so", PREFIX, &config, NULL, &recipe) == TRUE);
+	recipe_free(&recipe);
+	CHECK(recipe_load(&recipe, fresh_path));
+	CHECK(recipe.edit_count > 0);
+	CHECK(replay(&recipe, "h.so"));
+	CHECK(synth_same_file("a.so", "h.so"));
+	recipe_free(&recipe);
+
+	// a truncated recipe is not loaded
+	CHECK(truncate(path, 40) == 0);
+	CHECK(!recipe_load(&recipe, path));
+}
+
+static void cache(void) {
+	write_library("d.so", "libz.so");
+	CHECK(synth_copy("d.so", "e.so"));
+
+	RecipeCache recipes;
+	recipe_cache_init(&recipes);
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, PREFIX };
+	PatchConfig config = { { &rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, &recipes };
+
+	unsigned char build_id[RECIPE_MAX_BUILD_ID];
+	int fd = open("d.so", O_RDONLY);
+	int build_id_size = elf_read_build_id(fd, build_id, sizeof(build_id));
+	close(fd);
+
+	uint64_t rules_hash = recipe_rules_hash(PREFIX, PATCH_STRATEGY_PREFIX);
+	CHECK(!recipe_cache_get(&recipes, build_id, build_id_size, rules_hash, NULL));
+	CHECK(patch_file("d.so", &config) == TRUE);
+	CHECK(recipe_cache_get(&recipes, build_id, build_id_size, rules_hash, NULL));
+	CHECK(!recipe_cache_get(&recipes, build_id, build_id_size, recipe_rules_hash("/other/", PATCH_STRATEGY_PREFIX), NULL));
+
+	CHECK(patch_file("e.so", &config) == TRUE);
+	CHECK(synth_same_file("d.so", "e.so"));
+
+	// what the cache hands out is a copy that replays on its own
+	PatchRecipe recipe;
+	CHECK(recipe_cache_get(&recipes, build_id, build_id_size, rules_hash, &recipe));
+	CHECK(synth_copy("orig.so", "f.so"));
+	CHECK(replay(&recipe, "f.so"));
+	CHECK(synth_same_file("d.so", "f.so"));
+	recipe_free(&recipe);
+	recipe_cache_free(&recipes);
+}
+
+int main(void) {
+	record_and_replay();
+	cache();
+	return check_report("recipe");
+}
@@ -0,0 +1,164 @@
+// test_rules.c
+//
+// Per-ABI rules: the first rule matching a header's class and e_machine
+// wins, byte order does not matter, and a tree mixing ABIs is patched in
+// one pass with the prefix of each, libraries without a rule left alone.
+#include "../elfbatch.h"
+#include "../elfjournal.h"
+#include "../elflock.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* needed[] = { "libc.so", "libm.so" };
+
+static const PatchRule rule_list[] = {
+	{ EM_ARM, ELFCLASS32, "armeabi-v7a", "/data/app/lib/arm/" },
+	{ EM_AARCH64, ELFCLASS64, "arm64-v8a", "/data/app/lib/arm64/" },
+	{ PATCH_ANY, ELFCLASS32, "x86", "/data/app/lib/x86/" }, // every other 32-bit ABI
+};
+static const PatchRules rules = { rule_list, 3 };
+
+typedef struct {
+	const char* name;
+	int elf_class;
+	int data;
+	int machine;
+	const char* prefix; // NULL: no rule matches
+} Library;
+
+static const Library libraries[] = {
+	{ "arm.so", ELFCLASS32, ELFDATA2LSB, EM_ARM, "/data/app/lib/arm/" },
+	{ "arm64.so", ELFCLASS64, ELFDATA2LSB, EM_AARCH64, "/data/app/lib/arm64/" },
+	{ "arm64be.so", ELFCLASS64, ELFDATA2MSB, EM_AARCH64, "/data/app/lib/arm64/" },
+	{ "x86.so", ELFCLASS32, ELFDATA2LSB, EM_386, "/data/app/lib/x86/" },
+	{ "x86_64.so", ELFCLASS64, ELFDATA2LSB, EM_X86_64, NULL },
+};
+#define LIBRARIES (int)(sizeof(libraries) / sizeof(libraries[0]))
+
+static void write_tree(const char* dir) {
+	mkdir(dir, 0755);
+	for (int i = 0; i < LIBRARIES; ++i) {
+		SynthSpec spec = { 0 };
+		spec.elf_class = libraries[i].elf_class;
+		spec.data = libraries[i].data;
+		spec.machine = libraries[i].machine;
+		spec.needed = needed;
+		spec.needed_count = 2;
+		spec.build_id = i + 1;
+		spec.sections = TRUE;
+
+		char path[64], orig[64];
+		snprintf(path, sizeof(path), "%s/%s", dir, libraries[i].name);
+		snprintf(orig, sizeof(orig), "%s/%s.orig", dir, libraries[i].name);
+		CHECK(synth_write(path, &spec));
+		CHECK(synth_copy(path, orig));
+	}
+}
+
+// every library under the prefix of its rule, or as written without one
+static void check_tree(const char* dir) {
+	for (int i = 0; i < LIBRARIES; ++i) {
+		char path[64], orig[64];
+		snprintf(path, sizeof(path), "%s/%s", dir, libraries[i].name);
+		snprintf(orig, sizeof(orig), "%s/%s.orig", dir, libraries[i].name);
+		if (!libraries[i].prefix) {
+			CHECK(synth_same_file(path, orig));
+			continue;
+		}
+
+		SynthFile file;
+		const char* names[4] = { NULL };
+		CHECK(synth_load(path, &file));
+		CHECK(synth_needed(&file, names, 4) == 2);
+		for (int n = 0; n < 2; ++n) {
+			char expected[64];
+			snprintf(expected, sizeof(expected), "%s%s", libraries[i].prefix, needed[n]);
+			CHECK(names[n] && strcmp(names[n], expected) == 0);
+		}
+		synth_free(&file);
+	}
+}
+
+static void reverted(const char* dir) {
+	for (int i = 0; i < LIBRARIES; ++i) {
+		char path[64], orig[64];
+		snprintf(path, sizeof(path), "%s/%s", dir, libraries[i].name);
+		snprintf(orig, sizeof(orig), "%s/%s.orig", dir, libraries[i].name);
+		CHECK(synth_same_file(path, orig));
+	}
+}
+
+int main(void) {
+	// first match in order, PATCH_ANY for either field
+	CHECK(patch_rule_find(&rules, ELFCLASS32, EM_ARM) == &rule_list[0]);
+	CHECK(patch_rule_find(&rules, ELFCLASS64, EM_AARCH64) == &rule_list[1]);
+	CHECK(patch_rule_find(&rules, ELFCLASS32, EM_386) == &rule_list[2]);
+	CHECK(patch_rule_find(&rules, ELFCLASS32, EM_AARCH64) == &rule_list[2]);
+	CHECK(patch_rule_find(&rules, ELFCLASS64, EM_X86_64) == NULL);
+	CHECK(patch_rule_find(&rules, ELFCLASS64, EM_ARM) == NULL);
+
+	PatchRule any = { PATCH_ANY, PATCH_ANY, NULL, "/any/" };
+	PatchRules catch_all = { &any, 1 };
+	CHECK(patch_rule_find(&catch_all, ELFCLASS64, EM_X86_64) == &any);
+	PatchRules none = { NULL, 0 };
+	CHECK(patch_rule_find(&none, ELFCLASS32, EM_ARM) == NULL);
+
+	// from the header on disk, in either byte order
+	write_tree("single");
+	for (int i = 0; i < LIBRARIES; ++i) {
+		char path[64];
+		snprintf(path, sizeof(path), "single/%s", libraries[i].name);
+		int fd = open(path, O_RDONLY);
+		const PatchRule* rule = patch_rule_read(&rules, fd);
+		CHECK(libraries[i].prefix ? rule && strcmp(rule->prefix, libraries[i].prefix) == 0 : rule == NULL);
+		close(fd);
+	}
+	FILE* text = fopen("single/notes.txt", "w");
+	fputs("not a library at all\n", text);
+	fclose(text);
+	int fd = open("single/notes.txt", O_RDONLY);
+	CHECK(patch_rule_read(&rules, fd) == NULL);
+	close(fd);
+
+	// one file at a time: each with its ABI's prefix, the one without a rule unchanged
+	PatchConfig config = { rules, PATCH_STRATEGY_PREFIX, NULL, "single.journal", LOCK_WAIT_DEFAULT, FALSE, NULL };
+	for (int i = 0; i < LIBRARIES; ++i) {
+		char path[64];
+		snprintf(path, sizeof(path), "single/%s", libraries[i].name);
+		CHECK(patch_file(path, &config) == (libraries[i].prefix ? TRUE : PATCH_UNCHANGED));
+	}
+	check_tree("single");
+	CHECK(journal_revert("single.journal", LOCK_WAIT_DEFAULT) == 0);
+	reverted("single");
+
+	// the whole tree as one batch
+	write_tree("batch");
+	const char* paths[LIBRARIES];
+	char path_storage[LIBRARIES][64];
+	for (int i = 0; i < LIBRARIES; ++i) {
+		snprintf(path_storage[i], sizeof(path_storage[i]), "batch/%s", libraries[i].name);
+		paths[i] = path_storage[i];
+	}
+	config.journal = "batch.journal";
+	PatchBatchStats stats;
+	CHECK(patch_batch(paths, LIBRARIES, &config, 2, NULL, &stats) == TRUE);
+	CHECK(stats.inputs == LIBRARIES && stats.patched == LIBRARIES - 1 && stats.unchanged == 1 && stats.failed == 0);
+	check_tree("batch");
+
+	// the same tree with the other strategy: every patched file refused, none touched
+	PatchConfig runpath = config;
+	runpath.strategy = PATCH_STRATEGY_RUNPATH;
+	CHECK(patch_batch(paths, LIBRARIES, &runpath, 2, NULL, &stats) == FALSE);
+	CHECK(stats.conflicts == LIBRARIES - 1 && stats.unchanged == 1 && stats.patched == 0 && stats.failed == 0);
+	check_tree("batch");
+	CHECK(journal_revert("batch.journal", LOCK_WAIT_DEFAULT) == 0);
+	reverted("batch");
+
+	return check_report("rules");
+}
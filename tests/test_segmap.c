@@ -0,0 +1,113 @@
+// test_segmap.c
+//
+// The segment table on its own, then through the fd patcher: a second
+// patch has to find the string table in the segment the first one added.
+#include "../elfpatcher.h"
+#include "../elfjournal.h"
+#include "../elflock.h"
+#include "../elfsegmap.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static void lookups(void) {
+	// given out of order, as program headers may be
+	ElfSegment segments[] = {
+		{ 0x20000, 0x3000, 0x800, 0x2000, 0x1000 },  // .data and .bss
+		{ 0x0, 0x0, 0x2000, 0x2000, 0x1000 },
+		{ 0x40000, 0x6000, 0x100, 0x100, 0x10000 },
+	};
+	ElfSegmentMap map;
+	CHECK(segmap_init(&map, segments, 3));
+	CHECK(map.count == 3 && map.by_vaddr[0].virtual_address == 0 && map.by_vaddr[2].virtual_address == 0x40000);
+
+	uint64_t offset = 0;
+	CHECK(segmap_vaddr_to_offset(&map, 0x10, 4, &offset) && offset == 0x10);
+	CHECK(segmap_vaddr_to_offset(&map, 0x20100, 0x10, &offset) && offset == 0x3100);
+	CHECK(!segmap_vaddr_to_offset(&map, 0x407f0, 0x10, &offset));
+	CHECK(segmap_vaddr_to_offset(&map, 0x400f0, 0x10, &offset) && offset == 0x60f0);
+
+	// past p_filesz (.bss), across the end of a segment, in a gap
+	CHECK(!segmap_vaddr_to_offset(&map, 0x20900, 4, &offset));
+	CHECK(!segmap_vaddr_to_offset(&map, 0x1ffc, 8, &offset));
+	CHECK(!segmap_vaddr_to_offset(&map, 0x30000, 4, &offset));
+
+	// the largest alignment wins
+	uint64_t align = 0;
+	CHECK(segmap_next_free_vaddr(&map, &align) == 0x50000 && align == 0x10000);
+
+	// an appended segment is found like the others, an overlapping one is refused
+	ElfSegment appended = { 0x50000, 0x7000, 0x200, 0x200, 0x1000 };
+	CHECK(segmap_add(&map, &appended));
+	CHECK(segmap_vaddr_to_offset(&map, 0x50010, 0x10, &offset) && offset == 0x7010);
+	ElfSegment overlapping = { 0x50100, 0x8000, 0x200, 0x200, 0x1000 };
+	CHECK(!segmap_add(&map, &overlapping));
+	segmap_free(&map);
+
+	ElfSegment overlap[] = { { 0x0, 0x0, 0x2000, 0x2000, 0x1000 }, { 0x1000, 0x1000, 0x100, 0x100, 0x1000 } };
+	CHECK(!segmap_init(&map, overlap, 2));
+	segmap_free(&map);
+}
+
+// patch twice with different rules, then revert both from the journal
+static void patch_twice(int elf_class, int data) {
+	static const char* needed[] = { "libc.so", "libz.so" };
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_X86_64;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.sections = TRUE;
+	CHECK(synth_write("lib.so", &spec));
+	CHECK(synth_copy("lib.so", "orig.so"));
+	unlink("journal");
+
+	PatchRule first = { PATCH_ANY, PATCH_ANY, NULL, "/a/" };
+	PatchConfig config = { { &first, 1 }, PATCH_STRATEGY_PREFIX, NULL, "journal", LOCK_WAIT_DEFAULT, FALSE, NULL };
+	CHECK(patch_file("lib.so", &config) == TRUE);
+
+	SynthFile file;
+	CHECK(synth_load("lib.so", &file));
+	uint64_t strtab_first = 0;
+	CHECK(synth_dyn(&file, DT_STRTAB, &strtab_first));
+	synth_free(&file);
+
+	// other rules are refused while the marker says what the file holds
+	PatchRule second = { PATCH_ANY, PATCH_ANY, NULL, "/b/" };
+	config.rules.rules = &second;
+	CHECK(synth_copy("lib.so", "first.so"));
+	CHECK(patch_file("lib.so", &config) == PATCH_CONFLICT);
+	CHECK(synth_same_file("lib.so", "first.so"));
+
+	// without it (a copy that lost its xattrs) they go on top, growing the file again
+	int fd = open("lib.so", O_RDONLY);
+	mark_clear(fd);
+	close(fd);
+	CHECK(patch_file("lib.so", &config) == TRUE);
+
+	CHECK(synth_load("lib.so", &file));
+	const char* names[4];
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[0] && strcmp(names[0], "/b//a/libc.so") == 0);
+	CHECK(names[1] && strcmp(names[1], "/b//a/libz.so") == 0);
+
+	// the table moved into data the patcher mapped, above the original segments
+	uint64_t strtab = 0, offset = 0;
+	CHECK(synth_dyn(&file, DT_STRTAB, &strtab) && strtab >= strtab_first && strtab_first > 0x10000);
+	CHECK(synth_offset(&file, strtab, file.strsz, &offset) && offset != strtab);
+	synth_free(&file);
+
+	CHECK(journal_revert("journal", LOCK_WAIT_DEFAULT) == 0);
+	CHECK(synth_same_file("lib.so", "orig.so"));
+}
+
+int main(void) {
+	lookups();
+	patch_twice(ELFCLASS64, ELFDATA2LSB);
+	patch_twice(ELFCLASS32, ELFDATA2MSB);
+	return check_report("segmap");
+}
@@ -0,0 +1,171 @@
+// test_strip.c
+//
+// Size-optimised output from elfmod: the section table cut down to what
+// bionic checks or dropped altogether, data appended by an earlier edit
+// moved down into the space freed, and everything the loader resolves
+// still in place afterwards.
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TRUE 1
+
+static const char* needed[] = { "libc.so", "libm.so", "libold.so" };
+static const char* defined[] = { "codec_open", "codec_close", "codec_decode", "codec_encode" };
+static const char* undefined[] = { "malloc", "free" };
+
+static size_t file_size(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+// the loader's view of 'path': names, symbols and their values
+static void check_loadable(const char* path, const char* third_needed, const uint64_t* values) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+
+	const char* names[4] = { NULL };
+	CHECK(synth_needed(&file, names, 4) == 3);
+	CHECK(names[0] && strcmp(names[0], "libc.so") == 0);
+	CHECK(names[2] && strcmp(names[2], third_needed) == 0);
+
+	uint64_t value;
+	CHECK(synth_dyn(&file, DT_SONAME, &value) && synth_string(&file, value) && strcmp(synth_string(&file, value), "libcodec.so") == 0);
+	for (int i = 0; i < 4; ++i) {
+		int index = synth_gnu_lookup(&file, defined[i]);
+		CHECK(index > 0 && index == synth_sysv_lookup(&file, defined[i]));
+		CHECK(synth_symbol_value(&file, index) == values[i]);
+	}
+	for (int i = 0; i < 2; ++i) CHECK(synth_sysv_lookup(&file, undefined[i]) > 0);
+	synth_free(&file);
+}
+
+// the minimal table: .dynamic and .dynstr where the dynamic tags put them
+static void check_minimal_sections(const char* path) {
+	SynthFile file;
+	CHECK(synth_load(path, &file));
+	int w = file.elf_class == ELFCLASS64 ? 8 : 4;
+	uint64_t shentsize = w == 8 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+	CHECK(file.shnum == 4 && file.shoff % w == 0);
+	CHECK(file.shoff + 4 * shentsize == file.size);
+
+	uint64_t shstrndx = synth_get(&file, w == 8 ? 62 : 50, 2);
+	CHECK(shstrndx == 3);
+	uint64_t names = synth_get(&file, file.shoff + 3 * shentsize + 8 + 2 * w, w);
+
+	static const char* expected[] = { "", ".dynamic", ".dynstr", ".shstrtab" };
+	static const uint32_t types[] = { SHT_NULL, SHT_DYNAMIC, SHT_STRTAB, SHT_STRTAB };
+	for (int i = 0; i < 4; ++i) {
+		uint64_t shdr = file.shoff + i * shentsize;
+		uint64_t name = names + synth_get(&file, shdr, 4);
+		CHECK(name < file.size && strcmp((const char*)file.data + name, expected[i]) == 0);
+		CHECK(synth_get(&file, shdr + 4, 4) == types[i]);
+	}
+
+	uint64_t dynamic = file.shoff + shentsize, dynstr = file.shoff + 2 * shentsize;
+	uint64_t strtab, strsz;
+	CHECK(synth_get(&file, dynamic + 8 + 2 * w, w) == file.dynamic_offset);
+	CHECK(synth_dyn(&file, DT_STRTAB, &strtab) && synth_dyn(&file, DT_STRSZ, &strsz));
+	CHECK(synth_get(&file, dynstr + 8 + w, w) == strtab && synth_get(&file, dynstr + 8 + 3 * w, w) == strsz);
+	CHECK((const char*)file.data + synth_get(&file, dynstr + 8 + 2 * w, w) == file.strtab);
+	synth_free(&file);
+}
+
+static void strip(int elf_class, int data) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.soname = "libcodec.so";
+	spec.defined = defined;
+	spec.defined_count = 4;
+	spec.undefined = undefined;
+	spec.undefined_count = 2;
+	spec.verneed = "libc.so";
+	spec.gnu_hash = TRUE;
+	spec.sysv_hash = TRUE;
+	spec.sections = TRUE;
+	spec.debug_size = 2 * 4096; // room for appended data to move down a page
+	CHECK(synth_write("lib.so", &spec));
+
+	uint64_t values[4];
+	SynthFile file;
+	CHECK(synth_load("lib.so", &file));
+	for (int i = 0; i < 4; ++i) values[i] = synth_symbol_value(&file, synth_gnu_lookup(&file, defined[i]));
+	synth_free(&file);
+
+	// minimal: three named sections, the rest of the table gone
+	ElfContext ctx;
+	size_t saved = 0;
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_strip(&ctx, ELF_STRIP_MINIMAL, &saved) == 0);
+	CHECK(elf_save(&ctx, "minimal.so") == 0);
+	CHECK(elf_verify(&ctx, "minimal.so") == 0);
+	elf_close(&ctx);
+	CHECK(saved > 0 && file_size("minimal.so") == file_size("lib.so") - saved);
+	check_minimal_sections("minimal.so");
+	check_loadable("minimal.so", "libold.so", values);
+
+	// stripping it again gains nothing and changes nothing
+	CHECK(elf_load("minimal.so", &ctx) == 0);
+	CHECK(elf_strip(&ctx, ELF_STRIP_MINIMAL, &saved) == 0);
+	CHECK(saved == 0);
+	CHECK(elf_save(&ctx, "minimal2.so") == 0);
+	elf_close(&ctx);
+	CHECK(synth_same_file("minimal.so", "minimal2.so"));
+
+	// all: no section table at all, for loaders other than bionic
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_strip(&ctx, ELF_STRIP_ALL, &saved) == 0);
+	CHECK(elf_save(&ctx, "all.so") == 0);
+	CHECK(elf_verify(&ctx, "all.so") == 0);
+	elf_close(&ctx);
+	CHECK(file_size("all.so") == file_size("lib.so") - saved);
+	CHECK(file_size("all.so") < file_size("minimal.so"));
+	CHECK(synth_load("all.so", &file));
+	CHECK(file.shnum == 0 && file.shoff == 0);
+	synth_free(&file);
+	check_loadable("all.so", "libold.so", values);
+
+	// a longer name appends a new .dynstr behind the sections; stripping
+	// in the same run slides it down by the pages they leave
+	const char* longer = "libreplacement_with_a_long_name.so";
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", longer) == 0);
+	CHECK(elf_save(&ctx, "grown.so") == 0);
+	CHECK(elf_strip(&ctx, ELF_STRIP_MINIMAL, &saved) == 0);
+	CHECK(elf_save(&ctx, "grown_minimal.so") == 0);
+	CHECK(elf_verify(&ctx, "grown_minimal.so") == 0);
+	elf_close(&ctx);
+	CHECK(saved > 0 && file_size("grown_minimal.so") == file_size("grown.so") - saved);
+	check_minimal_sections("grown_minimal.so");
+	check_loadable("grown_minimal.so", longer, values);
+
+	SynthFile grown, stripped;
+	CHECK(synth_load("grown.so", &grown));
+	CHECK(synth_load("grown_minimal.so", &stripped));
+	CHECK(stripped.strtab - (const char*)stripped.data < grown.strtab - (const char*)grown.data);
+	synth_free(&grown);
+	synth_free(&stripped);
+
+	// and a file grown by an earlier run is stripped in its own
+	CHECK(elf_load("grown.so", &ctx) == 0);
+	CHECK(elf_strip(&ctx, ELF_STRIP_ALL, &saved) == 0);
+	CHECK(elf_save(&ctx, "grown_all.so") == 0);
+	CHECK(elf_verify(&ctx, "grown_all.so") == 0);
+	elf_close(&ctx);
+	CHECK(saved > 0 && file_size("grown_all.so") < file_size("grown_minimal.so"));
+	check_loadable("grown_all.so", longer, values);
+}
+
+int main(void) {
+	strip(ELFCLASS64, ELFDATA2LSB);
+	strip(ELFCLASS32, ELFDATA2MSB);
+	return check_report("strip");
+}
@@ -0,0 +1,115 @@
+// test_verify.c
+//
+// elf_verify on files changed after elf_save: a byte of a modified range,
+// the size, the identification or a DT_NEEDED offset outside .dynstr are
+// each enough to fail it, while an untouched file passes again.
+#include "../elfparser/elfmod.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRUE 1
+#define FALSE 0
+
+static const char* needed[] = { "libc.so", "libm.so", "libold.so" };
+
+// xor the byte at 'offset' of 'path' with 'mask'
+static void flip(const char* path, uint64_t offset, unsigned char mask) {
+	int fd = open(path, O_RDWR);
+	unsigned char byte;
+	CHECK(fd >= 0 && pread(fd, &byte, 1, offset) == 1);
+	byte ^= mask;
+	CHECK(pwrite(fd, &byte, 1, offset) == 1);
+	close(fd);
+}
+
+static void write_at(const char* path, uint64_t offset, const void* bytes, size_t size) {
+	int fd = open(path, O_RDWR);
+	CHECK(fd >= 0 && pwrite(fd, bytes, size, offset) == (ssize_t)size);
+	close(fd);
+}
+
+static void fails_with(ElfContext* ctx, const char* path, const char* error) {
+	CHECK(elf_verify(ctx, path) != 0);
+	CHECK(strstr(elf_get_error(), error) != NULL);
+}
+
+static void tampered(int elf_class, int data, const char* new_lib) {
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = data;
+	spec.machine = EM_AARCH64;
+	spec.needed = needed;
+	spec.needed_count = 3;
+	spec.sysv_hash = TRUE;
+	spec.sections = TRUE;
+	CHECK(synth_write("lib.so", &spec));
+
+	ElfContext ctx;
+	CHECK(elf_load("lib.so", &ctx) == 0);
+	CHECK(elf_replace_needed_lib(&ctx, "libold.so", new_lib) == 0);
+	CHECK(elf_save(&ctx, "out.so") == 0);
+	CHECK(elf_verify(&ctx, "out.so") == 0);
+	CHECK(ctx.touched_count > 0);
+
+	// every modified range is read back: its first and its last byte
+	for (size_t i = 0; i < ctx.touched_count; ++i) {
+		const ElfRange* range = &ctx.touched[i];
+		flip("out.so", range->offset, 0x20);
+		fails_with(&ctx, "out.so", "does not match");
+		flip("out.so", range->offset, 0x20);
+		flip("out.so", range->offset + range->size - 1, 0x01);
+		fails_with(&ctx, "out.so", "does not match");
+		flip("out.so", range->offset + range->size - 1, 0x01);
+	}
+	CHECK(elf_verify(&ctx, "out.so") == 0);
+
+	// cut short, or grown
+	CHECK(synth_copy("out.so", "saved.so"));
+	CHECK(truncate("out.so", ctx.saved_size - 1) == 0);
+	fails_with(&ctx, "out.so", "size");
+	CHECK(truncate("out.so", ctx.saved_size + 1) == 0);
+	fails_with(&ctx, "out.so", "size");
+	CHECK(elf_verify(&ctx, "missing.so") != 0);
+
+	// outside the modified ranges: the identification and the dynamic table
+	CHECK(synth_copy("saved.so", "out.so"));
+	flip("out.so", EI_OSABI, 0x03);
+	fails_with(&ctx, "out.so", "identification");
+
+	CHECK(synth_copy("saved.so", "out.so"));
+	SynthFile file;
+	CHECK(synth_load("out.so", &file));
+	int w = file.elf_class == ELFCLASS64 ? 8 : 4;
+	int entry = 0;
+	while (entry < file.dyn_count && file.dyn_tags[entry] != DT_NEEDED) entry++;
+	CHECK(entry < file.dyn_count);
+	unsigned char outside[8];
+	memset(outside, 0x7f, sizeof(outside)); // beyond any DT_STRSZ in either byte order
+	uint64_t value_offset = file.dynamic_offset + entry * 2 * w + w;
+	synth_free(&file);
+	write_at("out.so", value_offset, outside, w);
+
+	// where the edit rewrote the dynamic table, its checksum catches this first
+	int moved = FALSE;
+	for (size_t i = 0; i < ctx.touched_count; ++i) {
+		moved |= value_offset >= ctx.touched[i].offset && value_offset < ctx.touched[i].offset + ctx.touched[i].size;
+	}
+	fails_with(&ctx, "out.so", moved ? "does not match" : "outside DT_STRSZ");
+
+	CHECK(synth_copy("saved.so", "out.so"));
+	CHECK(elf_verify(&ctx, "out.so") == 0);
+	elf_close(&ctx);
+}
+
+int main(void) {
+	tampered(ELFCLASS64, ELFDATA2LSB, "libnew.so"); // in place
+	tampered(ELFCLASS32, ELFDATA2MSB, "libnew.so");
+	tampered(ELFCLASS64, ELFDATA2MSB, "libreplacement_with_a_long_name.so"); // appended
+	tampered(ELFCLASS32, ELFDATA2LSB, "libreplacement_with_a_long_name.so");
+	return check_report("verify");
+}
@@ -0,0 +1,91 @@
+// test_watch.c
+//
+// Watch mode: libraries written into a watched directory, directly or
+// renamed in from a temporary, are patched once they fall quiet; other
+// names and subdirectories are left alone, and setting 'stop' ends it.
+#include "../elflock.h"
+#include "../elfwatch.h"
+#include "check.h"
+#include "synth.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define PREFIX "/data/app/lib/"
+
+static volatile sig_atomic_t stop = 0;
+
+static void write_library(const char* path, int build_id) {
+	static const char* needed[] = { "libc.so", "libm.so" };
+	SynthSpec spec = { 0 };
+	spec.elf_class = ELFCLASS32;
+	spec.data = ELFDATA2LSB;
+	spec.machine = EM_ARM;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.build_id = build_id;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+static int patched(const char* path) {
+	SynthFile file;
+	const char* names[4] = { NULL };
+	if (!synth_load(path, &file)) return FALSE;
+	int ok = synth_needed(&file, names, 4) == 2 && names[0] && strcmp(names[0], PREFIX "libc.so") == 0;
+	synth_free(&file);
+	return ok;
+}
+
+static void pause_ms(long ms) {
+	struct timespec pause = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&pause, NULL);
+}
+
+// plays the linker, then stops the watch once both libraries are patched
+static void* writer(void* arg) {
+	(void)arg;
+	pause_ms(300); // the watches are in place by then
+
+	write_library("out/libdirect.so", 1);
+	write_library("out/.tmp_renamed", 2);
+	CHECK(rename("out/.tmp_renamed", "out/librenamed.so.1") == 0);
+	write_library("out/notes.txt", 3);
+	write_library("out/sub/libnested.so", 4);
+
+	for (int waited = 0; waited < 5000 && !(patched("out/libdirect.so") && patched("out/librenamed.so.1")); waited += 20) {
+		pause_ms(20);
+	}
+	pause_ms(100); // the echoes of the patches' own writes come and go
+	stop = 1;
+	return NULL;
+}
+
+int main(void) {
+	CHECK(mkdir("out", 0755) == 0 && mkdir("out/sub", 0755) == 0);
+	PatchRule rule = { PATCH_ANY, PATCH_ANY, NULL, PREFIX };
+	PatchConfig patch = { { &rule, 1 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+
+	// a directory that does not exist cannot be watched
+	const char* missing[] = { "no_such_dir" };
+	PatchWatchConfig bad = { missing, 1, &patch, 0 };
+	CHECK(patch_watch_run(&bad, &stop) == FALSE);
+
+	const char* dirs[] = { "out" };
+	PatchWatchConfig config = { dirs, 1, &patch, 20 };
+	pthread_t thread;
+	CHECK(pthread_create(&thread, NULL, writer, NULL) == 0);
+	CHECK(patch_watch_run(&config, &stop) == TRUE);
+	pthread_join(thread, NULL);
+
+	CHECK(patched("out/libdirect.so"));
+	CHECK(patched("out/librenamed.so.1"));
+	write_library("unwatched.txt", 3);
+	CHECK(synth_same_file("out/notes.txt", "unwatched.txt"));
+	write_library("unwatched.so", 4);
+	CHECK(synth_same_file("out/sub/libnested.so", "unwatched.so"));
+	return check_report("watch");
+}
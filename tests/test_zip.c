@@ -0,0 +1,317 @@
+// test_zip.c
+//
+// Stored native libraries patched inside an archive: entries that grow
+// move behind the others with their page alignment, every CRC-32 and size
+// is rewritten, and a failing entry leaves the archive as it was.
+#include "../elflock.h"
+#include "../elfzip.h"
+#include "check.h"
+#include "synth.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ENTRIES 8
+
+typedef struct {
+	const char* name;
+	const char* source; // file holding the data
+	int align;          // data alignment, 0 for none
+} ZipInput;
+
+typedef struct {
+	char name[128];
+	uint32_t crc;
+	uint32_t size;
+	uint32_t data_offset;
+	unsigned char* data;
+} ZipEntry;
+
+// bitwise, so the check does not share the table under test
+static uint32_t crc32_slow(const unsigned char* data, size_t size) {
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static void put16(unsigned char* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(unsigned char* p, uint32_t v) {
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static uint32_t get16(const unsigned char* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char* p) {
+	return get16(p) | (get16(p + 2) << 16);
+}
+
+static unsigned char* read_all(const char* path, size_t* size) {
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) return NULL;
+	unsigned char* data = malloc(st.st_size + 1);
+	*size = st.st_size;
+	if (read(fd, data, *size) != (ssize_t)*size) {
+		free(data);
+		data = NULL;
+	}
+	close(fd);
+	return data;
+}
+
+// a stored-only archive, aligned entries padded zipalign style
+static void write_zip(const char* path, const ZipInput* inputs, int count) {
+	unsigned char* zip = calloc(1, 1 << 20);
+	unsigned char central[4096];
+	uint32_t offset = 0, central_size = 0;
+
+	for (int i = 0; i < count; ++i) {
+		size_t size;
+		unsigned char* data = read_all(inputs[i].source, &size);
+		uint32_t crc = crc32_slow(data, size);
+		uint32_t name_length = strlen(inputs[i].name);
+
+		uint32_t extra_length = 0;
+		if (inputs[i].align) {
+			uint32_t unpadded = offset + 30 + name_length + 6;
+			extra_length = 6 + (inputs[i].align - unpadded % inputs[i].align) % inputs[i].align;
+		}
+
+		unsigned char* local = &zip[offset];
+		put32(local, 0x04034b50);
+		put16(local + 4, 10);
+		put32(local + 14, crc);
+		put32(local + 18, size);
+		put32(local + 22, size);
+		put16(local + 26, name_length);
+		put16(local + 28, extra_length);
+		memcpy(local + 30, inputs[i].name, name_length);
+		if (extra_length) {
+			put16(local + 30 + name_length, 0xD935);
+			put16(local + 32 + name_length, extra_length - 4);
+			put16(local + 34 + name_length, inputs[i].align);
+		}
+		memcpy(local + 30 + name_length + extra_length, data, size);
+
+		unsigned char* entry = &central[central_size];
+		memset(entry, 0, 46);
+		put32(entry, 0x02014b50);
+		put16(entry + 4, 20);
+		put16(entry + 6, 10);
+		put32(entry + 16, crc);
+		put32(entry + 20, size);
+		put32(entry + 24, size);
+		put16(entry + 28, name_length);
+		put32(entry + 42, offset);
+		memcpy(entry + 46, inputs[i].name, name_length);
+		central_size += 46 + name_length;
+
+		offset += 30 + name_length + extra_length + size;
+		free(data);
+	}
+
+	memcpy(&zip[offset], central, central_size);
+	unsigned char* end = &zip[offset + central_size];
+	memset(end, 0, 22);
+	put32(end, 0x06054b50);
+	put16(end + 8, count);
+	put16(end + 10, count);
+	put32(end + 12, central_size);
+	put32(end + 16, offset);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	uint32_t zip_size = offset + central_size + 22;
+	CHECK(fd >= 0 && write(fd, zip, zip_size) == (ssize_t)zip_size);
+	close(fd);
+	free(zip);
+}
+
+// the entries of the central directory, each checked against its local header and CRC
+static int read_zip(const char* path, ZipEntry* entries) {
+	size_t size;
+	unsigned char* zip = read_all(path, &size);
+	if (!zip || size < 22) return -1;
+
+	const unsigned char* end = &zip[size - 22];
+	CHECK(get32(end) == 0x06054b50);
+	int count = get16(end + 10);
+	uint32_t position = get32(end + 16);
+	CHECK(position + get32(end + 12) == size - 22);
+
+	for (int i = 0; i < count && i < MAX_ENTRIES; ++i) {
+		const unsigned char* entry = &zip[position];
+		CHECK(get32(entry) == 0x02014b50);
+		ZipEntry* e = &entries[i];
+		uint32_t name_length = get16(entry + 28);
+		snprintf(e->name, sizeof(e->name), "%.*s", (int)name_length, (const char*)entry + 46);
+		e->crc = get32(entry + 16);
+		e->size = get32(entry + 24);
+		CHECK(get32(entry + 20) == e->size);
+
+		const unsigned char* local = &zip[get32(entry + 42)];
+		CHECK(get32(local) == 0x04034b50);
+		CHECK(get32(local + 14) == e->crc && get32(local + 18) == e->size && get32(local + 22) == e->size);
+		CHECK(get16(local + 26) == name_length && memcmp(local + 30, e->name, name_length) == 0);
+		e->data_offset = get32(entry + 42) + 30 + name_length + get16(local + 28);
+		CHECK(e->data_offset + e->size <= size);
+
+		e->data = malloc(e->size + 1);
+		memcpy(e->data, &zip[e->data_offset], e->size);
+		CHECK(crc32_slow(e->data, e->size) == e->crc);
+
+		position += 46 + name_length + get16(entry + 30) + get16(entry + 32);
+	}
+
+	free(zip);
+	return count;
+}
+
+static void free_entries(ZipEntry* entries, int count) {
+	for (int i = 0; i < count; ++i) free(entries[i].data);
+}
+
+static void write_library(const char* path, int elf_class, int machine) {
+	static const char* needed[] = { "libc.so", "liblog.so" };
+	SynthSpec spec = { 0 };
+	spec.elf_class = elf_class;
+	spec.data = ELFDATA2LSB;
+	spec.machine = machine;
+	spec.needed = needed;
+	spec.needed_count = 2;
+	spec.sections = TRUE;
+	CHECK(synth_write(path, &spec));
+}
+
+typedef struct {
+	const char* path;
+	const PatchConfig* config;
+	int result;
+} ZipJob;
+
+static void* patch_zip_job(void* arg) {
+	ZipJob* job = arg;
+	job->result = patch_zip(job->path, job->config, NULL);
+	return NULL;
+}
+
+// the data of 'entry' as a library: its first DT_NEEDED
+static void first_needed_is(const ZipEntry* entry, const char* expected) {
+	int fd = open("entry.so", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CHECK(fd >= 0 && write(fd, entry->data, entry->size) == (ssize_t)entry->size);
+	close(fd);
+
+	SynthFile file;
+	const char* names[4] = { NULL };
+	CHECK(synth_load("entry.so", &file));
+	CHECK(synth_needed(&file, names, 4) == 2);
+	CHECK(names[0] && strcmp(names[0], expected) == 0);
+	synth_free(&file);
+}
+
+int main(void) {
+	write_library("lib64.so", ELFCLASS64, EM_AARCH64);
+	write_library("lib32.so", ELFCLASS32, EM_ARM);
+	FILE* asset = fopen("asset.txt", "w");
+	fputs("not a library\n", asset);
+	fclose(asset);
+
+	ZipInput inputs[] = {
+		{ "AndroidManifest.xml", "asset.txt", 0 },
+		{ "lib/arm64-v8a/libone.so", "lib64.so", 4096 },
+		{ "lib/armeabi-v7a/libtwo.so", "lib32.so", 4096 },
+		{ "assets/lib/data.so", "asset.txt", 0 }, // not under lib/<abi>/
+	};
+	write_zip("app.apk", inputs, 4);
+
+	PatchRule rules[] = {
+		{ EM_AARCH64, ELFCLASS64, "arm64-v8a", "/data/lib64/" },
+		{ EM_ARM, ELFCLASS32, "armeabi-v7a", "/data/lib/" },
+	};
+	PatchConfig config = { { rules, 2 }, PATCH_STRATEGY_PREFIX, NULL, NULL, LOCK_WAIT_DEFAULT, FALSE, NULL };
+
+	// one ABI first, then the rest
+	CHECK(patch_zip("app.apk", &config, "armeabi-v7a") == TRUE);
+	ZipEntry entries[MAX_ENTRIES];
+	CHECK(read_zip("app.apk", entries) == 4);
+	first_needed_is(&entries[1], "libc.so");
+	first_needed_is(&entries[2], "/data/lib/libc.so");
+	free_entries(entries, 4);
+
+	CHECK(patch_zip("app.apk", &config, NULL) == TRUE);
+	CHECK(read_zip("app.apk", entries) == 4);
+
+	struct stat st;
+	CHECK(stat("lib64.so", &st) == 0 && entries[1].size > st.st_size); // grown
+
+	for (int i = 1; i <= 2; ++i) CHECK(entries[i].data_offset % 4096 == 0);
+	first_needed_is(&entries[1], "/data/lib64/libc.so");
+	first_needed_is(&entries[2], "/data/lib/libc.so");
+	CHECK(strcmp(entries[0].name, "AndroidManifest.xml") == 0 && entries[0].size == 14);
+	CHECK(strcmp(entries[3].name, "assets/lib/data.so") == 0 && memcmp(entries[3].data, "not a library\n", 14) == 0);
+	free_entries(entries, 4);
+	CHECK(stat("app.apk", &st) == 0 && (st.st_mode & 0777) == 0640);
+
+	// nothing left to patch: same bytes
+	CHECK(synth_copy("app.apk", "patched.apk"));
+	CHECK(patch_zip("app.apk", &config, NULL) == TRUE);
+	CHECK(synth_same_file("app.apk", "patched.apk"));
+
+	// a writer waiting for the lock while another renames a new archive
+	// over the path patches the new one, not the stale inode it opened
+	write_zip("race.apk", inputs, 2);
+	ZipInput renamed_inputs[] = {
+		{ "AndroidManifest.xml", "asset.txt", 0 },
+		{ "lib/arm64-v8a/libone.so", "lib64.so", 4096 },
+		{ "lib/armeabi-v7a/libtwo.so", "lib32.so", 4096 },
+	};
+	write_zip("race.new", renamed_inputs, 3);
+	int holder = open("race.apk", O_RDWR);
+	CHECK(holder >= 0 && lock_file(holder, LOCK_WAIT_SKIP) == TRUE);
+
+	ZipJob job = { "race.apk", &config, FALSE };
+	pthread_t waiter;
+	CHECK(pthread_create(&waiter, NULL, patch_zip_job, &job) == 0);
+	struct timespec pause = { 0, 100 * 1000000L };
+	nanosleep(&pause, NULL);
+	CHECK(rename("race.new", "race.apk") == 0);
+	close(holder);
+	pthread_join(waiter, NULL);
+
+	CHECK(job.result == TRUE);
+	int count = read_zip("race.apk", entries);
+	CHECK(count == 3);
+	if (count == 3) {
+		first_needed_is(&entries[1], "/data/lib64/libc.so");
+		first_needed_is(&entries[2], "/data/lib/libc.so");
+	}
+	free_entries(entries, count);
+
+	// a library cut short fails the archive, which stays as it was
+	CHECK(synth_copy("lib64.so", "cut.so") && truncate("cut.so", 200) == 0);
+	ZipInput broken[] = {
+		{ "lib/arm64-v8a/libone.so", "lib64.so", 4096 },
+		{ "lib/arm64-v8a/libcut.so", "cut.so", 4096 },
+	};
+	write_zip("broken.apk", broken, 2);
+	CHECK(synth_copy("broken.apk", "broken.orig"));
+	CHECK(patch_zip("broken.apk", &config, NULL) == FALSE);
+	CHECK(synth_same_file("broken.apk", "broken.orig"));
+
+	return check_report("zip");
+}